@@ -1,10 +1,17 @@
 #include "CommandHandlers.hpp"
 
+#include <memory>
+#include <thread>
+
 #include "Color.hpp"
 #include "util.cpp"
+#include "../shared/Chunker.hpp"
+#include "../shared/Delta.hpp"
 #include "../shared/FileInfo.hpp"
+#include "../shared/TransferWindow.hpp"
 
-void CommandHandlers::sendFile ( std::ifstream& file, const std::ifstream::pos_type fileSize, Connection& connection, const bool quiet ) {
+void CommandHandlers::sendFile ( std::ifstream& file, const std::ifstream::pos_type fileSize, Connection& connection, const bool quiet, const uint64_t offset,
+                                 const bool hashTrailer ) {
     if ( !file.good() ) {
         std::cerr << colorize("Could not open file", Color::RED) << std::endl;
         return;
@@ -19,10 +26,24 @@ void CommandHandlers::sendFile ( std::ifstream& file, const std::ifstream::pos_t
 
     double totalTimeRead = 0.0, totalTimeUpload = 0.0;
 
-    unsigned long long sizeRead = 0;
-    unsigned long long sizeUploaded = 0;
+    unsigned long long sizeRead = offset;
+    unsigned long long sizeUploaded = offset;
 
-    if ( !quiet ) {
+    file.seekg(static_cast<std::streamoff>(offset));
+
+    TransferWindow window;
+    Compressor compressor;
+
+    unsigned char hash[crypto_generichash_BYTES];
+    crypto_generichash_state state;
+    crypto_generichash_init(&state, nullptr, 0, sizeof hash);
+
+    if ( !quiet && offset > 0 ) {
+        std::cout << colorize("Resuming upload of size: ", Color::BLUE) << colorize(
+            humanReadableSize(fileSize), Color::CYAN
+        ) << colorize(" at: ", Color::BLUE) << colorize(humanReadableSize(offset), Color::CYAN) << "\n" << std::endl;
+    }
+    else if ( !quiet ) {
         std::cout << colorize("Starting upload of size: ", Color::BLUE) << colorize(
             humanReadableSize(fileSize), Color::CYAN
         ) << "\n" << std::endl;
@@ -38,11 +59,14 @@ void CommandHandlers::sendFile ( std::ifstream& file, const std::ifstream::pos_t
         totalTimeRead += duration.count();
         sizeRead += file.gcount();
 
-        readSpeed = static_cast<double>(sizeRead) / totalTimeRead;
+        readSpeed = static_cast<double>(sizeRead - offset) / totalTimeRead;
+
+        if ( hashTrailer )
+            crypto_generichash_update(&state, reinterpret_cast<const unsigned char*>(buffer.get()), file.gcount());
 
         const auto startUploadTime = std::chrono::high_resolution_clock::now();
 
-        connection.send(std::string(buffer.get(), file.gcount()));
+        connection.send(std::string(buffer.get(), file.gcount()), compressor);
 
         const auto endUploadTime = std::chrono::high_resolution_clock::now();
 
@@ -51,10 +75,10 @@ void CommandHandlers::sendFile ( std::ifstream& file, const std::ifstream::pos_t
         totalTimeUpload += duration.count();
         sizeUploaded += file.gcount();
 
-        uploadSpeed = static_cast<double>(sizeUploaded) / totalTimeUpload;
+        uploadSpeed = static_cast<double>(sizeUploaded - offset) / totalTimeUpload;
 
-        if ( connection.receiveInternal() != "confirm" )
-            throw std::runtime_error("Server did not confirm the chunk");
+        window.sent(file.gcount());
+        window.collect(connection);
 
 #ifdef HIKUP_DEBUG
         std::cout << "\r" << colorize("Sending data: ", Color::BLUE) +
@@ -97,13 +121,13 @@ void CommandHandlers::sendFile ( std::ifstream& file, const std::ifstream::pos_t
 
             buffer = std::make_unique<char[]>(chunkSize);
         }
-        else if ( duration.count() < 0.3 && freeRam >= chunkSize * 2 ) {
-            chunkSize = static_cast<int>(chunkSize * 2);
+        else if ( duration.count() < 0.3 && freeRam >= chunkSize * 2 && chunkSize < Frame::maxChunkSize ) {
+            chunkSize = std::min<size_t>(chunkSize * 2, Frame::maxChunkSize);
             buffer = std::make_unique<char[]>(chunkSize);
 
         }
-        else if ( duration.count() < 0.6 && freeRam >= chunkSize * 2 ) {
-            chunkSize = static_cast<int>(chunkSize * 1.25);
+        else if ( duration.count() < 0.6 && freeRam >= chunkSize * 2 && chunkSize < Frame::maxChunkSize ) {
+            chunkSize = std::min<size_t>(static_cast<size_t>(chunkSize * 1.25), Frame::maxChunkSize);
             buffer = std::make_unique<char[]>(chunkSize);
         }
     }
@@ -129,7 +153,329 @@ void CommandHandlers::sendFile ( std::ifstream& file, const std::ifstream::pos_t
     }
 #endif
 
+    if ( hashTrailer ) {
+        crypto_generichash_final(&state, hash, sizeof hash);
+        connection.sendInternal("trailer:" + binToHex(hash, sizeof hash));
+    }
+    else
+        connection.sendInternal("DONE");
+    window.drain(connection);
+
+    uploadResult(connection, quiet);
+}
+
+void CommandHandlers::sendFileDeduplicated ( std::ifstream& file, const std::ifstream::pos_type fileSize, Connection& connection, const bool quiet ) {
+    if ( !file.good() ) {
+        std::cerr << colorize("Could not open file", Color::RED) << std::endl;
+        return;
+    }
+
+    // chunks going out in one message, and manifest entries per message
+    constexpr size_t messageSize = 4 * 1024 * 1024;
+    constexpr size_t entriesPerMessage = 1024;
+
+    if ( !quiet )
+        std::cout << colorize("Computing chunks", Color::GREEN) << std::endl;
+
+    const auto chunks = Chunker::split(file);
+
+    connection.sendInternal("chunks:" + std::to_string(chunks.size()));
+
+    for ( size_t i = 0; i < chunks.size(); i += entriesPerMessage ) {
+        std::string manifest = "manifest:";
+
+        for ( size_t j = i; j < std::min(chunks.size(), i + entriesPerMessage); ++j )
+            manifest += ( j == i ? "" : "," ) + Chunker::toHex(chunks[j].hash) + ':' + std::to_string(chunks[j].length);
+
+        connection.sendInternal(manifest);
+    }
+
+    const auto reply = connection.receiveInternal();
+
+    if ( !reply.starts_with("missing:") )
+        throw std::runtime_error("Server did not answer the manifest, got: " + reply);
+
+    // ranges of chunk indices, i.e. "0-5,9,12-20"
+    std::vector<size_t> missing;
+    std::istringstream ranges(reply.substr(strlen("missing:")));
+
+    for ( std::string range; std::getline(ranges, range, ','); ) {
+        const auto separator = range.find('-');
+        const auto first = std::stoull(range.substr(0, separator));
+        const auto last = separator == std::string::npos ? first : std::stoull(range.substr(separator + 1));
+
+        if ( last < first || last >= chunks.size() )
+            throw std::runtime_error("Server asked for chunks outside of the file: " + range);
+
+        for ( auto index = first; index <= last; ++index )
+            missing.push_back(index);
+    }
+
+    uint64_t toSend = 0;
+    for ( const auto index: missing )
+        toSend += chunks[index].length;
+
+    if ( !quiet ) {
+        std::cout << colorize("Server already stores ", Color::BLUE) << colorize(
+            humanReadableSize(static_cast<uint64_t>(fileSize) - toSend), Color::CYAN
+        ) << colorize(" of the file, sending ", Color::BLUE) << colorize(
+            std::to_string(missing.size()) + " of " + std::to_string(chunks.size()) + " chunks", Color::CYAN
+        ) << "\n" << std::endl;
+    }
+
+    TransferWindow window;
+    Compressor compressor;
+    std::string message;
+    uint64_t sent = 0;
+
+    const auto flush = [&] {
+        connection.send(message, compressor);
+        window.sent(message.size());
+        window.collect(connection);
+
+        sent += message.size();
+        message.clear();
+
+        if ( !quiet ) {
+            std::cout << "\r" << colorize("Sending chunks: ", Color::BLUE) +
+                    colorize(humanReadableSize(sent), Color::CYAN) + colorize("/", Color::BLUE) +
+                    colorize(humanReadableSize(toSend), Color::CYAN) + colorize(
+                        std::string(" (") +
+                        std::to_string(( static_cast<double>(sent) / static_cast<double>(toSend) ) * 100.0).
+                        substr(0, 5) + " %)",
+                        Color::PURPLE
+                    ) + "  " << std::flush;
+        }
+    };
+
+    file.clear();
+
+    for ( const auto index: missing ) {
+        const auto& chunk = chunks[index];
+
+        if ( !message.empty() && message.size() + chunk.length > messageSize )
+            flush();
+
+        const auto start = message.size();
+        message.resize(start + chunk.length);
+
+        file.seekg(static_cast<std::streamoff>(chunk.offset));
+        file.read(message.data() + start, chunk.length);
+
+        if ( static_cast<size_t>(file.gcount()) != chunk.length )
+            throw std::runtime_error("File changed while uploading");
+    }
+
+    if ( !message.empty() )
+        flush();
+
+    if ( !quiet && toSend > 0 )
+        std::cout << std::endl;
+
     connection.sendInternal("DONE");
+    window.drain(connection);
+
+    uploadResult(connection, quiet);
+}
+
+void CommandHandlers::sendFileDelta ( std::ifstream& file, const std::ifstream::pos_type fileSize, Connection& connection, const bool quiet ) {
+    if ( !file.good() ) {
+        std::cerr << colorize("Could not open file", Color::RED) << std::endl;
+        return;
+    }
+
+    // literal data going out in one message
+    constexpr size_t messageSize = 4 * 1024 * 1024;
+
+    const auto header = connection.receiveInternal();
+
+    if ( !header.starts_with("blocks:") )
+        throw std::runtime_error("Server did not send the block signatures, got: " + header);
+
+    // "blocks:<block size>:<count>"
+    const auto separator = header.find(':', strlen("blocks:"));
+    const auto blockSize = std::stoull(header.substr(strlen("blocks:"), separator - strlen("blocks:")));
+    const auto count = std::stoull(header.substr(separator + 1));
+
+    std::vector<Delta::Signature> signatures;
+    signatures.reserve(count);
+
+    while ( signatures.size() < count ) {
+        const auto message = connection.receiveInternal();
+
+        if ( !message.starts_with("signatures:") )
+            throw std::runtime_error("Server did not send the block signatures, got: " + message);
+
+        std::istringstream entries(message.substr(strlen("signatures:")));
+
+        for ( std::string entry; std::getline(entries, entry, ','); )
+            signatures.push_back(Delta::fromHex(entry));
+    }
+
+    if ( signatures.size() != count || ( count > 0 && ( blockSize < Delta::minBlockSize || blockSize > Delta::maxBlockSize ) ) )
+        throw std::runtime_error("Server sent malformed block signatures");
+
+    if ( !quiet ) {
+        if ( count > 0 )
+            std::cout << colorize("Comparing with the previous version, ", Color::GREEN) << colorize(
+                std::to_string(count) + " blocks of " + humanReadableSize(blockSize), Color::CYAN
+            ) << std::endl;
+        else
+            std::cout << colorize("Server has no previous version of the file, sending all of it", Color::YELLOW) << std::endl;
+    }
+
+    TransferWindow window;
+    Compressor compressor;
+    std::string message;
+    uint64_t sent = 0;
+    uint64_t reused = 0;
+
+    // a run of consecutive blocks goes out as one copy
+    uint64_t runFirst = 0;
+    uint64_t runLength = 0;
+
+    const auto progress = [&] {
+        if ( quiet )
+            return;
+
+        std::cout << "\r" << colorize("Sent: ", Color::BLUE) + colorize(humanReadableSize(sent), Color::CYAN) +
+                colorize(", reused: ", Color::BLUE) + colorize(humanReadableSize(reused), Color::CYAN) +
+                colorize(" of ", Color::BLUE) + colorize(humanReadableSize(fileSize), Color::CYAN) + "  " << std::flush;
+    };
+
+    const auto flushLiteral = [&] {
+        if ( message.empty() )
+            return;
+
+        connection.send(message, compressor);
+        window.sent(message.size());
+        window.collect(connection);
+
+        sent += message.size();
+        message.clear();
+        progress();
+    };
+
+    const auto flushRun = [&] {
+        if ( runLength == 0 )
+            return;
+
+        connection.sendInternal("copy:" + std::to_string(runFirst) + '-' + std::to_string(runFirst + runLength - 1));
+        reused += runLength * blockSize;
+        runLength = 0;
+        progress();
+    };
+
+    file.clear();
+    file.seekg(0);
+
+    Delta::diff(file, blockSize, signatures,
+        [&] ( const std::string_view data ) {
+            flushRun();
+
+            if ( message.size() + data.size() > messageSize )
+                flushLiteral();
+            message.append(data);
+        },
+        [&] ( const uint32_t block ) {
+            if ( runLength > 0 && block == runFirst + runLength ) {
+                ++runLength;
+                return;
+            }
+
+            flushLiteral();
+            flushRun();
+            runFirst = block;
+            runLength = 1;
+        });
+
+    flushLiteral();
+    flushRun();
+
+    if ( !quiet )
+        std::cout << std::endl;
+
+    connection.sendInternal("DONE");
+    window.drain(connection);
+
+    uploadResult(connection, quiet);
+}
+
+void CommandHandlers::sendFileResumable ( std::ifstream& file, const std::ifstream::pos_type fileSize, const std::string& fileName,
+                                          const std::string& hash, Connection& connection, const std::string& serverAddr, const bool quiet ) {
+    std::unique_ptr<Connection> reconnected;
+    auto current = &connection;
+    std::string session;
+
+    for ( unsigned attempt = 1; ; ++attempt ) {
+        try {
+            if ( attempt > 1 ) {
+                reconnected = std::make_unique<Connection>();
+                reconnected->connectToServer(serverAddr, 6998);
+                current = reconnected.get();
+
+                current->sendInternal("command:RESUMABLE_UPLOAD")
+                        .sendInternal("size:" + std::to_string(fileSize))
+                        .sendInternal("filename:" + fileName)
+                        .sendInternal("hash:" + hash)
+                        .sendInternal("session:" + session);
+
+                if ( const auto reason = current->receiveInternal(); reason != "OK" ) {
+                    std::cerr << colorize("Server did not resume the upload: " + reason, Color::RED) << std::endl;
+                    return;
+                }
+            }
+
+            session = current->receiveInternal().substr(strlen("session:"));
+            const auto offset = std::stoull(current->receiveInternal().substr(strlen("offset:")));
+
+            file.clear();
+            sendFile(file, fileSize, *current, quiet, offset);
+            return;
+        }
+        catch ( const std::runtime_error& e ) {
+            if ( session.empty() || attempt == maxResumeAttempts )
+                throw;
+
+            std::cerr << '\n' << colorize("Connection lost: " + std::string(e.what()) + ", resuming", Color::YELLOW) << std::endl;
+            std::this_thread::sleep_for(std::chrono::seconds(1u << ( attempt - 1 )));
+        }
+    }
+}
+
+void CommandHandlers::downloadFileResumable ( Connection& connection, const std::string& hash, const std::string& serverAddr, const bool quiet ) {
+    std::unique_ptr<Connection> reconnected;
+    auto current = &connection;
+
+    for ( unsigned attempt = 1; ; ++attempt ) {
+        try {
+            if ( attempt > 1 ) {
+                reconnected = std::make_unique<Connection>();
+                reconnected->connectToServer(serverAddr, 6998);
+                current = reconnected.get();
+
+                current->sendInternal("command:RESUMABLE_DOWNLOAD").sendInternal("hash:" + hash);
+
+                if ( const auto reason = current->receiveInternal(); reason != "OK" ) {
+                    std::cerr << colorize("Server did not resume the download: " + reason, Color::RED) << std::endl;
+                    return;
+                }
+            }
+
+            downloadFile(*current, quiet, hash);
+            return;
+        }
+        catch ( const std::runtime_error& e ) {
+            if ( attempt == maxResumeAttempts )
+                throw;
+
+            std::cerr << '\n' << colorize("Connection lost: " + std::string(e.what()) + ", resuming", Color::YELLOW) << std::endl;
+            std::this_thread::sleep_for(std::chrono::seconds(1u << ( attempt - 1 )));
+        }
+    }
+}
+
+void CommandHandlers::uploadResult ( Connection& connection, const bool quiet ) {
     if ( const auto confirmation = connection.receiveInternal();
         confirmation != "OK") {
         std::cerr << colorize("Upload failed with response: " + confirmation, Color::RED);
@@ -163,7 +509,7 @@ void CommandHandlers::sendFile ( std::ifstream& file, const std::ifstream::pos_t
     }
 }
 
-void CommandHandlers::downloadFile ( Connection& connection, const bool quiet ) {
+void CommandHandlers::downloadFile ( Connection& connection, const bool quiet, const std::string& resumeHash ) {
     auto fileSize = std::stoll(connection.receiveInternal());
     auto fileName = connection.receiveInternal();
     double totalTimeDownload = 0.0, totalTimeWrite = 0.0;
@@ -172,20 +518,44 @@ void CommandHandlers::downloadFile ( Connection& connection, const bool quiet )
 
     connection.resizeBuffer(freeRam);
 
-    long long sizeWritten = 0;
+    // a resumable download goes into a partial file that the next attempt continues
+    const auto resume = !resumeHash.empty();
+    const auto partName = fileName + ".part";
+    uint64_t offset = 0;
+
+    if ( resume ) {
+        if ( std::filesystem::exists(partName) ) {
+            offset = std::min<uint64_t>(std::filesystem::file_size(partName), fileSize);
+            std::filesystem::resize_file(partName, offset);
+        }
+        connection.sendInternal("offset:" + std::to_string(offset));
+    }
+
+    long long sizeWritten = static_cast<long long>(offset);
     unsigned long long sizeDownloaded = 0;
 
     if ( !quiet ) {
         std::cout << colorize("Downloading file: ", Color::BLUE) + colorize(fileName, Color::CYAN) << colorize(
             " of size: ", Color::BLUE
         ) << colorize(humanReadableSize(fileSize), Color::CYAN) << std::endl;
+
+        if ( offset > 0 )
+            std::cout << colorize("Resuming at: ", Color::BLUE) << colorize(humanReadableSize(offset), Color::CYAN) << std::endl;
     }
 
     // create file
-    std::ofstream file(fileName, std::ios::binary);
+    std::ofstream file;
+
+    if ( resume ) {
+        std::ofstream(partName, std::ios::binary | std::ios::app).close();
+        file.open(partName, std::ios::binary | std::ios::in);
+        file.seekp(static_cast<std::streamoff>(offset));
+    }
+    else
+        file.open(fileName, std::ios::binary);
 
     while ( true ) {
-        auto [chunk,duration] = connection.receiveWTime();
+        auto [chunk,duration] = connection.receiveViewWTime();
 
         if ( chunk == _internal"DONE" )
             break;
@@ -196,7 +566,7 @@ void CommandHandlers::downloadFile ( Connection& connection, const bool quiet )
         auto downloadSpeed = static_cast<double>(sizeDownloaded) / totalTimeDownload;
 
         auto writeStart = std::chrono::high_resolution_clock::now();
-        file.write(chunk.c_str(), static_cast<long>(chunk.size()));
+        file.write(chunk.data(), static_cast<long>(chunk.size()));
         auto writeEnd = std::chrono::high_resolution_clock::now();
 
         duration = writeEnd - writeStart;
@@ -204,7 +574,7 @@ void CommandHandlers::downloadFile ( Connection& connection, const bool quiet )
         sizeWritten += chunk.size();
         totalTimeWrite += duration.count();
 
-        auto writeSpeed = static_cast<double>(sizeWritten) / totalTimeWrite;
+        auto writeSpeed = static_cast<double>(sizeWritten - offset) / totalTimeWrite;
 
         connection.sendInternal("confirm");
 
@@ -224,6 +594,25 @@ void CommandHandlers::downloadFile ( Connection& connection, const bool quiet )
     if ( !quiet ) {
         std::cout << std::endl;
     }
+
+    if ( resume ) {
+        file.close();
+
+        // a partial file left by another file of the same name does not add up to the hash
+        if ( offset > 0 ) {
+            std::ifstream check(partName, std::ios::binary);
+
+            const auto hash = TreeHash::isTreeId(resumeHash) ? computeTreeHash(partName, fileSize, true).first
+                                                             : computeHash(check, 4 * 1024 * 1024, fileSize, true);
+
+            if ( hash != resumeHash ) {
+                std::filesystem::remove(partName);
+                throw std::runtime_error("Resumed file does not match its hash");
+            }
+        }
+
+        std::filesystem::rename(partName, fileName);
+    }
 }
 
 int CommandHandlers::listFiles ( Connection& connection, const std::string& user, const std::string& pass ) {
@@ -239,9 +628,9 @@ int CommandHandlers::listFiles ( Connection& connection, const std::string& user
     unsigned maxNameSize = 4, maxSizeSize = 4, maxDateSize = 11; // min sizes for headers
 
     try {
-        std::string fileData;
-        while ( ( fileData = connection.receive() ) != _internal"DONE" ) {
-            FileInfo fileInfo(fileData.substr(strlen(_data)));
+        std::string_view fileData;
+        while ( ( fileData = connection.receiveView() ) != _internal"DONE" ) {
+            FileInfo fileInfo(FileInfo::parse(fileData.substr(strlen(_data))));
             maxNameSize = std::max(maxNameSize, static_cast<unsigned>(fileInfo.getName().size()));
             maxSizeSize = std::max(maxSizeSize, static_cast<unsigned>(humanReadableSize(fileInfo.getSize()).size()));
             maxDateSize = std::max(maxDateSize, static_cast<unsigned>(fileInfo.getCreationDateString_c().size()));
@@ -288,4 +677,86 @@ int CommandHandlers::listFiles ( Connection& connection, const std::string& user
     std::cout.flush();
 
     return 0;
-}
\ No newline at end of file
+}
+int CommandHandlers::listFilesPaged ( Connection& connection, const std::string& user, const std::string& pass,
+                                      const ListQuery& query ) {
+    connection.sendInternal("user:" + user);
+    connection.sendInternal("pass:" + pass);
+
+    if ( connection.receiveInternal() != "OK" ) {
+        std::cerr << colorize("Authentication failed", Color::RED) << std::endl;
+        return 1;
+    }
+
+    connection.sendInternal("query:" + query.encode());
+
+    unsigned maxNameSize = 4, maxSizeSize = 4, maxDateSize = 11, hashSize = 4; // min sizes for headers
+    bool sized = false;
+    std::string cursor;
+
+    const auto rule = [&] {
+        return '|' + std::string(maxNameSize+2, '-') + "|" +
+               std::string(maxSizeSize+2, '-') + "|" +
+               std::string(maxDateSize+2, '-') + "|" +
+               std::string(hashSize+1, '-') + '\n';
+    };
+
+    try {
+        // views into the received message, rendered before the next one arrives
+        std::vector<FileInfo::View> page;
+
+        while ( true ) {
+            const auto message = connection.receiveView();
+
+            if ( message.starts_with(_internal"DONE:") ) {
+                cursor = message.substr(strlen(_internal"DONE:"));
+                break;
+            }
+            if ( !message.starts_with(_data) )
+                throw std::runtime_error("unexpected message: " + std::string(message));
+
+            page.clear();
+            for ( auto records = message.substr(strlen(_data)); !records.empty(); )
+                page.push_back(FileInfo::decodeBinary(records));
+
+            if ( !sized ) {
+                for ( const auto& file: page ) {
+                    maxNameSize = std::max(maxNameSize, static_cast<unsigned>(file.name.size()));
+                    maxSizeSize = std::max(maxSizeSize, static_cast<unsigned>(humanReadableSize(file.size).size()));
+                    maxDateSize = std::max(maxDateSize, static_cast<unsigned>(FileInfo::dateString_c(file.creationDate).size()));
+                    hashSize = std::max(hashSize, static_cast<unsigned>(file.hash.size()));
+                }
+
+                std::cout << padStringToSize("| Name", maxNameSize+2) + " | " +
+                            padStringToSize("Size", maxSizeSize) + " | " +
+                            padStringToSize("Upload Date", maxDateSize) + " | " +
+                            padStringToSize("Hash", hashSize) + "\n" + rule();
+                sized = true;
+            }
+
+            std::string rows;
+            for ( const auto& file: page ) {
+                rows += "| " +
+                    colorize(padStringToSize(std::string(file.name), maxNameSize), Color::CYAN) + " | " +
+                    colorize(padStringToSize(humanReadableSize(file.size), maxSizeSize), Color::LL_BLUE) + " | " +
+                    colorize(FileInfo::dateString_c(file.creationDate), Color::GREEN) + " | " +
+                    colorize(std::string(file.hash), Color::PURPLE) + '\n';
+            }
+            std::cout << rows;
+            std::cout.flush();
+        }
+    } catch ( std::runtime_error& e ) {
+        std::cerr << colorize("Error receiving file list: ", Color::RED) + colorize(e.what(), Color::RED) << std::endl;
+        return 1;
+    }
+
+    if ( sized )
+        std::cout << rule() << '\n';
+
+    if ( !cursor.empty() )
+        std::cout << colorize("More files may follow, continue with: --after '" + cursor + "'", Color::GREEN) << '\n';
+
+    std::cout.flush();
+
+    return 0;
+}
@@ -1,11 +1,52 @@
 #pragma once
 
+#include <cstdint>
 #include <fstream>
+#include <string>
 
 #include "../shared/Connection.hpp"
+#include "../shared/ListQuery.hpp"
 
 namespace CommandHandlers {
-	void sendFile ( std::ifstream& file, const std::ifstream::pos_type fileSize, Connection& connection, bool quiet = false );
-	void downloadFile ( Connection& connection, bool quiet = false );
+	// reconnections of a resumable transfer before it gives up
+	constexpr unsigned maxResumeAttempts = 5;
+
+	/**
+	 * @param offset bytes the server already has, sending starts after them
+	 * @param hashTrailer hash the data while sending it and send the hash after it, for a STREAMED_UPLOAD
+	 */
+	void sendFile ( std::ifstream& file, const std::ifstream::pos_type fileSize, Connection& connection, bool quiet = false, uint64_t offset = 0,
+	                bool hashTrailer = false );
+	/**
+	 * @brief Sends the file after the server accepted a RESUMABLE_UPLOAD request, reconnects and resumes when the connection breaks
+	 */
+	void sendFileResumable ( std::ifstream& file, std::ifstream::pos_type fileSize, const std::string& fileName,
+	                         const std::string& hash, Connection& connection, const std::string& serverAddr, bool quiet = false );
+	/**
+	 * @brief Sends the chunk manifest and then only the chunks the server reports missing
+	 */
+	void sendFileDeduplicated ( std::ifstream& file, const std::ifstream::pos_type fileSize, Connection& connection, bool quiet = false );
+	/**
+	 * @brief Sends literal data and references to the blocks of the previous version the server signed
+	 */
+	void sendFileDelta ( std::ifstream& file, const std::ifstream::pos_type fileSize, Connection& connection, bool quiet = false );
+	/**
+	 * @brief Reads the server's verdict after the file data was sent and prints hash and HTTP link
+	 */
+	void uploadResult ( Connection& connection, bool quiet = false );
+	/**
+	 * @param resumeHash hash of the file on a RESUMABLE_DOWNLOAD, the data goes into a partial file a later attempt continues
+	 */
+	void downloadFile ( Connection& connection, bool quiet = false, const std::string& resumeHash = {} );
+	/**
+	 * @brief Receives the file after the server accepted a RESUMABLE_DOWNLOAD request, reconnects and resumes when the connection breaks
+	 */
+	void downloadFileResumable ( Connection& connection, const std::string& hash, const std::string& serverAddr, bool quiet = false );
 	int listFiles ( Connection& connection, const std::string& user, const std::string& pass );
+	/**
+	 * @brief Lists after the server accepted a PAGED_LIST request, each page is printed as soon as it arrives
+	 *
+	 * The columns are sized by the first page, a longer name on a later page overflows its column.
+	 */
+	int listFilesPaged ( Connection& connection, const std::string& user, const std::string& pass, const ListQuery& query );
 }
\ No newline at end of file
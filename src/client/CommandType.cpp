@@ -20,6 +20,16 @@ namespace Command {
 				return "BATCH";
 			case Type::QUIET:
 				return "QUIET";
+			case Type::PARALLEL:
+				return "PARALLEL";
+			case Type::DEDUP:
+				return "DEDUP";
+			case Type::DELTA:
+				return "DELTA";
+			case Type::STREAMED:
+				return "STREAMED";
+			case Type::TREE:
+				return "TREE";
 			case Type::INVALID:
 				return "INVALID";
 			default: // cannot happen
@@ -47,6 +57,32 @@ namespace Command {
 		if ( commands.contains(Type::INVALID) )
 			return false;
 
+		// striping splits a single file, batches and non-transfers have nothing to split
+		if ( commands.contains(Type::PARALLEL) && ( commands.contains(Type::BATCH) ||
+		     !( commands.contains(Type::UPLOAD) || commands.contains(Type::DOWNLOAD) ) ) )
+			return false;
+
+		// deduplication works on a single upload over one connection
+		if ( commands.contains(Type::DEDUP) && ( commands.contains(Type::BATCH) ||
+		     commands.contains(Type::PARALLEL) || !commands.contains(Type::UPLOAD) ) )
+			return false;
+
+		// delta uploads too, and they replace the chunk manifest with block signatures of the previous version
+		if ( commands.contains(Type::DELTA) && ( commands.contains(Type::BATCH) || commands.contains(Type::PARALLEL) ||
+		     commands.contains(Type::DEDUP) || !commands.contains(Type::UPLOAD) ) )
+			return false;
+
+		// the single pass replaces the plain upload only, the other modes need the hash up front or read the file again
+		if ( commands.contains(Type::STREAMED) && ( commands.contains(Type::BATCH) || commands.contains(Type::PARALLEL) ||
+		     commands.contains(Type::DEDUP) || commands.contains(Type::DELTA) || !commands.contains(Type::UPLOAD) ) )
+			return false;
+
+		// the leaf hashes go with a plain upload of a single file
+		if ( commands.contains(Type::TREE) && ( commands.contains(Type::BATCH) || commands.contains(Type::PARALLEL) ||
+		     commands.contains(Type::DEDUP) || commands.contains(Type::DELTA) || commands.contains(Type::STREAMED) ||
+		     !commands.contains(Type::UPLOAD) ) )
+			return false;
+
 		return true;
 	}
 
@@ -78,6 +114,31 @@ namespace Command {
 			res.emplace(Type::QUIET);
 		}
 
+		if ( pos = command.find('p'); pos != std::string::npos ) {
+			command.erase(pos, 1);
+			res.emplace(Type::PARALLEL);
+		}
+
+		if ( pos = command.find('d'); pos != std::string::npos ) {
+			command.erase(pos, 1);
+			res.emplace(Type::DEDUP);
+		}
+
+		if ( pos = command.find('r'); pos != std::string::npos ) {
+			command.erase(pos, 1);
+			res.emplace(Type::DELTA);
+		}
+
+		if ( pos = command.find('s'); pos != std::string::npos ) {
+			command.erase(pos, 1);
+			res.emplace(Type::STREAMED);
+		}
+
+		if ( pos = command.find('t'); pos != std::string::npos ) {
+			command.erase(pos, 1);
+			res.emplace(Type::TREE);
+		}
+
 		if ( res.empty() || !command.empty() )
 			return {Type::INVALID};
 
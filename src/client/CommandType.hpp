@@ -12,6 +12,11 @@ namespace Command {
 		LIST,
 		BATCH,
 		QUIET,
+		PARALLEL,
+		DEDUP,
+		DELTA,
+		STREAMED,
+		TREE,
 		INVALID
 	};
 
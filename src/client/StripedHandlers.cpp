@@ -0,0 +1,287 @@
+#include "StripedHandlers.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "CommandHandlers.hpp"
+#include "util.cpp"
+#include "../shared/TransferWindow.hpp"
+
+namespace {
+
+	constexpr unsigned maxStreams = 8;
+	constexpr size_t chunkSize = 2 * 1024 * 1024;
+
+	struct Segment {
+		uint64_t offset;
+		uint64_t length;
+	};
+
+	/**
+	 * @brief Hands out segments to the connections and decides when to open another one
+	 */
+	class Scheduler {
+	public:
+		explicit Scheduler ( const uint64_t fileSize )
+			: _fileSize(fileSize),
+			  _segmentSize(std::clamp<uint64_t>(fileSize / 32, 4 * 1024 * 1024, 64 * 1024 * 1024)),
+			  _lastProbe(std::chrono::steady_clock::now()) {}
+
+		std::optional<Segment> claim () {
+			if ( _failed )
+				return std::nullopt;
+
+			const auto offset = _next.fetch_add(_segmentSize);
+
+			if ( offset >= _fileSize )
+				return std::nullopt;
+
+			return Segment{offset, std::min(_segmentSize, _fileSize - offset)};
+		}
+
+		void progress ( const size_t bytes ) { _done += bytes; }
+
+		[[nodiscard]] uint64_t done () const { return _done; }
+
+		/**
+		 * @brief Grows while the newest connection added at least half of an average connection's throughput
+		 */
+		bool shouldGrow ( const unsigned streams ) {
+			const auto now = std::chrono::steady_clock::now();
+			const auto elapsed = std::chrono::duration<double>(now - _lastProbe).count();
+
+			if ( !_growing || elapsed < 1.0 )
+				return false;
+
+			const auto rate = static_cast<double>(_done - _lastProbeBytes) / elapsed;
+
+			if ( _lastRate > 0.0 && rate - _lastRate < _lastRate / ( streams - 1 ) / 2 )
+				_growing = false;
+
+			_lastProbe = now;
+			_lastProbeBytes = _done;
+			_lastRate = rate;
+
+			const auto unclaimed = _fileSize - std::min<uint64_t>(_next, _fileSize);
+
+			return _growing && streams < maxStreams && unclaimed > _segmentSize * streams;
+		}
+
+		void fail ( const std::string& reason ) {
+			std::lock_guard lock(_mutex);
+			_failed = true;
+			_reason = reason;
+		}
+
+		[[nodiscard]] std::optional<std::string> failure () {
+			std::lock_guard lock(_mutex);
+			if ( !_failed )
+				return std::nullopt;
+			return _reason;
+		}
+
+	private:
+		const uint64_t _fileSize;
+		const uint64_t _segmentSize;
+		std::atomic<uint64_t> _next = 0;
+		std::atomic<uint64_t> _done = 0;
+		std::atomic<bool> _failed = false;
+		std::mutex _mutex;
+		std::string _reason;
+
+		// only touched by the primary connection
+		std::chrono::steady_clock::time_point _lastProbe;
+		uint64_t _lastProbeBytes = 0;
+		double _lastRate = 0.0;
+		bool _growing = true;
+	};
+
+	void uploadSegments ( Connection& connection, Scheduler& scheduler, const std::filesystem::path& path, const std::function<void()>& afterChunk ) {
+		std::ifstream file(path, std::ios::binary);
+		if ( !file.good() )
+			throw std::runtime_error("Could not open file");
+
+		const auto buffer = std::make_unique_for_overwrite<char[]>(chunkSize);
+		TransferWindow window;
+		Compressor compressor;
+
+		while ( const auto segment = scheduler.claim() ) {
+			connection.sendInternal("range:" + std::to_string(segment->offset) + ':' + std::to_string(segment->length));
+
+			file.seekg(static_cast<std::streamoff>(segment->offset));
+			auto remaining = segment->length;
+
+			while ( remaining > 0 ) {
+				file.read(buffer.get(), static_cast<std::streamsize>(std::min<uint64_t>(chunkSize, remaining)));
+				const auto read = static_cast<size_t>(file.gcount());
+
+				if ( read == 0 )
+					throw std::runtime_error("File shrank while uploading");
+
+				connection.send(std::string(buffer.get(), read), compressor);
+				window.sent(read);
+				window.collect(connection);
+
+				remaining -= read;
+				scheduler.progress(read);
+
+				if ( afterChunk )
+					afterChunk();
+			}
+		}
+
+		connection.sendInternal("DONE");
+		window.drain(connection);
+	}
+
+	void downloadSegments ( Connection& connection, Scheduler& scheduler, const std::filesystem::path& path, const std::function<void()>& afterChunk ) {
+		std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+		if ( !file.good() )
+			throw std::runtime_error("Could not open " + path.string() + " for writing");
+
+		while ( const auto segment = scheduler.claim() ) {
+			connection.sendInternal("range:" + std::to_string(segment->offset) + ':' + std::to_string(segment->length));
+
+			file.seekp(static_cast<std::streamoff>(segment->offset));
+			auto remaining = segment->length;
+
+			while ( remaining > 0 ) {
+				const auto chunk = connection.receiveView();
+
+				if ( chunk.empty() || chunk.size() > remaining )
+					throw std::runtime_error("Server sent data outside of the requested range");
+
+				file.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+				if ( !file.good() )
+					throw std::runtime_error("Could not write to " + path.string());
+
+				remaining -= chunk.size();
+				connection.sendInternal("confirm");
+				scheduler.progress(chunk.size());
+
+				if ( afterChunk )
+					afterChunk();
+			}
+		}
+
+		connection.sendInternal("DONE");
+	}
+
+	using SegmentWorker = void (*) ( Connection&, Scheduler&, const std::filesystem::path&, const std::function<void()>& );
+
+	/**
+	 * @brief Runs the transfer on the primary connection and adds stripe connections while they pay off
+	 *
+	 * @param request messages opening a stripe connection, answered by "OK" from the server
+	 */
+	void run ( Connection& connection, Scheduler& scheduler, const SegmentWorker worker, const std::filesystem::path& path,
+	           const std::vector<std::string>& request, const std::string& serverAddr, const uint64_t fileSize,
+	           const std::string& label, const bool quiet ) {
+		std::vector<std::jthread> stripes;
+		const auto start = std::chrono::steady_clock::now();
+
+		const auto addStripe = [&] {
+			stripes.emplace_back([&scheduler, worker, &path, &request, &serverAddr] {
+				try {
+					Connection stripe;
+					stripe.connectToServer(serverAddr, 6998);
+
+					for ( const auto& message: request )
+						stripe.sendInternal(message);
+
+					// the server may have finished already, the other connections carry the rest
+					if ( stripe.receiveInternal() != "OK" )
+						return;
+
+					worker(stripe, scheduler, path, {});
+				}
+				catch ( const std::exception& e ) { scheduler.fail(e.what()); }
+			});
+		};
+
+		const auto afterChunk = [&] {
+			const auto streams = static_cast<unsigned>(stripes.size() + 1);
+
+			if ( scheduler.shouldGrow(streams) )
+				addStripe();
+
+			if ( quiet )
+				return;
+
+			const auto done = scheduler.done();
+			const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+			std::cout << "\r" << colorize(label, Color::BLUE) <<
+					colorize(humanReadableSize(done), Color::CYAN) << colorize("/", Color::BLUE) <<
+					colorize(humanReadableSize(fileSize), Color::CYAN) << colorize(
+						std::string(" (") +
+						std::to_string(( static_cast<double>(done) / static_cast<double>(fileSize) ) * 100.0).
+						substr(0, 5) + " %)",
+						Color::PURPLE
+					) << " ┃ " << colorize("Streams: " + std::to_string(streams), Color::LL_BLUE) << " ━━ " <<
+					colorize(humanReadableSpeed(static_cast<double>(done) / elapsed), Color::GREEN) << "  " << std::flush;
+		};
+
+		try { worker(connection, scheduler, path, afterChunk); }
+		catch ( const std::exception& e ) { scheduler.fail(e.what()); }
+
+		stripes.clear();
+
+		if ( !quiet )
+			std::cout << std::endl;
+
+		if ( const auto failure = scheduler.failure() )
+			std::cerr << colorize("Transfer failed: " + *failure, Color::RED) << std::endl;
+	}
+
+}
+
+void Striped::sendFile ( const std::filesystem::path& path, const uintmax_t fileSize, Connection& connection, const std::string& serverAddr, const bool quiet ) {
+	const auto session = connection.receiveInternal();
+
+	if ( !session.starts_with("session:") )
+		throw std::runtime_error("Server did not open a striped upload, got: " + session);
+
+	if ( !quiet ) {
+		std::cout << colorize("Starting striped upload of size: ", Color::BLUE) << colorize(
+			humanReadableSize(fileSize), Color::CYAN
+		) << "\n" << std::endl;
+	}
+
+	Scheduler scheduler(fileSize);
+
+	run(connection, scheduler, uploadSegments, path, {"command:STRIPE_UPLOAD", session}, serverAddr, fileSize,
+	    "Sending data: ", quiet);
+
+	CommandHandlers::uploadResult(connection, quiet);
+}
+
+void Striped::downloadFile ( Connection& connection, const std::string& hash, const std::string& serverAddr, const bool quiet ) {
+	const auto fileSize = std::stoull(connection.receiveInternal());
+	const auto fileName = connection.receiveInternal();
+
+	if ( !quiet ) {
+		std::cout << colorize("Downloading file: ", Color::BLUE) + colorize(fileName, Color::CYAN) << colorize(
+			" of size: ", Color::BLUE
+		) << colorize(humanReadableSize(fileSize), Color::CYAN) << std::endl;
+	}
+
+	// every connection writes its segments in place
+	std::ofstream(fileName, std::ios::binary).close();
+	std::filesystem::resize_file(fileName, fileSize);
+
+	Scheduler scheduler(fileSize);
+
+	run(connection, scheduler, downloadSegments, fileName, {"command:STRIPE_DOWNLOAD", "hash:" + hash}, serverAddr,
+	    fileSize, "Receiving data: ", quiet);
+
+	if ( scheduler.failure() )
+		std::filesystem::remove(fileName);
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+
+#include "../shared/Connection.hpp"
+
+/**
+ * @brief Transfers of a single file spread over several connections
+ *
+ * The file is cut into segments that the connections claim one after another,
+ * so faster connections simply carry more of them. Additional connections are
+ * opened while each one still adds a fair share of throughput.
+ */
+namespace Striped {
+
+	/**
+	 * @brief Sends the file after the server accepted a STRIPED_UPLOAD request on `connection`
+	 */
+	void sendFile ( const std::filesystem::path& path, uintmax_t fileSize, Connection& connection, const std::string& serverAddr, bool quiet = false );
+
+	/**
+	 * @brief Receives the file after the server accepted a STRIPED_DOWNLOAD request on `connection`
+	 */
+	void downloadFile ( Connection& connection, const std::string& hash, const std::string& serverAddr, bool quiet = false );
+
+}
@@ -1,20 +1,85 @@
+#include <ctime>
+#include <iomanip>
 #include <iostream>
 #include <set>
+#include <sstream>
 
 #include "BatchHandlers.hpp"
 #include "CommandHandlers.hpp"
 #include "CommandType.hpp"
+#include "StripedHandlers.hpp"
 #include "../shared/Connection.hpp"
 
 void printHelp ( const std::string& argv0 ) {
-    std::cout << "Usage: " << argv0 << " [q]<up <file> | down <hash> | rm <hash> | ls <user> <pass>> <server> \n\n"
+    std::cout << "Usage: " << argv0 << " [q][p|d|r|s|t]<up <file> | down <hash> | rm <hash> | ls <user> <pass>> <server> \n\n"
                 "If file is successfully uploaded, you will get file hash\n"
                 "which you need to input if you want to download it.\n\n"
                 "For ls command, provide username and password (from server settings).\n\n"
                 "If server has HTTP server, you will get link for download.\n"
                 "You can append '?view=yes' to the link to view the file in browser.\n\n"
                 "You can also replace the file/hash with `-` and pass space/new-line separated list to standard input\n\n"
-                "add `q` into argument with up, down, rm for silent run. i.e. qup" << std::endl;
+                "add `q` into argument with up, down, rm for silent run. i.e. qup\n\n"
+                "add `p` into argument with up, down to transfer the file over several parallel connections. i.e. pup\n\n"
+                "add `d` into argument with up to send only the parts of the file the server does not store yet. i.e. dup\n\n"
+                "add `r` into argument with up to send only what changed since the last upload with the same name. i.e. rup\n\n"
+                "add `s` into argument with up to hash the file while sending it instead of reading it twice. i.e. sup\n\n"
+                "add `t` into argument with up to hash the file on all cores and let the server check it piece by piece. i.e. tup\n\n"
+                "ls takes options after the server:\n"
+                "  --sort name|size|date  --desc  --limit <n>  --offset <n>  --after <cursor>\n"
+                "  --min-size <bytes>  --max-size <bytes>  --since <YYYY-MM-DD>  --until <YYYY-MM-DD>"
+                << std::endl;
+}
+
+/**
+ * @brief Reads the options of ls, the ones following the server
+ * @throws std::runtime_error on an unknown option or a malformed value
+ */
+ListQuery parseListQuery ( const int argc, char* argv[] ) {
+    ListQuery query;
+
+    const auto date = [] ( const std::string& value ) {
+        std::tm tm{};
+        std::istringstream in(value);
+        in >> std::get_time(&tm, "%Y-%m-%d");
+        if ( in.fail() )
+            throw std::runtime_error("Invalid date, expected YYYY-MM-DD: " + value);
+        return static_cast<int64_t>(timegm(&tm));
+    };
+
+    for ( int i = 5; i < argc; ++i ) {
+        const std::string option = argv[i];
+
+        if ( option == "--desc" ) {
+            query.descending = true;
+            continue;
+        }
+
+        if ( i + 1 == argc )
+            throw std::runtime_error("Missing value for " + option);
+        const std::string value = argv[++i];
+
+        if ( option == "--sort" )
+            query.order = ListQuery::orderFrom(value);
+        else if ( option == "--limit" )
+            query.limit = std::stoull(value);
+        else if ( option == "--offset" )
+            query.offset = std::stoull(value);
+        else if ( option == "--after" )
+            query.after = value;
+        else if ( option == "--min-size" )
+            query.minSize = std::stoull(value);
+        else if ( option == "--max-size" )
+            query.maxSize = std::stoull(value);
+        else if ( option == "--since" )
+            query.since = date(value);
+        else if ( option == "--until" )
+            // the whole day
+            query.until = date(value) + 24 * 60 * 60 - 1;
+        else
+            throw std::runtime_error("Unknown option for ls: " + option);
+    }
+
+    return query;
 }
 
 int start ( int argc, char* argv[] ) {
@@ -26,6 +91,11 @@ int start ( int argc, char* argv[] ) {
     auto command = Command::resolveCommand(argv[1]);
 
     const auto quiet = command.contains(Command::Type::QUIET);
+    const auto parallel = command.contains(Command::Type::PARALLEL);
+    const auto deduplicate = command.contains(Command::Type::DEDUP);
+    const auto delta = command.contains(Command::Type::DELTA);
+    const auto streamed = command.contains(Command::Type::STREAMED);
+    const auto tree = command.contains(Command::Type::TREE);
 
     if ( !strcmp(argv[2], "-") )
         command.emplace(Command::Type::BATCH);
@@ -35,7 +105,7 @@ int start ( int argc, char* argv[] ) {
         return 1;
     }
 
-    if ( command.contains(Command::Type::LIST) && argc != 5 ) {
+    if ( command.contains(Command::Type::LIST) && argc < 5 ) {
         std::cerr << colorize("Invalid number of arguments for list command", Color::RED) << std::endl;
         printHelp(argv[0]);
         return 1;
@@ -46,8 +116,27 @@ int start ( int argc, char* argv[] ) {
     std::ifstream::pos_type fileSize;
     std::string fileName;
     std::string hash;
+    std::vector<TreeHash::Hash> leaves;
     std::string serverAddr;
 
+    const auto hashFile = [&] {
+        const auto freeMem = getFreeMemory();
+        auto toAllocate = std::min(freeMem / 4, static_cast<unsigned long>(fileSize / 16));
+        if ( toAllocate < freeMem / 2 )
+            toAllocate = std::min(freeMem, static_cast<unsigned long>(fileSize));
+
+
+        if ( !quiet ) {
+            std::cout << colorize("Computing hash by chunks of size: ", Color::GREEN) << colorize(
+                humanReadableSize(toAllocate), Color::CYAN
+            ) << std::endl;
+        }
+        hash = computeHash(file, toAllocate, fileSize, quiet);
+        if ( !quiet ) {
+            std::cout << colorize("Hash computed", Color::GREEN) << std::endl;
+        }
+    };
+
 
     if ( (command.contains(Command::Type::UPLOAD) ||
          command.contains(Command::Type::REMOVE) ||
@@ -75,29 +164,23 @@ int start ( int argc, char* argv[] ) {
         serverAddr = argv[3];
     }
 
+    ListQuery listQuery;
+
     try {
+        if ( command.contains(Command::Type::LIST) )
+            listQuery = parseListQuery(argc, argv);
+
         if ( command.contains(Command::Type::UPLOAD) ) {
             auto [_file, _fileSize, _fileName] = resolveFile(argv[2]);
             file = std::move(_file);
             fileSize = _fileSize;
             fileName = _fileName;
 
-
-            const auto freeMem = getFreeMemory();
-            auto toAllocate = std::min(freeMem / 4, static_cast<unsigned long>(fileSize / 16));
-            if ( toAllocate < freeMem / 2 )
-                toAllocate = std::min(freeMem, static_cast<unsigned long>(fileSize));
-
-
-            if ( !quiet ) {
-                std::cout << colorize("Computing hash by chunks of size: ", Color::GREEN) << colorize(
-                    humanReadableSize(toAllocate), Color::CYAN
-                ) << std::endl;
-            }
-            hash = computeHash(file, toAllocate, fileSize, quiet);
-            if ( !quiet ) {
-                std::cout << colorize("Hash computed", Color::GREEN) << std::endl;
-            }
+            // the single pass hashes while sending, only a fingerprint match needs the hash up front
+            if ( tree )
+                std::tie(hash, leaves) = computeTreeHash(std::filesystem::absolute(argv[2]), fileSize, quiet);
+            else if ( !streamed )
+                hashFile();
         }
 
         if ( !quiet ) {
@@ -115,18 +198,56 @@ int start ( int argc, char* argv[] ) {
         return 1;
     }
 
-    connection.sendInternal("command:" + Command::toString(Command::selectBasic(command)));
+    // servers that page listings get every ls as a paged one, older ones only without options
+    const auto paged = command.contains(Command::Type::LIST) && connection.peerPagesLists();
+
+    if ( command.contains(Command::Type::LIST) && !paged && argc > 5 ) {
+        std::cerr << colorize("The server does not support options for ls", Color::RED) << std::endl;
+        return 1;
+    }
+
+    // servers that keep interrupted transfers get plain transfers as resumable ones
+    const auto resumable = !parallel && !deduplicate && !delta && !streamed && !tree && connection.peerResumes() &&
+                           ( command.contains(Command::Type::UPLOAD) || command.contains(Command::Type::DOWNLOAD) );
+
+    connection.sendInternal(
+        std::string("command:") + ( parallel ? "STRIPED_" : "" ) + ( deduplicate ? "DEDUP_" : "" ) +
+        ( delta ? "DELTA_" : "" ) + ( streamed ? "STREAMED_" : "" ) +
+        ( tree ? "TREE_" : "" ) +
+        ( resumable ? "RESUMABLE_" : "" ) + ( paged ? "PAGED_" : "" ) + Command::toString(Command::selectBasic(command))
+    );
     if ( command.contains(Command::Type::UPLOAD) ) {
         connection.sendInternal("size:" + std::to_string(fileSize));
         connection.sendInternal("filename:" + fileName);
-        connection.sendInternal("hash:" + hash);
+        if ( streamed )
+            connection.sendInternal("fingerprint:" + fingerprint(file, fileSize));
+        else
+            connection.sendInternal("hash:" + hash);
+        if ( resumable )
+            connection.sendInternal("session:");
+
+        for ( size_t i = 0; i < leaves.size(); i += 1024 ) {
+            std::string message = "leaves:";
+            for ( size_t j = i; j < std::min(leaves.size(), i + 1024); ++j )
+                message += ( j == i ? "" : "," ) + TreeHash::toHex(leaves[j]);
+            connection.sendInternal(message);
+        }
     }
     else if ( command.contains(Command::Type::DOWNLOAD) || command.contains(Command::Type::REMOVE) ) {
         fileName = argv[2];
         connection.sendInternal("hash:" + fileName);
     }
 
-    if ( const auto reason = connection.receiveInternal(); reason != "OK" ) {
+    auto reason = connection.receiveInternal();
+
+    // the server stores a file that may be this one
+    if ( streamed && reason == "hash required" ) {
+        hashFile();
+        connection.sendInternal("hash:" + hash);
+        reason = connection.receiveInternal();
+    }
+
+    if ( reason != "OK" ) {
         std::cerr << colorize("Server did not accept the request\n", Color::RED);
 
         if ( command.contains(Command::Type::UPLOAD) ) {
@@ -161,10 +282,27 @@ int start ( int argc, char* argv[] ) {
         std::cout << colorize("Server ready!\n", Color::GREEN) << std::endl;
     }
 
-    if ( command.contains(Command::Type::UPLOAD) )
+    if ( command.contains(Command::Type::UPLOAD) && parallel )
+        Striped::sendFile(std::filesystem::absolute(argv[2]), fileSize, connection, serverAddr, quiet);
+    else if ( command.contains(Command::Type::UPLOAD) && deduplicate )
+        CommandHandlers::sendFileDeduplicated(file, fileSize, connection, quiet);
+    else if ( command.contains(Command::Type::UPLOAD) && delta )
+        CommandHandlers::sendFileDelta(file, fileSize, connection, quiet);
+    else if ( command.contains(Command::Type::UPLOAD) && streamed )
+        CommandHandlers::sendFile(file, fileSize, connection, quiet, 0, true);
+    else if ( command.contains(Command::Type::UPLOAD) && resumable )
+        CommandHandlers::sendFileResumable(file, fileSize, fileName, hash, connection, serverAddr, quiet);
+    else if ( command.contains(Command::Type::UPLOAD) )
         CommandHandlers::sendFile(file, fileSize, connection, quiet);
+    else if ( command.contains(Command::Type::DOWNLOAD) && parallel )
+        Striped::downloadFile(connection, fileName, serverAddr, quiet);
+    else if ( command.contains(Command::Type::DOWNLOAD) && resumable )
+        CommandHandlers::downloadFileResumable(connection, fileName, serverAddr, quiet);
     else if ( command.contains(Command::Type::DOWNLOAD) )
         CommandHandlers::downloadFile(connection, quiet);
+    else if ( command.contains(Command::Type::LIST) && paged ) {
+        return CommandHandlers::listFilesPaged(connection, argv[2], argv[3], listQuery);
+    }
     else if ( command.contains(Command::Type::LIST) ) {
         return CommandHandlers::listFiles(connection, argv[2], argv[3]);
     }
@@ -1,11 +1,15 @@
+#include <fcntl.h>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <sodium.h>
 #include <string>
+#include <thread>
+#include <unistd.h>
 #include <vector>
 
 #include "Color.hpp"
+#include "../shared/TreeHash.hpp"
 #include "../shared/utils.hpp"
 
 /**
@@ -97,6 +101,32 @@ inline std::string computeHash ( std::ifstream& file, const size_t allocationSpa
 	return binToHex(hash, sizeof hash);
 }
 
+/**
+ * @brief Tree hash of the file, its leaves are hashed on all cores
+ * @return identifier and the hashes of the leaves
+ */
+inline std::pair<std::string, std::vector<TreeHash::Hash>> computeTreeHash ( const std::filesystem::path& path, const size_t fileSize, bool quiet = false ) {
+	const int file = open(path.c_str(), O_RDONLY);
+	if ( file < 0 )
+		throw std::runtime_error("Could not open file");
+
+	if ( !quiet ) {
+		std::cout << colorize("Tree hashing file on ", Color::BLUE) << colorize(
+			std::to_string(std::max(1u, std::thread::hardware_concurrency())) + " threads", Color::CYAN) << std::endl;
+	}
+
+	std::vector<TreeHash::Hash> leaves;
+
+	try { leaves = TreeHash::leaves(file, fileSize); }
+	catch ( ... ) {
+		close(file);
+		throw;
+	}
+	close(file);
+
+	return {TreeHash::toId(TreeHash::root(leaves)), std::move(leaves)};
+}
+
 inline std::vector<std::string> cutStringIntoVector(std::string_view str) {
     std::vector<std::string> ret;
     size_t start = 0;
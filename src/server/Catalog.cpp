@@ -0,0 +1,219 @@
+#include "Catalog.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utils.hpp"
+
+namespace {
+
+	constexpr char magic[8] = {'H', 'K', 'C', 'A', 'T', 'v', '1', '\0'};
+
+	int openFile ( const std::filesystem::path& path ) {
+		const int file = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+		if ( file < 0 )
+			throw std::runtime_error("Catalog: could not open " + path.string() + ": " + strerror(errno));
+		return file;
+	}
+
+	std::uint64_t sizeOf ( const int file ) {
+		struct stat status{};
+		if ( fstat(file, &status) != 0 )
+			throw std::runtime_error(std::string("Catalog: could not stat: ") + strerror(errno));
+		return status.st_size;
+	}
+
+	void* map ( const int file, const std::uint64_t size ) {
+		void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+		if ( mapped == MAP_FAILED )
+			throw std::runtime_error(std::string("Catalog: could not map: ") + strerror(errno));
+		return mapped;
+	}
+
+	void* resize ( const int file, void* mapped, const std::uint64_t oldSize, const std::uint64_t newSize ) {
+		if ( ftruncate(file, static_cast<off_t>(newSize)) != 0 )
+			throw std::runtime_error(std::string("Catalog: could not grow: ") + strerror(errno));
+
+		void* remapped = mremap(mapped, oldSize, newSize, MREMAP_MAYMOVE);
+		if ( remapped == MAP_FAILED )
+			throw std::runtime_error(std::string("Catalog: could not remap: ") + strerror(errno));
+		return remapped;
+	}
+
+}
+
+Catalog::Catalog ( const std::filesystem::path& path )
+	: _path(path), _namesPath(std::filesystem::path(path).concat(".names")) {
+	static_assert(sizeof( Header ) == 64 && sizeof( Record ) % alignof( Record ) == 0);
+
+	_file = openFile(_path);
+	_namesFile = openFile(_namesPath);
+
+	_mapSize = sizeOf(_file);
+	const bool wellFormed = _mapSize >= sizeof( Header ) + sizeof( Record ) &&
+	                        ( _mapSize - sizeof( Header ) ) % sizeof( Record ) == 0;
+
+	if ( !wellFormed ) {
+		_mapSize = sizeof( Header ) + initialSlots * sizeof( Record );
+		if ( ftruncate(_file, static_cast<off_t>(_mapSize)) != 0 )
+			throw std::runtime_error("Catalog: could not size " + _path.string() + ": " + strerror(errno));
+	}
+
+	_namesMapSize = std::max(sizeOf(_namesFile), initialNamesSize);
+	if ( ftruncate(_namesFile, static_cast<off_t>(_namesMapSize)) != 0 )
+		throw std::runtime_error("Catalog: could not size " + _namesPath.string() + ": " + strerror(errno));
+
+	_map = map(_file, _mapSize);
+	_names = static_cast<char*>(map(_namesFile, _namesMapSize));
+
+	auto& header = _header();
+
+	_trusted = wellFormed && std::memcmp(header.magic, magic, sizeof magic) == 0 && header.clean &&
+	           header.slots <= _capacity() && header.namesSize <= _namesMapSize &&
+	           header.liveNamesSize <= header.namesSize;
+
+	for ( std::uint64_t slot = 0; _trusted && slot < header.slots; ++slot ) {
+		const auto& record = _records()[slot];
+
+		if ( !record.used )
+			_free.push_back(slot);
+		else if ( record.nameOffset + record.nameLength > header.namesSize || record.hash[sizeof record.hash - 1] != '\0' )
+			_trusted = false;
+	}
+
+	// a crash from here on leaves the catalog untrusted
+	header.clean = 0;
+	msync(_map, sizeof( Header ), MS_SYNC);
+
+	if ( !_trusted ) {
+		std::memcpy(header.magic, magic, sizeof magic);
+		clear();
+	}
+	else if ( header.namesSize > 2 * header.liveNamesSize + initialNamesSize )
+		_compactNames();
+}
+
+Catalog::~Catalog () {
+	msync(_names, _namesMapSize, MS_SYNC);
+	msync(_map, _mapSize, MS_SYNC);
+
+	_header().clean = 1;
+	msync(_map, sizeof( Header ), MS_SYNC);
+
+	munmap(_names, _namesMapSize);
+	munmap(_map, _mapSize);
+	close(_namesFile);
+	close(_file);
+}
+
+void Catalog::clear () {
+	auto& header = _header();
+	header.slots = 0;
+	header.namesSize = 0;
+	header.liveNamesSize = 0;
+	_free.clear();
+}
+
+std::uint64_t Catalog::put ( const std::string_view storedName, const std::string_view hash, const std::uint64_t size,
+                             const std::int64_t modified, const bool flat ) {
+	if ( hash.size() >= sizeof Record::hash )
+		throw std::runtime_error("Catalog: hash too long: " + std::string(hash));
+
+	if ( _header().namesSize + storedName.size() > _namesMapSize )
+		_growNames(_header().namesSize + storedName.size());
+
+	// growing may move the mapping, references into it are taken after
+	if ( _free.empty() && _header().slots == _capacity() )
+		_growRecords();
+
+	auto& header = _header();
+	std::uint64_t slot;
+
+	if ( !_free.empty() ) {
+		slot = _free.back();
+		_free.pop_back();
+	}
+	else
+		slot = header.slots++;
+
+	std::memcpy(_names + header.namesSize, storedName.data(), storedName.size());
+
+	auto& record = _records()[slot];
+	std::memset(&record, 0, sizeof record);
+	std::memcpy(record.hash, hash.data(), hash.size());
+	record.size = size;
+	record.modified = modified;
+	record.nameOffset = header.namesSize;
+	record.nameLength = static_cast<std::uint32_t>(storedName.size());
+	record.flat = flat;
+	record.used = 1;
+
+	header.namesSize += storedName.size();
+	header.liveNamesSize += storedName.size();
+
+	return slot;
+}
+
+void Catalog::erase ( const std::uint64_t slot ) {
+	auto& record = _records()[slot];
+	if ( !record.used )
+		return;
+
+	record.used = 0;
+	_header().liveNamesSize -= record.nameLength;
+	_free.push_back(slot);
+}
+
+void Catalog::setFlat ( const std::uint64_t slot, const bool flat ) { _records()[slot].flat = flat; }
+
+std::uint64_t Catalog::slots () const { return _header().slots; }
+
+const Catalog::Record* Catalog::at ( const std::uint64_t slot ) const {
+	const auto* record = &_records()[slot];
+	return record->used ? record : nullptr;
+}
+
+std::string_view Catalog::nameOf ( const Record& record ) const { return {_names + record.nameOffset, record.nameLength}; }
+
+std::string_view Catalog::hashOf ( const Record& record ) { return {record.hash, strnlen(record.hash, sizeof record.hash)}; }
+
+void Catalog::_growRecords () {
+	const auto newSize = sizeof( Header ) + 2 * _capacity() * sizeof( Record );
+	_map = resize(_file, _map, _mapSize, newSize);
+	_mapSize = newSize;
+}
+
+void Catalog::_growNames ( const std::uint64_t needed ) {
+	const auto newSize = std::max(2 * _namesMapSize, needed);
+	_names = static_cast<char*>(resize(_namesFile, _names, _namesMapSize, newSize));
+	_namesMapSize = newSize;
+}
+
+void Catalog::_compactNames () {
+	auto& header = _header();
+	std::string live;
+	live.reserve(header.liveNamesSize);
+
+	for ( std::uint64_t slot = 0; slot < header.slots; ++slot ) {
+		auto& record = _records()[slot];
+		if ( !record.used )
+			continue;
+
+		const auto offset = live.size();
+		live.append(_names + record.nameOffset, record.nameLength);
+		record.nameOffset = offset;
+	}
+
+	std::memcpy(_names, live.data(), live.size());
+	header.namesSize = live.size();
+	header.liveNamesSize = live.size();
+
+	Utils::log("Catalog: compacted the names of " + _path.filename().string());
+}
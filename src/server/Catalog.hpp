@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Memory-mapped metadata of the complete stored files, read at startup instead of scanning storage/
+ *
+ * Fixed-width records hold the hash, size and modification time of a stored file and where
+ * its stored name sits in the names file next to it; removed records are reused. The catalog
+ * only counts after a clean shutdown, one left open by a crash has to be rebuilt from storage/.
+ * Not thread-safe, StorageIndex serialises the access.
+ */
+class Catalog {
+public:
+	struct Record {
+		// NUL padded
+		char hash[80];
+		std::uint64_t size;
+		// file_clock ticks
+		std::int64_t modified;
+		std::uint64_t nameOffset;
+		std::uint32_t nameLength;
+		std::uint8_t used;
+		// still directly in storage/, from before the fan-out layout
+		std::uint8_t flat;
+		std::uint8_t padding[2];
+	};
+
+	/**
+	 * @param path records file, the names go into the file of the same name with ".names" appended
+	 * @throws std::runtime_error if the files cannot be opened or mapped
+	 */
+	explicit Catalog ( const std::filesystem::path& path );
+
+	~Catalog ();
+
+	Catalog ( const Catalog& ) = delete;
+
+	Catalog& operator= ( const Catalog& ) = delete;
+
+	/**
+	 * @return whether the catalog was closed cleanly, so it still describes storage/
+	 */
+	[[nodiscard]] bool trusted () const { return _trusted; }
+
+	void clear ();
+
+	/**
+	 * @return slot of the new record
+	 */
+	std::uint64_t put ( std::string_view storedName, std::string_view hash, std::uint64_t size, std::int64_t modified,
+	                    bool flat );
+
+	void erase ( std::uint64_t slot );
+
+	void setFlat ( std::uint64_t slot, bool flat );
+
+	[[nodiscard]] std::uint64_t slots () const;
+
+	/**
+	 * @return the record in the slot, nullptr if the slot is free
+	 */
+	[[nodiscard]] const Record* at ( std::uint64_t slot ) const;
+
+	[[nodiscard]] std::string_view nameOf ( const Record& record ) const;
+
+	[[nodiscard]] static std::string_view hashOf ( const Record& record );
+
+private:
+	struct Header {
+		char magic[8];
+		std::uint64_t slots;
+		// bytes of the names file in use, dead names included
+		std::uint64_t namesSize;
+		std::uint64_t liveNamesSize;
+		std::uint8_t clean;
+		std::uint8_t padding[31];
+	};
+
+	static constexpr std::uint64_t initialSlots = 1024;
+	static constexpr std::uint64_t initialNamesSize = 64 * 1024;
+
+	const std::filesystem::path _path;
+	const std::filesystem::path _namesPath;
+
+	int _file = -1;
+	int _namesFile = -1;
+	void* _map = nullptr;
+	std::uint64_t _mapSize = 0;
+	char* _names = nullptr;
+	std::uint64_t _namesMapSize = 0;
+	bool _trusted = false;
+	std::vector<std::uint64_t> _free;
+
+	[[nodiscard]] Header& _header () const { return *static_cast<Header*>(_map); }
+
+	[[nodiscard]] Record* _records () const { return reinterpret_cast<Record*>(static_cast<char*>(_map) + sizeof( Header )); }
+
+	[[nodiscard]] std::uint64_t _capacity () const { return ( _mapSize - sizeof( Header ) ) / sizeof( Record ); }
+
+	void _growRecords ();
+
+	void _growNames ( std::uint64_t needed );
+
+	/**
+	 * @brief Rewrites the names file with only the names of used records
+	 */
+	void _compactNames ();
+};
@@ -0,0 +1,240 @@
+#include "ChunkStore.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#include "utils.hpp"
+
+ChunkStore::ChunkStore ( std::filesystem::path directory, std::set<std::string> readyFiles )
+	: _directory(std::move(directory)),
+	  _indexer([this, readyFiles = std::move(readyFiles)] ( const std::stop_token& stop ) { _run(stop, readyFiles); }) {}
+
+void ChunkStore::add ( const std::string& fileHash, const std::filesystem::path& path,
+                       const std::vector<Chunker::Chunk>& chunks ) {
+	std::lock_guard lock(_mutex);
+
+	const auto current = _current(path);
+
+	// the file may have been removed while it was chunked
+	if ( !std::filesystem::exists(current) || _fileIds.contains(fileHash) )
+		return;
+
+	// without a manifest the chunks could not be released again
+	try { _writeManifest(fileHash, chunks); }
+	catch ( const std::exception& e ) {
+		Utils::elog(e.what());
+		return;
+	}
+
+	_insert(fileHash, current, chunks);
+}
+
+void ChunkStore::index ( const std::string& fileHash, const std::filesystem::path& path ) {
+	{
+		std::lock_guard lock(_mutex);
+		_queue.emplace_back(fileHash, path);
+	}
+	_queued.notify_one();
+}
+
+std::optional<ChunkStore::Location> ChunkStore::find ( const Chunker::Hash& chunk ) const {
+	std::lock_guard lock(_mutex);
+
+	const auto it = _chunks.find(chunk);
+	if ( it == _chunks.end() )
+		return std::nullopt;
+
+	const auto& occurrence = it->second.front();
+
+	return Location{_files[occurrence.file], occurrence.offset, occurrence.length};
+}
+
+void ChunkStore::remove ( const std::string& fileHash ) {
+	std::lock_guard lock(_mutex);
+
+	const auto id = _fileIds.find(fileHash);
+
+	if ( id == _fileIds.end() ) {
+		std::filesystem::remove(_directory / fileHash);
+		return;
+	}
+
+	std::size_t released = 0;
+
+	for ( const auto& chunk: _readManifest(fileHash) ) {
+		const auto it = _chunks.find(chunk.hash);
+		if ( it == _chunks.end() )
+			continue;
+
+		std::erase_if(it->second, [&] ( const Occurrence& occurrence ) { return occurrence.file == id->second; });
+
+		if ( it->second.empty() ) {
+			_chunks.erase(it);
+			++released;
+		}
+	}
+
+	_files[id->second].clear();
+	_fileIds.erase(id);
+	std::filesystem::remove(_directory / fileHash);
+
+	Utils::log("ChunkStore: removed manifest of " + fileHash + ", " + std::to_string(released) + " chunks released");
+}
+
+void ChunkStore::relocate ( const std::string& fileHash, const std::filesystem::path& path ) {
+	std::lock_guard lock(_mutex);
+
+	if ( const auto id = _fileIds.find(fileHash); id != _fileIds.end() )
+		_files[id->second] = path;
+
+	for ( auto& [queuedHash, queuedPath]: _queue )
+		if ( queuedHash == fileHash )
+			queuedPath = path;
+}
+
+std::filesystem::path ChunkStore::_current ( const std::filesystem::path& path ) {
+	auto fannedOut = Utils::FS::storagePath(path.filename().string());
+	return std::filesystem::exists(fannedOut) ? fannedOut : path;
+}
+
+void ChunkStore::_run ( const std::stop_token& stop, const std::set<std::string>& readyFiles ) {
+	try { _load(readyFiles); }
+	catch ( const std::exception& e ) { Utils::elog("ChunkStore: could not load manifests: " + std::string(e.what())); }
+
+	while ( true ) {
+		std::pair<std::string, std::filesystem::path> next;
+
+		{
+			std::unique_lock lock(_mutex);
+			if ( !_queued.wait(lock, stop, [this] { return !_queue.empty(); }) )
+				return;
+
+			next = std::move(_queue.front());
+			_queue.pop_front();
+		}
+
+		const auto& [fileHash, path] = next;
+
+		try {
+			std::ifstream file(path, std::ios::binary);
+			if ( !file.good() )
+				continue;
+
+			const auto chunks = Chunker::split(file);
+			add(fileHash, path, chunks);
+
+			Utils::log("ChunkStore: indexed " + std::to_string(chunks.size()) + " chunks of " + path.filename().string());
+		}
+		catch ( const std::exception& e ) {
+			Utils::elog("ChunkStore: could not index " + path.string() + ": " + e.what());
+		}
+	}
+}
+
+void ChunkStore::_load ( const std::set<std::string>& readyFiles ) {
+	std::map<std::string, std::filesystem::path> stored;
+
+	for ( const auto& entry: std::filesystem::recursive_directory_iterator(std::filesystem::current_path() / "storage") ) {
+		if ( !entry.is_regular_file() )
+			continue;
+
+		if ( auto hash = entry.path().extension().string().substr(1); readyFiles.contains(hash) )
+			stored.emplace(std::move(hash), entry.path());
+	}
+
+	std::size_t manifests = 0;
+
+	for ( const auto& entry: std::filesystem::directory_iterator(_directory) ) {
+		const auto fileHash = entry.path().filename().string();
+
+		std::lock_guard lock(_mutex);
+
+		// added since the server started
+		if ( _fileIds.contains(fileHash) ) {
+			stored.erase(fileHash);
+			continue;
+		}
+
+		const auto file = stored.find(fileHash);
+
+		// leftover of a removed file or an interrupted write
+		if ( file == stored.end() ) {
+			std::filesystem::remove(entry.path());
+			continue;
+		}
+
+		_insert(fileHash, _current(file->second), _readManifest(fileHash));
+		stored.erase(file);
+		++manifests;
+	}
+
+	{
+		std::lock_guard lock(_mutex);
+		for ( auto& [fileHash, path]: stored )
+			_queue.emplace_back(fileHash, _current(path));
+	}
+
+	Utils::log("ChunkStore: loaded " + std::to_string(manifests) + " manifests, " + std::to_string(stored.size()) +
+	           " files left to index");
+}
+
+void ChunkStore::_insert ( const std::string& fileHash, const std::filesystem::path& path,
+                           const std::vector<Chunker::Chunk>& chunks ) {
+	if ( _fileIds.contains(fileHash) )
+		return;
+
+	const auto id = static_cast<std::uint32_t>(_files.size());
+	_files.push_back(path);
+	_fileIds.emplace(fileHash, id);
+
+	for ( const auto& chunk: chunks ) {
+		// one occurrence per file is enough to copy the chunk from
+		if ( auto& occurrences = _chunks[chunk.hash]; occurrences.empty() || occurrences.back().file != id )
+			occurrences.push_back({id, chunk.offset, chunk.length});
+	}
+}
+
+std::vector<Chunker::Chunk> ChunkStore::_readManifest ( const std::string& fileHash ) const {
+	std::vector<Chunker::Chunk> chunks;
+	std::ifstream manifest(_directory / fileHash);
+
+	std::string hex;
+	std::uint32_t length;
+	std::uint64_t offset = 0;
+
+	try {
+		while ( manifest >> hex >> length ) {
+			chunks.push_back({offset, length, Chunker::fromHex(hex)});
+			offset += length;
+		}
+	}
+	catch ( const std::exception& e ) {
+		Utils::elog("ChunkStore: corrupt manifest of " + fileHash + ": " + e.what());
+	}
+
+	return chunks;
+}
+
+void ChunkStore::_writeManifest ( const std::string& fileHash, const std::vector<Chunker::Chunk>& chunks ) const {
+	const auto path = _directory / fileHash;
+	auto temporary = path;
+	temporary += ".tmp";
+
+	std::ostringstream contents;
+	for ( const auto& chunk: chunks )
+		contents << Chunker::toHex(chunk.hash) << ' ' << chunk.length << '\n';
+
+	std::ofstream manifest(temporary, std::ios::trunc);
+	manifest << contents.str();
+	manifest.close();
+
+	if ( !manifest ) {
+		std::filesystem::remove(temporary);
+		throw std::runtime_error("ChunkStore: could not write the manifest of " + fileHash);
+	}
+
+	// a crash never leaves a half written manifest behind
+	std::filesystem::rename(temporary, path);
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "../shared/Chunker.hpp"
+
+/**
+ * @brief Content-addressed index of the chunks inside the stored files
+ *
+ * Every stored file has a manifest, the list of its chunks, in the chunk directory.
+ * The index maps a chunk hash to the places it occurs in stored files, so an upload
+ * only has to carry the chunks no stored file contains yet. The stored files stay whole,
+ * they are what downloads, HTTP links and sync read from; a chunk is reclaimed together
+ * with the last file holding it.
+ */
+class ChunkStore {
+public:
+	struct Location {
+		std::filesystem::path path;
+		std::uint64_t offset;
+		std::uint32_t length;
+	};
+
+	/**
+	 * @param readyFiles hashes of the complete stored files, the ones without a manifest are indexed in the background
+	 */
+	ChunkStore ( std::filesystem::path directory, std::set<std::string> readyFiles );
+
+	ChunkStore ( const ChunkStore& ) = delete;
+
+	ChunkStore& operator= ( const ChunkStore& ) = delete;
+
+	/**
+	 * @brief Records the manifest of a stored file whose chunks are already known
+	 */
+	void add ( const std::string& fileHash, const std::filesystem::path& path, const std::vector<Chunker::Chunk>& chunks );
+
+	/**
+	 * @brief Queues a stored file to be chunked and recorded in the background
+	 */
+	void index ( const std::string& fileHash, const std::filesystem::path& path );
+
+	[[nodiscard]] std::optional<Location> find ( const Chunker::Hash& chunk ) const;
+
+	/**
+	 * @brief Points the occurrences in a stored file that moved at its new path
+	 */
+	void relocate ( const std::string& fileHash, const std::filesystem::path& path );
+
+	/**
+	 * @brief Drops the file's manifest, chunks that no other manifest uses leave the index
+	 */
+	void remove ( const std::string& fileHash );
+
+private:
+	struct Occurrence {
+		std::uint32_t file;
+		std::uint64_t offset;
+		std::uint32_t length;
+	};
+
+	struct HashHasher {
+		// chunk hashes are uniformly distributed already
+		std::size_t operator() ( const Chunker::Hash& hash ) const {
+			std::size_t value;
+			std::memcpy(&value, hash.data(), sizeof value);
+			return value;
+		}
+	};
+
+	const std::filesystem::path _directory;
+
+	mutable std::mutex _mutex;
+	// file id -> stored file, ids of removed files stay empty
+	std::vector<std::filesystem::path> _files;
+	std::unordered_map<std::string, std::uint32_t> _fileIds;
+	// the number of occurrences is the chunk's reference count
+	std::unordered_map<Chunker::Hash, std::vector<Occurrence>, HashHasher> _chunks;
+
+	std::condition_variable_any _queued;
+	std::deque<std::pair<std::string, std::filesystem::path>> _queue;
+	// declared last, it works on everything above
+	std::jthread _indexer;
+
+	/**
+	 * @brief Where the stored file is now; relocate only reaches the files known to the index,
+	 * one the storage migration moved while it was loaded or chunked is found in the fan-out layout
+	 */
+	[[nodiscard]] static std::filesystem::path _current ( const std::filesystem::path& path );
+
+	void _run ( const std::stop_token& stop, const std::set<std::string>& readyFiles );
+
+	/**
+	 * @brief Reads the manifests of the stored files, queues stored files without one and drops stale ones
+	 */
+	void _load ( const std::set<std::string>& readyFiles );
+
+	/**
+	 * @brief Adds the chunks to the index, caller holds the mutex
+	 */
+	void _insert ( const std::string& fileHash, const std::filesystem::path& path,
+	               const std::vector<Chunker::Chunk>& chunks );
+
+	[[nodiscard]] std::vector<Chunker::Chunk> _readManifest ( const std::string& fileHash ) const;
+
+	void _writeManifest ( const std::string& fileHash, const std::vector<Chunker::Chunk>& chunks ) const;
+};
@@ -2,37 +2,57 @@
 
 #include <algorithm>
 #include <cstring>
+#include <fcntl.h>
 #include <fstream>
+#include <limits>
+#include <map>
+#include <ranges>
 #include <set>
+#include <sstream>
+#include <unistd.h>
 #include <utility>
 
 #include "HTTPFileServer.hpp"
+#include "Reconciler.hpp"
+#include "SyncMarks.hpp"
 #include "utils.hpp"
+#include "../shared/Delta.hpp"
 #include "../shared/FileInfo.hpp"
+#include "../shared/ListQuery.hpp"
+#include "../shared/TransferWindow.hpp"
 #include "../shared/utils.hpp"
 #include "includes/toml.hpp"
 
 
 ConnectionHandler::ConnectionHandler ( const Settings& settings )
-	: _markedForRemoval("settings/toRemove.toml")
+	: _rings(settings.ioUring, settings.ioUringRings, settings.ioUringSqPoll)
+  , _markedForRemoval("settings/toRemove.toml")
   , _readyFiles("settings/readyFiles.toml")
-  , _settings(settings) {
-	if ( !settings.syncTargets.empty() )
-		_syncThread = std::jthread(&ConnectionHandler::_syncer, this);
-}
+  , _settings(settings)
+  , _storage("storage", "settings/storage.catalog", _readyFiles)
+  , _chunks("chunks", _readyFiles.list())
+  , _sessions("staging", std::chrono::seconds(settings.sessionTtl))
+  , _workers(settings.workers)
+  , _reactor(_workers, [this] ( ConnectionServer& connection ) { _serveConnection(connection); }) {
+	for ( const auto& target: _settings.syncTargets ) {
+		auto& task = *_syncTasks.emplace_back(std::make_unique<SyncTask>(target));
+		task.thread = std::jthread([this, &task] ( const std::stop_token& stop ) { _syncer(stop, task); });
+	}
 
-void ConnectionHandler::addClient ( ClientInfo client ) {
-	_clientThreads.emplace_back(&ConnectionHandler::_serveConnection, this, std::move(client));
+	if ( !_storage.flat().empty() )
+		_migration = std::jthread([this] ( const std::stop_token& stop ) { _migrateStorage(stop); });
 }
 
+void ConnectionHandler::addClient ( const ClientInfo& client ) { _reactor.add(client); }
 
-void ConnectionHandler::_serveConnection ( ClientInfo client ) {
-	Utils::log("ConnectionHandler: serving client " + client.getIp());
+void ConnectionHandler::requestStop () {
+	for ( const auto& task: _syncTasks )
+		task->thread.request_stop();
+}
 
-	ConnectionServer connection(client);
 
+void ConnectionHandler::_serveConnection ( ConnectionServer& connection ) {
 	try {
-		connection.init();
 		const auto message = connection.receiveInternal();
 
 		Utils::log("ConnectionHandler: received message: " + message);
@@ -44,14 +64,38 @@ void ConnectionHandler::_serveConnection ( ClientInfo client ) {
 			_handleRemoveFile(connection);
 		else if ( message == "command:LIST" )
 			_handleListFiles(connection);
+		else if ( message == "command:PAGED_LIST" )
+			_handleListFilesPaged(connection);
 		else if ( message == "command:SYNC" )
 			_syncAsSlave(connection);
+		else if ( message == "command:RECONCILED_SYNC" )
+			_syncAsSlave(connection, true);
 		else if ( message == "command:BATCH_UPLOAD")
 			_handleBatchReceiveFile(connection);
 		else if ( message == "command:BATCH_DOWNLOAD")
 			_handleBatchSendFile(connection);
 		else if ( message == "command:BATCH_REMOVE")
 			_handleBatchRemoveFile(connection);
+		else if ( message == "command:STRIPED_UPLOAD" )
+			_handleReceiveStriped(connection);
+		else if ( message == "command:STRIPE_UPLOAD" )
+			_handleReceiveStripe(connection);
+		else if ( message == "command:STRIPED_DOWNLOAD" )
+			_handleSendStriped(connection);
+		else if ( message == "command:STRIPE_DOWNLOAD" )
+			_handleSendStripe(connection);
+		else if ( message == "command:DEDUP_UPLOAD" )
+			_handleReceiveDeduplicated(connection);
+		else if ( message == "command:RESUMABLE_UPLOAD" )
+			_handleReceiveFile(connection, true);
+		else if ( message == "command:RESUMABLE_DOWNLOAD" )
+			_handleSendFile(connection, true);
+		else if ( message == "command:DELTA_UPLOAD" )
+			_handleReceiveDelta(connection);
+		else if ( message == "command:STREAMED_UPLOAD" )
+			_handleReceiveStreamed(connection);
+		else if ( message == "command:TREE_UPLOAD" )
+			_handleReceiveFile(connection, false, true);
 	}
 	catch ( const std::exception& e ) {
 		Utils::elog("ConnectionHandler: error serving client: " + std::string(e.what()));
@@ -78,194 +122,1358 @@ bool ConnectionHandler::_auth ( const std::string& user, const std::string& pass
 }
 
 template < ConnType T >
-void ConnectionHandler::_handleReceiveFile ( T& connection ) {
+void ConnectionHandler::_handleReceiveFile ( T& connection, const bool resumable, const bool treeLeaves ) {
 	const auto fileSize = stoll(connection.receiveInternal().substr(strlen("size:")));
 	auto fileName = connection.receiveInternal().substr(strlen("filename:"));
 	const auto hashFromClient = connection.receiveInternal().substr(strlen("hash:"));
+	const auto sessionId = resumable ? connection.receiveInternal().substr(strlen("session:")) : std::string();
+
+	// leaf hashes: "leaves:<hash>,..." until all leaves of the file arrived
+	std::vector<TreeHash::Hash> leaves;
+
+	if ( treeLeaves ) {
+		const auto count = std::max<uint64_t>(( fileSize + TreeHash::leafSize - 1 ) / TreeHash::leafSize, 1);
+
+		while ( leaves.size() < count ) {
+			const auto message = connection.receiveInternal();
+
+			if ( !message.starts_with("leaves:") )
+				throw std::runtime_error("receiveFile: expected the leaf hashes, got: " + message);
+
+			std::istringstream entries(message.substr(strlen("leaves:")));
+			for ( std::string entry; std::getline(entries, entry, ',') && leaves.size() < count; )
+				leaves.push_back(TreeHash::fromHex(entry));
+		}
+	}
 
 	const auto oldFileName = fileName;
 
 	const auto freeRam = std::min(getFreeMemory() / 4, static_cast<unsigned long>(fileSize / 16));
 
-	connection.resizeBuffer(freeRam);
+	connection.resizeBuffer(freeRam);
+
+	// convert all '.' to '<' in the filename
+	std::ranges::replace(fileName, '.', '<');
+
+	std::filesystem::path _path = Utils::FS::storagePath(fileName + '.' + hashFromClient);
+
+	if ( std::filesystem::exists(_path) ) {
+		connection.sendInternal("file already exists");
+		connection.sendInternal(_settings.httpProtocol + "://" + _settings.hostname + "/" + hashFromClient);
+		return;
+	}
+
+	// each leaf is checked once it arrived, so the leaves have to add up to the identifier first
+	if ( treeLeaves && ( !TreeHash::isTreeId(hashFromClient) || TreeHash::toId(TreeHash::root(leaves)) != hashFromClient ) ) {
+		connection.sendInternal("leaf hashes do not match the file hash");
+		connection.sendInternal(_settings.httpProtocol + "://" + _settings.hostname + "/" + hashFromClient);
+		return;
+	}
+
+	// a resumable upload writes into its session's part file, which survives a broken connection
+	std::optional<UploadSessions::Session> session;
+
+	if constexpr ( std::same_as<T, ConnectionServer> ) {
+		// claimed first, a connection that broke still holds the file until it hands the session back
+		if ( resumable )
+			session = _sessions.claim(sessionId, hashFromClient, oldFileName, fileSize, connection);
+
+		if ( resumable && !session ) {
+			connection.sendInternal("upload is still in progress on another connection");
+			connection.sendInternal(_settings.httpProtocol + "://" + _settings.hostname + "/" + hashFromClient);
+			return;
+		}
+	}
+
+	// downloads of the hash are told the file is being uploaded until it completed,
+	// dropped before the session is handed back so the connection resuming it finds the file free
+	std::optional<StorageIndex::Pending> pending;
+	pending.emplace(_storage, _path);
+
+	// e.g. two sync targets both sending a file this server lacks
+	if ( !pending->claimed() ) {
+		if ( session )
+			_sessions.release(session->id, session->committed);
+		connection.sendInternal("upload is still in progress on another connection");
+		connection.sendInternal(_settings.httpProtocol + "://" + _settings.hostname + "/" + hashFromClient);
+		return;
+	}
+
+	const auto target = session ? session->part : _path;
+	uint64_t committed = session ? session->committed : 0;
+
+	auto hasher = TreeHash::Hasher::like(hashFromClient);
+
+	// the hash continues after the part that is already stored
+	if ( committed > 0 ) {
+		const int part = open(target.c_str(), O_RDONLY);
+
+		if ( part < 0 || !_hashRange(hasher, part, committed) ) {
+			committed = 0;
+			hasher = TreeHash::Hasher::like(hashFromClient);
+		}
+
+		if ( part >= 0 )
+			close(part);
+	}
+
+	try {
+		connection.sendInternal("OK");
+
+		if ( session ) {
+			connection.sendInternal("session:" + session->id);
+			connection.sendInternal("offset:" + std::to_string(committed));
+		}
+
+		_markedForRemoval.remove(hashFromClient);
+	}
+	catch ( const std::exception& ) {
+		// the session must not keep pointing at this connection
+		if ( session ) {
+			pending.reset();
+			_sessions.release(session->id, committed);
+		}
+		throw;
+	}
+
+	if ( connection.trustedTransport() ) {
+		_receiveTrusted(connection, _path, fileSize, hashFromClient);
+		return;
+	}
+
+	std::ofstream file;
+	IoUringTransfer* ring = nullptr;
+
+	if constexpr ( std::same_as<T, ConnectionServer> )
+		ring = connection.attachRing(_rings, target, O_WRONLY | O_CREAT | ( session ? 0 : O_TRUNC ));
+
+	if ( !ring && session ) {
+		// keep what earlier connections wrote
+		std::ofstream(target, std::ios::binary | std::ios::app).close();
+		file.open(target, std::ios::binary | std::ios::in);
+		file.seekp(static_cast<std::streamoff>(committed));
+	}
+	else if ( !ring )
+		file.open(target, std::ios::binary);
+
+	std::string_view message;
+	long long sizeWritten = static_cast<long long>(committed);
+	size_t verifiedLeaves = 0;
+
+	const auto abort = [&] ( const std::string& reason ) {
+		std::cerr << "receiveFile: " << reason << std::endl;
+
+		// whatever reached the part file can be resumed from
+		bool flushed = true;
+		if ( file.is_open() ) {
+			file.close();
+			flushed = !file.fail();
+		}
+		if constexpr ( std::same_as<T, ConnectionServer> ) {
+			try { connection.detachRing(); }
+			catch ( const std::exception& ) { flushed = false; }
+		}
+
+		if ( session ) {
+			pending.reset();
+			_sessions.release(session->id, flushed ? sizeWritten : committed);
+		}
+		else
+			std::filesystem::remove(_path);
+
+		connection.sendInternal("fail");
+	};
+
+	Utils::log("receiveFile: starting download of size: " + std::to_string(fileSize) +
+	           ( committed > 0 ? ", resuming at " + std::to_string(committed) : "" ));
+
+	while ( true ) {
+		try { message = connection.receiveView(); }
+		catch ( const std::exception& e ) {
+			abort("error receiving message: " + std::string(e.what()));
+			return;
+		}
+
+		if ( message.starts_with(_internal"DONE") )
+			break;
+
+		// only queued on the ring, the write overlaps with receiving the next chunk
+		if ( ring ) {
+			try { ring->write(message.data(), message.size(), sizeWritten); }
+			catch ( const std::exception& e ) {
+				abort(e.what());
+				return;
+			}
+		}
+		else
+			file.write(message.data(), message.size());
+		sizeWritten += message.size();
+
+		hasher.update(reinterpret_cast<const unsigned char*>(message.data()), message.size());
+
+		// a corrupted leaf ends the upload right away instead of after the whole file
+		for ( ; treeLeaves && verifiedLeaves < hasher.leaves().size(); ++verifiedLeaves ) {
+			if ( verifiedLeaves >= leaves.size() || hasher.leaves()[verifiedLeaves] != leaves[verifiedLeaves] ) {
+				abort("leaf " + std::to_string(verifiedLeaves) + " does not match its hash");
+				return;
+			}
+		}
+
+		try { connection.sendInternal("confirm"); }
+		catch ( const std::exception& e ) {
+			abort("error sending confirmation: " + std::string(e.what()));
+			return;
+		}
+
+		// the recorded offset only covers bytes that left our buffers
+		if ( session && sizeWritten - committed >= sessionCommitInterval ) {
+			try {
+				if ( ring )
+					ring->flush();
+				else if ( !file.flush() )
+					throw std::runtime_error("could not write " + target.string());
+			}
+			catch ( const std::exception& e ) {
+				abort(e.what());
+				return;
+			}
+
+			committed = sizeWritten;
+			_sessions.commit(session->id, committed);
+		}
+
+		Utils::log(
+			std::string("\r") + "main: " + humanReadableSize(sizeWritten) + " / " + humanReadableSize(fileSize) +
+			" bytes written", false);
+	}
+	std::cout << std::endl;
+	file.close();
+
+	if constexpr ( std::same_as<T, ConnectionServer> ) {
+		try { connection.detachRing(); }
+		catch ( const std::exception& e ) {
+			abort(e.what());
+			return;
+		}
+	}
+
+	if ( session ) {
+		// the complete part becomes the stored file
+		std::error_code error;
+		std::filesystem::resize_file(target, sizeWritten, error);
+		if ( !error )
+			_moveIntoStorage(target, _path, error);
+
+		if ( error ) {
+			abort("could not move " + target.string() + " into storage: " + error.message());
+			return;
+		}
+
+		_sessions.finish(session->id);
+	}
+
+	_completeReceive(connection, _path, hashFromClient, hasher.finalize());
+}
+
+template < ConnType T >
+void ConnectionHandler::_receiveTrusted ( T& connection, const std::filesystem::path& _path, const uint64_t fileSize,
+                                         const std::string& hashFromClient ) {
+	const int file = open(_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if ( file < 0 )
+		throw std::runtime_error("receiveTrusted: could not create " + _path.string() + ": " + strerror(errno));
+
+	Utils::log("receiveTrusted: starting download of size: " + std::to_string(fileSize));
+
+	try {
+		connection.receiveFileBody(file, fileSize);
+
+		if ( const auto message = connection.receiveInternal(); message != "DONE" )
+			throw std::runtime_error("expected DONE, got: " + message);
+	}
+	catch ( const std::exception& e ) {
+		std::cerr << "receiveTrusted: error receiving file: " << e.what() << std::endl;
+		close(file);
+		std::filesystem::remove(_path);
+		connection.sendInternal("fail");
+		return;
+	}
+
+	// the body came in plaintext, the hash sent over the sealed channel vouches for it
+	const auto hashString = _hashFile(file, fileSize, TreeHash::isTreeId(hashFromClient));
+	close(file);
+
+	_completeReceive(connection, _path, hashFromClient, hashString);
+}
+
+template < ConnType T >
+void ConnectionHandler::_completeReceive ( T& connection, const std::filesystem::path& _path,
+                                          const std::string& hashFromClient, const std::string& hashString,
+                                          const std::vector<Chunker::Chunk>* chunks ) {
+	if ( hashFromClient != hashString ) {
+		std::filesystem::remove(_path);
+		Utils::elog(
+			"Sent hash and calculated hash do not match:\n remote: " + hashFromClient + "\n local: " + hashString);
+		_markedForRemoval.add(hashFromClient);
+		connection.sendInternal("Sent hash and calculated hash do not match");
+		return;
+	}
+
+	connection.sendInternal("OK");
+
+	_readyFiles.add(hashString);
+	_storage.markReady(_path);
+
+	if ( chunks )
+		_chunks.add(hashString, _path, *chunks);
+	else
+		_chunks.index(hashString, _path);
+
+	auto HTTPLinkString = HTTPFileServer::createSymlinkFor(_path);
+
+	connection.sendInternal(hashString);
+	connection.sendInternal(std::to_string(_settings.wantHttp));
+	if ( _settings.wantHttp && connection.receiveInternal() == "getHttpLink" )
+		connection.sendInternal(_settings.httpProtocol + "://" + _settings.hostname + "/" + HTTPLinkString);
+}
+
+void ConnectionHandler::_handleReceiveStreamed ( ConnectionServer& connection ) {
+	const auto fileSize = std::stoull(connection.receiveInternal().substr(strlen("size:")));
+	auto fileName = connection.receiveInternal().substr(strlen("filename:"));
+	const auto fingerprintFromClient = connection.receiveInternal().substr(strlen("fingerprint:"));
+
+	std::ranges::replace(fileName, '.', '<');
+
+	// a stored file of the same name and size with the same fingerprint may be this very file, only the hash can tell
+	std::string hashFromClient;
+
+	for ( const auto& stored: _storage.named(fileName) ) {
+		if ( stored.size != fileSize )
+			continue;
+
+		std::ifstream candidate(stored.path, std::ios::binary);
+
+		try {
+			if ( fingerprint(candidate, fileSize) != fingerprintFromClient )
+				continue;
+		}
+		catch ( const std::exception& ) { continue; }
+
+		connection.sendInternal("hash required");
+		hashFromClient = connection.receiveInternal().substr(strlen("hash:"));
+
+		if ( std::filesystem::exists(Utils::FS::storagePath(fileName + '.' + hashFromClient)) ) {
+			connection.sendInternal("file already exists");
+			connection.sendInternal(_settings.httpProtocol + "://" + _settings.hostname + "/" + hashFromClient);
+			return;
+		}
+
+		break;
+	}
+
+	connection.resizeBuffer(std::min(getFreeMemory() / 4, static_cast<unsigned long>(fileSize / 16)));
+
+	connection.sendInternal("OK");
+
+	// the stored name needs the hash, so the file is written under a temporary one a restart cleans up
+	unsigned char id[16];
+	randombytes_buf(id, sizeof id);
+	const auto temporary = std::filesystem::current_path() / "staging" / ( binToHex(id, sizeof id) + ".tmp" );
+
+	std::ofstream file;
+	const auto ring = connection.attachRing(_rings, temporary, O_WRONLY | O_CREAT | O_TRUNC);
+
+	if ( !ring )
+		file.open(temporary, std::ios::binary);
+
+	const auto abort = [&] ( const std::string& reason ) {
+		Utils::elog("receiveStreamed: " + reason);
+		file.close();
+		try { connection.detachRing(); }
+		catch ( const std::exception& ) {}
+		std::filesystem::remove(temporary);
+		connection.sendInternal("fail");
+	};
+
+	unsigned char hash[crypto_generichash_BYTES];
+	crypto_generichash_state state;
+	crypto_generichash_init(&state, nullptr, 0, sizeof hash);
+
+	uint64_t sizeWritten = 0;
+	std::string trailer;
+
+	Utils::log("receiveStreamed: starting download of size: " + std::to_string(fileSize));
+
+	try {
+		while ( true ) {
+			const auto message = connection.receiveView();
+
+			// the client's hash of what it sent follows the data
+			if ( message.starts_with(_internal"trailer:") ) {
+				trailer = message.substr(strlen(_internal"trailer:"));
+				break;
+			}
+
+			if ( message.size() > fileSize - sizeWritten )
+				throw std::runtime_error("received more than the file size");
+
+			if ( ring )
+				ring->write(message.data(), message.size(), sizeWritten);
+			else if ( !file.write(message.data(), static_cast<std::streamsize>(message.size())) )
+				throw std::runtime_error("could not write " + temporary.string());
+
+			sizeWritten += message.size();
+			crypto_generichash_update(&state, reinterpret_cast<const unsigned char*>(message.data()), message.size());
+
+			connection.sendInternal("confirm");
+		}
+
+		if ( sizeWritten != fileSize )
+			throw std::runtime_error("upload ended before the file was complete");
+
+		file.close();
+		if ( file.fail() )
+			throw std::runtime_error("could not write " + temporary.string());
+
+		connection.detachRing();
+	}
+	catch ( const std::exception& e ) {
+		abort(e.what());
+		return;
+	}
+
+	crypto_generichash_final(&state, hash, sizeof hash);
+	const auto hashString = binToHex(hash, sizeof hash);
+
+	// nothing reached storage yet, a mismatch only drops the staging file
+	const auto reject = [&] ( const std::string& sent, const std::string& remote ) {
+		std::filesystem::remove(temporary);
+		Utils::elog("receiveStreamed: " + sent + " and calculated hash do not match:\n remote: " + remote +
+		            "\n local: " + hashString);
+		connection.sendInternal("Sent hash and calculated hash do not match");
+	};
+
+	if ( trailer != hashString ) {
+		reject("trailer", trailer);
+		return;
+	}
+
+	// the hash asked for before the data, to compare with a stored file
+	if ( !hashFromClient.empty() && hashFromClient != hashString ) {
+		reject("hash sent before the data", hashFromClient);
+		return;
+	}
+
+	const auto _path = Utils::FS::storagePath(fileName + '.' + hashString);
+
+	// the same file finished on another connection in the meantime
+	if ( std::filesystem::exists(_path) ) {
+		std::filesystem::remove(temporary);
+		connection.sendInternal("file already exists");
+		return;
+	}
+
+	const auto pending = _storage.pending(_path);
+
+	if ( !pending.claimed() ) {
+		std::filesystem::remove(temporary);
+		connection.sendInternal("upload is still in progress on another connection");
+		return;
+	}
+
+	_markedForRemoval.remove(hashString);
+
+	std::error_code error;
+	_moveIntoStorage(temporary, _path, error);
+
+	if ( error ) {
+		abort("could not move " + temporary.string() + " into storage: " + error.message());
+		return;
+	}
+
+	_completeReceive(connection, _path, trailer, hashString);
+}
+
+void ConnectionHandler::_handleReceiveDeduplicated ( ConnectionServer& connection ) {
+	const auto fileSize = std::stoull(connection.receiveInternal().substr(strlen("size:")));
+	auto fileName = connection.receiveInternal().substr(strlen("filename:"));
+	const auto hashFromClient = connection.receiveInternal().substr(strlen("hash:"));
+
+	std::ranges::replace(fileName, '.', '<');
+
+	const auto _path = Utils::FS::storagePath(fileName + '.' + hashFromClient);
+
+	if ( std::filesystem::exists(_path) ) {
+		connection.sendInternal("file already exists");
+		connection.sendInternal(_settings.httpProtocol + "://" + _settings.hostname + "/" + hashFromClient);
+		return;
+	}
+
+	connection.sendInternal("OK");
+
+	_markedForRemoval.remove(hashFromClient);
+
+	// manifest: "chunks:<count>", then "manifest:<hash>:<length>,..." until all of them arrived
+	const auto count = std::stoull(connection.receiveInternal().substr(strlen("chunks:")));
+
+	std::vector<Chunker::Chunk> chunks;
+	chunks.reserve(std::min<uint64_t>(count, fileSize / Chunker::minSize + 1));
+	uint64_t offset = 0;
+
+	while ( chunks.size() < count ) {
+		const auto message = connection.receiveInternal();
+
+		if ( !message.starts_with("manifest:") )
+			throw std::runtime_error("receiveDeduplicated: expected the manifest, got: " + message);
+
+		std::istringstream entries(message.substr(strlen("manifest:")));
+
+		for ( std::string entry; std::getline(entries, entry, ','); ) {
+			const auto separator = entry.find(':');
+			if ( separator == std::string::npos )
+				throw std::runtime_error("receiveDeduplicated: malformed manifest entry: " + entry);
+
+			const auto length = std::stoull(entry.substr(separator + 1));
+
+			if ( length == 0 || length > Chunker::maxSize || length > fileSize - offset || chunks.size() == count )
+				throw std::runtime_error("receiveDeduplicated: manifest does not describe the file");
+
+			chunks.push_back({offset, static_cast<uint32_t>(length), Chunker::fromHex(entry.substr(0, separator))});
+			offset += length;
+		}
+	}
+
+	if ( offset != fileSize )
+		throw std::runtime_error("receiveDeduplicated: manifest does not describe the file");
+
+	const auto pending = _storage.pending(_path);
+
+	if ( !pending.claimed() )
+		throw std::runtime_error("receiveDeduplicated: " + _path.string() + " is uploaded on another connection");
+
+	const int file = open(_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if ( file < 0 )
+		throw std::runtime_error("receiveDeduplicated: could not create " + _path.string() + ": " + strerror(errno));
+
+	const auto abort = [&] ( const std::string& reason ) {
+		Utils::elog("receiveDeduplicated: " + reason);
+		close(file);
+		std::filesystem::remove(_path);
+		connection.sendInternal("fail");
+	};
+
+	if ( fileSize > 0 && posix_fallocate(file, 0, static_cast<off_t>(fileSize)) != 0 &&
+	     ftruncate(file, static_cast<off_t>(fileSize)) != 0 ) {
+		abort("could not allocate " + _path.string());
+		return;
+	}
+
+	// copy what the stored files already hold, a chunk repeated within the file is filled in from its first occurrence
+	std::map<Chunker::Hash, size_t> firstOccurrence;
+	std::map<std::filesystem::path, int> sources;
+	std::vector<size_t> missing;
+	uint64_t copied = 0;
+
+	for ( size_t i = 0; i < chunks.size(); ++i ) {
+		const auto& chunk = chunks[i];
+
+		if ( !firstOccurrence.try_emplace(chunk.hash, i).second )
+			continue;
+
+		const auto location = _chunks.find(chunk.hash);
+
+		if ( location && location->length == chunk.length ) {
+			auto source = sources.find(location->path);
+			if ( source == sources.end() )
+				source = sources.emplace(location->path, open(location->path.c_str(), O_RDONLY)).first;
+
+			if ( source->second >= 0 && _copyRange(source->second, location->offset, file, chunk.offset, chunk.length) ) {
+				copied += chunk.length;
+				continue;
+			}
+		}
+
+		missing.push_back(i);
+	}
+
+	for ( const auto source: sources | std::views::values )
+		if ( source >= 0 )
+			close(source);
+
+	// ranges of chunk indices, i.e. "0-5,9,12-20"
+	std::string missingString;
+	for ( size_t i = 0; i < missing.size(); ) {
+		auto last = i;
+		while ( last + 1 < missing.size() && missing[last + 1] == missing[last] + 1 )
+			++last;
+
+		missingString += ( missingString.empty() ? "" : "," ) + std::to_string(missing[i]);
+		if ( last != i )
+			missingString += '-' + std::to_string(missing[last]);
+
+		i = last + 1;
+	}
+
+	connection.sendInternal("missing:" + missingString);
+
+	Utils::log("receiveDeduplicated: " + humanReadableSize(copied) + " of " + humanReadableSize(fileSize) +
+	           " already stored, receiving " + std::to_string(missing.size()) + " of " + std::to_string(chunks.size()) +
+	           " chunks");
+
+	// the missing chunks arrive back to back in manifest order, each one is checked against its hash
+	size_t current = 0;
+	uint32_t filled = 0;
+	crypto_generichash_state state;
+	crypto_generichash_init(&state, nullptr, 0, crypto_generichash_BYTES);
+
+	try {
+		while ( true ) {
+			const auto message = connection.receiveView();
+
+			if ( message.starts_with(_internal"DONE") )
+				break;
+
+			auto data = message;
+
+			while ( !data.empty() ) {
+				if ( current == missing.size() )
+					throw std::runtime_error("received more than the missing chunks");
+
+				const auto& chunk = chunks[missing[current]];
+				const auto take = std::min<size_t>(data.size(), chunk.length - filled);
+
+				for ( size_t written = 0; written < take; ) {
+					const auto result = pwrite(file, data.data() + written, take - written,
+					                           static_cast<off_t>(chunk.offset + filled + written));
+					if ( result < 0 ) {
+						if ( errno == EINTR )
+							continue;
+						throw std::runtime_error("could not write: " + std::string(strerror(errno)));
+					}
+					written += result;
+				}
+
+				crypto_generichash_update(&state, reinterpret_cast<const unsigned char*>(data.data()), take);
+				filled += take;
+				data.remove_prefix(take);
+
+				if ( filled == chunk.length ) {
+					Chunker::Hash hash;
+					crypto_generichash_final(&state, hash.data(), hash.size());
+
+					// the chunk gets indexed under this hash, other uploads will copy it
+					if ( hash != chunk.hash )
+						throw std::runtime_error("chunk " + std::to_string(missing[current]) + " does not match its hash");
+
+					crypto_generichash_init(&state, nullptr, 0, crypto_generichash_BYTES);
+					filled = 0;
+					++current;
+				}
+			}
+
+			connection.sendInternal("confirm");
+		}
+
+		if ( current != missing.size() )
+			throw std::runtime_error("upload ended before all missing chunks arrived");
+	}
+	catch ( const std::exception& e ) {
+		abort(e.what());
+		return;
+	}
+
+	for ( size_t i = 0; i < chunks.size(); ++i ) {
+		const auto& first = chunks[firstOccurrence.at(chunks[i].hash)];
+
+		if ( first.offset != chunks[i].offset &&
+		     !_copyRange(file, first.offset, file, chunks[i].offset, chunks[i].length) ) {
+			abort("could not copy a repeated chunk");
+			return;
+		}
+	}
+
+	const auto hashString = _hashFile(file, fileSize, TreeHash::isTreeId(hashFromClient));
+	close(file);
+
+	_completeReceive(connection, _path, hashFromClient, hashString, &chunks);
+}
+
+void ConnectionHandler::_handleReceiveDelta ( ConnectionServer& connection ) {
+	const auto fileSize = std::stoull(connection.receiveInternal().substr(strlen("size:")));
+	const auto originalName = connection.receiveInternal().substr(strlen("filename:"));
+	const auto hashFromClient = connection.receiveInternal().substr(strlen("hash:"));
+
+	auto fileName = originalName;
+	std::ranges::replace(fileName, '.', '<');
+
+	const auto _path = Utils::FS::storagePath(fileName + '.' + hashFromClient);
+
+	if ( std::filesystem::exists(_path) ) {
+		connection.sendInternal("file already exists");
+		connection.sendInternal(_settings.httpProtocol + "://" + _settings.hostname + "/" + hashFromClient);
+		return;
+	}
+
+	// the previous version, kept open so a removal while the upload runs cannot take it away
+	const auto versions = _storage.named(fileName);
+	const auto previous = std::ranges::max_element(versions, {}, &StorageIndex::Entry::modified);
+	const auto basePath = previous != versions.end() ? previous->path : std::filesystem::path();
+	const int base = previous != versions.end() ? open(basePath.c_str(), O_RDONLY) : -1;
+
+	std::vector<Delta::Signature> signatures;
+	size_t blockSize = 0;
+
+	if ( base >= 0 ) {
+		blockSize = Delta::blockSize(std::filesystem::file_size(basePath));
+
+		std::ifstream stream(basePath, std::ios::binary);
+		signatures = Delta::signatures(stream, blockSize);
+	}
+
+	connection.sendInternal("OK");
+
+	_markedForRemoval.remove(hashFromClient);
+
+	// signatures: "blocks:<block size>:<count>", then "signatures:<signature>,..." until all of them went out
+	constexpr size_t signaturesPerMessage = 1024;
+
+	connection.sendInternal("blocks:" + std::to_string(blockSize) + ':' + std::to_string(signatures.size()));
+
+	for ( size_t i = 0; i < signatures.size(); i += signaturesPerMessage ) {
+		std::string message = "signatures:";
+
+		for ( size_t j = i; j < std::min(signatures.size(), i + signaturesPerMessage); ++j )
+			message += ( j == i ? "" : "," ) + Delta::toHex(signatures[j]);
+
+		connection.sendInternal(message);
+	}
+
+	Utils::log("receiveDelta: " + ( base >= 0
+		           ? "sent " + std::to_string(signatures.size()) + " signatures of " + basePath.filename().string()
+		           : "no previous version of " + originalName ));
+
+	const auto pending = _storage.pending(_path);
+
+	if ( !pending.claimed() ) {
+		if ( base >= 0 )
+			close(base);
+		throw std::runtime_error("receiveDelta: " + _path.string() + " is uploaded on another connection");
+	}
+
+	const int file = open(_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if ( file < 0 ) {
+		if ( base >= 0 )
+			close(base);
+		throw std::runtime_error("receiveDelta: could not create " + _path.string() + ": " + strerror(errno));
+	}
+
+	const auto abort = [&] ( const std::string& reason ) {
+		Utils::elog("receiveDelta: " + reason);
+		close(file);
+		if ( base >= 0 )
+			close(base);
+		std::filesystem::remove(_path);
+		connection.sendInternal("fail");
+	};
+
+	// the new file is rebuilt front to back: literal data arrives as data, copies of old blocks as "copy:<first>-<last>"
+	uint64_t written = 0;
+	uint64_t reused = 0;
+
+	try {
+		while ( true ) {
+			const auto message = connection.receiveView();
+
+			if ( message.starts_with(_internal"DONE") )
+				break;
+
+			if ( message.starts_with(_internal"copy:") ) {
+				const std::string range(message.substr(strlen(_internal"copy:")));
+				const auto separator = range.find('-');
+				if ( separator == std::string::npos )
+					throw std::runtime_error("malformed copy: " + range);
+
+				const auto first = std::stoull(range.substr(0, separator));
+				const auto last = std::stoull(range.substr(separator + 1));
+
+				if ( last < first || last >= signatures.size() ||
+				     ( last - first + 1 ) * blockSize > fileSize - written )
+					throw std::runtime_error("copy outside of the files: " + range);
+
+				const auto length = ( last - first + 1 ) * blockSize;
+
+				if ( !_copyRange(base, first * blockSize, file, written, length) )
+					throw std::runtime_error("could not copy from " + basePath.string());
+
+				written += length;
+				reused += length;
+				continue;
+			}
+
+			if ( message.size() > fileSize - written )
+				throw std::runtime_error("received more than the file size");
+
+			for ( size_t done = 0; done < message.size(); ) {
+				const auto result = pwrite(file, message.data() + done, message.size() - done,
+				                           static_cast<off_t>(written + done));
+				if ( result < 0 ) {
+					if ( errno == EINTR )
+						continue;
+					throw std::runtime_error("could not write: " + std::string(strerror(errno)));
+				}
+				done += result;
+			}
+
+			written += message.size();
+			connection.sendInternal("confirm");
+		}
+
+		if ( written != fileSize )
+			throw std::runtime_error("upload ended before the file was complete");
+	}
+	catch ( const std::exception& e ) {
+		abort(e.what());
+		return;
+	}
+
+	if ( base >= 0 )
+		close(base);
+
+	Utils::log("receiveDelta: reused " + humanReadableSize(reused) + " of " + humanReadableSize(fileSize) +
+	           " from the previous version");
+
+	const auto hashString = _hashFile(file, fileSize, TreeHash::isTreeId(hashFromClient));
+	close(file);
+
+	_completeReceive(connection, _path, hashFromClient, hashString);
+}
+
+void ConnectionHandler::_moveIntoStorage ( const std::filesystem::path& from, const std::filesystem::path& to,
+                                          std::error_code& error ) {
+	std::filesystem::rename(from, to, error);
+	if ( error != std::errc::cross_device_link )
+		return;
+
+	error.clear();
+	std::filesystem::copy_file(from, to, std::filesystem::copy_options::overwrite_existing, error);
+	if ( !error )
+		std::filesystem::remove(from, error);
+}
+
+bool ConnectionHandler::_copyRange ( const int from, uint64_t fromOffset, const int to, uint64_t toOffset,
+                                     uint64_t length ) {
+	while ( length > 0 ) {
+		auto inOffset = static_cast<off_t>(fromOffset);
+		auto outOffset = static_cast<off_t>(toOffset);
+
+		const auto result = copy_file_range(from, &inOffset, to, &outOffset, length, 0);
+		if ( result < 0 && errno == EINTR )
+			continue;
+		if ( result <= 0 )
+			return false;
+
+		fromOffset += result;
+		toOffset += result;
+		length -= result;
+	}
+
+	return true;
+}
+
+std::string ConnectionHandler::_findReadyFile ( ConnectionServer& connection, const std::string& hash ) {
+	const auto stored = _storage.find(hash);
+
+	if ( !stored ) {
+		Utils::log("sendFile: file not found");
+		connection.sendInternal("File not found");
+		return {};
+	}
+
+	if ( !stored->ready ) {
+		Utils::log("sendFile: file is being uploaded");
+		connection.sendInternal("File is being uploaded, try again later");
+		return {};
+	}
+
+	if ( !std::ifstream(stored->path, std::ios::binary).good() ) {
+		Utils::log("sendFile: could not open file");
+		connection.sendInternal("NO");
+		return {};
+	}
+
+	return stored->path;
+}
+
+void ConnectionHandler::_handleSendFile ( ConnectionServer& connection, const bool resumable ) {
+	const auto hash = connection.receiveInternal().substr(strlen("hash:"));
+	const auto fileName = _findReadyFile(connection, hash);
+
+	if ( fileName.empty() )
+		return;
+
+	std::ifstream file;
+	const auto ring = connection.attachRing(_rings, fileName, O_RDONLY);
+
+	if ( !ring )
+		file.open(fileName, std::ios::binary);
+
+	const auto freeRam = getFreeMemory() / 4;
+
+	connection.sendInternal("OK");
+
+	const auto fileSize = std::filesystem::file_size(fileName);
+
+	size_t chunkSize = 2 * 1024 * 1024;
+	auto buffer = std::make_unique<char[]>(chunkSize);
+
+	connection.sendInternal(std::to_string(fileSize));
+
+	auto lastOfSlash = fileName.find_last_of('/');
+	auto lastOfDot = fileName.find_last_of('.');
+
+	auto clientFileName = fileName.substr(lastOfSlash + 1, lastOfDot - lastOfSlash - 1);
+	std::ranges::replace(clientFileName, '<', '.');
+
+	connection.sendInternal(clientFileName);
+
+	// a resumed download continues after what the client's partial file already holds
+	const auto offset = resumable
+		                    ? std::min<uint64_t>(std::stoull(connection.receiveInternal().substr(strlen("offset:"))), fileSize)
+		                    : 0;
+
+	if ( !ring )
+		file.seekg(static_cast<std::streamoff>(offset));
+
+	Utils::log("sendFile: starting upload of size: " + humanReadableSize(fileSize) +
+	           ( offset > 0 ? ", resuming at " + humanReadableSize(offset) : "" ));
+
+	size_t sizeRead = offset;
+	TransferWindow window(_settings.transferWindow, _settings.transferWindowMax);
+	Compressor compressor;
+
+	while ( true ) {
+		std::string_view chunk;
+
+		if ( ring ) {
+			// the following chunk is read while this one is on the wire
+			const auto length = std::min<uint64_t>(chunkSize, fileSize - sizeRead);
+			const auto next = std::min<uint64_t>(chunkSize, fileSize - sizeRead - length);
+			const auto data = ring->read(sizeRead, length, next);
+			chunk = {data.data(), data.size()};
+		}
+		else {
+			file.read(buffer.get(), chunkSize);
+			chunk = {buffer.get(), static_cast<size_t>(file.gcount())};
+		}
+
+		const auto startUploadTime = std::chrono::high_resolution_clock::now();
+		connection.send(std::string(chunk), compressor);
+		const auto endUploadTime = std::chrono::high_resolution_clock::now();
+
+		std::chrono::duration<double> duration = endUploadTime - startUploadTime;
+
+		sizeRead += chunk.size();
+
+		window.sent(chunk.size());
+		window.collect(connection);
+
+		if ( sizeRead == static_cast<unsigned long long>(fileSize) )
+			break;
+
+		// adjust chunk size based on duration
+		if ( duration.count() > 1.4 ) {
+			// decrease chunkSize by 2%, ensure integer rounding
+			chunkSize = static_cast<int>(chunkSize * 0.75);
+
+			buffer = std::make_unique<char[]>(chunkSize);
+		}
+		else if ( duration.count() < 0.3 && freeRam >= chunkSize * 2 && chunkSize < Frame::maxChunkSize ) {
+			chunkSize = std::min<size_t>(chunkSize * 2, Frame::maxChunkSize);
+			buffer = std::make_unique<char[]>(chunkSize);
+		}
+		else if ( duration.count() < 0.6 && freeRam >= chunkSize * 2 && chunkSize < Frame::maxChunkSize ) {
+			chunkSize = std::min<size_t>(static_cast<size_t>(chunkSize * 1.25), Frame::maxChunkSize);
+			buffer = std::make_unique<char[]>(chunkSize);
+		}
+
+		// a chunk has to fit into one registered buffer
+		if ( ring )
+			chunkSize = std::min(chunkSize, IoUringPool::slotSize);
+	}
+
+	connection.sendInternal("DONE");
+
+	// the next request on this connection must not start with stale confirmations
+	window.drain(connection);
+
+	connection.detachRing();
+}
+
+void ConnectionHandler::_handleReceiveStriped ( ConnectionServer& connection ) {
+	const auto fileSize = std::stoull(connection.receiveInternal().substr(strlen("size:")));
+	auto fileName = connection.receiveInternal().substr(strlen("filename:"));
+	const auto hashFromClient = connection.receiveInternal().substr(strlen("hash:"));
+
+	std::ranges::replace(fileName, '.', '<');
+
+	const auto _path = Utils::FS::storagePath(fileName + '.' + hashFromClient);
+
+	if ( std::filesystem::exists(_path) ) {
+		connection.sendInternal("file already exists");
+		connection.sendInternal(_settings.httpProtocol + "://" + _settings.hostname + "/" + hashFromClient);
+		return;
+	}
+
+	connection.sendInternal("OK");
+
+	_markedForRemoval.remove(hashFromClient);
+
+	const auto upload = std::make_shared<StripedUpload>();
+	upload->size = fileSize;
+	upload->attached = 1; // this connection
+
+	const auto pending = _storage.pending(_path);
+
+	if ( !pending.claimed() )
+		throw std::runtime_error("receiveStriped: " + _path.string() + " is uploaded on another connection");
+
+	upload->file = open(_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if ( upload->file < 0 )
+		throw std::runtime_error("receiveStriped: could not create " + _path.string() + ": " + strerror(errno));
+
+	// allocate the whole file up front so the stripes only fill it in
+	if ( fileSize > 0 && posix_fallocate(upload->file, 0, static_cast<off_t>(fileSize)) != 0 &&
+	     ftruncate(upload->file, static_cast<off_t>(fileSize)) != 0 ) {
+		close(upload->file);
+		throw std::runtime_error("receiveStriped: could not allocate " + _path.string());
+	}
+
+	unsigned char sessionBytes[16];
+	randombytes_buf(sessionBytes, sizeof sessionBytes);
+	const auto session = binToHex(sessionBytes, sizeof sessionBytes);
+
+	{
+		std::lock_guard lock(_stripedUploadsMutex);
+		_stripedUploads.emplace(session, upload);
+	}
+
+	connection.sendInternal("session:" + session);
+
+	Utils::log("receiveStriped: starting download of size: " + std::to_string(fileSize));
+
+	// hashes the reassembled file while the rest is still arriving
+	std::string hashString;
+	std::jthread hasher([&hashString, &upload, &hashFromClient] {
+		hashString = _hashStriped(*upload, hashFromClient);
+	});
+
+	bool received = true;
+
+	try { _receiveRanges(connection, *upload); }
+	catch ( const std::exception& e ) {
+		Utils::elog("receiveStriped: error receiving message: " + std::string(e.what()));
+		received = false;
+	}
+
+	{
+		std::lock_guard lock(upload->mutex);
+		upload->failed |= !received;
+		--upload->attached;
+	}
+	upload->progress.notify_all();
+
+	hasher.join();
+
+	{
+		std::lock_guard lock(_stripedUploadsMutex);
+		_stripedUploads.erase(session);
+	}
+
+	close(upload->file);
+
+	if ( !received || hashString.empty() ) {
+		std::filesystem::remove(_path);
+		connection.sendInternal("fail");
+		return;
+	}
+
+	Utils::log("receiveStriped: " + humanReadableSize(fileSize) + " reassembled");
+
+	_completeReceive(connection, _path, hashFromClient, hashString);
+}
+
+void ConnectionHandler::_handleReceiveStripe ( ConnectionServer& connection ) {
+	const auto session = connection.receiveInternal().substr(strlen("session:"));
+
+	std::shared_ptr<StripedUpload> upload;
+
+	{
+		std::lock_guard lock(_stripedUploadsMutex);
+		if ( const auto it = _stripedUploads.find(session); it != _stripedUploads.end() )
+			upload = it->second;
+	}
+
+	if ( !upload ) {
+		connection.sendInternal("unknown session");
+		return;
+	}
+
+	{
+		std::lock_guard lock(upload->mutex);
+		if ( upload->failed ) {
+			connection.sendInternal("upload failed");
+			return;
+		}
+		++upload->attached;
+	}
+
+	connection.sendInternal("OK");
+
+	bool received = true;
+
+	try { _receiveRanges(connection, *upload); }
+	catch ( const std::exception& e ) {
+		Utils::elog("receiveStripe: error receiving message: " + std::string(e.what()));
+		received = false;
+	}
+
+	{
+		std::lock_guard lock(upload->mutex);
+		upload->failed |= !received;
+		--upload->attached;
+	}
+	upload->progress.notify_all();
+}
+
+void ConnectionHandler::_receiveRanges ( ConnectionServer& connection, StripedUpload& upload ) {
+	while ( true ) {
+		const auto request = connection.receiveInternal();
 
-	// convert all '.' to '<' in the filename
-	std::ranges::replace(fileName, '.', '<');
+		if ( request == "DONE" )
+			return;
 
-	std::filesystem::path _path = std::filesystem::current_path() / "storage" / ( fileName + '.' + hashFromClient );
+		if ( !request.starts_with("range:") )
+			throw std::runtime_error("receiveRanges: expected a range, got: " + request);
 
-	if ( std::filesystem::exists(_path) ) {
-		connection.sendInternal("file already exists");
-		connection.sendInternal(_settings.httpProtocol + "://" + _settings.hostname + "/" + hashFromClient);
-		return;
-	}
+		const auto separator = request.find(':', strlen("range:"));
+		if ( separator == std::string::npos )
+			throw std::runtime_error("receiveRanges: malformed range: " + request);
 
-	connection.sendInternal("OK");
+		const auto offset = std::stoull(request.substr(strlen("range:"), separator - strlen("range:")));
+		const auto length = std::stoull(request.substr(separator + 1));
 
-	_markedForRemoval.remove(hashFromClient);
+		if ( length == 0 || offset > upload.size || length > upload.size - offset )
+			throw std::runtime_error("receiveRanges: range outside of the file: " + request);
 
-	std::ofstream file(_path, std::ios::binary);
+		uint64_t received = 0;
 
-	Utils::log("receiveFile: starting download of size: " + std::to_string(fileSize));
+		while ( received < length ) {
+			const auto chunk = connection.receiveView();
 
-	std::string message;
-	long long sizeWritten = 0;
+			if ( chunk.empty() || chunk.size() > length - received )
+				throw std::runtime_error("receiveRanges: chunk does not fit the announced range");
 
-	unsigned char hash[crypto_generichash_BYTES];
-	crypto_generichash_state state;
-	crypto_generichash_init(&state, nullptr, 0, sizeof hash);
+			size_t written = 0;
+			while ( written < chunk.size() ) {
+				const auto result = pwrite(upload.file, chunk.data() + written, chunk.size() - written,
+				                           static_cast<off_t>(offset + received + written));
+				if ( result < 0 ) {
+					if ( errno == EINTR )
+						continue;
+					throw std::runtime_error("receiveRanges: could not write: " + std::string(strerror(errno)));
+				}
+				written += result;
+			}
 
-	while ( true ) {
-		try { message = connection.receive(); }
-		catch ( const std::exception& e ) {
-			std::cerr << "receiveFile: error receiving message: " << e.what() << std::endl;
-			file.close();
-			std::filesystem::remove(_path);
-			connection.sendInternal("fail");
-			return;
+			received += chunk.size();
+			connection.sendInternal("confirm");
 		}
 
-		if ( message.starts_with(_internal"DONE") )
-			break;
+		{
+			std::lock_guard lock(upload.mutex);
+			upload.completed.emplace(offset, length);
+		}
+		upload.progress.notify_all();
+	}
+}
 
-		file.write(message.data(), message.size());
-		sizeWritten += message.size();
+std::string ConnectionHandler::_hashFile ( const int file, const uint64_t size, const bool tree ) {
+	if ( tree ) {
+		try { return TreeHash::toId(TreeHash::root(TreeHash::leaves(file, size))); }
+		catch ( const std::exception& ) { return {}; }
+	}
 
-		connection.sendInternal("confirm");
+	TreeHash::Hasher hasher(false);
 
-		crypto_generichash_update(&state, reinterpret_cast<const unsigned char*>(message.data()), message.size());
+	if ( !_hashRange(hasher, file, size) )
+		return {};
 
-		Utils::log(
-			std::string("\r") + "main: " + humanReadableSize(sizeWritten) + " / " + humanReadableSize(fileSize) +
-			" bytes written", false);
-	}
-	std::cout << std::endl;
-	file.close();
+	return hasher.finalize();
+}
 
-	crypto_generichash_final(&state, hash, sizeof hash);
+bool ConnectionHandler::_hashRange ( TreeHash::Hasher& hasher, const int file, const uint64_t size ) {
+	constexpr size_t bufferSize = 4 * 1024 * 1024;
+	const auto buffer = std::make_unique_for_overwrite<unsigned char[]>(bufferSize);
 
-	auto hashString = binToHex(hash, sizeof hash);
+	for ( uint64_t hashed = 0; hashed < size; ) {
+		const auto result = pread(file, buffer.get(), std::min<uint64_t>(bufferSize, size - hashed), static_cast<off_t>(hashed));
+		if ( result < 0 && errno == EINTR )
+			continue;
+		if ( result <= 0 )
+			return false;
 
-	if ( hashFromClient != hashString ) {
-		std::filesystem::remove(_path);
-		Utils::elog(
-			"Sent hash and calculated hash do not match:\n remote: " + hashFromClient + "\n local: " + hashString);
-		_markedForRemoval.add(hashFromClient);
-		connection.sendInternal("Sent hash and calculated hash do not match");
-		return;
+		hasher.update(buffer.get(), result);
+		hashed += result;
 	}
 
-	connection.sendInternal("OK");
+	return true;
+}
 
-	_readyFiles.add(hashString);
+std::string ConnectionHandler::_hashStriped ( StripedUpload& upload, const std::string& id ) {
+	auto hasher = TreeHash::Hasher::like(id);
 
-	auto HTTPLinkString = HTTPFileServer::createSymlinkFor(_path);
+	constexpr size_t bufferSize = 4 * 1024 * 1024;
+	const auto buffer = std::make_unique_for_overwrite<unsigned char[]>(bufferSize);
 
-	connection.sendInternal(hashString);
-	connection.sendInternal(std::to_string(_settings.wantHttp));
-	if ( _settings.wantHttp && connection.receiveInternal() == "getHttpLink" )
-		connection.sendInternal(_settings.httpProtocol + "://" + _settings.hostname + "/" + HTTPLinkString);
-}
+	uint64_t hashed = 0;
 
-void ConnectionHandler::_handleSendFile ( ConnectionServer& connection ) {
-	auto hash = connection.receiveInternal().substr(strlen("hash:"));
-	std::string fileName;
+	while ( hashed < upload.size ) {
+		uint64_t available = 0;
 
-	for ( const auto& file: std::filesystem::directory_iterator("storage") )
-		if ( file.path().extension() == '.' + hash )
-			fileName = file.path();
+		{
+			std::unique_lock lock(upload.mutex);
+			upload.progress.wait(lock, [&] {
+				return upload.failed || upload.completed.contains(hashed) || upload.attached == 0;
+			});
 
-	if ( fileName.empty() ) {
-		Utils::log("sendFile: file not found");
-		connection.sendInternal("File not found");
-		return;
-	}
+			if ( upload.failed || !upload.completed.contains(hashed) )
+				return {};
 
-	if ( !_readyFiles.list().contains(hash) ) {
-		Utils::log("sendFile: file is being uploaded");
-		connection.sendInternal("File is being uploaded, try again later");
-		return;
+			// take every range that continues the hashed prefix
+			auto it = upload.completed.find(hashed);
+			while ( it != upload.completed.end() && it->first == hashed + available ) {
+				available += it->second;
+				it = upload.completed.erase(it);
+			}
+		}
+
+		while ( available > 0 ) {
+			const auto result = pread(upload.file, buffer.get(), std::min<uint64_t>(bufferSize, available),
+			                          static_cast<off_t>(hashed));
+			if ( result < 0 && errno == EINTR )
+				continue;
+			if ( result <= 0 )
+				return {};
+
+			hasher.update(buffer.get(), result);
+			hashed += result;
+			available -= result;
+		}
 	}
 
-	std::ifstream file(fileName, std::ios::binary);
+	return hasher.finalize();
+}
 
-	if ( !file.good() ) {
-		Utils::log("sendFile: could not open file");
-		connection.sendInternal("NO");
-		return;
-	}
+void ConnectionHandler::_handleSendStriped ( ConnectionServer& connection ) {
+	const auto hash = connection.receiveInternal().substr(strlen("hash:"));
+	const auto fileName = _findReadyFile(connection, hash);
 
-	const auto freeRam = getFreeMemory() / 4;
+	if ( fileName.empty() )
+		return;
 
 	connection.sendInternal("OK");
 
 	const auto fileSize = std::filesystem::file_size(fileName);
-
-	size_t chunkSize = 2 * 1024 * 1024;
-	auto buffer = std::make_unique<char[]>(chunkSize);
-
 	connection.sendInternal(std::to_string(fileSize));
 
-	auto lastOfSlash = fileName.find_last_of('/');
-	auto lastOfDot = fileName.find_last_of('.');
+	const auto lastOfSlash = fileName.find_last_of('/');
+	const auto lastOfDot = fileName.find_last_of('.');
 
 	auto clientFileName = fileName.substr(lastOfSlash + 1, lastOfDot - lastOfSlash - 1);
 	std::ranges::replace(clientFileName, '<', '.');
 
 	connection.sendInternal(clientFileName);
 
-	Utils::log("sendFile: starting upload of size: " + humanReadableSize(fileSize));
+	Utils::log("sendStriped: starting upload of size: " + humanReadableSize(fileSize));
 
-	size_t sizeRead = 0;
+	_sendRanges(connection, fileName);
+}
+
+void ConnectionHandler::_handleSendStripe ( ConnectionServer& connection ) {
+	const auto hash = connection.receiveInternal().substr(strlen("hash:"));
+	const auto fileName = _findReadyFile(connection, hash);
+
+	if ( fileName.empty() )
+		return;
+
+	connection.sendInternal("OK");
+
+	_sendRanges(connection, fileName);
+}
+
+void ConnectionHandler::_sendRanges ( ConnectionServer& connection, const std::filesystem::path& path ) const {
+	std::ifstream file(path, std::ios::binary);
+	const auto fileSize = std::filesystem::file_size(path);
+
+	constexpr size_t chunkSize = 2 * 1024 * 1024;
+	const auto buffer = std::make_unique_for_overwrite<char[]>(chunkSize);
+
+	TransferWindow window(_settings.transferWindow, _settings.transferWindowMax);
+	Compressor compressor;
 
 	while ( true ) {
-		file.read(buffer.get(), chunkSize);
+		const auto request = connection.receiveInternal();
 
-		const auto startUploadTime = std::chrono::high_resolution_clock::now();
-		connection.send(std::string(buffer.get(), file.gcount()));
-		const auto endUploadTime = std::chrono::high_resolution_clock::now();
+		if ( request == "DONE" )
+			return;
 
-		std::chrono::duration<double> duration = endUploadTime - startUploadTime;
+		if ( !request.starts_with("range:") )
+			throw std::runtime_error("sendRanges: expected a range, got: " + request);
 
-		sizeRead += file.gcount();
+		const auto separator = request.find(':', strlen("range:"));
+		if ( separator == std::string::npos )
+			throw std::runtime_error("sendRanges: malformed range: " + request);
 
-		if ( connection.receiveInternal() != "confirm" )
-			throw std::runtime_error("sendFile: client did not confirm the chunk");
+		const auto offset = std::stoull(request.substr(strlen("range:"), separator - strlen("range:")));
+		auto remaining = std::stoull(request.substr(separator + 1));
 
-		if ( sizeRead == static_cast<unsigned long long>(fileSize) )
-			break;
+		if ( offset > fileSize || remaining > fileSize - offset )
+			throw std::runtime_error("sendRanges: range outside of the file: " + request);
 
-		// adjust chunk size based on duration
-		if ( duration.count() > 1.4 ) {
-			// decrease chunkSize by 2%, ensure integer rounding
-			chunkSize = static_cast<int>(chunkSize * 0.75);
+		file.seekg(static_cast<std::streamoff>(offset));
 
-			buffer = std::make_unique<char[]>(chunkSize);
-		}
-		else if ( duration.count() < 0.3 && freeRam >= chunkSize * 2 ) {
-			chunkSize = static_cast<int>(chunkSize * 2);
-			buffer = std::make_unique<char[]>(chunkSize);
-		}
-		else if ( duration.count() < 0.6 && freeRam >= chunkSize * 2 ) {
-			chunkSize = static_cast<int>(chunkSize * 1.25);
-			buffer = std::make_unique<char[]>(chunkSize);
+		while ( remaining > 0 ) {
+			file.read(buffer.get(), static_cast<std::streamsize>(std::min<uint64_t>(chunkSize, remaining)));
+			const auto read = static_cast<size_t>(file.gcount());
+
+			if ( read == 0 )
+				throw std::runtime_error("sendRanges: could not read " + path.string());
+
+			connection.send(std::string(buffer.get(), read), compressor);
+			window.sent(read);
+			window.collect(connection);
+
+			remaining -= read;
 		}
-	}
 
-	connection.sendInternal("DONE");
+		// the next request comes after the confirmations of this range
+		window.drain(connection);
+	}
 }
 
 void ConnectionHandler::_removeOnSyncedTargets ( const std::string& hash ) {
 	_markedForRemoval.add(hash);
 
-	for ( const auto& target: _settings.syncTargets ) {
-		Connection connection;
+	for ( const auto& task: _syncTasks ) {
+		std::lock_guard lock(task->mutex);
+		task->removals.insert(hash);
+		task->wake.notify_one();
+	}
+}
 
-		try { connection.connectToServer(target.targetAddress, 6998, 5); }
-		catch ( ... ) {
-			Utils::log("removeOnSyncedTargets: Could not connect to remote");
-			continue;
-		}
+void ConnectionHandler::_removeOnTarget ( const Settings::SyncTarget& target, const std::set<std::string>& hashes ) {
+	for ( const auto& hash: hashes ) {
+		Connection connection;
+		connection.connectToServer(target.targetAddress, 6998, 5);
 
 		Utils::log("removeOnSyncedTargets: Trying to remove file on \"" + target.targetName + "\": " + hash);
 
@@ -280,29 +1488,24 @@ void ConnectionHandler::_removeOnSyncedTargets ( const std::string& hash ) {
 void ConnectionHandler::_handleRemoveFile ( ConnectionServer& connection ) {
 	const auto hash = connection.receiveInternal().substr(strlen("hash:"));
 
-	std::filesystem::path fileName;
-
-	for ( const auto& file: std::filesystem::directory_iterator("storage") )
-		if ( file.path().extension() == '.' + hash )
-			fileName = file.path();
+	const auto stored = _storage.find(hash);
 
-	if ( fileName.empty() ) {
+	if ( !stored ) {
 		Utils::log("_handleRemoveFile: file not found");
 		connection.sendInternal("File not found");
 		return;
 	}
 
-	if ( !_readyFiles.list().contains(hash) ) {
+	if ( !stored->ready ) {
 		Utils::log("_handleRemoveFile: file is being uploaded");
 		connection.sendInternal("File is being uploaded, try again later");
 		return;
 	}
 	connection.sendInternal("OK");
-	_removeFile(fileName);
+	_removeFile(stored->path);
 
 	_readyFiles.remove(hash);
 
-	std::lock_guard lock(_syncMutex);
 	_removeOnSyncedTargets(hash);
 }
 
@@ -319,13 +1522,72 @@ void ConnectionHandler::_handleListFiles ( ConnectionServer& connection ) const
 
 	connection.sendInternal("OK");
 
-	for ( const auto& file: std::filesystem::directory_iterator("storage") ) {
-		connection.sendData(FileInfo(file, true).encode());
-	}
+	for ( const auto& file: _storage.list() )
+		connection.sendData(file.encode());
 
 	connection.sendInternal("DONE");
 }
 
+void ConnectionHandler::_handleListFilesPaged ( ConnectionServer& connection ) const {
+	// files taken from the catalog per pass, and per message
+	constexpr size_t filesPerPass = 64 * 1024;
+	constexpr size_t pageSize = 64 * 1024;
+
+	connection.sendInternal("OK");
+
+	const std::string user = connection.receiveInternal();
+	const std::string pass = connection.receiveInternal();
+
+	if ( !_auth(user, pass) ) {
+		connection.sendInternal("NOPE");
+		return;
+	}
+
+	connection.sendInternal("OK");
+
+	const auto query = ListQuery::decode(connection.receiveInternal().substr(strlen("query:")));
+
+	auto toSkip = query.offset;
+	auto toSend = query.limit ? query.limit : std::numeric_limits<uint64_t>::max();
+	std::string cursor = query.after;
+	std::string page = _data;
+	Compressor compressor;
+
+	while ( toSend > 0 ) {
+		// never more than the offset and limit still need, so the cursor ends on the last file sent;
+		// toSkip + toSend would wrap without a limit
+		const auto wanted = toSend > std::numeric_limits<uint64_t>::max() - toSkip
+			                    ? filesPerPass
+			                    : static_cast<size_t>(std::min<uint64_t>(filesPerPass, toSkip + toSend));
+		const auto listing = _storage.list(query, cursor, wanted);
+
+		for ( const auto& file: listing.files ) {
+			if ( toSkip > 0 ) {
+				--toSkip;
+				continue;
+			}
+
+			file.appendBinary(page);
+			--toSend;
+
+			if ( page.size() >= pageSize ) {
+				connection.send(page, compressor);
+				page = _data;
+			}
+		}
+
+		if ( listing.files.empty() || listing.files.size() < wanted )
+			break;
+		cursor = listing.cursor;
+	}
+
+	if ( page.size() > strlen(_data) )
+		connection.send(page, compressor);
+
+	// only a listing cut short by the limit can be continued
+	connection.sendInternal(std::string("DONE:") + ( toSend == 0 ? cursor : "" ));
+}
+
 void ConnectionHandler::_handleBatchReceiveFile ( ConnectionServer& connection ) {
 	auto len = std::stoi(connection.receiveInternal().substr(strlen("length:")));
 
@@ -352,8 +1614,8 @@ void ConnectionHandler::_handleBatchRemoveFile ( ConnectionServer& connection )
 
 
 template < ConnType T >
-void ConnectionHandler::_sendFileInSync ( T& connection, const std::string& fileName ) {
-	const auto _path = std::filesystem::current_path() / "storage" / fileName;
+void ConnectionHandler::_sendFileInSync ( T& connection, const std::filesystem::path& _path ) {
+	const auto fileName = _path.filename().string();
 
 	const auto fileSize = std::filesystem::file_size(_path);
 
@@ -368,31 +1630,39 @@ void ConnectionHandler::_sendFileInSync ( T& connection, const std::string& file
 	connection.sendInternal("filename:" + clientStyleFileName);
 	connection.sendInternal("hash:" + hash);
 
-	if ( connection.receiveInternal() != "OK" ) {
-		Utils::elog("For some reason remote already has the file, this shouldn't happen");
+	// the remote may have got the file from another server meanwhile, the next sync tells
+	if ( const auto answer = connection.receiveInternal(); answer != "OK" ) {
+		Utils::elog("sendFileInSync: remote did not take " + fileName + ": " + answer);
 		connection.receiveInternal();
 		return;
 	}
 
+	if ( connection.trustedTransport() ) {
+		_sendTrusted(connection, _path, fileSize);
+		return;
+	}
+
 	std::ifstream file(_path, std::ios::binary);
 	size_t chunkSize = 2 * 1024 * 1024;
 	auto buffer = std::make_unique<char[]>(chunkSize);
 	size_t sizeRead = 0;
 	const auto freeRam = getFreeMemory() / 4;
+	TransferWindow window(_settings.transferWindow, _settings.transferWindowMax);
+	Compressor compressor;
 
 	while ( true ) {
 		file.read(buffer.get(), chunkSize);
 
 		const auto startUploadTime = std::chrono::high_resolution_clock::now();
-		connection.send(std::string(buffer.get(), file.gcount()));
+		connection.send(std::string(buffer.get(), file.gcount()), compressor);
 		const auto endUploadTime = std::chrono::high_resolution_clock::now();
 
 		std::chrono::duration<double> duration = endUploadTime - startUploadTime;
 
 		sizeRead += file.gcount();
 
-		if ( connection.receiveInternal() != "confirm" )
-			throw std::runtime_error("sendFile: client did not confirm the chunk");
+		window.sent(file.gcount());
+		window.collect(connection);
 
 		if ( sizeRead == static_cast<unsigned long long>(fileSize) )
 			break;
@@ -404,19 +1674,54 @@ void ConnectionHandler::_sendFileInSync ( T& connection, const std::string& file
 
 			buffer = std::make_unique<char[]>(chunkSize);
 		}
-		else if ( duration.count() < 0.3 && freeRam >= chunkSize * 2 ) {
-			chunkSize = static_cast<int>(chunkSize * 2);
+		else if ( duration.count() < 0.3 && freeRam >= chunkSize * 2 && chunkSize < Frame::maxChunkSize ) {
+			chunkSize = std::min<size_t>(chunkSize * 2, Frame::maxChunkSize);
 			buffer = std::make_unique<char[]>(chunkSize);
 		}
-		else if ( duration.count() < 0.6 && freeRam >= chunkSize * 2 ) {
-			chunkSize = static_cast<int>(chunkSize * 1.25);
+		else if ( duration.count() < 0.6 && freeRam >= chunkSize * 2 && chunkSize < Frame::maxChunkSize ) {
+			chunkSize = std::min<size_t>(static_cast<size_t>(chunkSize * 1.25), Frame::maxChunkSize);
 			buffer = std::make_unique<char[]>(chunkSize);
 		}
 	}
 
 	connection.sendInternal("DONE");
+	window.drain(connection);
 
-	if ( auto message = connection.receiveInternal(); message != "OK" ) { Utils::elog(connection.receiveInternal()); }
+	_confirmSentInSync(connection);
+}
+
+template < ConnType T >
+void ConnectionHandler::_confirmSentInSync ( T& connection ) {
+	if ( connection.receiveInternal() != "OK" ) {
+		Utils::elog(connection.receiveInternal());
+		return;
+	}
+
+	// the peer goes on like for a client's upload, the next file may only start after it
+	connection.receiveInternal();
+	if ( std::stoi(connection.receiveInternal()) ) {
+		connection.sendInternal("getHttpLink");
+		connection.receiveInternal();
+	}
+}
+
+template < ConnType T >
+void ConnectionHandler::_sendTrusted ( T& connection, const std::filesystem::path& _path, const uint64_t fileSize ) {
+	const int file = open(_path.c_str(), O_RDONLY);
+	if ( file < 0 )
+		throw std::runtime_error("sendTrusted: could not open " + _path.string() + ": " + strerror(errno));
+
+	try { connection.sendFileBody(file, fileSize); }
+	catch ( ... ) {
+		close(file);
+		throw;
+	}
+
+	close(file);
+
+	connection.sendInternal("DONE");
+
+	_confirmSentInSync(connection);
 }
 
 // set substraction
@@ -431,7 +1736,50 @@ std::set<std::string> operator/ ( const std::set<std::string>& set, const std::s
 	return result;
 }
 
-void ConnectionHandler::_syncAsSlave ( ConnectionServer& connection ) {
+template < ConnType T >
+void ConnectionHandler::_sendFilesInSync ( T& connection, const std::set<std::string>& hashes, const std::string& caller ) {
+	const auto paths = _storage.paths(hashes);
+	connection.sendInternal("files:" + std::to_string(paths.size()));
+
+	for ( auto counter = 0; const auto& path: paths ) {
+		Utils::log(
+			"ConnectionHandler::" + caller + ": sending file " + std::to_string(counter + 1) + "/" + std::to_string(
+				paths.size()));
+		_sendFileInSync(connection, path);
+		++counter;
+	}
+}
+
+template < ConnType T >
+void ConnectionHandler::_receiveFilesInSync ( T& connection, const std::string& caller ) {
+	const auto announced = connection.receiveInternal();
+	if ( !announced.starts_with("files:") )
+		throw std::runtime_error("Invalid message received (files):" + announced);
+
+	const auto count = std::stoull(announced.substr(strlen("files:")));
+
+	for ( size_t i = 0; i < count; ++i ) {
+		Utils::log(
+			"ConnectionHandler::" + caller + ": getting file " + std::to_string(i + 1) + "/" + std::to_string(count));
+		_handleReceiveFile(connection);
+	}
+}
+
+void ConnectionHandler::_adoptRemovals ( const std::set<std::string>& hashes, const std::string& caller ) {
+	const auto toRemove = _storage.paths(hashes);
+
+	if ( !toRemove.empty() )
+		Utils::log("ConnectionHandler::" + caller + ": removing " + std::to_string(toRemove.size()) + " files");
+
+	for ( const auto& path: toRemove ) {
+		Utils::log("ConnectionHandler: removing file " + path.filename().string());
+		_removeFile(path);
+	}
+
+	SyncMarks::adopt(_readyFiles, _markedForRemoval, hashes);
+}
+
+void ConnectionHandler::_syncAsSlave ( ConnectionServer& connection, const bool reconciled ) {
 	const std::string user = connection.receiveInternal();
 	const std::string pass = connection.receiveInternal();
 
@@ -442,22 +1790,48 @@ void ConnectionHandler::_syncAsSlave ( ConnectionServer& connection ) {
 
 	connection.sendInternal("OK");
 
+	// a master with a trusted target asks first, otherwise the removal list comes right away
+	auto request = connection.receive();
+
+	if ( request == _internal"transport:trusted" ) {
+		if ( _settings.acceptTrustedSync ) {
+			connection.sendInternal("OK");
+			connection.enableTrustedTransport();
+			Utils::log("ConnectionHandler::_syncAsSlave: file bodies travel unencrypted");
+		}
+		else
+			connection.sendInternal("trusted transport not accepted");
+
+		request = connection.receive();
+	}
+
+	if ( !request.starts_with(_data) )
+		throw std::runtime_error("Invalid message received (data):" + request);
+
+	if ( reconciled ) {
+		// ###################################### File removal
+		const auto removals = Reconciler(_markedForRemoval.list())
+			.reconcileAsSlave(connection, request.substr(strlen(_data)));
+		_adoptRemovals(removals.remoteOnly, "_syncAsSlave");
+
+		// ###################################### File exchange
+		const auto files = Reconciler(_readyFiles.list()).reconcileAsSlave(connection);
+
+		// master is first to send missing files
+		_receiveFilesInSync(connection, "_syncAsSlave");
+		_sendFilesInSync(connection, files.localOnly, "_syncAsSlave");
+
+		Utils::log("Incoming sync complete");
+		return;
+	}
+
 	// ###################################### File removal
 	{
-		const auto remoteHashes = _parseHashes<std::set<std::string>>(connection.receiveData());
-		const auto toRemove = Utils::FS::findCorrespondingFileNames(remoteHashes);
+		const auto remoteHashes = _parseHashes<std::set<std::string>>(request.substr(strlen(_data)));
 		const auto localHashes = _markedForRemoval.list();
 		connection.sendData(_generateHashesString(localHashes));
 
-		if ( !toRemove.empty() ) {
-			Utils::log("ConnectionHandler::_syncAsSlave: removing " + std::to_string(toRemove.size()) + " files");
-
-			for ( const auto& fileName: toRemove ) {
-				Utils::log("ConnectionHandler: removing file " + fileName);
-				_removeFile(std::filesystem::path("storage") / fileName);
-			}
-			_markedForRemoval.remove(remoteHashes);
-		}
+		_adoptRemovals(remoteHashes, "_syncAsSlave");
 	}
 
 	// ###################################### File exchange
@@ -472,20 +1846,20 @@ void ConnectionHandler::_syncAsSlave ( ConnectionServer& connection ) {
 	const auto toSend = localHashes / remoteHashes;
 
 	// Again, master is first to send missing files
-	for ( size_t i = 0; i < toGet.size(); i-- ) {
+	for ( size_t i = 0; i < toGet.size(); ++i ) {
 		Utils::log(
 			"ConnectionHandler::_syncAsSlave: getting file " + std::to_string(i + 1) + "/" + std::to_string(
 				toGet.size()));
 		_handleReceiveFile(connection);
 	}
 
-	const auto toSendFileNames = Utils::FS::findCorrespondingFileNames(toSend);
+	const auto toSendPaths = _storage.paths(toSend);
 
-	for ( auto counter = 0; const auto& fileName: toSendFileNames ) {
+	for ( auto counter = 0; const auto& path: toSendPaths ) {
 		Utils::log(
 			"ConnectionHandler::_syncAsSlave: sending file " + std::to_string(counter + 1) + "/" + std::to_string(
 				toSend.size()));
-		_sendFileInSync(connection, fileName);
+		_sendFileInSync(connection, path);
 		++counter;
 	}
 
@@ -494,11 +1868,13 @@ void ConnectionHandler::_syncAsSlave ( ConnectionServer& connection ) {
 
 void ConnectionHandler::_syncAsMaster ( const Settings::SyncTarget& target ) {
 	// send command type and authenticate
-	std::lock_guard lock(_syncMutex);
 	Connection connection;
 	connection.connectToServer(target.targetAddress, 6998);
 
-	connection.sendInternal("command:SYNC")
+	// older targets only know the exchange of whole hash lists
+	const bool reconciled = connection.peerReconciles();
+
+	connection.sendInternal(reconciled ? "command:RECONCILED_SYNC" : "command:SYNC")
 		.sendInternal("user:" + target.targetUser)
 		.sendInternal("pass:" + target.targetPass);
 
@@ -508,23 +1884,36 @@ void ConnectionHandler::_syncAsMaster ( const Settings::SyncTarget& target ) {
 		}
 	}
 
+	// authentication above went over the sealed channel, only file bodies skip encryption
+	if ( target.trusted ) {
+		connection.sendInternal("transport:trusted");
+
+		if ( const auto response = connection.receiveInternal(); response == "OK" )
+			connection.enableTrustedTransport();
+		else
+			Utils::log("ConnectionHandler::_syncAsMaster: \"" + target.targetName + "\" refused trusted transport: " + response);
+	}
+
+	if ( reconciled ) {
+		// ###################################### File removal
+		const auto removals = Reconciler(_markedForRemoval.list()).reconcileAsMaster(connection);
+		_adoptRemovals(removals.remoteOnly, "_syncAsMaster");
+
+		// ###################################### File exchange
+		const auto files = Reconciler(_readyFiles.list()).reconcileAsMaster(connection);
+
+		_sendFilesInSync(connection, files.localOnly, "_syncAsMaster");
+		_receiveFilesInSync(connection, "_syncAsMaster");
+		return;
+	}
+
 	// ###################################### File removal
 	{
 		const auto localHashes = _markedForRemoval.list();
 		connection.sendData(_generateHashesString(localHashes));
 
 		const auto remoteHashes = _parseHashes<std::set<std::string>>(connection.receiveData());
-		const auto toRemove = Utils::FS::findCorrespondingFileNames(remoteHashes);
-
-		if ( !toRemove.empty() ) {
-			Utils::log("ConnectionHandler::_syncAsMaster: removing " + std::to_string(toRemove.size()) + " files");
-
-			for ( const auto& fileName: toRemove ) {
-				Utils::log("ConnectionHandler: removing file " + fileName);
-				_removeFile(std::filesystem::path("storage") / fileName);
-			}
-			_markedForRemoval.remove(remoteHashes);
-		}
+		_adoptRemovals(remoteHashes, "_syncAsMaster");
 	}
 
 
@@ -537,17 +1926,17 @@ void ConnectionHandler::_syncAsMaster ( const Settings::SyncTarget& target ) {
 	const auto toGet = remoteHashes / localHashes;
 	const auto toSend = localHashes / remoteHashes;
 
-	const auto toSendFileNames = Utils::FS::findCorrespondingFileNames(toSend);
+	const auto toSendPaths = _storage.paths(toSend);
 
-	for ( auto counter = 0; const auto& fileName: toSendFileNames ) {
+	for ( auto counter = 0; const auto& path: toSendPaths ) {
 		Utils::log(
 			"ConnectionHandler::_syncAsMaster: sending file " + std::to_string(counter + 1) + "/" + std::to_string(
 				toSend.size()));
-		_sendFileInSync(connection, fileName);
+		_sendFileInSync(connection, path);
 		++counter;
 	}
 
-	for ( size_t i = 0; i < toGet.size(); i-- ) {
+	for ( size_t i = 0; i < toGet.size(); ++i ) {
 		Utils::log(
 			"ConnectionHandler::_syncAsMaster: getting file " + std::to_string(i + 1) + "/" + std::to_string(
 				toGet.size()));
@@ -556,20 +1945,56 @@ void ConnectionHandler::_syncAsMaster ( const Settings::SyncTarget& target ) {
 }
 
 
-void ConnectionHandler::_syncer () {
-	Utils::log("ConnectionHandler: syncing on");
+void ConnectionHandler::_syncer ( const std::stop_token& stop, SyncTask& task ) {
+	Utils::log("ConnectionHandler: syncing to \"" + task.target.targetName + "\" on");
+
+	const auto period = std::chrono::seconds(_settings.syncPeriod);
+	auto nextSync = std::chrono::steady_clock::now();
+
+	// every failure in a row doubles the wait, up to maxSyncBackoff or the period if that is longer
+	const auto retryIn = [&task, period] {
+		return std::min(period * ( 1u << std::min(task.failures, 16u) ), std::max(maxSyncBackoff, period));
+	};
+
+	while ( !stop.stop_requested() ) {
+		std::set<std::string> removals;
+
+		{
+			std::unique_lock lock(task.mutex);
+			task.wake.wait_until(lock, stop, nextSync, [&task] { return !task.removals.empty(); });
+			removals.swap(task.removals);
+		}
+
+		if ( stop.stop_requested() )
+			return;
 
-	while ( !_stopRequested ) {
-		for ( const auto& target: _settings.syncTargets ) {
-			try { _syncAsMaster(target); }
+		// an unreachable target gets the removals with its next successful sync
+		if ( !removals.empty() && task.failures == 0 ) {
+			try { _removeOnTarget(task.target, removals); }
 			catch ( const std::exception& e ) {
+				++task.failures;
+				nextSync = std::max(nextSync, std::chrono::steady_clock::now() + retryIn());
 				Utils::elog(
-					"Error occurred when trying sync to \"" + target.targetName + "\" on address " + target.
-					targetAddress + ": " + e.what());
+					"Error occurred when trying to remove files on \"" + task.target.targetName + "\" on address " +
+					task.target.targetAddress + ": " + e.what());
 			}
 		}
 
-		std::this_thread::sleep_for(std::chrono::seconds(_settings.syncPeriod));
+		if ( std::chrono::steady_clock::now() < nextSync )
+			continue;
+
+		try {
+			_syncAsMaster(task.target);
+			task.failures = 0;
+		}
+		catch ( const std::exception& e ) {
+			++task.failures;
+			Utils::elog(
+				"Error occurred when trying sync to \"" + task.target.targetName + "\" on address " + task.target.
+				targetAddress + ": " + e.what());
+		}
+
+		nextSync = std::chrono::steady_clock::now() + retryIn();
 	}
 }
 
@@ -611,11 +2036,49 @@ void ConnectionHandler::_removeFile ( const std::filesystem::path& path ) {
 
 	HTTPFileServer::removeSymlinkFor(path);
 	std::filesystem::remove(path);
+	_storage.remove(path);
+	_chunks.remove(path.extension().string().substr(1));
 }
 
-void ConnectionHandler::_cleanupClientThreads () {
-	while ( !_stopRequested ) {
-		std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-		std::erase_if(_clientThreads, [] ( const std::jthread& t ) { return t.joinable(); });
+void ConnectionHandler::_migrateStorage ( const std::stop_token& stop ) {
+	Utils::log("migrateStorage: moving " + std::to_string(_storage.flat().size()) + " stored files into the fan-out layout");
+
+	size_t moved = 0;
+
+	for ( const auto& from: _storage.flat() ) {
+		if ( stop.stop_requested() )
+			return;
+
+		const auto to = Utils::FS::storagePath(from.filename().string());
+		const auto hash = StorageIndex::hashOf(from);
+
+		std::error_code error;
+		std::filesystem::create_directories(to.parent_path(), error);
+		std::filesystem::create_hard_link(from, to, error);
+
+		// removed since the server started
+		if ( error ) {
+			if ( std::filesystem::exists(from) )
+				Utils::elog("migrateStorage: could not move " + from.string() + ": " + error.message());
+			continue;
+		}
+
+		if ( !_storage.relocate(from, to) ) {
+			std::filesystem::remove(to, error);
+			continue;
+		}
+
+		_chunks.relocate(hash, to);
+
+		try {
+			HTTPFileServer::removeSymlinkFor(from);
+			HTTPFileServer::createSymlinkFor(to);
+		}
+		catch ( const std::exception& e ) { Utils::elog("migrateStorage: could not relink " + from.string() + ": " + e.what()); }
+
+		std::filesystem::remove(from, error);
+		++moved;
 	}
+
+	Utils::log("migrateStorage: moved " + std::to_string(moved) + " stored files");
 }
@@ -1,14 +1,25 @@
 #pragma once
 
 
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
 #include <set>
 #include <thread>
 
+#include "ChunkStore.hpp"
 #include "ClientInfo.hpp"
 #include "ConnectionServer.hpp"
 #include "FileTracker.hpp"
+#include "IoUring.hpp"
+#include "Reactor.hpp"
 #include "Settings.hpp"
+#include "StorageIndex.hpp"
+#include "UploadSessions.hpp"
+#include "WorkerPool.hpp"
 #include "../shared/Connection.hpp"
+#include "../shared/TreeHash.hpp"
 #include "includes/toml.hpp"
 
 template < typename T >
@@ -23,35 +34,189 @@ class ConnectionHandler {
 public:
     explicit ConnectionHandler ( const Settings& settings );
 
-    void addClient ( ClientInfo client );
+    void addClient ( const ClientInfo& client );
 
-    void requestStop () { _stopRequested = true; }
+    /**
+     * @brief Stops the sync tasks, a sync that is running finishes first
+     */
+    void requestStop ();
+
+    [[nodiscard]] const StorageIndex& storage () const { return _storage; }
 
 private:
-    bool _stopRequested = false;
-    std::jthread _syncThread;
-    std::vector<std::jthread> _clientThreads;
-    std::mutex _syncMutex;
+    /**
+     * @brief Upload of one file spread over several connections, reassembled with positional writes
+     */
+    struct StripedUpload {
+        std::mutex mutex;
+        std::condition_variable progress;
+        int file = -1;
+        uint64_t size = 0;
+        // fully written ranges, offset -> length, removed once hashed
+        std::map<uint64_t, uint64_t> completed;
+        unsigned attached = 0;
+        bool failed = false;
+    };
+
+    /**
+     * @brief Sync with one target, each runs in its own thread so a slow target holds up no other
+     */
+    struct SyncTask {
+        explicit SyncTask ( const Settings::SyncTarget& target ) : target(target) {}
+
+        const Settings::SyncTarget& target;
+        std::mutex mutex;
+        std::condition_variable_any wake;
+        // removals to pass on before the next sync, guarded by mutex
+        std::set<std::string> removals;
+        // failed syncs in a row, each one doubles the wait for the next
+        unsigned failures = 0;
+        // declared last, so it is joined before the rest goes away
+        std::jthread thread;
+    };
+
+    // longest wait between syncs to an unreachable target, unless syncPeriod is longer
+    static constexpr std::chrono::seconds maxSyncBackoff{3600};
+
+    // part of a resumable upload written between two records of its committed offset
+    static constexpr uint64_t sessionCommitInterval = 64 * 1024 * 1024;
+
+    // outlives the client threads, their connections may still hold a ring
+    IoUringPool _rings;
     FileTracker _markedForRemoval;
 	FileTracker _readyFiles;
     const Settings _settings;
+    StorageIndex _storage;
+    ChunkStore _chunks;
+    UploadSessions _sessions;
+    std::mutex _stripedUploadsMutex;
+    std::map<std::string, std::shared_ptr<StripedUpload>> _stripedUploads;
+    std::jthread _migration;
+    // built once in the constructor, refer to the targets in _settings
+    std::vector<std::unique_ptr<SyncTask>> _syncTasks;
+    // declared last, so open requests finish before anything they use goes away
+    WorkerPool _workers;
+    Reactor _reactor;
 
 
-    void _serveConnection ( ClientInfo client );
+    void _serveConnection ( ConnectionServer& connection );
 
     [[nodiscard]] bool _auth ( const std::string& user, const std::string& pass ) const;
 
+    /**
+     * @param resumable the upload runs in a session, an interrupted connection leaves its part file for a resume
+     * @param treeLeaves the client sends the leaf hashes of its tree hash first, every leaf is checked as it arrives
+     */
+    template < ConnType T >
+    void _handleReceiveFile ( T& connection, bool resumable = false, bool treeLeaves = false );
+
+    /**
+     * @brief Receives the file body with splice, used once the sync peers agreed on the trusted transport
+     */
+    template < ConnType T >
+    void _receiveTrusted ( T& connection, const std::filesystem::path& _path, uint64_t fileSize,
+                           const std::string& hashFromClient );
+
+    /**
+     * @param chunks chunks of the file if the upload already knows them, otherwise it is chunked in the background
+     */
     template < ConnType T >
-    void _handleReceiveFile ( T& connection );
+    void _completeReceive ( T& connection, const std::filesystem::path& _path, const std::string& hashFromClient,
+                            const std::string& hashString, const std::vector<Chunker::Chunk>* chunks = nullptr );
+
+    /**
+     * @brief Upload hashed while it is sent, the client's hash arrives in a trailer after the data
+     *
+     * Before the data the client sends a fingerprint; only when it matches a stored file
+     * of the same name and size the full hash is asked for, to turn the duplicate away.
+     */
+    void _handleReceiveStreamed ( ConnectionServer& connection );
+
+    /**
+     * @brief Moves a finished upload into storage, copies if staging is on another filesystem
+     */
+    static void _moveIntoStorage ( const std::filesystem::path& from, const std::filesystem::path& to,
+                                   std::error_code& error );
+
+    /**
+     * @brief Upload that sends the chunk manifest first and then only the chunks no stored file contains
+     */
+    void _handleReceiveDeduplicated ( ConnectionServer& connection );
+
+    /**
+     * @brief Upload that gets the block signatures of the newest stored file with the same name
+     * and sends only what changed, the rest is copied from that file
+     */
+    void _handleReceiveDelta ( ConnectionServer& connection );
+
+    /**
+     * @brief Copies bytes between files in the kernel, shares the extents where the filesystem supports it
+     * @return false if the range could not be copied completely
+     */
+    static bool _copyRange ( int from, uint64_t fromOffset, int to, uint64_t toOffset, uint64_t length );
+
+    /**
+     * @brief Looks up a stored file that may be downloaded, answers the client with the reason if it may not
+     * @return path of the file or empty string
+     */
+    std::string _findReadyFile ( ConnectionServer& connection, const std::string& hash );
+
+    /**
+     * @param resumable the client answers with the offset its partial file ends at
+     */
+    void _handleSendFile ( ConnectionServer& connection, bool resumable = false );
+
+    void _handleReceiveStriped ( ConnectionServer& connection );
+
+    void _handleReceiveStripe ( ConnectionServer& connection );
 
-    void _handleSendFile ( ConnectionServer& connection );
+    static void _receiveRanges ( ConnectionServer& connection, StripedUpload& upload );
 
+    /**
+     * @brief Hashes the reassembled file as contiguous ranges complete
+     * @param id identifier the client sent, the file is hashed in the algorithm it was made with
+     * @return identifier of the file or empty string if the upload failed
+     */
+    static std::string _hashStriped ( StripedUpload& upload, const std::string& id );
+
+    /**
+     * @param tree tree hash on all cores instead of the sequential one
+     * @return identifier of the first `size` bytes of the file or empty string if it could not be read
+     */
+    static std::string _hashFile ( int file, uint64_t size, bool tree = false );
+
+    /**
+     * @brief Feeds the first `size` bytes of the file into `hasher`
+     * @return false if the file could not be read
+     */
+    static bool _hashRange ( TreeHash::Hasher& hasher, int file, uint64_t size );
+
+    void _handleSendStriped ( ConnectionServer& connection );
+
+    void _handleSendStripe ( ConnectionServer& connection );
+
+    void _sendRanges ( ConnectionServer& connection, const std::filesystem::path& path ) const;
+
+    /**
+     * @brief Marks the file for removal and has every sync task pass the removal on
+     */
     void _removeOnSyncedTargets ( const std::string& hash );
 
+    /**
+     * @brief Asks the target to remove the files right away, what fails here the next sync catches up on
+     * @throws std::runtime_error when the target cannot be reached or drops the connection
+     */
+    static void _removeOnTarget ( const Settings::SyncTarget& target, const std::set<std::string>& hashes );
+
     void _handleRemoveFile ( ConnectionServer& connection );
 
     void _handleListFiles ( ConnectionServer& connection ) const;
 
+    /**
+     * @brief LIST answering a ListQuery, the files go out in pages of binary records while the catalog is read
+     */
+    void _handleListFilesPaged ( ConnectionServer& connection ) const;
+
     void _handleBatchReceiveFile ( ConnectionServer& connection );
 
 	void _handleBatchSendFile ( ConnectionServer& connection );
@@ -61,11 +226,40 @@ private:
     // internal
 
     template < ConnType T >
-    static void _sendFileInSync ( T& connection, const std::string& fileName );
+    void _sendFileInSync ( T& connection, const std::filesystem::path& _path );
+
+    /**
+     * @brief Sends the file body with sendfile, used once the sync peers agreed on the trusted transport
+     */
+    template < ConnType T >
+    static void _sendTrusted ( T& connection, const std::filesystem::path& _path, uint64_t fileSize );
+
+    /**
+     * @brief Reads the peer's answer to a file sent in sync, up to where it expects the next file
+     */
+    template < ConnType T >
+    static void _confirmSentInSync ( T& connection );
+
+    /**
+     * @brief Announces how many files follow and sends them, the peer receives them with _receiveFilesInSync
+     */
+    template < ConnType T >
+    void _sendFilesInSync ( T& connection, const std::set<std::string>& hashes, const std::string& caller );
 
-    void _syncAsSlave ( ConnectionServer& connection );
+    template < ConnType T >
+    void _receiveFilesInSync ( T& connection, const std::string& caller );
+
+    /**
+     * @brief Removes the files the peer marked for removal and takes over its marks, see SyncMarks::adopt
+     */
+    void _adoptRemovals ( const std::set<std::string>& hashes, const std::string& caller );
+
+    /**
+     * @param reconciled the master reconciles the hash sets with a Reconciler instead of sending them whole
+     */
+    void _syncAsSlave ( ConnectionServer& connection, bool reconciled = false );
     void _syncAsMaster ( const Settings::SyncTarget& target );
-    void _syncer ();
+    void _syncer ( const std::stop_token& stop, SyncTask& task );
 
     template < SetOrVectorOfString T >
     static T _parseHashes ( const std::string& hashesString );
@@ -73,6 +267,13 @@ private:
     template < SetOrVectorOfString T >
     static std::string _generateHashesString ( const T& hashes );
 
-    static void _removeFile ( const std::filesystem::path& path );
-    void _cleanupClientThreads ();
+    void _removeFile ( const std::filesystem::path& path );
+
+    /**
+     * @brief Moves the stored files of a flat storage directory into the fan-out layout while the server runs
+     *
+     * Each file is hard linked to its new path before the index points there and the old name goes,
+     * so downloads find it throughout.
+     */
+    void _migrateStorage ( const std::stop_token& stop );
 };
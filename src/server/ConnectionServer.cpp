@@ -1,17 +1,18 @@
 #include "ConnectionServer.hpp"
 
+#include <algorithm>
 #include <cstring>
 #include <memory>
 #include <stdexcept>
-#include <thread>
 #include <unistd.h>
+#include <poll.h>
 #include <utility>
 #include <sys/socket.h>
 
 ConnectionServer::ConnectionServer ( ClientInfo clientInfo ) : ConnectionServer(std::move(clientInfo), 4 * 1024 * 1024) {}
 
 ConnectionServer::ConnectionServer ( ClientInfo clientInfo, const unsigned long bufferSize )
-	: _buffer(std::make_unique<char[]>(bufferSize)), _clientInfo(std::move(clientInfo)), _bufferSize(bufferSize) {}
+	: _receiveBuffer(bufferSize), _clientInfo(std::move(clientInfo)) {}
 
 ConnectionServer::~ConnectionServer () {
 	_active = false;
@@ -28,70 +29,88 @@ void ConnectionServer::init () {
 		throw std::runtime_error("setsockopt failed");
 	}
 
-	initEncryption();
-
-	_active = true;
-}
-
-void ConnectionServer::initEncryption () {
 	std::cout << "initializing encryption with client " << _clientInfo.getSocket() << std::endl;
 	if ( sodium_init() < 0 )
 		throw std::runtime_error("Could not initialize sodium");
 
-	if ( crypto_box_keypair(_keyPair.publicKey, _keyPair.secretKey) < 0 )
+	if ( crypto_kx_keypair(_keyPair.publicKey, _keyPair.secretKey) < 0 )
 		throw std::runtime_error("Could not generate keypair");
 
-	auto pk_hex = std::make_unique<char[]>(crypto_box_PUBLICKEYBYTES * 2 + 1);
+	auto pk_hex = std::make_unique<char[]>(crypto_kx_PUBLICKEYBYTES * 2 + 1);
 
-	sodium_bin2hex(pk_hex.get(), crypto_box_PUBLICKEYBYTES * 2 + 1, _keyPair.publicKey, crypto_box_PUBLICKEYBYTES);
+	sodium_bin2hex(pk_hex.get(), crypto_kx_PUBLICKEYBYTES * 2 + 1, _keyPair.publicKey, crypto_kx_PUBLICKEYBYTES);
 
 	std::cout << "public key: " << pk_hex.get() << std::endl;
 
-	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	send(_internal"publicKey:" + std::string(pk_hex.get(), crypto_kx_PUBLICKEYBYTES * 2));
 
-	send(_internal"publicKey:" + std::string(pk_hex.get(), crypto_box_PUBLICKEYBYTES * 2));
+	_active = true;
+}
 
-	receive();
+void ConnectionServer::completeHandshake () {
+	const auto message = receiveView();
 
-	if ( !_message.contains(_internal"publicKey:") )
+	if ( !message.starts_with(_internal"publicKey:") )
 		throw std::runtime_error("Could not receive pubKey");
 
-	auto pubKey_hex = _message.substr(strlen(_internal"publicKey:"));
+	const auto pubKey_hex = message.substr(strlen(_internal"publicKey:"));
 
-	if ( sodium_hex2bin(_remotePublicKey, crypto_box_PUBLICKEYBYTES, pubKey_hex.c_str(), pubKey_hex.size(), nullptr,
+	if ( sodium_hex2bin(_remotePublicKey, crypto_kx_PUBLICKEYBYTES, pubKey_hex.data(), pubKey_hex.size(), nullptr,
 	                    nullptr, nullptr) < 0 ) { throw std::runtime_error("Could not decode public key"); }
 
 	//std::cout << "pubKey: " << _remotePublicKey << std::endl;
 
-	for ( auto& string: _messagesBuffer )
-		secretOpen(string);
+	// one symmetric session per direction, the client's stream header arrives with its next frame
+	unsigned char sendKey[crypto_kx_SESSIONKEYBYTES];
+
+	if ( crypto_kx_server_session_keys(_receiveKey, sendKey, _keyPair.publicKey, _keyPair.secretKey,
+	                                   _remotePublicKey) != 0 )
+		throw std::runtime_error("Invalid public key received from client");
+
+	unsigned char streamHeader[crypto_secretstream_xchacha20poly1305_HEADERBYTES];
+
+	crypto_secretstream_xchacha20poly1305_init_push(&_sendStream, streamHeader, sendKey);
+	sodium_memzero(sendKey, sizeof sendKey);
+
+	Frame::Header header{Frame::Type::StreamHeader, Frame::Flags::none, sizeof streamHeader};
+
+	if ( !Frame::send(_clientInfo.getSocket(), header, reinterpret_cast<char*>(streamHeader)) )
+		throw std::runtime_error("Could not send stream header to client");
 
 	_encrypted = true;
 }
 
-void ConnectionServer::clearBuffer () const { memset(_buffer.get(), '\0', _bufferSize); }
+void ConnectionServer::openReceiveStream ( const Frame::Header& header ) {
+	if ( !_encrypted || _receiveStreamOpen || header.length != crypto_secretstream_xchacha20poly1305_HEADERBYTES )
+		throw std::runtime_error("unexpected stream header received");
 
-std::string ConnectionServer::receive () {
+	fill(crypto_secretstream_xchacha20poly1305_HEADERBYTES);
+	const auto streamHeader = reinterpret_cast<unsigned char*>(_receiveBuffer.readable().data());
 
-	_message.clear();
+	if ( crypto_secretstream_xchacha20poly1305_init_pull(&_receiveStream, streamHeader, _receiveKey) != 0 )
+		throw std::runtime_error("invalid stream header received");
 
-	if ( _moreInBuffer ) {
-		_message = _messagesBuffer[0];
-		_messagesBuffer.erase(_messagesBuffer.begin());
-		if ( _messagesBuffer.empty() )
-			_moreInBuffer = false;
-		return _message;
-	}
+	_receiveBuffer.consume(crypto_secretstream_xchacha20poly1305_HEADERBYTES);
+
+	sodium_memzero(_receiveKey, sizeof _receiveKey);
+	_receiveStreamOpen = true;
+}
+
+void ConnectionServer::fill ( const size_t length ) {
+	_receiveBuffer.reserve(length);
 
-	while ( !_message.ends_with(_end) ) {
-		//std::cout << "RECEIVE BUFFER BEFORE CLEAR|  " << _clientInfo.getSocket() << ": " << _buffer << std::endl;
-		clearBuffer();
+	while ( _receiveBuffer.readable().size() < length ) {
+		const auto space = _receiveBuffer.writable();
 
 		// receive message with timeout
-		_sizeOfPreviousMessage = recv(_clientInfo.getSocket(), _buffer.get(), _bufferSize, 0);
+		const auto result = _ring
+			                    ? static_cast<ssize_t>(_ring->receive(space.data(), space.size()))
+			                    : recv(_clientInfo.getSocket(), space.data(), space.size(), 0);
 
+		if ( result < 0 ) {
+			if ( errno == EINTR )
+				continue;
 
-		if ( _sizeOfPreviousMessage < 0 ) {
 			if ( errno != EAGAIN && errno != EWOULDBLOCK )
 				throw std::runtime_error("client disconnected or could not receive message");
 
@@ -99,128 +118,317 @@ std::string ConnectionServer::receive () {
 				throw std::runtime_error("timeout");
 		}
 
-		if ( _sizeOfPreviousMessage == 0 ) {
+		if ( result == 0 ) {
 			throw std::runtime_error("client disconnected");
 		}
 
-		_message += std::string(_buffer.get(), _sizeOfPreviousMessage);
-
-		//std::cout << "RECEIVE |  " << _clientInfo.getSocket() << (_clientInfo.name.empty() ? "" : "/" + _clientInfo.name ) << ": " << _message << std::endl;
+		_receiveBuffer.commit(result);
 	}
+}
 
-	//std::cout << "RECEIVE |  " << _clientInfo.getSocket() << ": " << _message << std::endl;
+std::string ConnectionServer::receive () { return std::string(receiveView()); }
 
-	// cut off the _end
+std::string_view ConnectionServer::receiveView () {
+	unsigned char headerBytes[Frame::headerSize];
+	Frame::Header header;
 
-	std::vector<std::string> messages;
-	std::string tmpMessage;
-	size_t pos = 0;
-	bool first = true;
+	while ( true ) {
+		fill(Frame::headerSize);
+		std::memcpy(headerBytes, _receiveBuffer.readable().data(), Frame::headerSize);
+		_receiveBuffer.consume(Frame::headerSize);
 
-	while ( ( pos = _message.find(_end) ) != std::string::npos ) {
-		if ( first ) {
-			tmpMessage = _message.substr(0, pos);
-			first = false;
-		}
-		else
-			messages.push_back(_message.substr(0, pos));
-		_message.erase(0, pos + strlen(_end));
+		header = Frame::decodeHeader(headerBytes);
+
+		if ( header.type == Frame::Type::Body )
+			throw std::runtime_error("unexpected file body");
+
+		if ( header.type != Frame::Type::StreamHeader )
+			break;
+
+		openReceiveStream(header);
 	}
 
-	_message = tmpMessage;
-	_messagesBuffer = messages;
+	if ( !_receiveStreamOpen && header.length > Frame::maxHandshakePayloadSize )
+		throw std::runtime_error("handshake message too large");
 
-	if ( _encrypted ) {
-		secretOpen(_message);
-		for ( auto& messageEnc: _messagesBuffer )
-			secretOpen(messageEnc);
+	// older clients do not advertise raw ciphertext and keep getting hex
+	if ( !_receiveStreamOpen ) {
+		_rawTransport = header.flags & Frame::Flags::rawCiphertext;
+		_compression = Compressor::available && header.flags & Frame::Flags::compressed;
 	}
 
-	if ( _messagesBuffer.empty() )
-		_moreInBuffer = false;
-	else
-		_moreInBuffer = true;
+	if ( _receiveStreamOpen != static_cast<bool>(header.flags & Frame::Flags::encrypted) )
+		throw std::runtime_error("unexpected encryption state of received message");
+
+	fill(header.length);
+
+	// the bytes stay in place until the next receive, so the view outlives the consume
+	const auto payload = _receiveBuffer.readable().first(header.length);
+	_receiveBuffer.consume(header.length);
 
-	//std::cout << "RECEIVE2 |  " << _clientInfo.getSocket() << ": " << _message << std::endl;
+	//std::cout << "RECEIVE |  " << _clientInfo.getSocket() << ": " << std::string_view(payload.data(), payload.size()) << std::endl;
 
-	return _message;
+	if ( !_receiveStreamOpen )
+		return {payload.data(), payload.size()};
+
+	const auto message = secretOpen(payload, headerBytes, header.flags & Frame::Flags::rawCiphertext);
+
+	if ( header.flags & Frame::Flags::compressed )
+		return _decompressor.decompress(message);
+
+	return message;
 }
 
 std::string ConnectionServer::receiveInternal () {
-	const auto message = receive();
+	const auto message = receiveView();
 
 	if ( !message.contains(_internal) )
-		throw std::runtime_error("Invalid message received (internal): " + message);
+		throw std::runtime_error("Invalid message received (internal): " + std::string(message));
 
-	return message.substr(strlen(_internal));
+	return std::string(message.substr(strlen(_internal)));
 }
 
 std::string ConnectionServer::receiveData () {
-	const auto message = receive();
+	const auto message = receiveView();
 
 	if ( !message.contains(_data) )
-		throw std::runtime_error("Invalid message received (data):" + message);
+		throw std::runtime_error("Invalid message received (data):" + std::string(message));
 
-	return message.substr(strlen(_data));
+	return std::string(message.substr(strlen(_data)));
 }
 
 void ConnectionServer::resizeBuffer ( const unsigned long newSize )  {
-	_buffer = std::make_unique<char[]>(newSize);
-	_bufferSize = newSize;
+	_receiveBuffer.resize(std::max(newSize, static_cast<unsigned long>(_receiveBuffer.readable().size())));
+}
+
+bool ConnectionServer::hasPending () {
+	if ( !_receiveBuffer.readable().empty() )
+		return true;
+
+	pollfd descriptor { _clientInfo.getSocket(), POLLIN, 0 };
+	return poll(&descriptor, 1, 0) > 0;
+}
+
+bool ConnectionServer::receiveAvailable () {
+	while ( true ) {
+		const auto space = _receiveBuffer.writable();
+
+		if ( space.empty() )
+			throw std::runtime_error("request does not fit into the receive buffer");
+
+		const auto result = recv(_clientInfo.getSocket(), space.data(), space.size(), MSG_DONTWAIT);
+
+		if ( result == 0 )
+			return false;
+
+		if ( result < 0 ) {
+			if ( errno == EINTR )
+				continue;
+
+			if ( errno == EAGAIN || errno == EWOULDBLOCK )
+				return true;
+
+			throw std::runtime_error("client disconnected or could not receive message");
+		}
+
+		_receiveBuffer.commit(result);
+	}
+}
+
+bool ConnectionServer::messageBuffered () {
+	auto bytes = _receiveBuffer.readable();
+
+	// stream headers are handled inside receive, the message is the frame after them
+	while ( bytes.size() >= Frame::headerSize ) {
+		const auto header = Frame::decodeHeader(reinterpret_cast<const unsigned char*>(bytes.data()));
+
+		if ( bytes.size() - Frame::headerSize < header.length )
+			return false;
+
+		if ( header.type != Frame::Type::StreamHeader )
+			return true;
+
+		bytes = bytes.subspan(Frame::headerSize + header.length);
+	}
+
+	return false;
+}
+
+void ConnectionServer::enableTrustedTransport () { _trustedTransport = true; }
+
+bool ConnectionServer::trustedTransport () const { return _trustedTransport; }
+
+void ConnectionServer::sendFileBody ( const int file, const uint64_t size ) {
+	if ( !_trustedTransport )
+		throw std::runtime_error("file bodies are only sent over a trusted transport");
+
+	if ( !Frame::sendFile(_clientInfo.getSocket(), file, 0, size) )
+		throw std::runtime_error("Could not send file to client: " + std::string(strerror(errno)));
+}
+
+void ConnectionServer::receiveFileBody ( const int file, const uint64_t size ) {
+	if ( !_trustedTransport )
+		throw std::runtime_error("file bodies are only accepted over a trusted transport");
+
+	uint64_t received = 0;
+
+	while ( received < size ) {
+		fill(Frame::headerSize);
+		const auto header = Frame::decodeHeader(reinterpret_cast<const unsigned char*>(_receiveBuffer.readable().data()));
+
+		if ( header.type != Frame::Type::Body || header.length > size - received )
+			throw std::runtime_error("expected a file body of " + std::to_string(size - received) + " bytes");
+
+		_receiveBuffer.consume(Frame::headerSize);
+
+		// part of the body may already sit in the buffer from an earlier recv
+		const auto buffered = std::min<uint64_t>(_receiveBuffer.readable().size(), header.length);
+		const auto bytes = _receiveBuffer.readable().first(buffered);
+
+		for ( size_t written = 0; written < buffered; ) {
+			const auto result = pwrite(file, bytes.data() + written, buffered - written, static_cast<off_t>(received + written));
+			if ( result < 0 && errno != EINTR )
+				throw std::runtime_error("Could not write file body: " + std::string(strerror(errno)));
+			if ( result > 0 )
+				written += result;
+		}
+
+		_receiveBuffer.consume(buffered);
+
+		if ( !Frame::spliceToFile(_clientInfo.getSocket(), file, received + buffered, header.length - buffered) )
+			throw std::runtime_error("Could not receive file body from client: " + std::string(strerror(errno)));
+
+		received += header.length;
+	}
+}
+
+IoUringTransfer* ConnectionServer::attachRing ( IoUringPool& pool, const std::filesystem::path& path, const int flags ) {
+	_ring = pool.lease(_clientInfo.getSocket(), path, flags);
+
+	return _ring.get();
+}
+
+void ConnectionServer::detachRing () {
+	if ( const auto ring = std::move(_ring) )
+		ring->flush();
 }
 
 bool ConnectionServer::isActive () const { return _active; }
 
-void ConnectionServer::send ( const std::string& message ) const {
-	auto messageToSend = message;
+void ConnectionServer::interrupt () { shutdown(_clientInfo.getSocket(), SHUT_RDWR); }
+
+void ConnectionServer::send ( const std::string& message ) { sendMessage(message, Frame::Flags::none); }
+
+void ConnectionServer::send ( const std::string& message, Compressor& compressor ) {
+	if ( !_compression ) {
+		send(message);
+		return;
+	}
+
+	if ( const auto compressed = compressor.compress(message) )
+		sendMessage(std::string(*compressed), Frame::Flags::compressed);
+	else
+		send(message);
+}
+
+void ConnectionServer::sendMessage ( std::string messageToSend, const std::uint16_t flags ) {
+	Frame::Header header;
+	header.flags = flags;
 
 	//std::cout << "SEND1 |  " << _clientInfo.getSocket() << (_clientInfo.name.empty() ? "" : "/" + _clientInfo.name ) << ": " << messageToSend << std::endl;
 
-	if ( _encrypted ) { secretSeal(messageToSend); }
-	messageToSend += _end;
+	if ( _encrypted ) {
+		header.flags |= Frame::Flags::encrypted;
+		header.length = messageToSend.size() + crypto_secretstream_xchacha20poly1305_ABYTES;
+
+		if ( _rawTransport )
+			header.flags |= Frame::Flags::rawCiphertext;
+		else
+			header.length *= 2;
+
+		unsigned char headerBytes[Frame::headerSize];
+		Frame::encodeHeader(header, headerBytes);
+
+		secretSeal(messageToSend, headerBytes);
+	}
+	else {
+		header.flags |= Frame::Flags::rawCiphertext | Frame::Flags::resumable | Frame::Flags::pagedList |
+		                Frame::Flags::reconciles;
+		if constexpr ( Compressor::available )
+			header.flags |= Frame::Flags::compressed;
+	}
+	header.length = messageToSend.size();
 
-	//std::cout << "SEND2 |  " << _clientInfo.getSocket() << (_clientInfo.name.empty() ? "" : "/" + _clientInfo.name ) << ": " << messageToSend << std::endl;
 	if ( !_active )
 		return;
-	try {
-		if ( ::send(_clientInfo.getSocket(), messageToSend.data(), messageToSend.length(), 0) < 0 ) {
-			throw std::runtime_error("Could not send message to client");
-		}
+
+	if ( _ring ) {
+		unsigned char headerBytes[Frame::headerSize];
+		Frame::encodeHeader(header, headerBytes);
+		_ring->send(headerBytes, Frame::headerSize, messageToSend.data(), messageToSend.size());
+		return;
 	}
-	catch ( std::exception& ) { throw std::runtime_error("Could not send message to client"); }
+
+	if ( !Frame::send(_clientInfo.getSocket(), header, messageToSend.data()) )
+		throw std::runtime_error("Could not send message to client");
 }
 
-void ConnectionServer::sendData ( const std::string& message ) const { send(_data + message); }
+void ConnectionServer::sendData ( const std::string& message ) { send(_data + message); }
 
-void ConnectionServer::sendInternal ( const std::string& message ) const { send(_internal + message); }
+void ConnectionServer::sendInternal ( const std::string& message ) { send(_internal + message); }
 
-void ConnectionServer::secretSeal ( std::string& message ) const {
-	const auto cypherText = std::make_unique<unsigned char[]>(crypto_box_SEALBYTES + message.size());
+void ConnectionServer::secretSeal ( std::string& message, const unsigned char* frameHeader ) {
+	const auto cypherTextSize = message.size() + crypto_secretstream_xchacha20poly1305_ABYTES;
+	const auto cypherText = std::make_unique_for_overwrite<unsigned char[]>(cypherTextSize);
 
-	if ( crypto_box_seal(cypherText.get(), reinterpret_cast<const unsigned char*>(message.data()), message.size(),
-	                     _remotePublicKey) < 0 )
+	if ( crypto_secretstream_xchacha20poly1305_push(&_sendStream, cypherText.get(), nullptr,
+	                                                reinterpret_cast<const unsigned char*>(message.data()), message.size(),
+	                                                frameHeader, Frame::headerSize,
+	                                                crypto_secretstream_xchacha20poly1305_TAG_MESSAGE) < 0 )
 		throw std::runtime_error("Could not encrypt message");
 
-	const auto messageHex = std::make_unique<unsigned char[]>(( crypto_box_SEALBYTES + message.size() ) * 2 + 1);
+	if ( _rawTransport ) {
+		message.assign(reinterpret_cast<char*>(cypherText.get()), cypherTextSize);
+		return;
+	}
+
+	const auto messageHex = std::make_unique_for_overwrite<char[]>(cypherTextSize * 2 + 1);
 
-	sodium_bin2hex(reinterpret_cast<char*>(messageHex.get()), ( crypto_box_SEALBYTES + message.size() ) * 2 + 1,
-	               cypherText.get(), crypto_box_SEALBYTES + message.size());
+	sodium_bin2hex(messageHex.get(), cypherTextSize * 2 + 1, cypherText.get(), cypherTextSize);
 
-	message = std::string(reinterpret_cast<char*>(messageHex.get()), ( crypto_box_SEALBYTES + message.size() ) * 2);
+	message = std::string(messageHex.get(), cypherTextSize * 2);
 }
 
-void ConnectionServer::secretOpen ( std::string& message ) const {
-	const auto cypherTextBin = std::make_unique<unsigned char[]>(message.size() / 2);
+std::string_view ConnectionServer::secretOpen ( const std::span<char> payload, const unsigned char* frameHeader, const bool raw ) {
+	auto cypherText = reinterpret_cast<unsigned char*>(payload.data());
+	size_t cypherTextSize = payload.size();
+
+	if ( !raw ) {
+		if ( cypherTextSize % 2 != 0 )
+			throw std::runtime_error("Invalid message to decrypt");
+
+		// decoding in place is fine, every byte is written behind the two characters it is read from
+		if ( sodium_hex2bin(cypherText, cypherTextSize / 2, payload.data(), cypherTextSize,
+		                    nullptr, nullptr, nullptr) < 0 )
+			throw std::runtime_error("Could not decode message");
 
-	if ( sodium_hex2bin(cypherTextBin.get(), message.size() / 2, reinterpret_cast<const char*>(message.data()),
-	                    message.size(), nullptr, nullptr, nullptr) < 0 )
-		throw std::runtime_error("Could not decode message");
+		cypherTextSize /= 2;
+	}
+
+	if ( cypherTextSize < crypto_secretstream_xchacha20poly1305_ABYTES )
+		throw std::runtime_error("Invalid message to decrypt");
 
-	const auto decrypted = std::make_unique<unsigned char[]>(message.size() / 2 - crypto_box_SEALBYTES);
+	const auto decryptedSize = cypherTextSize - crypto_secretstream_xchacha20poly1305_ABYTES;
+	unsigned char tag;
 
-	if ( crypto_box_seal_open(decrypted.get(), cypherTextBin.get(), message.size() / 2, _keyPair.publicKey,
-	                          _keyPair.secretKey) < 0 )
+	// the plaintext is written over its own ciphertext, which starts right after the encrypted tag byte
+	if ( crypto_secretstream_xchacha20poly1305_pull(&_receiveStream, cypherText + 1, nullptr, &tag,
+	                                                cypherText, cypherTextSize,
+	                                                frameHeader, Frame::headerSize) < 0 )
 		throw std::runtime_error("Could not decrypt message");
 
-	message = std::string(reinterpret_cast<char*>(decrypted.get()), message.size() / 2 - crypto_box_SEALBYTES);
+	if ( tag != crypto_secretstream_xchacha20poly1305_TAG_MESSAGE )
+		throw std::runtime_error("Unexpected tag on received message");
+
+	return {payload.data() + 1, decryptedSize};
 }
@@ -2,12 +2,16 @@
 
 #include <iostream>
 #include <memory>
+#include <span>
+#include <string_view>
 #include <sodium.h>
 
 #include "ClientInfo.hpp"
+#include "IoUring.hpp"
+#include "../shared/Compressor.hpp"
+#include "../shared/Frame.hpp"
+#include "../shared/ReceiveBuffer.hpp"
 
-
-#define _end "::--///--$$$"
 #define _internal "INTERNAL::"
 #define _data "DATA::"
 
@@ -23,51 +27,132 @@ public:
 
 	~ConnectionServer ();
 
+	/**
+	 * @brief Starts the key exchange by sending the server's public key
+	 */
 	void init ();
 
-	void send ( const std::string& message ) const;
+	/**
+	 * @brief Finishes the key exchange once the client's public key arrived
+	 */
+	void completeHandshake ();
+
+	void send ( const std::string& message );
+
+	/**
+	 * @brief Sends a file chunk, compressed when the client supports it and `compressor` finds it worthwhile
+	 */
+	void send ( const std::string& message, Compressor& compressor );
 
-	void sendInternal ( const std::string& message ) const;
+	void sendInternal ( const std::string& message );
 
-	void sendData ( const std::string& message ) const;
+	void sendData ( const std::string& message );
 
 	std::string receive ();
 
+	/**
+	 * @brief Receives without copying, the view stays valid until the next receive or resizeBuffer
+	 */
+	std::string_view receiveView ();
+
 	std::string receiveInternal ();
 
 	std::string receiveData ();
 
+	/**
+	 * @brief Checks without blocking whether part of a frame was already received
+	 */
+	bool hasPending ();
+
+	/**
+	 * @brief Buffers whatever the socket has to offer without blocking
+	 * @return false if the client disconnected
+	 */
+	bool receiveAvailable ();
+
+	/**
+	 * @brief Checks whether a whole message is buffered, so the next receive does not block
+	 */
+	[[nodiscard]] bool messageBuffered ();
+
 	void resizeBuffer ( unsigned long newSize );
 
+	/**
+	 * @brief Lets file bodies travel unencrypted, messages stay sealed; only after both sides agreed on it
+	 */
+	void enableTrustedTransport ();
+
+	[[nodiscard]] bool trustedTransport () const;
+
+	/**
+	 * @brief Sends the file contents as body frames with sendfile
+	 */
+	void sendFileBody ( int file, uint64_t size );
+
+	/**
+	 * @brief Receives body frames straight into the file with splice
+	 */
+	void receiveFileBody ( int file, uint64_t size );
+
+	/**
+	 * @brief Moves socket and file I/O of the current transfer onto a ring leased from `pool`
+	 * @return the transfer, nullptr if no ring is free and the blocking calls stay in use
+	 */
+	IoUringTransfer* attachRing ( IoUringPool& pool, const std::filesystem::path& path, int flags );
+
+	/**
+	 * @brief Waits for the queued file operations and hands the ring back
+	 * @throws std::runtime_error if one of them failed, the ring is handed back regardless
+	 */
+	void detachRing ();
+
 	[[nodiscard]] bool isActive () const;
 
+	/**
+	 * @brief Shuts the socket down from another thread, a receive blocked on it fails
+	 */
+	void interrupt ();
+
 private:
 	struct KeyPair {
-		unsigned char publicKey[crypto_box_PUBLICKEYBYTES];
-		unsigned char secretKey[crypto_box_SECRETKEYBYTES];
+		unsigned char publicKey[crypto_kx_PUBLICKEYBYTES];
+		unsigned char secretKey[crypto_kx_SECRETKEYBYTES];
 	};
 
-	std::unique_ptr<char[]> _buffer;
+	ReceiveBuffer _receiveBuffer;
 	KeyPair _keyPair;
 	ClientInfo _clientInfo;
-	std::vector<std::string> _messagesBuffer;
-
 
-	long int _sizeOfPreviousMessage = 0;
-	unsigned long _bufferSize = 4*1024*1024;
-	std::string _message;
-
-	unsigned char _remotePublicKey[crypto_box_PUBLICKEYBYTES];
+	unsigned char _remotePublicKey[crypto_kx_PUBLICKEYBYTES];
+	// kept only until the client's stream header arrives
+	unsigned char _receiveKey[crypto_kx_SESSIONKEYBYTES];
+	crypto_secretstream_xchacha20poly1305_state _sendStream;
+	crypto_secretstream_xchacha20poly1305_state _receiveStream;
 	bool _active = true;
 	bool _encrypted = false;
-	bool _moreInBuffer = false;
-
-	void initEncryption ();
-
-	void clearBuffer () const;
-
-	void secretOpen ( std::string& message ) const;
-
-	void secretSeal ( std::string& message ) const;
+	bool _receiveStreamOpen = false;
+	// negotiated during the handshake, both sides have to advertise it
+	bool _rawTransport = false;
+	bool _compression = false;
+	bool _trustedTransport = false;
+	Decompressor _decompressor;
+	std::unique_ptr<IoUringTransfer> _ring;
+
+	/**
+	 * @brief Receives until at least `length` unconsumed bytes are buffered
+	 */
+	void fill ( size_t length );
+
+	void sendMessage ( std::string message, std::uint16_t flags );
+
+	void openReceiveStream ( const Frame::Header& header );
+
+	/**
+	 * @brief Decrypts the payload in place
+	 * @return view of the plaintext inside `payload`
+	 */
+	std::string_view secretOpen ( std::span<char> payload, const unsigned char* frameHeader, bool raw );
+
+	void secretSeal ( std::string& message, const unsigned char* frameHeader );
 
 };
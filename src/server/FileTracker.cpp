@@ -1,176 +1,318 @@
 #include "FileTracker.hpp"
 
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
 #include <iostream>
+#include <sodium.h>
+#include <unistd.h>
 
 #include "utils.hpp"
 
-FileTracker::FileTracker ( const std::filesystem::path& path )
-	: filePath(path) {
-	std::ofstream out(path, std::ios_base::app); // touch the file
+namespace {
 
-	try { root = toml::parse_file(path.string()); }
-	catch ( const toml::parse_error& err ) {
-		Utils::elog(
-			"Error parsing file '" + *err.source().path + "':\n" + std::string(err.description()) + "\n (" + err.
-			source().begin + ")\n");
-		throw std::runtime_error("Could not load array from " + path.string());
+	// record: operation, hash length (2 bytes, little endian), hash, checksum of everything before it
+	constexpr std::size_t headerSize = 3;
+	constexpr std::size_t checksumSize = 4;
+
+	void checksum ( const unsigned char* data, const std::size_t size, unsigned char* out ) {
+		unsigned char hash[crypto_generichash_BYTES];
+		crypto_generichash(hash, sizeof hash, data, size, nullptr, 0);
+		std::memcpy(out, hash, checksumSize);
 	}
 
-	if ( !out ) { throw std::runtime_error("FileTracker::add: Cannot open file for writing"); }
+	void writeAll ( const int file, const char* data, std::size_t size, const std::filesystem::path& path ) {
+		while ( size > 0 ) {
+			const auto written = ::write(file, data, size);
+			if ( written < 0 && errno == EINTR )
+				continue;
+			if ( written < 0 )
+				throw std::runtime_error("FileTracker: could not write " + path.string() + ": " + strerror(errno));
+			data += written;
+			size -= written;
+		}
+	}
 
-	out.close();
+	void syncFile ( const std::filesystem::path& path ) {
+		const int file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if ( file < 0 || fsync(file) != 0 ) {
+			if ( file >= 0 )
+				close(file);
+			throw std::runtime_error("FileTracker: could not sync " + path.string() + ": " + strerror(errno));
+		}
+		close(file);
+	}
+
+}
+
+FileTracker::FileTracker ( const std::filesystem::path& path )
+	: filePath(path), logPath(std::filesystem::path(path).replace_extension(".log")) {
+	_loadSnapshot();
+	_replay();
+
+	// read back by the compaction
+	log = open(logPath.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if ( log < 0 )
+		throw std::runtime_error("FileTracker: Cannot open " + logPath.string() + " for writing");
+
+	maintainer = std::jthread([this] ( const std::stop_token& stop ) { _maintain(stop); });
+}
+
+FileTracker::~FileTracker () {
+	maintainer.request_stop();
+	if ( maintainer.joinable() )
+		maintainer.join();
+
+	fdatasync(log);
+	close(log);
 }
 
 void FileTracker::add ( const std::set<std::string>& additions ) {
-	toml::array* arr = nullptr;
+	for ( const auto& addition: additions )
+		_insert(addition, true);
+}
 
-	// Check if the key "my_strings" exists and is an array
-	if ( const auto val = root["array"]; val ) {
-		if ( const auto existing_arr = val.as_array() ) {
-			arr = existing_arr;
-		}
-		else throw std::runtime_error("FileTracker::add: \"array\" exists but is not an array");
-	}
-	else {
-		// Create the array in root table
-		root.insert("array", toml::array{});
-		arr = root["array"].as_array();
-	}
+void FileTracker::add ( const std::string& addition ) { _insert(addition, true); }
+
+void FileTracker::remove ( const std::set<std::string>& toRemove ) {
+	for ( const auto& hash: toRemove )
+		_erase(hash, true);
+}
 
-	if ( !arr )
-		throw std::runtime_error("FileTracker::add: Failed to get or create the array");
+void FileTracker::remove ( const std::string& toRemove ) { _erase(toRemove, true); }
 
+bool FileTracker::contains ( const std::string_view hash ) const {
+	const auto& shard = _shardOf(hash);
+	std::lock_guard lock(shard.mutex);
+	return shard.hashes.contains(hash);
+}
 
-	std::set<std::string> toAdd = additions;
+std::set<std::string> FileTracker::list () const {
+	std::set<std::string> hashes;
 
-	for ( const auto& item: *arr ) {
-		if ( const auto hash = item.as_string() ) {
-			if ( toAdd.contains(hash->get()) )
-				toAdd.erase(hash->get());
-		}
+	for ( const auto& shard: shards ) {
+		std::lock_guard lock(shard.mutex);
+		hashes.insert(shard.hashes.begin(), shard.hashes.end());
 	}
 
-	for ( const auto& addition: toAdd )
-		arr->push_back(addition);
+	return hashes;
+}
 
-	// Serialize and save back
-	std::ofstream out(filePath, std::ios::trunc);
-	if ( !out ) { throw std::runtime_error("FileTracker::add: Cannot open file for writing"); }
-	out << root;
+FileTracker::Shard& FileTracker::_shardOf ( const std::string_view hash ) { return shards[Hash{}(hash) % shardCount]; }
 
-	out.close();
+const FileTracker::Shard& FileTracker::_shardOf ( const std::string_view hash ) const {
+	return shards[Hash{}(hash) % shardCount];
 }
 
-void FileTracker::add ( const std::string& addition ) {
-	toml::array* arr = nullptr;
+std::vector<std::unique_lock<std::mutex>> FileTracker::_lockAll () const {
+	std::vector<std::unique_lock<std::mutex>> locks;
+	locks.reserve(shardCount);
 
-	// Check if the key "my_strings" exists and is an array
-	if ( const auto val = root["array"]; val ) {
-		if ( const auto existing_arr = val.as_array() ) {
-			arr = existing_arr;
-		}
-		else throw std::runtime_error("FileTracker::add: \"array\" exists but is not an array");
-	}
-	else {
-		// Create the array in root table
-		root.insert("array", toml::array{});
-		arr = root["array"].as_array();
+	// always in the same order, two of these cannot deadlock
+	for ( auto& shard: shards )
+		locks.emplace_back(shard.mutex);
+
+	return locks;
+}
+
+bool FileTracker::_insert ( const std::string& hash, const bool record ) {
+	auto& shard = _shardOf(hash);
+	std::lock_guard lock(shard.mutex);
+
+	if ( !shard.hashes.insert(hash).second )
+		return false;
+
+	++size;
+	if ( record )
+		_append(Operation::add, hash);
+	return true;
+}
+
+bool FileTracker::_erase ( const std::string& hash, const bool record ) {
+	auto& shard = _shardOf(hash);
+	std::lock_guard lock(shard.mutex);
+
+	if ( shard.hashes.erase(hash) == 0 )
+		return false;
+
+	--size;
+	if ( record )
+		_append(Operation::remove, hash);
+	return true;
+}
+
+void FileTracker::_loadSnapshot () {
+	std::ofstream out(filePath, std::ios_base::app); // touch the file
+
+	if ( !out ) { throw std::runtime_error("FileTracker: Cannot open " + filePath.string() + " for writing"); }
+
+	out.close();
+
+	toml::table root;
+
+	try { root = toml::parse_file(filePath.string()); }
+	catch ( const toml::parse_error& err ) {
+		Utils::elog(
+			"Error parsing file '" + *err.source().path + "':\n" + std::string(err.description()) + "\n (" + err.
+			source().begin + ")\n");
+		throw std::runtime_error("Could not load array from " + filePath.string());
 	}
 
-	if ( !arr )
-		throw std::runtime_error("FileTracker::add: Failed to get or create the array");
+	const toml::node* arrayNode = root.get("array");
+	if ( !arrayNode )
+		return;
+
+	const toml::array* arr = arrayNode->as_array();
+	if ( !arr ) {
+		Utils::elog("\"array\" key is not an array in TOML file: " + filePath.string());
+		throw std::runtime_error("FileTracker: \"array\" is not an array");
+	}
 
 	for ( const auto& item: *arr ) {
-		if ( const auto hash = item.as_string() ) {
-			if ( hash->get() == addition )
-				return;
-		}
+		if ( const auto& hash = item.as_string() )
+			_insert(hash->get(), false);
+		else Utils::elog("FileTracker: One item in array array is not a string");
 	}
+}
 
-	// Not found: append new {hash, count=1}
+void FileTracker::_replay () {
+	std::ifstream in(logPath, std::ios::binary);
+	if ( !in )
+		return;
 
-	arr->push_back(addition);
+	const std::string records((std::istreambuf_iterator(in)), std::istreambuf_iterator<char>());
+	const auto* data = reinterpret_cast<const unsigned char*>(records.data());
 
-	// Serialize and save back
-	std::ofstream out(filePath, std::ios::trunc);
-	if ( !out )
-		throw std::runtime_error("FileTracker::add: Cannot open file for writing");
-	out << root;
+	std::size_t offset = 0;
 
-	out.close();
-}
+	while ( records.size() - offset >= headerSize ) {
+		const auto operation = static_cast<Operation>(data[offset]);
+		const std::size_t length = data[offset + 1] | data[offset + 2] << 8;
+		const auto recordSize = headerSize + length + checksumSize;
 
-void FileTracker::remove ( const std::set<std::string>& toRemove ) {
-	if ( const auto val = root["array"]; val ) {
-		if ( val.is_array() ) {
-			std::vector<toml::const_array_iterator> itemsToRemove;
-
-			const auto arr = val.as_array();
-			for ( auto item = arr->begin(); item != arr->end(); ++item ) {
-				if ( toRemove.contains(item->as_string()->get()) )
-					itemsToRemove.push_back(item);
-			}
-
-			for ( const auto item: itemsToRemove )
-				arr->erase(item);
-		}
-		else Utils::elog("FileTracker::remove: \"array\" exists but is not an array");
+		if ( records.size() - offset < recordSize || ( operation != Operation::add && operation != Operation::remove ) )
+			break;
+
+		unsigned char expected[checksumSize];
+		checksum(data + offset, headerSize + length, expected);
+		if ( std::memcmp(expected, data + offset + headerSize + length, checksumSize) != 0 )
+			break;
+
+		const auto hash = records.substr(offset + headerSize, length);
+
+		if ( operation == Operation::add )
+			_insert(hash, false);
+		else
+			_erase(hash, false);
+
+		offset += recordSize;
+		++logRecords;
 	}
 
-	std::ofstream out(filePath);
-	if ( !out )
-		throw std::runtime_error("FileTracker::remove: Could not open file for writing: " + filePath.string());
+	if ( offset < records.size() ) {
+		Utils::elog("FileTracker: dropping a torn record at the end of " + logPath.string());
+		in.close();
+		std::filesystem::resize_file(logPath, offset);
+	}
+}
 
+void FileTracker::_append ( const Operation operation, const std::string& hash ) {
+	if ( hash.size() > 0xffff )
+		throw std::runtime_error("FileTracker: hash too long: " + hash);
 
-	out << root;
+	// records of other shards may land in between, O_APPEND keeps each write whole
+	char record[headerSize + 0xffff + checksumSize];
+	auto* data = reinterpret_cast<unsigned char*>(record);
+
+	data[0] = static_cast<unsigned char>(operation);
+	data[1] = static_cast<unsigned char>(hash.size());
+	data[2] = static_cast<unsigned char>(hash.size() >> 8);
+	std::memcpy(data + headerSize, hash.data(), hash.size());
+	checksum(data, headerSize + hash.size(), data + headerSize + hash.size());
+
+	writeAll(log, record, headerSize + hash.size() + checksumSize, logPath);
+
+	++logRecords;
+	unsynced.store(true, std::memory_order_release);
 }
 
-void FileTracker::remove ( const std::string& toRemove ) {
-	if ( const auto val = root["array"]; val ) {
-		if ( val.is_array() ) {
-			std::vector<toml::const_array_iterator> itemsToRemove;
+void FileTracker::_maintain ( const std::stop_token& stop ) {
+	std::unique_lock lock(maintainerMutex);
+
+	// records that come in during one interval share the sync
+	while ( !maintainerWake.wait_for(lock, stop, syncInterval, [] { return false; }) && !stop.stop_requested() ) {
+		if ( !unsynced.exchange(false, std::memory_order_acq_rel) )
+			continue;
 
-			const auto arr = val.as_array();
-			for ( auto item = arr->begin(); item != arr->end(); ++item ) {
-				if ( item->as_string()->get() == toRemove )
-					itemsToRemove.push_back(item);
-			}
+		if ( fdatasync(log) != 0 )
+			Utils::elog("FileTracker: could not sync " + logPath.string() + ": " + strerror(errno));
 
-			for ( const auto item: itemsToRemove )
-				arr->erase(item);
+		if ( logRecords > compactAfter && logRecords > 2 * size ) {
+			try { _compact(); }
+			catch ( const std::exception& e ) { Utils::elog(std::string("FileTracker: compaction failed: ") + e.what()); }
 		}
-		else Utils::elog("FileTracker::remove: \"array\" exists but is not an array");
 	}
+}
+
+void FileTracker::_compact () {
+	std::set<std::string> snapshot;
+	off_t covered;
+	uint64_t coveredRecords;
+
+	{
+		const auto locks = _lockAll();
 
-	std::ofstream out(filePath);
+		for ( const auto& shard: shards )
+			snapshot.insert(shard.hashes.begin(), shard.hashes.end());
+
+		covered = lseek(log, 0, SEEK_END);
+		coveredRecords = logRecords;
+	}
+
+	toml::array arr;
+	for ( const auto& hash: snapshot )
+		arr.push_back(hash);
+
+	const auto temporarySnapshot = std::filesystem::path(filePath).concat(".tmp");
+
+	std::ofstream out(temporarySnapshot, std::ios::trunc);
+	out << toml::table{{"array", std::move(arr)}};
+	out.close();
 	if ( !out )
-		throw std::runtime_error("FileTracker::remove: Could not open file for writing: " + filePath.string());
+		throw std::runtime_error("Cannot write " + temporarySnapshot.string());
 
+	syncFile(temporarySnapshot);
+	std::filesystem::rename(temporarySnapshot, filePath);
 
-	out << root;
-}
+	const auto locks = _lockAll();
 
-std::set<std::string> FileTracker::list () const {
-	std::set<std::string> hashes;
+	// the records appended while the snapshot was written start the new log
+	std::string tail(lseek(log, 0, SEEK_END) - covered, '\0');
+	if ( !tail.empty() && pread(log, tail.data(), tail.size(), covered) != static_cast<ssize_t>(tail.size()) )
+		throw std::runtime_error("Cannot read " + logPath.string());
 
+	const auto temporaryLog = std::filesystem::path(logPath).concat(".tmp");
 
-	const toml::node* arrayNode = root.get("array");
-	if ( !arrayNode ) {
-		// No "array" key, return empty set
-		return hashes;
-	}
+	const int next = open(temporaryLog.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+	if ( next < 0 )
+		throw std::runtime_error("Cannot open " + temporaryLog.string() + " for writing");
 
-	const toml::array* arr = arrayNode->as_array();
-	if ( !arr ) {
-		Utils::elog("\"array\" key is not an array in TOML file: " + filePath.string());
-		throw std::runtime_error("FileTracker::remove: \"array\" is not an array");
+	try {
+		writeAll(next, tail.data(), tail.size(), temporaryLog);
+		if ( fdatasync(next) != 0 )
+			throw std::runtime_error("Cannot sync " + temporaryLog.string());
+		std::filesystem::rename(temporaryLog, logPath);
 	}
-
-	for ( const auto& item: *arr ) {
-		if ( const auto& hash = item.as_string() )
-			hashes.insert(hash->get());
-		else Utils::elog("FileTracker::remove: One item in array array is not a string");
+	catch ( ... ) {
+		close(next);
+		throw;
 	}
 
-	return hashes;
+	close(log);
+	log = next;
+	logRecords -= coveredRecords;
+
+	Utils::log("FileTracker: compacted " + logPath.filename().string() + " into a snapshot of " +
+	           std::to_string(snapshot.size()) + " hashes");
 }
@@ -1,21 +1,110 @@
 #pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <filesystem>
+#include <mutex>
 #include <set>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
 
 #include "includes/toml.hpp"
 
+/**
+ * @brief Persistent set of hashes, kept as a TOML snapshot and an append-only log of the changes since
+ *
+ * add and remove append one checksummed record to the log, a background thread syncs the log
+ * to disk in groups and folds it into a new snapshot once it outgrew the set. At startup the
+ * log is replayed over the snapshot, a torn record from a crash ends the replay.
+ *
+ * The set is split into shards with a lock each, so membership checks and changes of different
+ * hashes do not wait for one another; only the compaction locks all shards for a moment.
+ */
 class FileTracker {
 public:
     explicit FileTracker( const std::filesystem::path& path );
 
+    ~FileTracker ();
+
+    FileTracker ( const FileTracker& ) = delete;
+    FileTracker& operator= ( const FileTracker& ) = delete;
+
     void add ( const std::set<std::string>& additions );
     void add ( const std::string& addition );
     void remove ( const std::set<std::string>& toRemove );
     void remove ( const std::string& toRemove );
+
+    [[nodiscard]] bool contains ( std::string_view hash ) const;
+
+    /**
+     * @brief Copy of every hash, for the sync to compare with its peers
+     */
     [[nodiscard]] std::set<std::string> list ( ) const;
 
 private:
-    toml::table root;
+    enum class Operation : uint8_t { add = 1, remove = 2 };
+
+    struct Hash {
+        using is_transparent = void;
+
+        size_t operator() ( const std::string_view hash ) const { return std::hash<std::string_view>{}(hash); }
+    };
+
+    struct alignas(64) Shard {
+        mutable std::mutex mutex;
+        std::unordered_set<std::string, Hash, std::equal_to<>> hashes;
+    };
+
+    static constexpr size_t shardCount = 64;
+    // unsynced records wait at most this long for the next group sync
+    static constexpr auto syncInterval = std::chrono::milliseconds(100);
+    // the log is compacted once it holds more records than this and than twice the set
+    static constexpr uint64_t compactAfter = 1024;
+
     std::filesystem::path filePath;
+    std::filesystem::path logPath;
+
+    std::array<Shard, shardCount> shards;
+    std::atomic<uint64_t> size = 0;
+    // written under the lock of the shard a record belongs to, replaced under all of them
+    int log = -1;
+    std::atomic<uint64_t> logRecords = 0;
+    std::atomic<bool> unsynced = false;
+
+    std::mutex maintainerMutex;
+    std::condition_variable_any maintainerWake;
+    // declared last, so it stops before the state it works on goes away
+    std::jthread maintainer;
+
+    [[nodiscard]] Shard& _shardOf ( std::string_view hash );
+    [[nodiscard]] const Shard& _shardOf ( std::string_view hash ) const;
+
+    [[nodiscard]] std::vector<std::unique_lock<std::mutex>> _lockAll () const;
+
+    bool _insert ( const std::string& hash, bool record );
+    bool _erase ( const std::string& hash, bool record );
+
+    void _loadSnapshot ();
+
+    /**
+     * @brief Applies the log's records, cuts off a torn record at its end
+     */
+    void _replay ();
+
+    /**
+     * @brief Caller holds the lock of the hash's shard
+     */
+    void _append ( Operation operation, const std::string& hash );
+
+    void _maintain ( const std::stop_token& stop );
+
+    /**
+     * @brief Writes the set into a new snapshot and starts a new log with the records that came in meanwhile
+     */
+    void _compact ();
 };
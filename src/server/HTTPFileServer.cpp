@@ -35,27 +35,24 @@ void HTTPFileServer::_run ( const std::string& address ) const {
 }
 
 std::string HTTPFileServer::createSymlinkFor( const std::filesystem::path & file ) {
-	auto fileName = file.filename().string();
-	fileName = fileName.substr(0, fileName.find('.'));
-	std::ranges::replace(fileName, '<', '.');
-	const auto dotPos = fileName.find_last_of('.');
-	if ( dotPos == std::string::npos )
-		fileName = ".noext";
-	else
-		fileName = fileName.substr(dotPos);
-
-	fileName = file.extension().string().substr(1) + fileName;
-
-	const auto linkPath = std::filesystem::current_path() / "links" / fileName;
+	const auto fileName = _linkNameFor(file);
+	const auto linkPath = _linkPathFor(file);
 
 	if ( std::filesystem::exists(linkPath) )
 		return "file already exists, this shouldn't happen";
 
+	std::filesystem::create_directories(linkPath.parent_path());
 	std::filesystem::create_symlink(file, linkPath);
 	return fileName;
 }
 
 void HTTPFileServer::removeSymlinkFor( const std::filesystem::path & file ) {
+	std::filesystem::remove(_linkPathFor(file));
+	// links from before the fan-out layout
+	std::filesystem::remove(std::filesystem::current_path() / "links" / _linkNameFor(file));
+}
+
+std::string HTTPFileServer::_linkNameFor ( const std::filesystem::path& file ) {
 	auto fileName = file.filename().string();
 	fileName = fileName.substr(0, fileName.find('.'));
 	std::ranges::replace(fileName, '<', '.');
@@ -65,31 +62,25 @@ void HTTPFileServer::removeSymlinkFor( const std::filesystem::path & file ) {
 	else
 		fileName = fileName.substr(dotPos);
 
-	fileName = file.extension().string().substr(1) + fileName;
-
-	const auto linkPath = std::filesystem::current_path() / "links" / fileName;
+	return file.extension().string().substr(1) + fileName;
+}
 
-	std::filesystem::remove(linkPath);
+std::filesystem::path HTTPFileServer::_linkPathFor ( const std::filesystem::path& file ) {
+	return std::filesystem::current_path() / "links" / Utils::FS::fanOut(file.extension().string().substr(1)) /
+	       _linkNameFor(file);
 }
 
 void HTTPFileServer::_generateSymLinks () {
-	for ( const auto& file: std::filesystem::directory_iterator("storage") ) {
-		auto fileName = file.path().filename().string();
-		fileName = fileName.substr(0, fileName.find('.'));
-		std::ranges::replace(fileName, '<', '.');
-		const auto dotPos = fileName.find_last_of('.');
-		if ( dotPos == std::string::npos )
-			fileName = ".noext";
-		else
-			fileName = fileName.substr(dotPos);
-
-		fileName = file.path().extension().string().substr(1) + fileName;
+	for ( const auto& file: std::filesystem::recursive_directory_iterator("storage") ) {
+		if ( !file.is_regular_file() )
+			continue;
 
-		const auto linkPath = std::filesystem::current_path() / "links" / fileName;
+		const auto linkPath = _linkPathFor(file.path());
 
 		if ( std::filesystem::exists(linkPath) )
 			continue;
 
+		std::filesystem::create_directories(linkPath.parent_path());
 		std::filesystem::create_symlink(std::filesystem::current_path() / file, linkPath);
 	}
 }
@@ -124,11 +115,12 @@ void HTTPFileServer::_ev_handler ( mg_connection* c, const int ev, void* ev_data
 
 		// get hash from file name
 		const auto hash = request.substr(1, request.find_last_of('.')-1);
-		auto fileName = Utils::FS::findCorrespondingFileName(hash).value_or("<<<<INVALID>>>>");
+		const auto stored = HTTPFileServerVars::_storage->find(hash);
+		auto fileName = stored ? stored->path.filename().string() : "<<<<INVALID>>>>";
 		MG_INFO(( "File path2: %s", fileName.c_str() ));
 		fileName = fileName.substr(0, fileName.find('.'));
 		std::ranges::replace(fileName, '<', '.');
-		const auto filePath = "/" + hash + fileName.substr(fileName.find_last_of('.'));
+		const auto filePath = "/" + Utils::FS::fanOut(hash).string() + "/" + hash + fileName.substr(fileName.find_last_of('.'));
 		MG_INFO(( "File path3: %s", filePath.c_str() ));
 
 		if ( !std::filesystem::exists(HTTPFileServerVars::_rootDir + filePath) ) {
@@ -5,6 +5,7 @@
 #include <thread>
 #include <utility>
 
+#include "StorageIndex.hpp"
 #include "includes/mongoose.hpp"
 
 namespace HTTPFileServerVars { // ugly i know
@@ -12,14 +13,16 @@ namespace HTTPFileServerVars { // ugly i know
 	inline std::string _authUser;
 	inline std::string _authPass;
 	inline std::string _httpDisplayInBrowser;
+	inline const StorageIndex* _storage = nullptr;
 }
 
 class HTTPFileServer {
 public:
-	HTTPFileServer ( bool& turnOff, std::string rootDir, const bool httpDisplayInBrowser )
+	HTTPFileServer ( bool& turnOff, std::string rootDir, const bool httpDisplayInBrowser, const StorageIndex& storage )
 		:	_turnOff(turnOff)
 	{
 		HTTPFileServerVars::_rootDir = std::move(rootDir);
+		HTTPFileServerVars::_storage = &storage;
 		HTTPFileServerVars::_httpDisplayInBrowser = httpDisplayInBrowser ? "yes" : "no";
 	}
 
@@ -31,6 +34,16 @@ public:
 private:
 	void _run ( const std::string & address ) const;
 
+	/**
+	 * @return name of the link to a stored file, "<hash><extension>", the last part of its URL
+	 */
+	static std::string _linkNameFor ( const std::filesystem::path& file );
+
+	/**
+	 * @brief Links fan out below links/ like the stored files below storage/
+	 */
+	static std::filesystem::path _linkPathFor ( const std::filesystem::path& file );
+
 	static void _generateSymLinks ();
 
 	static void _ev_handler ( mg_connection* c, int ev, void* ev_data );
@@ -0,0 +1,570 @@
+#include "IoUring.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "utils.hpp"
+
+IoUring::IoUring ( const unsigned entries, const bool sqPoll ) : _sqPoll(sqPoll) {
+	io_uring_params params{};
+
+	if ( sqPoll ) {
+		params.flags |= IORING_SETUP_SQPOLL;
+		params.sq_thread_idle = 1000; // ms before the kernel thread sleeps and needs a wakeup
+	}
+
+	_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+	if ( _fd < 0 )
+		throw std::runtime_error("io_uring_setup: " + std::string(strerror(errno)));
+
+	_sqRingSize = params.sq_off.array + params.sq_entries * sizeof( unsigned );
+	_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof( io_uring_cqe );
+
+	const bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+	if ( singleMmap )
+		_sqRingSize = _cqRingSize = std::max(_sqRingSize, _cqRingSize);
+
+	_sqRing = mmap(nullptr, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+	if ( _sqRing == MAP_FAILED ) {
+		_sqRing = nullptr;
+		_release();
+		throw std::runtime_error("io_uring: could not map the submission ring");
+	}
+
+	if ( singleMmap )
+		_cqRing = _sqRing;
+	else {
+		_cqRing = mmap(nullptr, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+		if ( _cqRing == MAP_FAILED ) {
+			_cqRing = nullptr;
+			_release();
+			throw std::runtime_error("io_uring: could not map the completion ring");
+		}
+	}
+
+	_sqesSize = params.sq_entries * sizeof( io_uring_sqe );
+	const auto sqes = mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+	if ( sqes == MAP_FAILED ) {
+		_release();
+		throw std::runtime_error("io_uring: could not map the submission entries");
+	}
+	_sqes = static_cast<io_uring_sqe*>(sqes);
+
+	const auto sq = static_cast<char*>(_sqRing);
+	_sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+	_sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+	_sqFlags = reinterpret_cast<unsigned*>(sq + params.sq_off.flags);
+	_sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+	_sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+	_sqEntries = params.sq_entries;
+	_sqLocalTail = *_sqTail;
+
+	const auto cq = static_cast<char*>(_cqRing);
+	_cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+	_cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+	_cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+	_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+}
+
+IoUring::~IoUring () { _release(); }
+
+void IoUring::registerBuffers ( const std::span<const iovec> buffers ) {
+	if ( syscall(__NR_io_uring_register, _fd, IORING_REGISTER_BUFFERS, buffers.data(), buffers.size()) < 0 )
+		throw std::runtime_error("io_uring: could not register buffers: " + std::string(strerror(errno)));
+}
+
+void IoUring::registerFiles ( const std::span<const int> files ) {
+	if ( syscall(__NR_io_uring_register, _fd, IORING_REGISTER_FILES, files.data(), files.size()) < 0 )
+		throw std::runtime_error("io_uring: could not register files: " + std::string(strerror(errno)));
+}
+
+void IoUring::unregisterFiles () {
+	if ( syscall(__NR_io_uring_register, _fd, IORING_UNREGISTER_FILES, nullptr, 0) < 0 )
+		throw std::runtime_error("io_uring: could not unregister files: " + std::string(strerror(errno)));
+}
+
+void IoUring::prepareRecv ( const unsigned file, void* buffer, const std::size_t length, const std::uint64_t userData,
+                            const bool linked ) {
+	const auto sqe = _acquire();
+	sqe->opcode = IORING_OP_RECV;
+	sqe->flags = IOSQE_FIXED_FILE | ( linked ? IOSQE_IO_LINK : 0 );
+	sqe->fd = static_cast<int>(file);
+	sqe->addr = reinterpret_cast<std::uint64_t>(buffer);
+	sqe->len = static_cast<unsigned>(std::min<std::size_t>(length, INT_MAX));
+	sqe->user_data = userData;
+}
+
+void IoUring::prepareLinkTimeout ( const __kernel_timespec* timeout, const std::uint64_t userData ) {
+	const auto sqe = _acquire();
+	sqe->opcode = IORING_OP_LINK_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = reinterpret_cast<std::uint64_t>(timeout);
+	sqe->len = 1;
+	sqe->user_data = userData;
+}
+
+void IoUring::prepareSendMsg ( const unsigned file, const msghdr* message, const std::uint64_t userData ) {
+	const auto sqe = _acquire();
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->flags = IOSQE_FIXED_FILE;
+	sqe->fd = static_cast<int>(file);
+	sqe->addr = reinterpret_cast<std::uint64_t>(message);
+	sqe->len = 1;
+	sqe->user_data = userData;
+}
+
+void IoUring::prepareWriteFixed ( const unsigned file, const void* buffer, const std::size_t length,
+                                  const std::uint64_t offset, const unsigned bufferIndex, const std::uint64_t userData ) {
+	const auto sqe = _acquire();
+	sqe->opcode = IORING_OP_WRITE_FIXED;
+	sqe->flags = IOSQE_FIXED_FILE;
+	sqe->fd = static_cast<int>(file);
+	sqe->addr = reinterpret_cast<std::uint64_t>(buffer);
+	sqe->len = static_cast<unsigned>(length);
+	sqe->off = offset;
+	sqe->buf_index = static_cast<std::uint16_t>(bufferIndex);
+	sqe->user_data = userData;
+}
+
+void IoUring::prepareReadFixed ( const unsigned file, void* buffer, const std::size_t length, const std::uint64_t offset,
+                                 const unsigned bufferIndex, const std::uint64_t userData ) {
+	const auto sqe = _acquire();
+	sqe->opcode = IORING_OP_READ_FIXED;
+	sqe->flags = IOSQE_FIXED_FILE;
+	sqe->fd = static_cast<int>(file);
+	sqe->addr = reinterpret_cast<std::uint64_t>(buffer);
+	sqe->len = static_cast<unsigned>(length);
+	sqe->off = offset;
+	sqe->buf_index = static_cast<std::uint16_t>(bufferIndex);
+	sqe->user_data = userData;
+}
+
+void IoUring::submit ( unsigned waitFor ) {
+	std::atomic_ref tail(*_sqTail);
+	std::atomic_ref head(*_sqHead);
+
+	tail.store(_sqLocalTail, std::memory_order_release);
+
+	unsigned flags = 0;
+
+	if ( _sqPoll ) {
+		// the kernel thread picks the entries up by itself unless it went to sleep
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if ( std::atomic_ref(*_sqFlags).load(std::memory_order_relaxed) & IORING_SQ_NEED_WAKEUP )
+			flags |= IORING_ENTER_SQ_WAKEUP;
+	}
+
+	if ( waitFor > 0 && _ready() < waitFor )
+		flags |= IORING_ENTER_GETEVENTS;
+	else
+		waitFor = 0;
+
+	while ( true ) {
+		const unsigned toSubmit = _sqPoll ? 0 : _sqLocalTail - head.load(std::memory_order_acquire);
+
+		if ( toSubmit == 0 && flags == 0 )
+			return;
+
+		if ( syscall(__NR_io_uring_enter, _fd, toSubmit, waitFor, flags, nullptr, 0) >= 0 )
+			return;
+
+		if ( errno != EINTR )
+			throw std::runtime_error("io_uring_enter: " + std::string(strerror(errno)));
+	}
+}
+
+std::optional<IoUring::Completion> IoUring::peek () {
+	std::atomic_ref head(*_cqHead);
+	const auto current = head.load(std::memory_order_relaxed);
+
+	if ( current == std::atomic_ref(*_cqTail).load(std::memory_order_acquire) )
+		return std::nullopt;
+
+	const auto& cqe = _cqes[current & _cqMask];
+	const Completion completion{cqe.user_data, cqe.res};
+
+	head.store(current + 1, std::memory_order_release);
+
+	return completion;
+}
+
+io_uring_sqe* IoUring::_acquire () {
+	// a full queue is handed over first, with a polling kernel thread it may take a moment to drain
+	while ( _sqLocalTail - std::atomic_ref(*_sqHead).load(std::memory_order_acquire) >= _sqEntries ) {
+		submit();
+		if ( _sqPoll )
+			std::this_thread::yield();
+	}
+
+	const auto index = _sqLocalTail & _sqMask;
+	const auto sqe = &_sqes[index];
+	std::memset(sqe, 0, sizeof *sqe);
+	_sqArray[index] = index;
+	++_sqLocalTail;
+
+	return sqe;
+}
+
+unsigned IoUring::_ready () const {
+	return std::atomic_ref(*_cqTail).load(std::memory_order_acquire) - *_cqHead;
+}
+
+void IoUring::_release () {
+	if ( _sqes )
+		munmap(_sqes, _sqesSize);
+	if ( _cqRing && _cqRing != _sqRing )
+		munmap(_cqRing, _cqRingSize);
+	if ( _sqRing )
+		munmap(_sqRing, _sqRingSize);
+	if ( _fd >= 0 )
+		close(_fd);
+
+	_sqes = nullptr;
+	_cqRing = _sqRing = nullptr;
+	_fd = -1;
+}
+
+
+IoUringTransfer::IoUringTransfer ( IoUringPool& pool, const std::size_t entry, const int socket, const int file )
+	: _pool(pool), _entry(entry), _file(file), _slots(IoUringPool::slotsPerRing) {
+	// same limit as SO_RCVTIMEO on the blocking path, which io_uring receives do not honour
+	_timeout.tv_sec = 20;
+
+	const int files[] = {socket, file};
+	_ring().registerFiles(files);
+}
+
+IoUringTransfer::~IoUringTransfer () {
+	bool usable = true;
+
+	// nothing may complete on this ring after the next transfer leased it
+	try {
+		while ( _inFlight > 0 )
+			_reapOne();
+
+		_ring().unregisterFiles();
+	}
+	catch ( const std::exception& e ) {
+		Utils::elog("IoUringTransfer: dropping ring: " + std::string(e.what()));
+		usable = false;
+	}
+
+	close(_file);
+
+	if ( !usable ) {
+		std::lock_guard lock(_pool._mutex);
+		_pool._entries[_entry].ring.reset();
+	}
+
+	_pool._release(_entry);
+}
+
+std::size_t IoUringTransfer::receive ( char* buffer, const std::size_t length ) {
+	_ring().prepareRecv(socketSlot, buffer, length, recvTag, true);
+	_ring().prepareLinkTimeout(&_timeout, timeoutTag);
+	_inFlight += 2;
+
+	const auto result = _awaitSocket();
+
+	if ( result == -ECANCELED )
+		throw std::runtime_error("timeout");
+
+	if ( result < 0 )
+		throw std::runtime_error("client disconnected or could not receive message");
+
+	return static_cast<std::size_t>(result);
+}
+
+void IoUringTransfer::send ( const unsigned char* header, const std::size_t headerLength, const char* payload,
+                             const std::size_t payloadLength ) {
+	iovec parts[2] = {
+		{const_cast<unsigned char*>(header), headerLength},
+		{const_cast<char*>(payload), payloadLength}
+	};
+	std::size_t part = 0;
+
+	while ( part < 2 ) {
+		msghdr message{};
+		message.msg_iov = parts + part;
+		message.msg_iovlen = 2 - part;
+
+		_ring().prepareSendMsg(socketSlot, &message, sendTag);
+		++_inFlight;
+
+		auto sent = _awaitSocket();
+
+		if ( sent < 0 )
+			throw std::runtime_error("Could not send message to client: " + std::string(strerror(-sent)));
+
+		while ( part < 2 && static_cast<std::size_t>(sent) >= parts[part].iov_len ) {
+			sent -= static_cast<std::int32_t>(parts[part].iov_len);
+			++part;
+		}
+
+		if ( part < 2 ) {
+			parts[part].iov_base = static_cast<char*>(parts[part].iov_base) + sent;
+			parts[part].iov_len -= sent;
+		}
+	}
+}
+
+void IoUringTransfer::write ( const char* data, std::size_t length, std::uint64_t offset ) {
+	while ( length > 0 ) {
+		const auto slot = _freeSlot();
+		const auto piece = std::min(length, IoUringPool::slotSize);
+
+		std::memcpy(_buffer(slot).data(), data, piece);
+		_slots[slot] = {SlotState::Writing, offset, piece, 0};
+		_submitSlot(slot);
+
+		data += piece;
+		offset += piece;
+		length -= piece;
+	}
+
+	if ( _fileError )
+		throw std::runtime_error(*_fileError);
+}
+
+std::span<const char> IoUringTransfer::read ( const std::uint64_t offset, const std::size_t length, const std::size_t nextLength ) {
+	if ( _current ) {
+		_slots[*_current].state = SlotState::Free;
+		_current.reset();
+	}
+
+	if ( length == 0 )
+		return {};
+
+	if ( length > IoUringPool::slotSize )
+		throw std::invalid_argument("IoUringTransfer::read: chunk larger than a registered buffer");
+
+	// prefetches for another chunk size are of no use anymore
+	for ( auto& slot: _slots ) {
+		const bool wanted = ( slot.offset == offset && slot.length == length ) ||
+		                    ( slot.offset == offset + length && slot.length == nextLength );
+		if ( wanted )
+			continue;
+
+		if ( slot.state == SlotState::Ready )
+			slot.state = SlotState::Free;
+		else if ( slot.state == SlotState::Reading )
+			slot.state = SlotState::Discarded;
+	}
+
+	auto slot = _findRead(offset, length);
+
+	if ( !slot ) {
+		slot = _freeSlot();
+		_slots[*slot] = {SlotState::Reading, offset, length, 0};
+		_submitSlot(*slot);
+	}
+
+	// queued now, it goes to the kernel together with whatever this chunk waits for
+	if ( nextLength > 0 && nextLength <= IoUringPool::slotSize && !_findRead(offset + length, nextLength) ) {
+		for ( unsigned i = 0; i < _slots.size(); ++i ) {
+			if ( _slots[i].state != SlotState::Free )
+				continue;
+
+			_slots[i] = {SlotState::Reading, offset + length, nextLength, 0};
+			_submitSlot(i);
+			break;
+		}
+	}
+
+	while ( _slots[*slot].state == SlotState::Reading )
+		_reapOne();
+
+	if ( _slots[*slot].state != SlotState::Ready )
+		throw std::runtime_error(_fileError.value_or("io_uring: read failed"));
+
+	_current = slot;
+
+	return {_buffer(*slot).data(), length};
+}
+
+void IoUringTransfer::flush () {
+	const auto busy = [this] {
+		return std::ranges::any_of(_slots, [] ( const Slot& slot ) {
+			return slot.state == SlotState::Writing || slot.state == SlotState::Reading ||
+			       slot.state == SlotState::Discarded;
+		});
+	};
+
+	while ( busy() )
+		_reapOne();
+
+	if ( _fileError )
+		throw std::runtime_error(*_fileError);
+}
+
+IoUring& IoUringTransfer::_ring () { return *_pool._entries[_entry].ring; }
+
+std::span<char> IoUringTransfer::_buffer ( const unsigned slot ) {
+	return {_pool._entries[_entry].buffers[slot].get(), IoUringPool::slotSize};
+}
+
+std::int32_t IoUringTransfer::_awaitSocket () {
+	_socketResult.reset();
+
+	while ( !_socketResult )
+		_reapOne();
+
+	return *_socketResult;
+}
+
+void IoUringTransfer::_reapOne () {
+	if ( const auto completion = _ring().peek() ) {
+		_complete(*completion);
+		return;
+	}
+
+	_ring().submit(1);
+}
+
+void IoUringTransfer::_complete ( const IoUring::Completion& completion ) {
+	--_inFlight;
+
+	if ( completion.userData == timeoutTag )
+		return;
+
+	if ( completion.userData & socketTag ) {
+		_socketResult = completion.result;
+		return;
+	}
+
+	auto& slot = _slots[completion.userData];
+
+	if ( slot.state == SlotState::Discarded ) {
+		slot.state = SlotState::Free;
+		return;
+	}
+
+	if ( completion.result <= 0 ) {
+		_fileError = std::string("io_uring: file ") + ( slot.state == SlotState::Writing ? "write" : "read" ) + " failed: " +
+		             ( completion.result < 0 ? strerror(-completion.result) : "unexpected end of file" );
+		slot.state = SlotState::Free;
+		return;
+	}
+
+	slot.done += static_cast<std::size_t>(completion.result);
+
+	// short transfers on regular files are rare, the rest is simply asked for again
+	if ( slot.done < slot.length ) {
+		_submitSlot(static_cast<unsigned>(completion.userData));
+		return;
+	}
+
+	slot.state = slot.state == SlotState::Reading ? SlotState::Ready : SlotState::Free;
+}
+
+void IoUringTransfer::_submitSlot ( const unsigned slot ) {
+	const auto& state = _slots[slot];
+	const auto buffer = _buffer(slot).data() + state.done;
+
+	if ( state.state == SlotState::Writing )
+		_ring().prepareWriteFixed(fileSlot, buffer, state.length - state.done, state.offset + state.done, slot, slot);
+	else
+		_ring().prepareReadFixed(fileSlot, buffer, state.length - state.done, state.offset + state.done, slot, slot);
+
+	++_inFlight;
+}
+
+unsigned IoUringTransfer::_freeSlot () {
+	while ( true ) {
+		for ( unsigned i = 0; i < _slots.size(); ++i )
+			if ( _slots[i].state == SlotState::Free )
+				return i;
+
+		if ( _fileError )
+			throw std::runtime_error(*_fileError);
+
+		_reapOne();
+	}
+}
+
+std::optional<unsigned> IoUringTransfer::_findRead ( const std::uint64_t offset, const std::size_t length ) const {
+	for ( unsigned i = 0; i < _slots.size(); ++i ) {
+		const auto& slot = _slots[i];
+		if ( ( slot.state == SlotState::Reading || slot.state == SlotState::Ready ) &&
+		     slot.offset == offset && slot.length == length )
+			return i;
+	}
+
+	return std::nullopt;
+}
+
+
+IoUringPool::IoUringPool ( const bool enabled, const unsigned rings, const bool sqPoll ) {
+	if ( !enabled )
+		return;
+
+	for ( unsigned i = 0; i < rings; ++i ) {
+		try {
+			Entry entry;
+			entry.ring = std::make_unique<IoUring>(32, sqPoll);
+
+			std::vector<iovec> buffers;
+			for ( unsigned slot = 0; slot < slotsPerRing; ++slot ) {
+				entry.buffers.emplace_back(std::make_unique_for_overwrite<char[]>(slotSize));
+				buffers.push_back({entry.buffers.back().get(), slotSize});
+			}
+
+			entry.ring->registerBuffers(buffers);
+			_entries.push_back(std::move(entry));
+		}
+		catch ( const std::exception& e ) {
+			Utils::elog("IoUringPool: " + std::string(e.what()) + ", falling back to blocking I/O");
+			break;
+		}
+	}
+
+	if ( !_entries.empty() )
+		Utils::log("IoUringPool: " + std::to_string(_entries.size()) + " io_uring rings ready");
+}
+
+std::unique_ptr<IoUringTransfer> IoUringPool::lease ( const int socket, const std::filesystem::path& path, const int flags ) {
+	std::size_t entry = 0;
+
+	{
+		std::lock_guard lock(_mutex);
+
+		const auto it = std::ranges::find_if(_entries, [] ( const Entry& e ) { return e.ring && !e.busy; });
+		if ( it == _entries.end() )
+			return nullptr;
+
+		it->busy = true;
+		entry = it - _entries.begin();
+	}
+
+	const int file = open(path.c_str(), flags | O_CLOEXEC, 0644);
+
+	if ( file < 0 ) {
+		_release(entry);
+		return nullptr;
+	}
+
+	try { return std::unique_ptr<IoUringTransfer>(new IoUringTransfer(*this, entry, socket, file)); }
+	catch ( const std::exception& e ) {
+		Utils::elog("IoUringPool: " + std::string(e.what()));
+		close(file);
+		_release(entry);
+		return nullptr;
+	}
+}
+
+bool IoUringPool::enabled () const { return !_entries.empty(); }
+
+void IoUringPool::_release ( const std::size_t entry ) {
+	std::lock_guard lock(_mutex);
+	_entries[entry].busy = false;
+}
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <sys/socket.h>
+#include <vector>
+
+/**
+ * @brief Minimal io_uring ring on top of the raw system calls
+ *
+ * A ring is driven by one thread at a time. The prepare calls only queue
+ * submissions, they reach the kernel together on the next submit, so queued
+ * file writes ride along with the next socket operation in one io_uring_enter.
+ */
+class IoUring {
+public:
+	struct Completion {
+		std::uint64_t userData;
+		std::int32_t result;
+	};
+
+	/**
+	 * @throws std::runtime_error if the kernel does not provide io_uring
+	 */
+	IoUring ( unsigned entries, bool sqPoll );
+
+	~IoUring ();
+
+	IoUring ( const IoUring& ) = delete;
+
+	IoUring& operator= ( const IoUring& ) = delete;
+
+	void registerBuffers ( std::span<const iovec> buffers );
+
+	void registerFiles ( std::span<const int> files );
+
+	void unregisterFiles ();
+
+	void prepareRecv ( unsigned file, void* buffer, std::size_t length, std::uint64_t userData, bool linked = false );
+
+	void prepareLinkTimeout ( const __kernel_timespec* timeout, std::uint64_t userData );
+
+	void prepareSendMsg ( unsigned file, const msghdr* message, std::uint64_t userData );
+
+	void prepareWriteFixed ( unsigned file, const void* buffer, std::size_t length, std::uint64_t offset,
+	                         unsigned bufferIndex, std::uint64_t userData );
+
+	void prepareReadFixed ( unsigned file, void* buffer, std::size_t length, std::uint64_t offset,
+	                        unsigned bufferIndex, std::uint64_t userData );
+
+	/**
+	 * @brief Hands the queued submissions to the kernel and waits until at least `waitFor` completions are ready
+	 */
+	void submit ( unsigned waitFor = 0 );
+
+	/**
+	 * @brief Takes the next completion without waiting
+	 */
+	std::optional<Completion> peek ();
+
+private:
+	int _fd = -1;
+	bool _sqPoll;
+
+	void* _sqRing = nullptr;
+	void* _cqRing = nullptr;
+	std::size_t _sqRingSize = 0;
+	std::size_t _cqRingSize = 0;
+	io_uring_sqe* _sqes = nullptr;
+	std::size_t _sqesSize = 0;
+
+	unsigned* _sqHead = nullptr;
+	unsigned* _sqTail = nullptr;
+	unsigned* _sqFlags = nullptr;
+	unsigned* _sqArray = nullptr;
+	unsigned _sqMask = 0;
+	unsigned _sqEntries = 0;
+	// queued locally, published to the kernel on submit
+	unsigned _sqLocalTail = 0;
+
+	unsigned* _cqHead = nullptr;
+	unsigned* _cqTail = nullptr;
+	unsigned _cqMask = 0;
+	io_uring_cqe* _cqes = nullptr;
+
+	io_uring_sqe* _acquire ();
+
+	[[nodiscard]] unsigned _ready () const;
+
+	void _release ();
+};
+
+class IoUringPool;
+
+/**
+ * @brief One transfer's use of a leased ring: the client socket and the stored file as fixed files
+ *
+ * Socket operations wait for their completion, file writes are copied into
+ * registered buffers and only queued, reads are prefetched one chunk ahead.
+ */
+class IoUringTransfer {
+public:
+	~IoUringTransfer ();
+
+	IoUringTransfer ( const IoUringTransfer& ) = delete;
+
+	IoUringTransfer& operator= ( const IoUringTransfer& ) = delete;
+
+	/**
+	 * @return number of received bytes, 0 if the peer disconnected
+	 * @throws std::runtime_error on errors and after the receive timeout
+	 */
+	std::size_t receive ( char* buffer, std::size_t length );
+
+	void send ( const unsigned char* header, std::size_t headerLength, const char* payload, std::size_t payloadLength );
+
+	/**
+	 * @brief Queues a write of `data` at `offset`, waits only when every registered buffer is in use
+	 */
+	void write ( const char* data, std::size_t length, std::uint64_t offset );
+
+	/**
+	 * @brief Returns `length` bytes at `offset` and starts reading the following `nextLength` bytes
+	 *
+	 * The view stays valid until the next read.
+	 */
+	std::span<const char> read ( std::uint64_t offset, std::size_t length, std::size_t nextLength );
+
+	/**
+	 * @brief Waits for all file operations
+	 * @throws std::runtime_error if one of them failed
+	 */
+	void flush ();
+
+private:
+	friend class IoUringPool;
+
+	enum class SlotState { Free, Writing, Reading, Ready, Discarded };
+
+	struct Slot {
+		SlotState state = SlotState::Free;
+		std::uint64_t offset = 0;
+		std::size_t length = 0;
+		// bytes already transferred, short reads and writes are resubmitted from here
+		std::size_t done = 0;
+	};
+
+	static constexpr unsigned socketSlot = 0;
+	static constexpr unsigned fileSlot = 1;
+	static constexpr std::uint64_t socketTag = 1ULL << 62;
+	static constexpr std::uint64_t recvTag = socketTag | 1;
+	static constexpr std::uint64_t sendTag = socketTag | 2;
+	static constexpr std::uint64_t timeoutTag = socketTag | 3;
+
+	IoUringPool& _pool;
+	std::size_t _entry;
+	int _file;
+
+	std::vector<Slot> _slots;
+	std::optional<std::int32_t> _socketResult;
+	std::optional<std::string> _fileError;
+	std::optional<unsigned> _current;
+	__kernel_timespec _timeout{};
+	// every submission still owed a completion, the ring is only handed back without any
+	unsigned _inFlight = 0;
+
+	IoUringTransfer ( IoUringPool& pool, std::size_t entry, int socket, int file );
+
+	IoUring& _ring ();
+
+	std::span<char> _buffer ( unsigned slot );
+
+	/**
+	 * @brief Submits and reaps until the socket operation completed
+	 */
+	std::int32_t _awaitSocket ();
+
+	void _reapOne ();
+
+	void _complete ( const IoUring::Completion& completion );
+
+	void _submitSlot ( unsigned slot );
+
+	unsigned _freeSlot ();
+
+	std::optional<unsigned> _findRead ( std::uint64_t offset, std::size_t length ) const;
+};
+
+/**
+ * @brief A small fixed number of rings shared by all transfers, each leased by one transfer at a time
+ *
+ * When io_uring is disabled, unavailable or all rings are busy, lease returns nothing
+ * and the transfer keeps using the blocking calls.
+ */
+class IoUringPool {
+public:
+	static constexpr std::size_t slotSize = 4 * 1024 * 1024;
+	static constexpr unsigned slotsPerRing = 4;
+
+	IoUringPool ( bool enabled, unsigned rings, bool sqPoll );
+
+	/**
+	 * @brief Opens `path` and registers it together with the socket on a free ring
+	 */
+	std::unique_ptr<IoUringTransfer> lease ( int socket, const std::filesystem::path& path, int flags );
+
+	[[nodiscard]] bool enabled () const;
+
+private:
+	friend class IoUringTransfer;
+
+	struct Entry {
+		std::unique_ptr<IoUring> ring;
+		std::vector<std::unique_ptr<char[]>> buffers;
+		bool busy = false;
+	};
+
+	std::mutex _mutex;
+	std::vector<Entry> _entries;
+
+	void _release ( std::size_t entry );
+};
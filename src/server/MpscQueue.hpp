@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <optional>
+
+/**
+ * @brief Unbounded lock-free queue for many producers and a single consumer
+ *
+ * Producers link their node with one atomic exchange and never wait on each other.
+ * A push that is still linking its node hides the nodes behind it, so pop may
+ * come up empty for a moment; producers therefore notify the consumer only after
+ * push returned.
+ */
+template < typename T >
+class MpscQueue {
+public:
+	MpscQueue () : _head(new Node), _tail(_head.load()) {}
+
+	~MpscQueue () {
+		while ( pop() ) {}
+		delete _tail;
+	}
+
+	MpscQueue ( const MpscQueue& ) = delete;
+
+	MpscQueue& operator= ( const MpscQueue& ) = delete;
+
+	void push ( T value ) {
+		const auto node = new Node{std::move(value)};
+		const auto previous = _head.exchange(node, std::memory_order_acq_rel);
+		previous->next.store(node, std::memory_order_release);
+	}
+
+	/**
+	 * @brief Only ever called from the consumer thread
+	 */
+	std::optional<T> pop () {
+		const auto tail = _tail;
+		const auto next = tail->next.load(std::memory_order_acquire);
+
+		if ( !next )
+			return std::nullopt;
+
+		// the popped node stays behind as the new empty front
+		auto value = std::move(next->value);
+		next->value.reset();
+		_tail = next;
+		delete tail;
+
+		return value;
+	}
+
+private:
+	struct Node {
+		std::optional<T> value;
+		std::atomic<Node*> next = nullptr;
+	};
+
+	std::atomic<Node*> _head;
+	Node* _tail;
+};
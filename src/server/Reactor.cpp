@@ -0,0 +1,161 @@
+#include "Reactor.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "utils.hpp"
+
+Reactor::Reactor ( WorkerPool& workers, Handler handler ) : _workers(workers), _handler(std::move(handler)) {
+	_epoll = epoll_create1(EPOLL_CLOEXEC);
+	_wakeup = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+	if ( _epoll < 0 || _wakeup < 0 )
+		throw std::runtime_error("Reactor: could not create epoll instance: " + std::string(strerror(errno)));
+
+	epoll_event event{};
+	event.events = EPOLLIN;
+	event.data.fd = _wakeup;
+
+	if ( epoll_ctl(_epoll, EPOLL_CTL_ADD, _wakeup, &event) < 0 )
+		throw std::runtime_error("Reactor: could not watch wakeup descriptor: " + std::string(strerror(errno)));
+
+	_thread = std::jthread([this] ( const std::stop_token& stop ) { _run(stop); });
+}
+
+Reactor::~Reactor () {
+	_thread.request_stop();
+	_wake();
+	_thread.join();
+
+	// clients still in the key exchange or sending their request are closed here
+	_sessions.clear();
+	while ( const auto client = _incoming.pop() )
+		close(client->getSocket());
+
+	close(_wakeup);
+	close(_epoll);
+}
+
+void Reactor::add ( const ClientInfo& client ) {
+	_incoming.push(client);
+
+	if ( !_wakeupPending.exchange(true, std::memory_order_acq_rel) )
+		_wake();
+}
+
+void Reactor::_wake () {
+	constexpr uint64_t one = 1;
+	if ( write(_wakeup, &one, sizeof one) < 0 && errno != EAGAIN )
+		Utils::elog("Reactor: could not wake up the event loop");
+}
+
+void Reactor::_run ( const std::stop_token& stop ) {
+	epoll_event events[64];
+
+	while ( !stop.stop_requested() ) {
+		// wakes up at least once a second to drop idle clients
+		const auto count = epoll_wait(_epoll, events, std::size(events), 1000);
+
+		if ( count < 0 && errno != EINTR ) {
+			Utils::elog("Reactor: epoll_wait failed: " + std::string(strerror(errno)));
+			return;
+		}
+
+		for ( int i = 0; i < count; ++i ) {
+			if ( events[i].data.fd == _wakeup )
+				_startQueued();
+			else
+				_onReadable(events[i].data.fd);
+		}
+
+		_dropIdle();
+	}
+}
+
+void Reactor::_startQueued () {
+	uint64_t wakeups;
+	if ( read(_wakeup, &wakeups, sizeof wakeups) < 0 && errno != EAGAIN )
+		Utils::elog("Reactor: could not read wakeup descriptor");
+
+	// cleared before draining, a client pushed from now on brings its own wakeup
+	_wakeupPending.store(false, std::memory_order_release);
+
+	while ( const auto client = _incoming.pop() ) {
+		Utils::log("Reactor: serving client " + client->getIp());
+
+		auto connection = std::make_unique<ConnectionServer>(*client, bufferSize);
+
+		try { connection->init(); }
+		catch ( const std::exception& e ) {
+			Utils::elog("Reactor: could not start key exchange: " + std::string(e.what()));
+			continue;
+		}
+
+		const auto socket = client->getSocket();
+
+		_sessions.emplace(socket, Session{std::move(connection), State::KeyExchange, std::chrono::steady_clock::now()});
+
+		epoll_event event{};
+		event.events = EPOLLIN | EPOLLRDHUP;
+		event.data.fd = socket;
+
+		if ( epoll_ctl(_epoll, EPOLL_CTL_ADD, socket, &event) < 0 ) {
+			Utils::elog("Reactor: could not watch client: " + std::string(strerror(errno)));
+			_sessions.erase(socket);
+		}
+	}
+}
+
+void Reactor::_onReadable ( const int socket ) {
+	const auto it = _sessions.find(socket);
+	if ( it == _sessions.end() )
+		return;
+
+	auto& [connection, state, lastActivity] = it->second;
+
+	try {
+		// a closed socket leaves the epoll set by itself
+		if ( !connection->receiveAvailable() ) {
+			_sessions.erase(it);
+			return;
+		}
+
+		lastActivity = std::chrono::steady_clock::now();
+
+		if ( state == State::KeyExchange ) {
+			if ( !connection->messageBuffered() )
+				return;
+
+			connection->completeHandshake();
+			state = State::Request;
+		}
+
+		if ( !connection->messageBuffered() )
+			return;
+	}
+	catch ( const std::exception& e ) {
+		Utils::elog("Reactor: dropping client: " + std::string(e.what()));
+		_sessions.erase(it);
+		return;
+	}
+
+	// the request is complete, from here on the handler reads and writes blocking
+	epoll_ctl(_epoll, EPOLL_CTL_DEL, socket, nullptr);
+	std::shared_ptr<ConnectionServer> ready = std::move(connection);
+	_sessions.erase(it);
+
+	_workers.submit([this, ready] { _handler(*ready); });
+}
+
+void Reactor::_dropIdle () {
+	const auto now = std::chrono::steady_clock::now();
+
+	std::erase_if(_sessions, [now] ( const auto& entry ) {
+		return now - entry.second.lastActivity > idleTimeout;
+	});
+}
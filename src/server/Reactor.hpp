@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+
+#include "ClientInfo.hpp"
+#include "ConnectionServer.hpp"
+#include "MpscQueue.hpp"
+#include "WorkerPool.hpp"
+
+/**
+ * @brief Owns accepted connections until their request has fully arrived
+ *
+ * A single epoll thread drives the key exchange and buffers the request without
+ * blocking, so idle and slow clients hold nothing but their socket. Once the
+ * request is complete the connection leaves the reactor and its handler runs
+ * on the worker pool. Accepted clients arrive through a lock-free queue, so any
+ * number of acceptor threads can feed it; the sessions belong to the epoll thread alone.
+ */
+class Reactor {
+public:
+	using Handler = std::function<void ( ConnectionServer& connection )>;
+
+	Reactor ( WorkerPool& workers, Handler handler );
+
+	~Reactor ();
+
+	Reactor ( const Reactor& ) = delete;
+
+	Reactor& operator= ( const Reactor& ) = delete;
+
+	/**
+	 * @brief Queues an accepted client, safe to call from any thread
+	 */
+	void add ( const ClientInfo& client );
+
+private:
+	enum class State { KeyExchange, Request };
+
+	struct Session {
+		std::unique_ptr<ConnectionServer> connection;
+		State state = State::KeyExchange;
+		std::chrono::steady_clock::time_point lastActivity;
+	};
+
+	// same limit a blocking receive has through SO_RCVTIMEO
+	static constexpr auto idleTimeout = std::chrono::seconds(20);
+	// grows on demand once a handler receives file data
+	static constexpr std::size_t bufferSize = 64 * 1024;
+
+	WorkerPool& _workers;
+	Handler _handler;
+	int _epoll = -1;
+	int _wakeup = -1;
+	MpscQueue<ClientInfo> _incoming;
+	// set while a wakeup is on its way, so a burst of accepts costs one eventfd write
+	std::atomic<bool> _wakeupPending = false;
+	std::unordered_map<int, Session> _sessions;
+	std::jthread _thread;
+
+	void _run ( const std::stop_token& stop );
+
+	void _wake ();
+
+	/**
+	 * @brief Starts the key exchange with every queued client and watches it from then on
+	 */
+	void _startQueued ();
+
+	void _onReadable ( int socket );
+
+	void _dropIdle ();
+};
@@ -0,0 +1,230 @@
+#include "Reconciler.hpp"
+
+#include <algorithm>
+#include <sodium.h>
+#include <stdexcept>
+
+namespace {
+
+	enum class Answer : std::uint8_t { equal = 0, hashes = 1, descend = 2 };
+
+	// depth (1 byte), prefix, count and fingerprint (8 bytes each), little endian like the rest
+	constexpr std::size_t nodeSize = 25;
+
+	void appendLE ( std::string& out, const std::uint64_t value, const int bytes ) {
+		for ( int i = 0; i < bytes; ++i )
+			out.push_back(static_cast<char>(value >> 8 * i));
+	}
+
+	std::uint64_t readLE ( const unsigned char* in, const int bytes ) {
+		std::uint64_t value = 0;
+		for ( int i = 0; i < bytes; ++i )
+			value |= static_cast<std::uint64_t>(in[i]) << 8 * i;
+		return value;
+	}
+
+	class Reader {
+	public:
+		explicit Reader ( const std::string_view in ) : _in(in) {}
+
+		[[nodiscard]] bool empty () const { return _in.empty(); }
+
+		std::uint64_t number ( const int bytes ) {
+			return readLE(reinterpret_cast<const unsigned char*>(_take(bytes).data()), bytes);
+		}
+
+		std::string_view bytes ( const std::size_t size ) { return _take(size); }
+
+	private:
+		std::string_view _in;
+
+		std::string_view _take ( const std::size_t size ) {
+			if ( _in.size() < size )
+				throw std::runtime_error("Reconciler: truncated message");
+
+			const auto taken = _in.substr(0, size);
+			_in.remove_prefix(size);
+			return taken;
+		}
+	};
+
+	void appendHash ( std::string& out, const std::string_view hash ) {
+		appendLE(out, hash.size(), 2);
+		out += hash;
+	}
+
+	void appendHashes ( std::string& out, const std::set<std::string>& hashes ) {
+		appendLE(out, hashes.size(), 4);
+		for ( const auto& hash: hashes )
+			appendHash(out, hash);
+	}
+
+	std::set<std::string> readHashes ( Reader& reader ) {
+		std::set<std::string> hashes;
+
+		for ( auto count = reader.number(4); count > 0; --count )
+			hashes.emplace(reader.bytes(reader.number(2)));
+
+		return hashes;
+	}
+
+	std::string_view body ( const std::string_view message, const std::string_view prefix ) {
+		if ( !message.starts_with(prefix) )
+			throw std::runtime_error("Reconciler: unexpected message");
+		return message.substr(prefix.size());
+	}
+
+}
+
+Reconciler::Reconciler ( const std::set<std::string>& hashes ) {
+	_items.reserve(hashes.size());
+
+	for ( const auto& hash: hashes ) {
+		unsigned char digest[16];
+		crypto_generichash(digest, sizeof digest, reinterpret_cast<const unsigned char*>(hash.data()), hash.size(), nullptr,
+		                   0);
+
+		// big endian, so the first hex digit of the digest is the first digit of the key
+		std::uint64_t key = 0;
+		for ( int i = 0; i < 8; ++i )
+			key = key << 8 | digest[i];
+
+		_items.push_back({key, readLE(digest + 8, 8), hash});
+	}
+
+	std::ranges::sort(_items, {}, &Item::key);
+
+	_prefixFingerprints.resize(_items.size() + 1);
+	for ( std::size_t i = 0; i < _items.size(); ++i )
+		_prefixFingerprints[i + 1] = _prefixFingerprints[i] ^ _items[i].fingerprint;
+}
+
+std::pair<std::size_t, std::size_t> Reconciler::_range ( const std::uint8_t depth, const std::uint64_t prefix ) const {
+	if ( depth == 0 )
+		return {0, _items.size()};
+
+	const auto shift = 64 - 4 * depth;
+	const auto first = prefix << shift;
+	const auto last = first | ( shift == 0 ? 0 : ( std::uint64_t{1} << shift ) - 1 );
+
+	const auto begin = std::ranges::lower_bound(_items, first, {}, &Item::key);
+	const auto end = std::ranges::upper_bound(begin, _items.end(), last, {}, &Item::key);
+
+	return {begin - _items.begin(), end - _items.begin()};
+}
+
+Reconciler::Node Reconciler::_nodeAt ( const std::uint8_t depth, const std::uint64_t prefix ) const {
+	const auto [begin, end] = _range(depth, prefix);
+	return {depth, prefix, end - begin, _prefixFingerprints[end] ^ _prefixFingerprints[begin]};
+}
+
+std::string Reconciler::_encodeNodes ( const std::vector<Node>& nodes ) {
+	std::string message(nodesPrefix);
+	message.reserve(message.size() + nodes.size() * nodeSize);
+
+	for ( const auto& node: nodes ) {
+		appendLE(message, node.depth, 1);
+		appendLE(message, node.prefix, 8);
+		appendLE(message, node.count, 8);
+		appendLE(message, node.fingerprint, 8);
+	}
+
+	return message;
+}
+
+std::string Reconciler::_answer ( const std::string_view message ) const {
+	std::string answer;
+	Reader reader(body(message, nodesPrefix));
+
+	while ( !reader.empty() ) {
+		const auto depth = static_cast<std::uint8_t>(reader.number(1));
+		const auto prefix = reader.number(8);
+		const auto count = reader.number(8);
+		const auto fingerprint = reader.number(8);
+
+		if ( depth > maxDepth )
+			throw std::runtime_error("Reconciler: node too deep");
+
+		const auto mine = _nodeAt(depth, prefix);
+
+		if ( mine.count == count && mine.fingerprint == fingerprint ) {
+			appendLE(answer, static_cast<std::uint8_t>(Answer::equal), 1);
+			continue;
+		}
+
+		if ( mine.count > leafSize && count > leafSize && depth < maxDepth ) {
+			appendLE(answer, static_cast<std::uint8_t>(Answer::descend), 1);
+			continue;
+		}
+
+		appendLE(answer, static_cast<std::uint8_t>(Answer::hashes), 1);
+		appendLE(answer, mine.count, 4);
+
+		const auto [begin, end] = _range(depth, prefix);
+		for ( auto i = begin; i < end; ++i )
+			appendHash(answer, _items[i].hash);
+	}
+
+	return answer;
+}
+
+std::vector<Reconciler::Node> Reconciler::_process ( const std::string_view answer, const std::vector<Node>& nodes,
+                                                     Difference& difference ) const {
+	std::vector<Node> next;
+	Reader reader(answer);
+
+	for ( const auto& node: nodes ) {
+		switch ( static_cast<Answer>(reader.number(1)) ) {
+			case Answer::equal:
+				break;
+
+			case Answer::descend:
+				if ( node.depth == maxDepth )
+					throw std::runtime_error("Reconciler: cannot descend below the deepest node");
+
+				for ( std::uint64_t digit = 0; digit < 16; ++digit )
+					next.push_back(_nodeAt(node.depth + 1, node.prefix << 4 | digit));
+				break;
+
+			case Answer::hashes: {
+				auto remote = readHashes(reader);
+				const auto [begin, end] = _range(node.depth, node.prefix);
+
+				for ( auto i = begin; i < end; ++i ) {
+					// what is left of the peer's hashes afterwards only it has
+					if ( remote.erase(_items[i].hash) == 0 )
+						difference.localOnly.insert(_items[i].hash);
+				}
+
+				difference.remoteOnly.merge(remote);
+				break;
+			}
+
+			default:
+				throw std::runtime_error("Reconciler: unknown answer");
+		}
+	}
+
+	if ( !reader.empty() )
+		throw std::runtime_error("Reconciler: more answers than nodes");
+
+	return next;
+}
+
+std::string Reconciler::_encodeDifference ( const Difference& difference ) {
+	std::string message(differencePrefix);
+	appendHashes(message, difference.localOnly);
+	appendHashes(message, difference.remoteOnly);
+	return message;
+}
+
+Reconciler::Difference Reconciler::_decodeDifference ( const std::string_view message ) {
+	Reader reader(body(message, differencePrefix));
+	Difference difference;
+
+	// the master's own hashes are the ones this side lacks
+	difference.remoteOnly = readHashes(reader);
+	difference.localOnly = readHashes(reader);
+
+	return difference;
+}
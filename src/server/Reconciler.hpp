@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Finds the difference between the hash sets of two sync peers without sending either set
+ *
+ * Every hash is placed by its BLAKE2b digest into a 16-ary tree, a node's fingerprint is the
+ * count and XOR of the digests below it. The master sends the fingerprints of the nodes it has
+ * yet to compare, the slave answers each with "equal", "descend" or, for a small node, its
+ * hashes in it. Only the nodes on the way to a differing hash are sent, so the bytes exchanged
+ * grow with the difference; peers that already agree exchange one root fingerprint.
+ */
+class Reconciler {
+public:
+	struct Difference {
+		// hashes only this side has
+		std::set<std::string> localOnly;
+		// hashes only the peer has
+		std::set<std::string> remoteOnly;
+	};
+
+	explicit Reconciler ( const std::set<std::string>& hashes );
+
+	/**
+	 * @brief Drives the comparison and tells the slave the outcome at its end
+	 * @throws std::runtime_error on a malformed answer
+	 */
+	template < typename Conn >
+	Difference reconcileAsMaster ( Conn& connection ) const {
+		Difference difference;
+		std::vector<Node> nodes{_nodeAt(0, 0)};
+
+		while ( !nodes.empty() ) {
+			connection.sendData(_encodeNodes(nodes));
+			nodes = _process(connection.receiveData(), nodes, difference);
+		}
+
+		connection.sendData(_encodeDifference(difference));
+		return difference;
+	}
+
+	/**
+	 * @brief Answers the master's fingerprints until it sends the difference
+	 * @throws std::runtime_error on a malformed message
+	 */
+	template < typename Conn >
+	Difference reconcileAsSlave ( Conn& connection ) const { return reconcileAsSlave(connection, connection.receiveData()); }
+
+	/**
+	 * @param message the master's first message, when the caller already received it
+	 */
+	template < typename Conn >
+	Difference reconcileAsSlave ( Conn& connection, std::string message ) const {
+		while ( !message.starts_with(differencePrefix) ) {
+			connection.sendData(_answer(message));
+			message = connection.receiveData();
+		}
+
+		return _decodeDifference(message);
+	}
+
+private:
+	struct Item {
+		// the first 8 bytes of the digest place the hash, the next 8 go into the fingerprint
+		std::uint64_t key;
+		std::uint64_t fingerprint;
+		std::string hash;
+	};
+
+	struct Node {
+		// in hex digits of the key
+		std::uint8_t depth;
+		std::uint64_t prefix;
+		std::uint64_t count;
+		std::uint64_t fingerprint;
+	};
+
+	static constexpr std::string_view nodesPrefix = "nodes:";
+	static constexpr std::string_view differencePrefix = "difference:";
+	// nodes with at most this many hashes on either side are settled by sending the hashes
+	static constexpr std::uint64_t leafSize = 8;
+	static constexpr std::uint8_t maxDepth = 16;
+
+	// sorted by key
+	std::vector<Item> _items;
+	// XOR of the fingerprints of all items before the index
+	std::vector<std::uint64_t> _prefixFingerprints;
+
+	/**
+	 * @return indices of the first item in the node and of the first one behind it
+	 */
+	[[nodiscard]] std::pair<std::size_t, std::size_t> _range ( std::uint8_t depth, std::uint64_t prefix ) const;
+
+	[[nodiscard]] Node _nodeAt ( std::uint8_t depth, std::uint64_t prefix ) const;
+
+	[[nodiscard]] static std::string _encodeNodes ( const std::vector<Node>& nodes );
+
+	/**
+	 * @brief The slave's side: compares the master's nodes with its own
+	 */
+	[[nodiscard]] std::string _answer ( std::string_view message ) const;
+
+	/**
+	 * @brief The master's side: settles the nodes the slave sent hashes for
+	 * @return children of the nodes the slave wants to descend into
+	 */
+	std::vector<Node> _process ( std::string_view answer, const std::vector<Node>& nodes, Difference& difference ) const;
+
+	[[nodiscard]] static std::string _encodeDifference ( const Difference& difference );
+
+	/**
+	 * @brief Turns the master's difference around to the slave's point of view
+	 */
+	[[nodiscard]] static Difference _decodeDifference ( std::string_view message );
+};
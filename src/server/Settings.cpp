@@ -1,5 +1,8 @@
 #include "Settings.hpp"
 
+#include <algorithm>
+#include <thread>
+
 #include "utils.hpp"
 #include "includes/toml.hpp"
 
@@ -17,8 +20,18 @@ Settings::Settings ( const Settings& other ) {
     httpProtocol = other.httpProtocol;
     hostname = other.hostname;
     httpDisplayInBrowser = other.httpDisplayInBrowser;
+    workers = other.workers;
+    backlog = other.backlog;
+    acceptors = other.acceptors;
     syncTargets = other.syncTargets;
     syncPeriod = other.syncPeriod;
+    acceptTrustedSync = other.acceptTrustedSync;
+    transferWindow = other.transferWindow;
+    transferWindowMax = other.transferWindowMax;
+    sessionTtl = other.sessionTtl;
+    ioUring = other.ioUring;
+    ioUringRings = other.ioUringRings;
+    ioUringSqPoll = other.ioUringSqPoll;
 }
 
 Settings Settings::loadFromFile ( const std::filesystem::path& filePath ) {
@@ -54,6 +67,14 @@ Settings Settings::loadFromFile ( const std::filesystem::path& filePath ) {
         result.authPass = settings["auth"]["password"].as_string()->value_or("admin");
     }
 
+    // 0 picks two per core, but at least enough for one striped transfer without starting more
+    result.workers = static_cast<unsigned>(settings["server"]["workers"].value_or<int64_t>(0));
+    if ( result.workers == 0 )
+        result.workers = std::max(8u, 2 * std::thread::hardware_concurrency());
+
+    result.backlog = static_cast<int>(settings["server"]["backlog"].value_or<int64_t>(128));
+    result.acceptors = std::max(1u, static_cast<unsigned>(settings["server"]["acceptors"].value_or<int64_t>(1)));
+
     if ( const auto syncTargets = settings["syncTargets"]["targets"].as_array() ) {
         auto it = syncTargets->begin();
         while ( it != syncTargets->end() ) {
@@ -63,13 +84,24 @@ Settings Settings::loadFromFile ( const std::filesystem::path& filePath ) {
                 target->get("name")->as_string()->value_or("INVALID"),
                 target->get("address")->as_string()->value_or("INVALID"),
                 target->get("user")->as_string()->value_or("INVALID"),
-                target->get("pass")->as_string()->value_or("INVALID")
+                target->get("pass")->as_string()->value_or("INVALID"),
+                ( *target )["trusted"].value_or(false)
             );
 
             ++it;
         }
     }
     result.syncPeriod = settings["syncTargets"]["syncPeriod"].as_integer()->value_or(30);
+    result.acceptTrustedSync = settings["syncTargets"]["acceptTrusted"].value_or(false);
+
+    // optional section, older settings files do not have it
+    result.transferWindow = static_cast<unsigned>(settings["transfer"]["window"].value_or<int64_t>(4));
+    result.transferWindowMax = static_cast<unsigned>(settings["transfer"]["windowMax"].value_or<int64_t>(64));
+    result.sessionTtl = static_cast<unsigned>(settings["transfer"]["sessionTtl"].value_or<int64_t>(86400));
+
+    result.ioUring = settings["io"]["uring"].value_or(false);
+    result.ioUringRings = static_cast<unsigned>(settings["io"]["rings"].value_or<int64_t>(2));
+    result.ioUringSqPoll = settings["io"]["sqPoll"].value_or(false);
 
 
     return result;
@@ -82,6 +114,18 @@ std::string Settings::toString () const {
             + "  hostname: " + hostname + "\n"
             + "  httpAddress: " + httpAddress + "\n"
             + "  httpProtocol: " + httpProtocol + "\n"
+            + "  workers: " + std::to_string(workers) + "\n"
+            + "  backlog: " + std::to_string(backlog) + "\n"
+            + "  acceptors: " + std::to_string(acceptors) + "\n"
+            + "transfer: \n"
+            + "  window: " + std::to_string(transferWindow) + "\n"
+            + "  windowMax: " + std::to_string(transferWindowMax) + "\n"
+            + "  sessionTtl: " + std::to_string(sessionTtl) + "\n"
+            + "io: \n"
+            + "  uring: " + ( ioUring ? "true" : "false" ) + "\n"
+            + "  rings: " + std::to_string(ioUringRings) + "\n"
+            + "  sqPoll: " + ( ioUringSqPoll ? "true" : "false" ) + "\n"
+            + "acceptTrustedSync: " + ( acceptTrustedSync ? "true" : "false" ) + "\n"
             + "auth: \n"
             + "  user: " + authUser + "\n"
             + "  password: " + authPass + "\n"
@@ -92,11 +136,12 @@ std::string Settings::toString () const {
 
                 std::string result = "syncTargets:\n";
 
-                for ( const auto& [targetName, targetAddress, targetUser, targetPass] : syncTargets ) {
+                for ( const auto& [targetName, targetAddress, targetUser, targetPass, trusted] : syncTargets ) {
                     result += "  " + targetName + ":\n";
                     result += "    address: " + targetAddress + '\n';
                     result += "    user: " + targetUser + '\n';
                     result += "    pass: " + targetPass + '\n';
+                    result += "    trusted: " + std::string(trusted ? "true" : "false") + '\n';
                     result += "\n";
                 }
 
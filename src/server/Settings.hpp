@@ -20,8 +20,27 @@ struct Settings {
     std::string httpProtocol;
     bool httpDisplayInBrowser;
 
+    // threads kept ready for requests, more are started while a transfer keeps every one busy
+    unsigned workers = 8;
+    // listen backlog and number of accepting threads, more than one listens with SO_REUSEPORT
+    int backlog = 128;
+    unsigned acceptors = 1;
+
     std::vector<SyncTarget> syncTargets;
     int syncPeriod;
+    // masters may send file bodies unencrypted when their target is marked trusted
+    bool acceptTrustedSync = false;
+
+    // chunks in flight at the start of a transfer and the limit the window may grow to
+    unsigned transferWindow = 4;
+    unsigned transferWindowMax = 64;
+    // seconds an interrupted upload is kept for the client to resume it
+    unsigned sessionTtl = 86400;
+
+    // optional io_uring engine for stored files, transfers fall back to blocking calls without it
+    bool ioUring = false;
+    unsigned ioUringRings = 2;
+    bool ioUringSqPoll = false;
 
     bool wantHttp = false;
 
@@ -34,6 +53,8 @@ struct Settings {
         std::string targetAddress;
         std::string targetUser;
         std::string targetPass;
+        // private network, file bodies skip encryption and move with sendfile/splice
+        bool trusted = false;
     };
 };
 
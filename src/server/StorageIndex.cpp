@@ -0,0 +1,364 @@
+#include "StorageIndex.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <compare>
+#include <limits>
+#include <mutex>
+
+#include "utils.hpp"
+
+namespace {
+
+	// sorts the listed files, the name and hash break ties of the ordered field
+	struct Key {
+		// size or modification time, 0 when ordering by name
+		std::int64_t primary;
+		// stored form, '<' for '.'
+		std::string_view name;
+		std::string_view hash;
+		const Catalog::Record* record;
+	};
+
+	std::strong_ordering compareNames ( const std::string_view a, const std::string_view b ) {
+		const auto unmapped = [] ( const char c ) { return static_cast<unsigned char>(c == '<' ? '.' : c); };
+
+		return std::lexicographical_compare_three_way(a.begin(), a.end(), b.begin(), b.end(), [&] ( const char x, const char y ) {
+			return unmapped(x) <=> unmapped(y);
+		});
+	}
+
+	bool precedes ( const Key& a, const Key& b, const bool descending ) {
+		auto order = a.primary <=> b.primary;
+		if ( order == 0 )
+			order = compareNames(a.name, b.name);
+		if ( order == 0 )
+			order = a.hash <=> b.hash;
+
+		return descending ? order > 0 : order < 0;
+	}
+
+	// "<primary>/<hash>/<name>", file names cannot contain a '/'
+	std::string cursorOf ( const Key& key ) {
+		auto cursor = std::to_string(key.primary) + '/' + std::string(key.hash) + '/' + std::string(key.name);
+		std::ranges::replace(cursor, '<', '.');
+		return cursor;
+	}
+
+	/**
+	 * @brief The key points into `cursor`
+	 */
+	Key parseCursor ( const std::string& cursor ) {
+		const auto hashStart = cursor.find('/');
+		const auto nameStart = hashStart == std::string::npos ? hashStart : cursor.find('/', hashStart + 1);
+		if ( nameStart == std::string::npos )
+			throw std::runtime_error("StorageIndex: malformed cursor: " + cursor);
+
+		Key key{0, std::string_view(cursor).substr(nameStart + 1),
+		        std::string_view(cursor).substr(hashStart + 1, nameStart - hashStart - 1), nullptr};
+
+		const auto [end, error] = std::from_chars(cursor.data(), cursor.data() + hashStart, key.primary);
+		if ( error != std::errc() || end != cursor.data() + hashStart )
+			throw std::runtime_error("StorageIndex: malformed cursor: " + cursor);
+
+		return key;
+	}
+
+}
+
+StorageIndex::Pending::Pending ( StorageIndex& index, std::filesystem::path path )
+	: _index(index), _path(std::move(path)) {
+	std::filesystem::create_directories(_path.parent_path());
+
+	std::unique_lock lock(_index._mutex);
+
+	if ( const auto entries = _index._byHash.find(hashOf(_path)); entries != _index._byHash.end() ) {
+		const auto entry = std::ranges::find(entries->second, _path, &Entry::path);
+
+		// only an entry whose file went missing may be replaced
+		if ( entry != entries->second.end() && ( !entry->ready || std::filesystem::exists(_path) ) )
+			return;
+	}
+
+	_index._erase(_path, false);
+	_index._insert({_path, 0, {}, false});
+	_claimed = true;
+}
+
+StorageIndex::Pending::~Pending () {
+	if ( !_claimed )
+		return;
+
+	std::unique_lock lock(_index._mutex);
+	_index._erase(_path, true);
+}
+
+StorageIndex::StorageIndex ( const std::filesystem::path& directory, const std::filesystem::path& catalog,
+                             const FileTracker& readyFiles )
+	: _directory(std::filesystem::absolute(directory)), _catalog(catalog) {
+	if ( _catalog.trusted() )
+		_load(readyFiles);
+	else
+		_scan(readyFiles);
+}
+
+void StorageIndex::markReady ( const std::filesystem::path& path ) {
+	std::error_code error;
+	Entry entry{std::filesystem::absolute(path), std::filesystem::file_size(path, error), {}, true};
+	entry.modified = std::filesystem::last_write_time(path, error);
+
+	std::unique_lock lock(_mutex);
+	_erase(entry.path, false);
+
+	entry.slot = _catalog.put(entry.path.filename().string(), hashOf(entry.path), entry.size,
+	                          entry.modified.time_since_epoch().count(), entry.path.parent_path() == _directory);
+	_insert(std::move(entry));
+}
+
+void StorageIndex::remove ( const std::filesystem::path& path ) {
+	std::unique_lock lock(_mutex);
+	_erase(std::filesystem::absolute(path), false);
+}
+
+bool StorageIndex::relocate ( const std::filesystem::path& from, const std::filesystem::path& to ) {
+	std::unique_lock lock(_mutex);
+
+	const auto entries = _byHash.find(hashOf(from));
+	if ( entries == _byHash.end() )
+		return false;
+
+	const auto entry = std::ranges::find(entries->second, std::filesystem::absolute(from), &Entry::path);
+	if ( entry == entries->second.end() )
+		return false;
+
+	entry->path = std::filesystem::absolute(to);
+	if ( entry->slot != noSlot )
+		_catalog.setFlat(entry->slot, entry->path.parent_path() == _directory);
+	return true;
+}
+
+std::optional<StorageIndex::Entry> StorageIndex::find ( const std::string& hash ) const {
+	std::shared_lock lock(_mutex);
+
+	const auto entries = _byHash.find(hash);
+	if ( entries == _byHash.end() )
+		return std::nullopt;
+
+	const auto ready = std::ranges::find_if(entries->second, &Entry::ready);
+
+	return ready != entries->second.end() ? *ready : entries->second.front();
+}
+
+std::set<std::filesystem::path> StorageIndex::paths ( const std::set<std::string>& hashes ) const {
+	std::set<std::filesystem::path> paths;
+	std::shared_lock lock(_mutex);
+
+	for ( const auto& hash: hashes ) {
+		if ( const auto entries = _byHash.find(hash); entries != _byHash.end() )
+			for ( const auto& entry: entries->second )
+				paths.emplace(entry.path);
+	}
+
+	return paths;
+}
+
+std::vector<StorageIndex::Entry> StorageIndex::named ( const std::string& fileName ) const {
+	std::vector<Entry> files;
+	std::shared_lock lock(_mutex);
+
+	const auto hashes = _hashesByName.find(fileName);
+	if ( hashes == _hashesByName.end() )
+		return files;
+
+	for ( const auto& hash: hashes->second ) {
+		for ( const auto& entry: _byHash.at(hash) )
+			if ( entry.ready && nameOf(entry.path) == fileName )
+				files.push_back(entry);
+	}
+
+	return files;
+}
+
+std::vector<FileInfo> StorageIndex::list () const {
+	std::vector<FileInfo> files;
+	std::shared_lock lock(_mutex);
+
+	for ( std::uint64_t slot = 0; slot < _catalog.slots(); ++slot ) {
+		if ( const auto* record = _catalog.at(slot) )
+			files.push_back(_infoOf(*record));
+	}
+
+	return files;
+}
+
+StorageIndex::Listing StorageIndex::list ( const ListQuery& query, const std::string& after, const std::size_t count ) const {
+	Listing listing;
+	if ( count == 0 )
+		return listing;
+
+	const auto cursor = after.empty() ? std::nullopt : std::optional(parseCursor(after));
+	const auto ticks = [] ( const std::int64_t seconds ) {
+		return std::filesystem::file_time_type::clock::from_sys(std::chrono::sys_seconds(std::chrono::seconds(seconds))).
+		       time_since_epoch().count();
+	};
+	const auto since = query.since == std::numeric_limits<std::int64_t>::min() ? query.since : ticks(query.since);
+	const auto until = query.until == std::numeric_limits<std::int64_t>::max() ? query.until : ticks(query.until);
+
+	const auto before = [&] ( const Key& a, const Key& b ) { return precedes(a, b, query.descending); };
+
+	// the first `count` found so far and then some, files behind the threshold can no longer make it
+	std::vector<Key> kept;
+	std::optional<Key> threshold;
+	const auto keepFirst = [&] {
+		std::ranges::nth_element(kept, kept.begin() + static_cast<std::ptrdiff_t>(count) - 1, before);
+		kept.resize(count);
+		threshold = kept.back();
+	};
+
+	std::shared_lock lock(_mutex);
+
+	for ( std::uint64_t slot = 0; slot < _catalog.slots(); ++slot ) {
+		const auto* record = _catalog.at(slot);
+
+		if ( !record || record->size < query.minSize || record->size > query.maxSize ||
+		     record->modified < since || record->modified > until )
+			continue;
+
+		const auto name = _catalog.nameOf(*record);
+		const Key key{
+			query.order == ListQuery::Order::size ? static_cast<std::int64_t>(record->size) :
+			query.order == ListQuery::Order::date ? record->modified : 0,
+			name.substr(0, name.rfind('.')), Catalog::hashOf(*record), record
+		};
+
+		if ( ( cursor && !before(*cursor, key) ) || ( threshold && !before(key, *threshold) ) )
+			continue;
+
+		kept.push_back(key);
+		if ( kept.size() == 2 * count )
+			keepFirst();
+	}
+
+	if ( kept.size() > count )
+		keepFirst();
+	std::ranges::sort(kept, before);
+
+	listing.files.reserve(kept.size());
+	for ( const auto& key: kept )
+		listing.files.push_back(_infoOf(*key.record));
+
+	if ( !kept.empty() )
+		listing.cursor = cursorOf(kept.back());
+
+	return listing;
+}
+
+void StorageIndex::_insert ( Entry entry ) {
+	const auto hash = hashOf(entry.path);
+
+	_hashesByName[nameOf(entry.path)].insert(hash);
+	_byHash[hash].push_back(std::move(entry));
+}
+
+void StorageIndex::_erase ( const std::filesystem::path& path, const bool onlyPending ) {
+	const auto hash = hashOf(path);
+
+	const auto entries = _byHash.find(hash);
+	if ( entries == _byHash.end() )
+		return;
+
+	const auto erased = std::erase_if(entries->second, [&] ( const Entry& entry ) {
+		if ( entry.path != path || ( onlyPending && entry.ready ) )
+			return false;
+
+		if ( entry.slot != noSlot )
+			_catalog.erase(entry.slot);
+		return true;
+	});
+
+	if ( erased == 0 )
+		return;
+
+	if ( entries->second.empty() )
+		_byHash.erase(entries);
+
+	// the name keeps the hash while another file of the same name and content is left
+	if ( const auto name = _hashesByName.find(nameOf(path)); name != _hashesByName.end() ) {
+		const auto stillNamed = _byHash.contains(hash) && std::ranges::any_of(_byHash.at(hash), [&] ( const Entry& entry ) {
+			return nameOf(entry.path) == name->first;
+		});
+
+		if ( !stillNamed )
+			name->second.erase(hash);
+		if ( name->second.empty() )
+			_hashesByName.erase(name);
+	}
+}
+
+FileInfo StorageIndex::_infoOf ( const Catalog::Record& record ) const {
+	// the stored name without the hash, with its '.' back
+	auto name = std::string(_catalog.nameOf(record));
+	name.erase(name.rfind('.'));
+	std::ranges::replace(name, '<', '.');
+
+	const auto ftime = std::filesystem::file_time_type(std::filesystem::file_time_type::duration(record.modified));
+
+	return {
+		std::move(name), std::string(Catalog::hashOf(record)), record.size,
+		std::chrono::clock_cast<std::chrono::utc_clock>(ftime)
+	};
+}
+
+void StorageIndex::_load ( const FileTracker& readyFiles ) {
+	for ( std::uint64_t slot = 0; slot < _catalog.slots(); ++slot ) {
+		const auto* record = _catalog.at(slot);
+		if ( !record )
+			continue;
+
+		const auto hash = std::string(Catalog::hashOf(*record));
+
+		if ( !readyFiles.contains(hash) ) {
+			_catalog.erase(slot);
+			continue;
+		}
+
+		const auto path = ( record->flat ? _directory : _directory / Utils::FS::fanOut(hash) ) / _catalog.nameOf(*record);
+
+		if ( record->flat )
+			_flat.push_back(path);
+
+		_insert({
+			path, record->size, std::filesystem::file_time_type(std::filesystem::file_time_type::duration(record->modified)),
+			true, slot
+		});
+	}
+
+	Utils::log("StorageIndex: loaded " + std::to_string(_byHash.size()) + " stored files from the catalog");
+}
+
+void StorageIndex::_scan ( const FileTracker& readyFiles ) {
+	_catalog.clear();
+
+	for ( const auto& file: std::filesystem::recursive_directory_iterator(_directory) ) {
+		if ( !file.is_regular_file() || file.path().extension().empty() )
+			continue;
+
+		const auto& path = file.path();
+		const auto hash = hashOf(path);
+		const bool flat = path.parent_path() == _directory;
+
+		if ( flat )
+			_flat.push_back(path);
+
+		Entry entry{path, file.file_size(), file.last_write_time(), readyFiles.contains(hash)};
+
+		if ( entry.ready )
+			entry.slot = _catalog.put(path.filename().string(), hash, entry.size, entry.modified.time_since_epoch().count(),
+			                          flat);
+
+		_insert(std::move(entry));
+	}
+
+	Utils::log("StorageIndex: indexed " + std::to_string(_byHash.size()) + " stored files, catalog rebuilt");
+}
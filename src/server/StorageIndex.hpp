@@ -0,0 +1,163 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Catalog.hpp"
+#include "FileTracker.hpp"
+#include "../shared/FileInfo.hpp"
+#include "../shared/ListQuery.hpp"
+
+/**
+ * @brief In-memory index of the stored files by hash
+ *
+ * Loaded from the catalog of the complete files at startup, storage/ is only scanned when the
+ * catalog was not closed cleanly. Uploads and removals keep both current, so looking up or
+ * listing stored files never walks the directory. Stored files are named
+ * "<name with '.' as '<'>.<hash>" and live in fan-out directories below it (see Utils::FS::storagePath),
+ * the same content may be stored under several names.
+ */
+class StorageIndex {
+public:
+	static constexpr std::uint64_t noSlot = UINT64_MAX;
+
+	struct Entry {
+		std::filesystem::path path;
+		std::uint64_t size = 0;
+		std::filesystem::file_time_type modified;
+		// false while the upload is still writing the file
+		bool ready = false;
+		// record in the catalog, complete files only
+		std::uint64_t slot = noSlot;
+	};
+
+	struct Listing {
+		std::vector<FileInfo> files;
+		// continues behind the last of the files, see ListQuery::after
+		std::string cursor;
+	};
+
+	/**
+	 * @brief Lists an upload's file as not ready and drops it again unless the upload completed
+	 *
+	 * Creates the file's fan-out directories, uploads write into them right after. Another upload
+	 * of the same path, still running or just completed, keeps it and this one is refused.
+	 */
+	class Pending {
+	public:
+		Pending ( StorageIndex& index, std::filesystem::path path );
+
+		~Pending ();
+
+		Pending ( const Pending& ) = delete;
+
+		Pending& operator= ( const Pending& ) = delete;
+
+		/**
+		 * @return false if another upload has the path, the file must then be left alone
+		 */
+		[[nodiscard]] bool claimed () const { return _claimed; }
+
+	private:
+		StorageIndex& _index;
+		const std::filesystem::path _path;
+		bool _claimed = false;
+	};
+
+	/**
+	 * @param catalog where the catalog of the complete files is kept
+	 * @param readyFiles hashes of the complete stored files
+	 */
+	StorageIndex ( const std::filesystem::path& directory, const std::filesystem::path& catalog,
+	               const FileTracker& readyFiles );
+
+	StorageIndex ( const StorageIndex& ) = delete;
+
+	StorageIndex& operator= ( const StorageIndex& ) = delete;
+
+	[[nodiscard]] Pending pending ( const std::filesystem::path& path ) { return {*this, path}; }
+
+	/**
+	 * @brief Records the file as complete, with its final size and modification time
+	 */
+	void markReady ( const std::filesystem::path& path );
+
+	void remove ( const std::filesystem::path& path );
+
+	/**
+	 * @brief Points the entry of a stored file moved to another directory at its new path
+	 * @return false if there is no entry for `from`, it was removed meanwhile
+	 */
+	bool relocate ( const std::filesystem::path& from, const std::filesystem::path& to );
+
+	/**
+	 * @return stored files found directly in the storage directory at startup, from before the fan-out layout
+	 */
+	[[nodiscard]] const std::vector<std::filesystem::path>& flat () const { return _flat; }
+
+	/**
+	 * @return a stored file with this hash, a ready one if there is any
+	 */
+	[[nodiscard]] std::optional<Entry> find ( const std::string& hash ) const;
+
+	/**
+	 * @return paths of the stored files with these hashes
+	 */
+	[[nodiscard]] std::set<std::filesystem::path> paths ( const std::set<std::string>& hashes ) const;
+
+	/**
+	 * @return ready files uploaded under `fileName`, in the form the storage directory uses
+	 */
+	[[nodiscard]] std::vector<Entry> named ( const std::string& fileName ) const;
+
+	/**
+	 * @return the complete stored files as the catalog has them
+	 */
+	[[nodiscard]] std::vector<FileInfo> list () const;
+
+	/**
+	 * @brief Up to `count` complete files passing the query's filters, in its order, behind the cursor `after`
+	 *
+	 * One pass over the catalog that keeps only the first `count` matches, so the memory it
+	 * takes does not grow with the number of stored files. The query's offset and limit are
+	 * left to the caller.
+	 * @throws std::runtime_error on a malformed cursor
+	 */
+	[[nodiscard]] Listing list ( const ListQuery& query, const std::string& after, std::size_t count ) const;
+
+	static std::string hashOf ( const std::filesystem::path& path ) { return path.extension().string().substr(1); }
+
+	static std::string nameOf ( const std::filesystem::path& path ) { return path.stem().string(); }
+
+private:
+	const std::filesystem::path _directory;
+	mutable std::shared_mutex _mutex;
+	// written under the exclusive lock
+	Catalog _catalog;
+	// usually a single file per hash
+	std::unordered_map<std::string, std::vector<Entry>> _byHash;
+	std::unordered_map<std::string, std::set<std::string>> _hashesByName;
+	std::vector<std::filesystem::path> _flat;
+
+	/**
+	 * @brief Caller holds the mutex exclusively
+	 */
+	void _insert ( Entry entry );
+
+	/**
+	 * @param onlyPending leave the entry alone if its upload completed
+	 */
+	void _erase ( const std::filesystem::path& path, bool onlyPending );
+
+	[[nodiscard]] FileInfo _infoOf ( const Catalog::Record& record ) const;
+
+	void _load ( const FileTracker& readyFiles );
+
+	void _scan ( const FileTracker& readyFiles );
+};
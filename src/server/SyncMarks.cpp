@@ -0,0 +1,9 @@
+#include "SyncMarks.hpp"
+
+void SyncMarks::adopt ( FileTracker& readyFiles, FileTracker& markedForRemoval, const std::set<std::string>& hashes ) {
+	if ( hashes.empty() )
+		return;
+
+	readyFiles.remove(hashes);
+	markedForRemoval.add(hashes);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <set>
+#include <string>
+
+#include "FileTracker.hpp"
+
+namespace SyncMarks {
+
+	/**
+	 * @brief Takes over removal marks a sync peer has: the hashes stop being ready here and are marked here too
+	 *
+	 * Both peers then hold the same marks, so the next round neither offers the removed file
+	 * back to the peer nor finds the marks differing again.
+	 */
+	void adopt ( FileTracker& readyFiles, FileTracker& markedForRemoval, const std::set<std::string>& hashes );
+
+}
@@ -0,0 +1,198 @@
+#include "UploadSessions.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <sodium.h>
+
+#include "utils.hpp"
+#include "includes/toml.hpp"
+#include "../shared/utils.hpp"
+
+UploadSessions::UploadSessions ( std::filesystem::path directory, const std::chrono::seconds ttl )
+	: _directory(std::move(directory)), _ttl(ttl) {
+	for ( const auto& file: std::filesystem::directory_iterator(_directory) ) {
+		if ( file.path().extension() != ".toml" )
+			continue;
+
+		try {
+			const auto metadata = toml::parse_file(file.path().string());
+
+			Entry entry;
+			entry.hash = metadata["hash"].value_or<std::string>("");
+			entry.fileName = metadata["filename"].value_or<std::string>("");
+			entry.size = metadata["size"].value_or<int64_t>(0);
+			entry.committed = metadata["committed"].value_or<int64_t>(0);
+			entry.lastUse = std::chrono::file_clock::to_sys(std::filesystem::last_write_time(file.path()));
+
+			_sessions.emplace(file.path().stem().string(), std::move(entry));
+		}
+		catch ( const toml::parse_error& ) {
+			Utils::elog("UploadSessions: dropping unreadable session " + file.path().string());
+			_remove(file.path().stem().string());
+		}
+	}
+
+	// part files whose session is gone and interrupted metadata writes
+	for ( const auto& file: std::filesystem::directory_iterator(_directory) ) {
+		if ( file.path().extension() == ".tmp" ||
+		     ( file.path().extension() == ".part" && !_sessions.contains(file.path().stem().string()) ) )
+			std::filesystem::remove(file.path());
+	}
+
+	Utils::log("UploadSessions: " + std::to_string(_sessions.size()) + " interrupted uploads can be resumed");
+
+	_collector = std::jthread([this] ( const std::stop_token& stop ) { _collect(stop); });
+}
+
+std::optional<UploadSessions::Session> UploadSessions::claim ( const std::string& id, const std::string& hash,
+                                                               const std::string& fileName, const std::uint64_t size,
+                                                               ConnectionServer& connection ) {
+	std::unique_lock lock(_mutex);
+
+	const auto uploads = [&] ( const Entry& entry ) {
+		return entry.hash == hash && entry.fileName == fileName && entry.size == size;
+	};
+
+	auto session = _sessions.find(id);
+
+	if ( session != _sessions.end() && !uploads(session->second) )
+		session = _sessions.end();
+
+	// a client started again without its session id, e.g. after a crash
+	if ( session == _sessions.end() ) {
+		session = std::ranges::find_if(_sessions, [&] ( const auto& candidate ) {
+			return !candidate.second.owner && uploads(candidate.second);
+		});
+	}
+
+	if ( session == _sessions.end() ) {
+		unsigned char idBytes[16];
+		randombytes_buf(idBytes, sizeof idBytes);
+
+		Entry entry;
+		entry.hash = hash;
+		entry.fileName = fileName;
+		entry.size = size;
+
+		session = _sessions.emplace(binToHex(idBytes, sizeof idBytes), std::move(entry)).first;
+	}
+
+	const auto sessionId = session->first;
+
+	// the previous connection is most likely still waiting for data that will never come
+	if ( session->second.owner ) {
+		session->second.owner->interrupt();
+
+		const auto handedOver = _changed.wait_for(lock, handOverTimeout, [&] {
+			const auto current = _sessions.find(sessionId);
+			return current == _sessions.end() || !current->second.owner;
+		});
+
+		session = _sessions.find(sessionId);
+
+		if ( !handedOver || session == _sessions.end() )
+			return std::nullopt;
+	}
+
+	session->second.owner = &connection;
+	session->second.lastUse = Clock::now();
+	_save(sessionId, session->second);
+
+	return Session{sessionId, _partPath(sessionId), session->second.committed};
+}
+
+void UploadSessions::commit ( const std::string& id, const std::uint64_t offset ) {
+	std::lock_guard lock(_mutex);
+
+	const auto session = _sessions.find(id);
+	if ( session == _sessions.end() )
+		return;
+
+	session->second.committed = offset;
+	session->second.lastUse = Clock::now();
+	_save(id, session->second);
+}
+
+void UploadSessions::release ( const std::string& id, const std::uint64_t offset ) {
+	{
+		std::lock_guard lock(_mutex);
+
+		const auto session = _sessions.find(id);
+		if ( session == _sessions.end() )
+			return;
+
+		session->second.committed = offset;
+		session->second.owner = nullptr;
+		session->second.lastUse = Clock::now();
+		_save(id, session->second);
+
+		Utils::log("UploadSessions: upload of " + session->second.fileName + " interrupted at " +
+		           humanReadableSize(offset) + ", session " + id + " can be resumed");
+	}
+	_changed.notify_all();
+}
+
+void UploadSessions::finish ( const std::string& id ) {
+	{
+		std::lock_guard lock(_mutex);
+		_sessions.erase(id);
+		_remove(id);
+	}
+	_changed.notify_all();
+}
+
+void UploadSessions::_collect ( const std::stop_token& stop ) {
+	const auto interval = std::min<std::chrono::seconds>(_ttl, std::chrono::minutes(10));
+
+	std::unique_lock lock(_mutex);
+
+	while ( !_changed.wait_for(lock, stop, interval, [&stop] { return stop.stop_requested(); }) ) {
+		const auto now = Clock::now();
+
+		for ( auto session = _sessions.begin(); session != _sessions.end(); ) {
+			if ( session->second.owner || now - session->second.lastUse < _ttl ) {
+				++session;
+				continue;
+			}
+
+			Utils::log("UploadSessions: session " + session->first + " of " + session->second.fileName + " expired");
+			_remove(session->first);
+			session = _sessions.erase(session);
+		}
+	}
+}
+
+std::filesystem::path UploadSessions::_partPath ( const std::string& id ) const {
+	return std::filesystem::absolute(_directory / ( id + ".part" ));
+}
+
+std::filesystem::path UploadSessions::_metadataPath ( const std::string& id ) const { return _directory / ( id + ".toml" ); }
+
+void UploadSessions::_save ( const std::string& id, const Entry& entry ) const {
+	const toml::table metadata{
+		{"hash", entry.hash},
+		{"filename", entry.fileName},
+		{"size", static_cast<int64_t>(entry.size)},
+		{"committed", static_cast<int64_t>(entry.committed)}
+	};
+
+	const auto path = _metadataPath(id);
+	auto temporary = path;
+	temporary += ".tmp";
+
+	std::ofstream out(temporary, std::ios::trunc);
+	out << metadata;
+	out.close();
+
+	if ( !out ) {
+		Utils::elog("UploadSessions: could not record session " + id);
+		return;
+	}
+
+	std::filesystem::rename(temporary, path);
+}
+
+void UploadSessions::_remove ( const std::string& id ) const {
+	std::filesystem::remove(_metadataPath(id));
+	std::filesystem::remove(_partPath(id));
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include "ConnectionServer.hpp"
+
+/**
+ * @brief Uploads in progress that outlive their connection
+ *
+ * A resumable upload writes into a part file in the staging directory and records how far
+ * the part file is known to be complete. When the connection breaks, the client reconnects
+ * with the session id and continues from that offset. Sessions nobody resumed within the
+ * TTL are deleted together with their part file.
+ */
+class UploadSessions {
+public:
+	struct Session {
+		std::string id;
+		std::filesystem::path part;
+		std::uint64_t committed;
+	};
+
+	UploadSessions ( std::filesystem::path directory, std::chrono::seconds ttl );
+
+	UploadSessions ( const UploadSessions& ) = delete;
+
+	UploadSessions& operator= ( const UploadSessions& ) = delete;
+
+	/**
+	 * @brief Claims the upload of a file for `connection`
+	 *
+	 * Resumes session `id` if it uploads the same file, else an idle session of the same file,
+	 * else opens a new one. A connection still holding the session is interrupted, its handler
+	 * hands the session back with what it wrote.
+	 * @return nothing if the session was not handed back in time
+	 */
+	std::optional<Session> claim ( const std::string& id, const std::string& hash, const std::string& fileName,
+	                               std::uint64_t size, ConnectionServer& connection );
+
+	/**
+	 * @brief Records that the part file is complete up to `offset`
+	 */
+	void commit ( const std::string& id, std::uint64_t offset );
+
+	/**
+	 * @brief Hands the session back after its connection broke, it can be resumed from `offset`
+	 */
+	void release ( const std::string& id, std::uint64_t offset );
+
+	/**
+	 * @brief Forgets the session once its part file became the stored file
+	 */
+	void finish ( const std::string& id );
+
+private:
+	using Clock = std::chrono::system_clock;
+
+	struct Entry {
+		std::string hash;
+		std::string fileName;
+		std::uint64_t size = 0;
+		std::uint64_t committed = 0;
+		// connection currently uploading, nullptr while the session waits for a resume
+		ConnectionServer* owner = nullptr;
+		Clock::time_point lastUse;
+	};
+
+	// how long a claim waits for the interrupted connection to hand the session back
+	static constexpr std::chrono::seconds handOverTimeout{30};
+
+	const std::filesystem::path _directory;
+	const std::chrono::seconds _ttl;
+
+	std::mutex _mutex;
+	std::condition_variable_any _changed;
+	std::map<std::string, Entry> _sessions;
+	// declared last, it works on everything above
+	std::jthread _collector;
+
+	/**
+	 * @brief Deletes the sessions that were not used within the TTL
+	 */
+	void _collect ( const std::stop_token& stop );
+
+	[[nodiscard]] std::filesystem::path _partPath ( const std::string& id ) const;
+
+	[[nodiscard]] std::filesystem::path _metadataPath ( const std::string& id ) const;
+
+	void _save ( const std::string& id, const Entry& entry ) const;
+
+	void _remove ( const std::string& id ) const;
+};
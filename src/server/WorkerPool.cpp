@@ -0,0 +1,96 @@
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+#include <string>
+
+#include "utils.hpp"
+
+WorkerPool::WorkerPool ( const unsigned threads ) {
+	std::lock_guard lock(_mutex);
+
+	for ( unsigned i = 0; i < std::max(1u, threads); ++i )
+		_threads.emplace_back(&WorkerPool::_run, this, false);
+}
+
+WorkerPool::~WorkerPool () {
+	{
+		std::lock_guard lock(_mutex);
+		_stopping = true;
+	}
+	_available.notify_all();
+
+	// a spare exiting meanwhile finds itself gone from _threads and leaves the join to this loop
+	while ( true ) {
+		std::list<std::thread> threads;
+
+		{
+			std::lock_guard lock(_mutex);
+			threads.splice(threads.end(), _threads);
+			threads.splice(threads.end(), _finished);
+		}
+
+		if ( threads.empty() )
+			return;
+
+		for ( auto& thread: threads )
+			thread.join();
+	}
+}
+
+void WorkerPool::submit ( std::function<void()> task ) {
+	std::list<std::thread> finished;
+
+	{
+		std::lock_guard lock(_mutex);
+		_tasks.push_back(std::move(task));
+		finished.swap(_finished);
+
+		// every thread is busy, the task must not wait for a transfer to end
+		if ( _tasks.size() > _idle )
+			_threads.emplace_back(&WorkerPool::_run, this, true);
+	}
+	_available.notify_one();
+
+	for ( auto& thread: finished )
+		thread.join();
+}
+
+unsigned WorkerPool::size () {
+	std::lock_guard lock(_mutex);
+	return static_cast<unsigned>(_threads.size());
+}
+
+void WorkerPool::_run ( const bool spare ) {
+	std::unique_lock lock(_mutex);
+
+	while ( true ) {
+		const auto ready = [this] { return _stopping || !_tasks.empty(); };
+
+		++_idle;
+		if ( spare )
+			_available.wait_for(lock, spareIdleTimeout, ready);
+		else
+			_available.wait(lock, ready);
+		--_idle;
+
+		if ( _tasks.empty() )
+			break;
+
+		auto task = std::move(_tasks.front());
+		_tasks.pop_front();
+
+		lock.unlock();
+
+		try { task(); }
+		catch ( const std::exception& e ) { Utils::elog("WorkerPool: task failed: " + std::string(e.what())); }
+
+		lock.lock();
+	}
+
+	if ( !spare || _stopping )
+		return;
+
+	if ( const auto self = std::ranges::find(_threads, std::this_thread::get_id(), &std::thread::get_id);
+		self != _threads.end() )
+		_finished.splice(_finished.end(), _threads, self);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <thread>
+
+/**
+ * @brief Threads running queued tasks in order, more are started while every one is busy
+ *
+ * The handlers block for the whole transfer, so a fixed number of threads would let a few
+ * slow clients hold up everyone else. Threads started beyond the kept ones exit once they
+ * found no task for a while. On destruction the queue is worked off and every thread joined,
+ * so open transfers finish before the server exits.
+ */
+class WorkerPool {
+public:
+	/**
+	 * @param threads kept running while there is nothing to do
+	 */
+	explicit WorkerPool ( unsigned threads );
+
+	~WorkerPool ();
+
+	WorkerPool ( const WorkerPool& ) = delete;
+
+	WorkerPool& operator= ( const WorkerPool& ) = delete;
+
+	void submit ( std::function<void()> task );
+
+	/**
+	 * @return threads running at the moment
+	 */
+	[[nodiscard]] unsigned size ();
+
+private:
+	// how long a thread beyond the kept ones waits for a task before it exits
+	static constexpr std::chrono::seconds spareIdleTimeout{30};
+
+	std::mutex _mutex;
+	std::condition_variable _available;
+	std::deque<std::function<void()>> _tasks;
+	// threads waiting for a task
+	std::size_t _idle = 0;
+	bool _stopping = false;
+	std::list<std::thread> _threads;
+	// spare threads that exited, joined by the next submit
+	std::list<std::thread> _finished;
+
+	/**
+	 * @param spare started beyond the kept threads, exits when idle
+	 */
+	void _run ( bool spare );
+};
@@ -1,38 +1,42 @@
-#include <condition_variable>
-#include <iostream>
+#include <cerrno>
+#include <chrono>
+#include <thread>
+#include <sys/socket.h>
 
 #include "ClientInfo.hpp"
+#include "ConnectionHandler.hpp"
 #include "utils.hpp"
 
-inline void accepter ( std::condition_variable& callBack,
-                       const int& serverSocket,
-                       ClientInfo& acceptedClient,
-                       bool& newClientAccepted,
+/**
+ * @brief Accepts clients on `serverSocket` and hands them straight to the connection handler
+ *
+ * Several acceptors may run, each on its own SO_REUSEPORT socket.
+ */
+inline void accepter ( const int serverSocket,
+                       ConnectionHandler& connectionHandler,
                        const bool& turnOff ) {
 	while ( true ) {
-		if ( turnOff )
-			return;
+		sockaddr_in clientAddress{};
+		socklen_t clientAddressSize = sizeof( clientAddress );
 
-		if ( !newClientAccepted ) {
-			sockaddr_in clientAddress{};
-			socklen_t clientAddressSize = sizeof( clientAddress );
+		const auto socket = accept4(serverSocket, reinterpret_cast<struct sockaddr*>(&clientAddress),
+		                            &clientAddressSize, SOCK_CLOEXEC);
 
-			const auto socket = accept(serverSocket, reinterpret_cast<struct sockaddr*>(&clientAddress),
-			                                &clientAddressSize);
-
-			if ( turnOff )
-				return;
+		if ( turnOff )
+			return;
 
-			if ( socket < 0 )
-				continue;
+		if ( socket < 0 ) {
+			// out of descriptors, give the clients being served a moment to finish
+			if ( errno == EMFILE || errno == ENFILE )
+				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			continue;
+		}
 
-			acceptedClient = ClientInfo();
-			acceptedClient.init(ClientInfo::convertAddrToString(clientAddress), socket);
+		ClientInfo acceptedClient;
+		acceptedClient.init(ClientInfo::convertAddrToString(clientAddress), socket);
 
-			Utils::log("main: accepted client number " + std::to_string(acceptedClient.getSocket()) + " with addr " + acceptedClient.getIp());
+		Utils::log("main: accepted client number " + std::to_string(acceptedClient.getSocket()) + " with addr " + acceptedClient.getIp());
 
-			newClientAccepted = true;
-			callBack.notify_one();
-		}
+		connectionHandler.addClient(acceptedClient);
 	}
 }
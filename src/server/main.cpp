@@ -38,6 +38,8 @@ int main () {
 
 	std::filesystem::create_directory("storage");
 	std::filesystem::create_directory("links");
+	std::filesystem::create_directory("chunks");
+	std::filesystem::create_directory("staging");
 
 	const Settings settings = Settings::loadFromFile("settings/settings.toml");
 
@@ -45,14 +47,31 @@ int main () {
 
 	Utils::log(settings.toString());
 
-	const int serverSocket = socket(AF_INET, SOCK_STREAM, 0);
-
 	sockaddr_in serverAddress = {AF_INET, htons(6998), {INADDR_ANY}, {0}};
 
-	if ( bind(serverSocket, reinterpret_cast<sockaddr*>(&serverAddress), sizeof( serverAddress )) < 0 ) {
-		std::cerr << "main: could not bind server socket" << std::endl;
-		close(serverSocket);
-		return 1;
+	// one listening socket per acceptor, with SO_REUSEPORT the kernel spreads new connections over them
+	std::vector<int> serverSockets;
+
+	for ( unsigned i = 0; i < settings.acceptors; ++i ) {
+		const int serverSocket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		constexpr int enable = 1;
+
+		if ( settings.acceptors > 1 &&
+		     setsockopt(serverSocket, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof( enable )) < 0 ) {
+			std::cerr << "main: could not enable SO_REUSEPORT" << std::endl;
+			close(serverSocket);
+			std::ranges::for_each(serverSockets, close);
+			return 1;
+		}
+
+		if ( bind(serverSocket, reinterpret_cast<sockaddr*>(&serverAddress), sizeof( serverAddress )) < 0 ) {
+			std::cerr << "main: could not bind server socket" << std::endl;
+			close(serverSocket);
+			std::ranges::for_each(serverSockets, close);
+			return 1;
+		}
+
+		serverSockets.push_back(serverSocket);
 	}
 
 	std::mutex mutex;
@@ -61,19 +80,14 @@ int main () {
 
 	std::thread terminalThread(terminal, std::ref(callBack), std::ref(turnOff));
 
-	listen(serverSocket, 10);
+	ConnectionHandler connectionHandler(settings);
 
-	bool newClientAccepted = false;
-	ClientInfo acceptedClient;
+	std::vector<std::thread> accepterThreads;
 
-	std::thread accepterThread(
-		accepter,
-		std::ref(callBack),
-		std::ref(serverSocket),
-		std::ref(acceptedClient),
-		std::ref(newClientAccepted),
-		std::ref(turnOff)
-		);
+	for ( const auto serverSocket: serverSockets ) {
+		listen(serverSocket, settings.backlog);
+		accepterThreads.emplace_back(accepter, serverSocket, std::ref(connectionHandler), std::ref(turnOff));
+	}
 
 	std::thread httpThread;
 
@@ -81,7 +95,8 @@ int main () {
 		HTTPFileServer httpFileServer(
 		turnOff,
 		std::filesystem::absolute(std::filesystem::current_path() / "links").string(),
-		settings.httpDisplayInBrowser
+		settings.httpDisplayInBrowser,
+		connectionHandler.storage()
 		);
 
 		httpThread = httpFileServer.run(settings.authUser, settings.authPass, settings.httpAddress);
@@ -89,22 +104,12 @@ int main () {
 		Utils::log("main: http server started");
 	}
 
-	ConnectionHandler connectionHandler(settings);
-
 	Utils::log("main: entering main loop, server started");
 
 	while ( true ) {
 		std::unique_lock lock(mutex);
 		callBack.wait(lock);
 
-		if ( newClientAccepted ) {
-			if ( !newClientAccepted )
-				continue;
-
-			connectionHandler.addClient(acceptedClient);
-			newClientAccepted = false;
-		}
-
 		if ( stopRequested )
 			turnOff = true;
 
@@ -123,9 +128,12 @@ int main () {
 			connectionHandler.requestStop();
 
 			Utils::log("main: terminal closed");
-			shutdown(serverSocket, SHUT_RDWR);
-			close(serverSocket);
-			accepterThread.join();
+			for ( const auto serverSocket: serverSockets ) {
+				shutdown(serverSocket, SHUT_RDWR);
+				close(serverSocket);
+			}
+			for ( auto& accepterThread: accepterThreads )
+				accepterThread.join();
 			Utils::log("main: accepter closed");
 			if ( settings.wantHttp )
 				httpThread.join();
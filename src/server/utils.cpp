@@ -1,6 +1,7 @@
 #include "utils.hpp"
 
 #include <algorithm>
+#include <cctype>
 #include <iostream>
 #include <mutex>
 #include <set>
@@ -36,56 +37,37 @@ namespace Utils {
     namespace FS {
 
 
-        std::set<std::string> findCorrespondingFileNames ( const std::set<std::string>& hash ) {
-            const auto directory = std::filesystem::current_path() / "storage";
-
-            std::set<std::string> result;
-
-            for ( const auto& entry: std::filesystem::directory_iterator(directory) ) {
-                if ( hash.contains(entry.path().extension().string().substr(1)) ) {
-                    result.emplace(entry.path().filename().string());
-                }
-            }
-
-            return result;
-        }
-
-        std::optional<std::string> findCorrespondingFileName ( const std::string& hash ) {
-            const auto directory = std::filesystem::current_path() / "storage";
-
-            for ( const auto& entry: std::filesystem::directory_iterator(directory) ) {
-                if ( hash == entry.path().extension().string().substr(1) ) {
-                    return entry.path().filename().string();
-                }
-            }
-
-            return {};
-        }
-
         std::set<std::string> getLocalFileHashes () {
             std::set<std::string> hashes;
 
             for ( const auto directory = std::filesystem::current_path() / "storage";
-                const auto& file: std::filesystem::directory_iterator(directory) ) {
+                const auto& file: std::filesystem::recursive_directory_iterator(directory) ) {
 
-                hashes.emplace(file.path().extension().string().substr(1));
+                if ( file.is_regular_file() )
+                    hashes.emplace(file.path().extension().string().substr(1));
             }
 
             return hashes;
         }
 
-        std::optional<std::string> getLocalRawFileName ( std::string filename ) {
+        std::filesystem::path fanOut ( std::string_view hash ) {
+            // tagged hashes fan out by their digits, not by the tag
+            if ( const auto tag = hash.find('-'); tag != std::string_view::npos )
+                hash.remove_prefix(tag + 1);
 
-            std::ranges::replace(filename, '.', '<');
+            std::string digits = "____";
 
-            for ( const auto directory = std::filesystem::current_path() / "storage";
-                const auto& file: std::filesystem::directory_iterator(directory) ) {
+            for ( size_t i = 0; i < std::min<size_t>(digits.size(), hash.size()); ++i )
+                if ( std::isxdigit(static_cast<unsigned char>(hash[i])) )
+                    digits[i] = static_cast<char>(std::tolower(static_cast<unsigned char>(hash[i])));
 
-                if ( file.path().stem() == filename )
-                    return file.path().filename().string();
-            }
+            return std::filesystem::path(digits.substr(0, 2)) / digits.substr(2);
+        }
+
+        std::filesystem::path storagePath ( const std::string& storedName ) {
+            const auto hash = std::filesystem::path(storedName).extension().string();
 
-            return {};
+            return std::filesystem::current_path() / "storage" / fanOut(hash.empty() ? hash : hash.substr(1)) / storedName;
         }
     }
 }
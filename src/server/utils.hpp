@@ -1,7 +1,9 @@
 #pragma once
 #include <filesystem>
+#include <optional>
 #include <set>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "includes/toml.hpp"
@@ -13,13 +15,18 @@ namespace Utils {
     void elog ( const std::string& message, bool newline = true );
 
     namespace FS {
-        std::set<std::string> findCorrespondingFileNames ( const std::set<std::string>& hash );
-
-        std::optional<std::string> findCorrespondingFileName ( const std::string& hash );
-
         std::set<std::string> getLocalFileHashes ();
 
-        std::optional<std::string> getLocalRawFileName ( const std::string& filename );
+        /**
+         * @brief Directories of an object below storage/ or links/, "ab/cd" from the first hex digits of its hash
+         */
+        std::filesystem::path fanOut ( std::string_view hash );
+
+        /**
+         * @param storedName file name in storage, "<name>.<hash>"
+         * @return path of the stored file, storage/ab/cd/<name>.<hash>
+         */
+        std::filesystem::path storagePath ( const std::string& storedName );
 
     }
 }
@@ -0,0 +1,116 @@
+#include "Chunker.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <sodium.h>
+
+#include "utils.hpp"
+
+namespace {
+
+	/**
+	 * @brief One pseudo-random word per byte value, generated at compile time so every build cuts alike
+	 */
+	constexpr std::array<std::uint64_t, 256> makeGear () {
+		std::array<std::uint64_t, 256> gear{};
+		std::uint64_t state = 0x68696b7570636463; // "hikupcdc"
+
+		for ( auto& word: gear ) {
+			// splitmix64
+			state += 0x9e3779b97f4a7c15;
+			auto z = state;
+			z = ( z ^ ( z >> 30 ) ) * 0xbf58476d1ce4e5b9;
+			z = ( z ^ ( z >> 27 ) ) * 0x94d049bb133111eb;
+			word = z ^ ( z >> 31 );
+		}
+
+		return gear;
+	}
+
+	constexpr auto gear = makeGear();
+
+	// normalized chunking: a stricter mask below the average size and a looser one above it
+	// pull the chunk sizes towards the average, the top bits of the gear hash cover the last 64 bytes
+	constexpr std::uint64_t maskSmall = ~0ULL << ( 64 - 18 );
+	constexpr std::uint64_t maskLarge = ~0ULL << ( 64 - 14 );
+
+	constexpr std::size_t bufferSize = 4 * 1024 * 1024;
+
+}
+
+std::size_t Chunker::cut ( const unsigned char* data, const std::size_t size ) {
+	if ( size <= minSize )
+		return size;
+
+	const auto limit = std::min(size, maxSize);
+	const auto normal = std::min(limit, averageSize);
+
+	// no cut point can come before minSize, so hashing starts there
+	std::uint64_t hash = 0;
+	auto i = minSize;
+
+	for ( ; i < normal; ++i ) {
+		hash = ( hash << 1 ) + gear[data[i]];
+		if ( !( hash & maskSmall ) )
+			return i + 1;
+	}
+
+	for ( ; i < limit; ++i ) {
+		hash = ( hash << 1 ) + gear[data[i]];
+		if ( !( hash & maskLarge ) )
+			return i + 1;
+	}
+
+	return limit;
+}
+
+std::vector<Chunker::Chunk> Chunker::split ( std::istream& stream ) {
+	std::vector<Chunk> chunks;
+
+	const auto buffer = std::make_unique_for_overwrite<unsigned char[]>(bufferSize);
+	std::size_t filled = 0;
+	std::uint64_t offset = 0;
+
+	while ( true ) {
+		stream.read(reinterpret_cast<char*>(buffer.get() + filled), static_cast<std::streamsize>(bufferSize - filled));
+		filled += stream.gcount();
+
+		if ( stream.bad() || ( !stream && !stream.eof() ) )
+			throw std::runtime_error("Chunker: could not read the stream");
+
+		const bool end = stream.eof();
+		std::size_t start = 0;
+
+		// a cut needs maxSize bytes of lookahead, except at the end of the stream
+		while ( filled - start >= maxSize || ( end && start < filled ) ) {
+			Chunk chunk{offset, static_cast<std::uint32_t>(cut(buffer.get() + start, filled - start)), {}};
+			crypto_generichash(chunk.hash.data(), chunk.hash.size(), buffer.get() + start, chunk.length, nullptr, 0);
+			chunks.push_back(chunk);
+
+			start += chunk.length;
+			offset += chunk.length;
+		}
+
+		if ( end )
+			return chunks;
+
+		std::memmove(buffer.get(), buffer.get() + start, filled - start);
+		filled -= start;
+	}
+}
+
+std::string Chunker::toHex ( const Hash& hash ) { return binToHex(hash.data(), hash.size()); }
+
+Chunker::Hash Chunker::fromHex ( const std::string_view hex ) {
+	Hash hash;
+	std::size_t length = 0;
+
+	if ( hex.size() != hash.size() * 2 ||
+	     sodium_hex2bin(hash.data(), hash.size(), hex.data(), hex.size(), nullptr, &length, nullptr) != 0 ||
+	     length != hash.size() )
+		throw std::runtime_error("Chunker: not a chunk hash: " + std::string(hex));
+
+	return hash;
+}
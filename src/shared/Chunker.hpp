@@ -0,0 +1,52 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Content-defined chunking in the style of FastCDC
+ *
+ * Cut points depend only on the bytes around them, so an insertion or deletion
+ * moves the boundaries next to it and leaves every other chunk of the file unchanged.
+ * Client and server run the same chunker, equal content yields equal chunk hashes on both sides.
+ */
+namespace Chunker {
+
+	constexpr std::size_t minSize = 16 * 1024;
+	constexpr std::size_t averageSize = 64 * 1024;
+	constexpr std::size_t maxSize = 256 * 1024;
+
+	using Hash = std::array<unsigned char, 32>;
+
+	struct Chunk {
+		std::uint64_t offset;
+		std::uint32_t length;
+		Hash hash;
+	};
+
+	/**
+	 * @brief Length of the first chunk of `data`, all of it when no cut point lies within
+	 *
+	 * Pass at least maxSize bytes unless `data` is the end of the stream.
+	 */
+	std::size_t cut ( const unsigned char* data, std::size_t size );
+
+	/**
+	 * @brief Cuts the rest of the stream into chunks and hashes them
+	 * @throws std::runtime_error if the stream fails before its end
+	 */
+	std::vector<Chunk> split ( std::istream& stream );
+
+	std::string toHex ( const Hash& hash );
+
+	/**
+	 * @throws std::runtime_error if `hex` is not a hash
+	 */
+	Hash fromHex ( std::string_view hex );
+
+}
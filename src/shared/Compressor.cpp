@@ -0,0 +1,132 @@
+#include "Compressor.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include "Frame.hpp"
+
+#ifdef HIKUP_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+Compressor::Compressor () {
+#ifdef HIKUP_HAVE_ZSTD
+	_context = ZSTD_createCCtx();
+#endif
+}
+
+Compressor::~Compressor () {
+#ifdef HIKUP_HAVE_ZSTD
+	ZSTD_freeCCtx(_context);
+#endif
+}
+
+std::optional<std::string_view> Compressor::compress ( const std::string_view chunk ) {
+	const auto now = Clock::now();
+
+	// whatever happened since the last call was sending the previous chunk
+	if ( _lastReturn && _lastWireBytes > 0 ) {
+		const auto elapsed = std::chrono::duration<double>(now - *_lastReturn).count();
+		if ( elapsed > 0.0 ) {
+			const auto rate = static_cast<double>(_lastWireBytes) / elapsed;
+			_wireRate = _wireRate == 0.0 ? rate : _wireRate * 0.75 + rate * 0.25;
+		}
+	}
+
+#ifdef HIKUP_HAVE_ZSTD
+	if ( !_context || chunk.empty() )
+		return _sent(chunk.size(), std::nullopt);
+
+	if ( _skip > 0 ) {
+		--_skip;
+		return _sent(chunk.size(), std::nullopt);
+	}
+
+	const auto bound = ZSTD_compressBound(chunk.size());
+	if ( bound > _capacity ) {
+		_output = std::make_unique_for_overwrite<char[]>(bound);
+		_capacity = bound;
+	}
+
+	const auto size = ZSTD_compressCCtx(_context, _output.get(), _capacity, chunk.data(), chunk.size(), _level);
+	const auto cpuTime = std::chrono::duration<double>(Clock::now() - now).count();
+
+	if ( ZSTD_isError(size) ) {
+		_skip = probeInterval;
+		return _sent(chunk.size(), std::nullopt);
+	}
+
+	if ( static_cast<double>(size) > static_cast<double>(chunk.size()) * incompressible ) {
+		_level = minLevel;
+		_skip = probeInterval;
+		return _sent(chunk.size(), std::nullopt);
+	}
+
+	if ( _wireRate > 0.0 ) {
+		const auto savedTime = static_cast<double>(chunk.size() - size) / _wireRate;
+
+		if ( cpuTime > savedTime ) {
+			// the link is faster than compressing, at the lowest level it is not worth it at all
+			if ( _level > minLevel )
+				--_level;
+			else
+				_skip = probeInterval;
+		}
+		else if ( cpuTime * 4 < savedTime && _level < maxLevel )
+			++_level;
+	}
+
+	return _sent(size, std::string_view(_output.get(), size));
+#else
+	return _sent(chunk.size(), std::nullopt);
+#endif
+}
+
+int Compressor::level () const { return _level; }
+
+std::optional<std::string_view> Compressor::_sent ( const std::size_t wireBytes, std::optional<std::string_view> result ) {
+	_lastWireBytes = wireBytes;
+	_lastReturn = Clock::now();
+	return result;
+}
+
+Decompressor::Decompressor () {
+#ifdef HIKUP_HAVE_ZSTD
+	_context = ZSTD_createDCtx();
+#endif
+}
+
+Decompressor::~Decompressor () {
+#ifdef HIKUP_HAVE_ZSTD
+	ZSTD_freeDCtx(_context);
+#endif
+}
+
+std::string_view Decompressor::decompress ( const std::string_view payload ) {
+#ifdef HIKUP_HAVE_ZSTD
+	if ( !_context )
+		throw std::runtime_error("Could not create decompression context");
+
+	const auto size = ZSTD_getFrameContentSize(payload.data(), payload.size());
+
+	// only chunks are compressed, a few bytes must not make the receiver allocate gigabytes
+	if ( size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN || size > Frame::maxChunkSize )
+		throw std::runtime_error("Invalid compressed message");
+
+	if ( size > _capacity ) {
+		_output = std::make_unique_for_overwrite<char[]>(size);
+		_capacity = size;
+	}
+
+	const auto result = ZSTD_decompressDCtx(_context, _output.get(), _capacity, payload.data(), payload.size());
+
+	if ( ZSTD_isError(result) || result != size )
+		throw std::runtime_error("Could not decompress message");
+
+	return {_output.get(), result};
+#else
+	static_cast<void>(payload);
+	throw std::runtime_error("Received a compressed message, but compression is not supported");
+#endif
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string_view>
+
+struct ZSTD_CCtx_s;
+struct ZSTD_DCtx_s;
+
+/**
+ * @brief zstd stage for file chunks that decides chunk by chunk whether compressing pays off
+ *
+ * The time between two calls is what putting the previous chunk on the wire took,
+ * which gives the link throughput without asking the caller. A chunk is worth compressing
+ * when the CPU time spent on it is below the wire time its saved bytes would have cost;
+ * the level moves up while there is room and down when the CPU falls behind the link.
+ * Chunks that barely shrink (already compressed media) switch compression off,
+ * it is probed again every few chunks in case the data changes.
+ */
+class Compressor {
+public:
+#ifdef HIKUP_HAVE_ZSTD
+	static constexpr bool available = true;
+#else
+	static constexpr bool available = false;
+#endif
+
+	Compressor ();
+
+	~Compressor ();
+
+	Compressor ( const Compressor& ) = delete;
+
+	Compressor& operator= ( const Compressor& ) = delete;
+
+	/**
+	 * @return the compressed chunk, valid until the next call, or nothing when the chunk should go out as it is
+	 */
+	std::optional<std::string_view> compress ( std::string_view chunk );
+
+	[[nodiscard]] int level () const;
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	static constexpr int minLevel = 1;
+	static constexpr int maxLevel = 9;
+	// chunks sent uncompressed before probing again once compression was switched off
+	static constexpr unsigned probeInterval = 32;
+	// compressed size above this share of the original counts as incompressible
+	static constexpr double incompressible = 0.95;
+
+	ZSTD_CCtx_s* _context = nullptr;
+	std::unique_ptr<char[]> _output;
+	std::size_t _capacity = 0;
+
+	int _level = minLevel;
+	unsigned _skip = 0;
+	// bytes per second, smoothed
+	double _wireRate = 0.0;
+	std::optional<Clock::time_point> _lastReturn;
+	std::size_t _lastWireBytes = 0;
+
+	std::optional<std::string_view> _sent ( std::size_t wireBytes, std::optional<std::string_view> result );
+};
+
+/**
+ * @brief Counterpart of Compressor on the receiving side, one per connection
+ */
+class Decompressor {
+public:
+	Decompressor ();
+
+	~Decompressor ();
+
+	Decompressor ( const Decompressor& ) = delete;
+
+	Decompressor& operator= ( const Decompressor& ) = delete;
+
+	/**
+	 * @return the original chunk, valid until the next call
+	 * @throws std::runtime_error on corrupt input, a chunk larger than Frame::maxChunkSize or when built without zstd
+	 */
+	std::string_view decompress ( std::string_view payload );
+
+private:
+	ZSTD_DCtx_s* _context = nullptr;
+	std::unique_ptr<char[]> _output;
+	std::size_t _capacity = 0;
+};
@@ -1,8 +1,9 @@
 #include "Connection.hpp"
 
+#include <algorithm>
 #include <iostream>
 
-Connection::Connection ( const unsigned long bufferSize ) : _buffer(std::make_unique<char[]>(bufferSize)), _bufferSize(bufferSize) {
+Connection::Connection ( const unsigned long bufferSize ) : _receiveBuffer(bufferSize) {
 #ifdef __linux__
 	_socket = socket(AF_INET, SOCK_STREAM, 0);
 	if ( _socket == -1 ) { throw std::runtime_error("Could not create socket"); }
@@ -20,8 +21,7 @@ Connection::Connection ( const unsigned long bufferSize ) : _buffer(std::make_un
 
 	if ( sodium_init() < 0 ) { throw std::runtime_error("Could not initialize sodium"); }
 
-	crypto_box_keypair(_keyPair.publicKey, _keyPair.secretKey);
-	memset(_buffer.get(), '\0', _bufferSize);
+	crypto_kx_keypair(_keyPair.publicKey, _keyPair.secretKey);
 }
 
 void Connection::connectToServer ( std::string ip, const int port, const time_t timeout ) {
@@ -86,238 +86,223 @@ void Connection::connectToServer ( std::string ip, const int port, const time_t
 #endif
 }
 
-void Connection::_send ( const char* message, const size_t length ) {
-	std::lock_guard<std::mutex> lock(_sendMutex);
+void Connection::_send ( Frame::Header header, const char* payload, const size_t length ) {
+	header.length = length;
+
 #ifdef __linux__
-	if ( ::send(_socket, message, length, 0) < 0 ) { throw std::runtime_error("Could not send message"); }
+	if ( !Frame::send(_socket, header, payload) ) { throw std::runtime_error("Could not send message"); }
 #elif _WIN32
-	if(::send(_socket, message, length, 0) == SOCKET_ERROR) {
+	unsigned char headerBytes[Frame::headerSize];
+	Frame::encodeHeader(header, headerBytes);
+
+	if(::send(_socket, reinterpret_cast<const char*>(headerBytes), Frame::headerSize, 0) == SOCKET_ERROR ||
+	   ::send(_socket, payload, length, 0) == SOCKET_ERROR) {
 		throw std::runtime_error("Could not send message: " + WSAGetLastError());
 	}
 #endif
 }
 
-std::string Connection::_receive () {
-	std::string message;
-
-	while ( !message.ends_with(_end) ) {
-		clearBuffer();
+void Connection::_fill ( const size_t length ) {
+	_receiveBuffer.reserve(length);
 
-		_sizeOfPreviousMessage = recv(_socket, _buffer.get(), _bufferSize, 0);
+	while ( _receiveBuffer.readable().size() < length ) {
+		const auto space = _receiveBuffer.writable();
+		const auto result = recv(_socket, space.data(), space.size(), 0);
 
-		if ( _sizeOfPreviousMessage < 0 || errno == EAGAIN || errno == EWOULDBLOCK ) {
+		if ( result < 0 ) {
+			if ( errno == EINTR )
+				continue;
 			throw std::runtime_error("Could not receive message from server: " + std::string(strerror(errno)));
 		}
 
-		if ( _sizeOfPreviousMessage == 0 ) {
+		if ( result == 0 ) {
 			throw std::runtime_error("server disconnected");
 		}
 
-		message += std::string(_buffer.get(), _sizeOfPreviousMessage);
+		_receiveBuffer.commit(result);
 	}
-
-	return message;
 }
 
-Connection& Connection::send ( const std::string& message ) {
-	auto messageToSend = message;
+std::string_view Connection::_receive () {
+	unsigned char headerBytes[Frame::headerSize];
+	Frame::Header header;
 
-#ifdef HIKUP_CONN_DEBUG
-	printf("SEND | %s\n", messageToSend.c_str());
-#endif
+	while ( true ) {
+		_fill(Frame::headerSize);
+		std::memcpy(headerBytes, _receiveBuffer.readable().data(), Frame::headerSize);
+		_receiveBuffer.consume(Frame::headerSize);
 
-	if ( _encrypted ) {
-		_secretSeal(messageToSend);
+		header = Frame::decodeHeader(headerBytes);
 
-		if (messageToSend.size() % 2 != 0)
-			throw std::runtime_error("Invalid message to send");
-	}
+		if ( header.type == Frame::Type::Body )
+			throw std::runtime_error("Unexpected file body");
 
-	messageToSend += _end;
+		if ( header.type != Frame::Type::StreamHeader )
+			break;
 
-	//std::cout << "\nSEND | " << messageToSend << std::endl;
-
-	_send(messageToSend.data(), messageToSend.size());
-
-	return *this;
-}
+		_openReceiveStream(header);
+	}
 
-Connection& Connection::sendData ( const std::string& message ) { return send(_data + message); }
+	if ( !_receiveStreamOpen && header.length > Frame::maxHandshakePayloadSize )
+		throw std::runtime_error("Handshake message too large");
 
-Connection& Connection::sendInternal ( const std::string& message ) { return send(_internal + message); }
+	// older servers do not advertise raw ciphertext and keep getting hex
+	if ( !_receiveStreamOpen ) {
+		_rawTransport = header.flags & Frame::Flags::rawCiphertext;
+		_compression = Compressor::available && header.flags & Frame::Flags::compressed;
+		_peerResumes = header.flags & Frame::Flags::resumable;
+		_peerPagesLists = header.flags & Frame::Flags::pagedList;
+		_peerReconciles = header.flags & Frame::Flags::reconciles;
+	}
 
-std::string Connection::receive () {
+	if ( _receiveStreamOpen != static_cast<bool>(header.flags & Frame::Flags::encrypted) )
+		throw std::runtime_error("Unexpected encryption state of received message");
 
-	if ( _moreInBuffer ) {
-		auto message = _messagesBuffer[0];
-		_messagesBuffer.erase(_messagesBuffer.begin());
-		if ( _messagesBuffer.empty() )
-			_moreInBuffer = false;
-		return message;
-	}
+	_fill(header.length);
 
-	auto message = _receive();
+	// the bytes stay in place until the next receive, so the view outlives the consume
+	const auto payload = _receiveBuffer.readable().first(header.length);
+	_receiveBuffer.consume(header.length);
 
-	// remove the _end string
+	if ( !_receiveStreamOpen )
+		return {payload.data(), payload.size()};
 
-	std::vector<std::string> messages;
-	std::string tmpMessage;
-	size_t sPos = 0, ePos = 0;
-	bool first = true;
+	const auto message = _secretOpen(payload, headerBytes, header.flags & Frame::Flags::rawCiphertext);
 
-	while ( ( ePos = message.find(_end, sPos) ) != std::string::npos ) {
-		if ( first ) {
-			tmpMessage = message.substr(sPos, ePos-sPos);
-			first = false;
-		}
-		else
-			messages.push_back(message.substr(sPos, ePos-sPos));
+	if ( header.flags & Frame::Flags::compressed )
+		return _decompressor.decompress(message);
 
+	return message;
+}
 
-		sPos = ePos + strlen(_end);
-	}
+Connection& Connection::send ( const std::string& message ) { return _sendMessage(message, Frame::Flags::none); }
 
-	message = tmpMessage;
-	_messagesBuffer = messages;
+Connection& Connection::send ( const std::string& message, Compressor& compressor ) {
+	if ( !_compression )
+		return send(message);
 
-	if ( _encrypted ) {
-		_secretOpen(message);
-		for ( auto& messageEnc: _messagesBuffer )
-			_secretOpen(messageEnc);
-	}
+	if ( const auto compressed = compressor.compress(message) )
+		return _sendMessage(std::string(*compressed), Frame::Flags::compressed);
 
-	if ( _messagesBuffer.empty() )
-		_moreInBuffer = false;
-	else
-		_moreInBuffer = true;
+	return send(message);
+}
 
+Connection& Connection::_sendMessage ( std::string messageToSend, const std::uint16_t flags ) {
+	Frame::Header header;
+	header.flags = flags;
 
 #ifdef HIKUP_CONN_DEBUG
-	std::cout << "RECEIVE | " << message << std::endl;
-	std::cout << "RECEIVE BUFFER | "
-			  << std::accumulate(_messagesBuffer.begin(), _messagesBuffer.end(), std::string(),
-								 [](const std::string &a, const std::string &b) {
-									 return a + b + " | ";
-								 })
-			  << std::endl;
+	printf("SEND | %s\n", messageToSend.c_str());
 #endif
 
+	// sealing advances the stream state, so it has to happen in the same order as the sends
+	std::lock_guard<std::mutex> lock(_sendMutex);
 
-	if ( message.contains(_internal"publicKey:") ) {
-		const std::string publicKey = message.substr(strlen(_internal"publicKey:"));
-
-		if ( sodium_hex2bin(_remotePublicKey, crypto_box_PUBLICKEYBYTES, publicKey.c_str(), publicKey.size(), nullptr,
-		                    nullptr, nullptr) < 0 ) { throw std::runtime_error("Could not decode public key"); }
-
-		const auto pk_hex = std::make_unique<char[]>(crypto_box_PUBLICKEYBYTES * 2 + 1);
+	if ( _encrypted ) {
+		header.flags |= Frame::Flags::encrypted;
+		header.length = messageToSend.size() + crypto_secretstream_xchacha20poly1305_ABYTES;
 
-		sodium_bin2hex(pk_hex.get(), crypto_box_PUBLICKEYBYTES * 2 + 1, _keyPair.publicKey, crypto_box_PUBLICKEYBYTES);
+		if ( _rawTransport )
+			header.flags |= Frame::Flags::rawCiphertext;
+		else
+			header.length *= 2;
 
-		//std::cout << "public key: " << pk_base64.get() << std::endl;
+		unsigned char headerBytes[Frame::headerSize];
+		Frame::encodeHeader(header, headerBytes);
 
-		send(_internal"publicKey:" + std::string(pk_hex.get(), crypto_box_PUBLICKEYBYTES * 2));
+		_secretSeal(messageToSend, headerBytes);
 
-		_encrypted = true;
+		if ( messageToSend.size() != header.length )
+			throw std::runtime_error("Invalid message to send");
 	}
-
-	return message;
-}
-
-std::tuple<std::string, std::chrono::duration<double>> Connection::receiveWTime () {
-
-	if ( _moreInBuffer ) {
-		auto message = _messagesBuffer[0];
-		_messagesBuffer.erase(_messagesBuffer.begin());
-		if ( _messagesBuffer.empty() )
-			_moreInBuffer = false;
-		return {message, std::chrono::duration<double>(0)};
+	else {
+		header.flags |= Frame::Flags::rawCiphertext;
+		if constexpr ( Compressor::available )
+			header.flags |= Frame::Flags::compressed;
 	}
 
-	const auto start = std::chrono::high_resolution_clock::now();
-	auto message = _receive();
-	const auto end = std::chrono::high_resolution_clock::now();
+	_send(header, messageToSend.data(), messageToSend.size());
 
-	// remove the _end string
+	return *this;
+}
 
-	std::vector<std::string> messages;
-	std::string tmpMessage;
-	size_t sPos = 0, ePos = 0;
-	bool first = true;
+Connection& Connection::sendData ( const std::string& message ) { return send(_data + message); }
 
-	while ( ( ePos = message.find(_end, sPos) ) != std::string::npos ) {
-		if ( first ) {
-			tmpMessage = message.substr(sPos, ePos-sPos);
-			first = false;
-		}
-		else
-			messages.push_back(message.substr(sPos, ePos-sPos));
+Connection& Connection::sendInternal ( const std::string& message ) { return send(_internal + message); }
 
+std::string Connection::receive () { return std::string(receiveView()); }
 
-		sPos = ePos + strlen(_end);
-	}
+std::tuple<std::string, std::chrono::duration<double>> Connection::receiveWTime () {
+	const auto [message, duration] = receiveViewWTime();
 
-	message = tmpMessage;
-	_messagesBuffer = messages;
+	return {std::string(message), duration};
+}
 
-	if ( _encrypted ) {
-		_secretOpen(message);
-		for ( auto& messageEnc: _messagesBuffer )
-			_secretOpen(messageEnc);
-	}
+std::string_view Connection::receiveView () {
+	const auto [message, duration] = receiveViewWTime();
 
-	if ( _messagesBuffer.empty() )
-		_moreInBuffer = false;
-	else
-		_moreInBuffer = true;
+	return message;
+}
 
+std::tuple<std::string_view, std::chrono::duration<double>> Connection::receiveViewWTime () {
+	const auto start = std::chrono::high_resolution_clock::now();
+	const auto message = _receive();
+	const auto end = std::chrono::high_resolution_clock::now();
 
 #ifdef HIKUP_CONN_DEBUG
 	std::cout << "RECEIVE | " << message << std::endl;
-	std::cout << "RECEIVE BUFFER | "
-			  << std::accumulate(_messagesBuffer.begin(), _messagesBuffer.end(), std::string(),
-								 [](const std::string &a, const std::string &b) {
-									 return a + b + " | ";
-								 })
-			  << std::endl;
 #endif
 
 
-	if ( message.contains(_internal"publicKey:") ) {
-		const std::string publicKey = message.substr(strlen(_internal"publicKey:"));
+	if ( !_encrypted && message.starts_with(_internal"publicKey:") ) {
+		const auto publicKey = message.substr(strlen(_internal"publicKey:"));
 
-		if ( sodium_hex2bin(_remotePublicKey, crypto_box_PUBLICKEYBYTES, publicKey.c_str(), publicKey.size(), nullptr,
+		if ( sodium_hex2bin(_remotePublicKey, crypto_kx_PUBLICKEYBYTES, publicKey.data(), publicKey.size(), nullptr,
 							nullptr, nullptr) < 0 ) { throw std::runtime_error("Could not decode public key"); }
 
-		const auto pk_hex = std::make_unique<char[]>(crypto_box_PUBLICKEYBYTES * 2 + 1);
+		const auto pk_hex = std::make_unique<char[]>(crypto_kx_PUBLICKEYBYTES * 2 + 1);
 
-		sodium_bin2hex(pk_hex.get(), crypto_box_PUBLICKEYBYTES * 2 + 1, _keyPair.publicKey, crypto_box_PUBLICKEYBYTES);
+		sodium_bin2hex(pk_hex.get(), crypto_kx_PUBLICKEYBYTES * 2 + 1, _keyPair.publicKey, crypto_kx_PUBLICKEYBYTES);
 
 		//std::cout << "public key: " << pk_base64.get() << std::endl;
 
-		send(_internal"publicKey:" + std::string(pk_hex.get(), crypto_box_PUBLICKEYBYTES * 2));
+		send(_internal"publicKey:" + std::string(pk_hex.get(), crypto_kx_PUBLICKEYBYTES * 2));
 
-		_encrypted = true;
+		_startSession();
 	}
 
 	return {message, end - start};
 }
 
 std::string Connection::receiveInternal () {
-	const auto message = receive();
+	const auto message = receiveView();
 
 	if ( !message.contains(_internal) )
 		throw std::runtime_error("Invalid message received (internal)");
 
-	return message.substr(strlen(_internal));
+	return std::string(message.substr(strlen(_internal)));
 }
 
 std::string Connection::receiveData () {
-	const auto message = receive();
+	const auto message = receiveView();
 
 	if ( !message.contains(_data) )
 		throw std::runtime_error("Invalid message received (data)");
 
-	return message.substr(strlen(_data));
+	return std::string(message.substr(strlen(_data)));
+}
+
+bool Connection::hasPending () {
+	if ( !_receiveBuffer.readable().empty() )
+		return true;
+
+#ifdef __linux__
+	pollfd descriptor { _socket, POLLIN, 0 };
+	return poll(&descriptor, 1, 0) > 0;
+#elif _WIN32
+	WSAPOLLFD descriptor { _socket, POLLRDNORM, 0 };
+	return WSAPoll(&descriptor, 1, 0) > 0;
+#endif
 }
 
 bool Connection::isConnected () const {
@@ -325,9 +310,66 @@ bool Connection::isConnected () const {
 }
 
 void Connection::resizeBuffer ( const unsigned long newSize )  {
-	_buffer = std::make_unique<char[]>(newSize);
-	_bufferSize = newSize;
+	_receiveBuffer.resize(std::max(newSize, static_cast<unsigned long>(_receiveBuffer.readable().size())));
+}
+
+void Connection::enableTrustedTransport () { _trustedTransport = true; }
+
+bool Connection::trustedTransport () const { return _trustedTransport; }
+
+bool Connection::peerResumes () const { return _peerResumes; }
+
+bool Connection::peerPagesLists () const { return _peerPagesLists; }
+
+bool Connection::peerReconciles () const { return _peerReconciles; }
+
+#ifdef __linux__
+void Connection::sendFileBody ( const int file, const uint64_t size ) {
+	if ( !_trustedTransport )
+		throw std::runtime_error("File bodies are only sent over a trusted transport");
+
+	std::lock_guard<std::mutex> lock(_sendMutex);
+
+	if ( !Frame::sendFile(_socket, file, 0, size) )
+		throw std::runtime_error("Could not send file: " + std::string(strerror(errno)));
+}
+
+void Connection::receiveFileBody ( const int file, const uint64_t size ) {
+	if ( !_trustedTransport )
+		throw std::runtime_error("File bodies are only accepted over a trusted transport");
+
+	uint64_t received = 0;
+
+	while ( received < size ) {
+		_fill(Frame::headerSize);
+		const auto header = Frame::decodeHeader(reinterpret_cast<const unsigned char*>(_receiveBuffer.readable().data()));
+
+		if ( header.type != Frame::Type::Body || header.length > size - received )
+			throw std::runtime_error("Expected a file body of " + std::to_string(size - received) + " bytes");
+
+		_receiveBuffer.consume(Frame::headerSize);
+
+		// part of the body may already sit in the buffer from an earlier recv
+		const auto buffered = std::min<uint64_t>(_receiveBuffer.readable().size(), header.length);
+		const auto bytes = _receiveBuffer.readable().first(buffered);
+
+		for ( size_t written = 0; written < buffered; ) {
+			const auto result = pwrite(file, bytes.data() + written, buffered - written, static_cast<off_t>(received + written));
+			if ( result < 0 && errno != EINTR )
+				throw std::runtime_error("Could not write file body: " + std::string(strerror(errno)));
+			if ( result > 0 )
+				written += result;
+		}
+
+		_receiveBuffer.consume(buffered);
+
+		if ( !Frame::spliceToFile(_socket, file, received + buffered, header.length - buffered) )
+			throw std::runtime_error("Could not receive file body from server: " + std::string(strerror(errno)));
+
+		received += header.length;
+	}
 }
+#endif
 
 void Connection::close () {
 #ifdef __linux__
@@ -346,8 +388,6 @@ Connection::~Connection () {
 		close();
 }
 
-void Connection::clearBuffer () const { memset(_buffer.get(), '\0', _bufferSize); }
-
 std::vector<std::string> Connection::dnsLookup ( const std::string& domain, int ipv ) {
 	// credit to http://www.zedwood.com/article/cpp-dns-lookup-ipv4-and-ipv6
 
@@ -391,37 +431,93 @@ std::vector<std::string> Connection::dnsLookup ( const std::string& domain, int
 	return output;
 }
 
-void Connection::_secretSeal ( std::string& message ) const {
-	const auto cypherText = std::make_unique<unsigned char[]>(crypto_box_SEALBYTES + message.size());
+void Connection::_startSession () {
+	unsigned char sendKey[crypto_kx_SESSIONKEYBYTES];
+
+	if ( crypto_kx_client_session_keys(_receiveKey, sendKey, _keyPair.publicKey, _keyPair.secretKey,
+	                                   _remotePublicKey) != 0 )
+		throw std::runtime_error("Invalid public key received from server");
+
+	unsigned char streamHeader[crypto_secretstream_xchacha20poly1305_HEADERBYTES];
+
+	crypto_secretstream_xchacha20poly1305_init_push(&_sendStream, streamHeader, sendKey);
+	sodium_memzero(sendKey, sizeof sendKey);
+
+	std::lock_guard<std::mutex> lock(_sendMutex);
+
+	_send({Frame::Type::StreamHeader}, reinterpret_cast<char*>(streamHeader), sizeof streamHeader);
+
+	_encrypted = true;
+}
+
+void Connection::_openReceiveStream ( const Frame::Header& header ) {
+	if ( !_encrypted || _receiveStreamOpen || header.length != crypto_secretstream_xchacha20poly1305_HEADERBYTES )
+		throw std::runtime_error("Unexpected stream header received");
+
+	_fill(crypto_secretstream_xchacha20poly1305_HEADERBYTES);
+	const auto streamHeader = reinterpret_cast<unsigned char*>(_receiveBuffer.readable().data());
+
+	if ( crypto_secretstream_xchacha20poly1305_init_pull(&_receiveStream, streamHeader, _receiveKey) != 0 )
+		throw std::runtime_error("Invalid stream header received");
+
+	_receiveBuffer.consume(crypto_secretstream_xchacha20poly1305_HEADERBYTES);
+
+	sodium_memzero(_receiveKey, sizeof _receiveKey);
+	_receiveStreamOpen = true;
+}
+
+void Connection::_secretSeal ( std::string& message, const unsigned char* frameHeader ) {
+	const auto cypherTextSize = message.size() + crypto_secretstream_xchacha20poly1305_ABYTES;
+	const auto cypherText = std::make_unique_for_overwrite<unsigned char[]>(cypherTextSize);
 
-	if ( crypto_box_seal(cypherText.get(), reinterpret_cast<const unsigned char*>(message.data()), message.size(),
-	                     _remotePublicKey) < 0 )
+	if ( crypto_secretstream_xchacha20poly1305_push(&_sendStream, cypherText.get(), nullptr,
+	                                                reinterpret_cast<const unsigned char*>(message.data()), message.size(),
+	                                                frameHeader, Frame::headerSize,
+	                                                crypto_secretstream_xchacha20poly1305_TAG_MESSAGE) < 0 )
 		throw std::runtime_error("Could not encrypt message");
 
-	const auto messageHex = std::make_unique<unsigned char[]>(( crypto_box_SEALBYTES + message.size() ) * 2 + 1);
+	if ( _rawTransport ) {
+		message.assign(reinterpret_cast<char*>(cypherText.get()), cypherTextSize);
+		return;
+	}
+
+	const auto messageHex = std::make_unique_for_overwrite<char[]>(cypherTextSize * 2 + 1);
 
-	sodium_bin2hex(reinterpret_cast<char*>(messageHex.get()), ( crypto_box_SEALBYTES + message.size() ) * 2 + 1,
-	               cypherText.get(), crypto_box_SEALBYTES + message.size());
+	sodium_bin2hex(messageHex.get(), cypherTextSize * 2 + 1, cypherText.get(), cypherTextSize);
 
-	message = std::string(reinterpret_cast<char*>(messageHex.get()), ( crypto_box_SEALBYTES + message.size() ) * 2);
+	message = std::string(messageHex.get(), cypherTextSize * 2);
 }
 
-void Connection::_secretOpen ( std::string& message ) const {
+std::string_view Connection::_secretOpen ( const std::span<char> payload, const unsigned char* frameHeader, const bool raw ) {
+	auto cypherText = reinterpret_cast<unsigned char*>(payload.data());
+	size_t cypherTextSize = payload.size();
 
-	if (message.length() % 2 != 0)
-		throw std::runtime_error("Invalid message to decrypt: " + message);
+	if ( !raw ) {
+		if ( cypherTextSize % 2 != 0 )
+			throw std::runtime_error("Invalid message to decrypt");
 
-	const auto cypherTextBin = std::make_unique<unsigned char[]>(message.size() / 2);
+		// decoding in place is fine, every byte is written behind the two characters it is read from
+		if ( sodium_hex2bin(cypherText, cypherTextSize / 2, payload.data(), cypherTextSize,
+		                    nullptr, nullptr, nullptr) < 0 )
+			throw std::runtime_error("Could not decode message");
 
-	if ( sodium_hex2bin(cypherTextBin.get(), message.size() / 2, reinterpret_cast<const char*>(message.data()),
-	                    message.size(), nullptr, nullptr, nullptr) < 0 )
-		throw std::runtime_error("Could not decode message: " + message);
+		cypherTextSize /= 2;
+	}
+
+	if ( cypherTextSize < crypto_secretstream_xchacha20poly1305_ABYTES )
+		throw std::runtime_error("Invalid message to decrypt");
 
-	const auto decrypted = std::make_unique<unsigned char[]>(message.size() / 2 - crypto_box_SEALBYTES);
+	const auto decryptedSize = cypherTextSize - crypto_secretstream_xchacha20poly1305_ABYTES;
+	unsigned char tag;
 
-	if ( crypto_box_seal_open(decrypted.get(), cypherTextBin.get(), message.size() / 2, _keyPair.publicKey,
-	                          _keyPair.secretKey) < 0 )
+	// the plaintext is written over its own ciphertext, which starts right after the encrypted tag byte
+	if ( crypto_secretstream_xchacha20poly1305_pull(&_receiveStream, cypherText + 1, nullptr, &tag,
+	                                                cypherText, cypherTextSize,
+	                                                frameHeader, Frame::headerSize) < 0 )
 		throw std::runtime_error("Could not decrypt message");
 
-	message = std::string(reinterpret_cast<char*>(decrypted.get()), message.size() / 2 - crypto_box_SEALBYTES);
+	if ( tag != crypto_secretstream_xchacha20poly1305_TAG_MESSAGE )
+		throw std::runtime_error("Unexpected tag on received message");
+
+	return {payload.data() + 1, decryptedSize};
 }
@@ -1,7 +1,9 @@
 #pragma once
 
 #include <cstring>
+#include <span>
 #include <string>
+#include <string_view>
 #include <stdexcept>
 #include <cerrno>
 #include <vector>
@@ -10,8 +12,13 @@
 #include <thread>
 #include <sodium.h>
 
+#include "Compressor.hpp"
+#include "Frame.hpp"
+#include "ReceiveBuffer.hpp"
+
 #ifdef __linux__
 #include <sys/socket.h>
+#include <poll.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <unistd.h>
@@ -24,7 +31,6 @@
 #include <ws2tcpip.h>
 #endif
 
-#define _end "::--///--$$$"
 #define _internal "INTERNAL::"
 #define _data "DATA::"
 
@@ -53,6 +59,11 @@ public:
 
 	Connection& send ( const std::string& message );
 
+	/**
+	 * @brief Sends a file chunk, compressed when the server supports it and `compressor` finds it worthwhile
+	 */
+	Connection& send ( const std::string& message, Compressor& compressor );
+
 	Connection& sendData ( const std::string& message );
 
 	Connection& sendInternal ( const std::string& message );
@@ -61,27 +72,75 @@ public:
 
 	std::tuple<std::string, std::chrono::duration<double>> receiveWTime();
 
+	/**
+	 * @brief Receives without copying, the view stays valid until the next receive or resizeBuffer
+	 */
+	std::string_view receiveView ();
+
+	std::tuple<std::string_view, std::chrono::duration<double>> receiveViewWTime ();
+
 	std::string receiveInternal ();
 
 	std::string receiveData ();
 
+	/**
+	 * @brief Checks without blocking whether part of a frame was already received
+	 */
+	bool hasPending ();
+
 	bool isConnected () const;
 
 	void resizeBuffer ( unsigned long newSize );
 
+	/**
+	 * @brief Lets file bodies travel unencrypted, messages stay sealed; only after both sides agreed on it
+	 */
+	void enableTrustedTransport ();
+
+	[[nodiscard]] bool trustedTransport () const;
+
+	/**
+	 * @brief Whether the server keeps interrupted transfers, known once connected
+	 */
+	[[nodiscard]] bool peerResumes () const;
+
+	/**
+	 * @brief Whether the server answers paged LIST queries, known once connected
+	 */
+	[[nodiscard]] bool peerPagesLists () const;
+
+	/**
+	 * @brief Whether the server syncs by reconciling hash sets, known once connected
+	 */
+	[[nodiscard]] bool peerReconciles () const;
+
+#ifdef __linux__
+	/**
+	 * @brief Sends the file contents as body frames with sendfile
+	 */
+	void sendFileBody ( int file, uint64_t size );
+
+	/**
+	 * @brief Receives body frames straight into the file with splice
+	 */
+	void receiveFileBody ( int file, uint64_t size );
+#endif
+
 	void close ();
 
 private:
 	struct KeyPair {
-		unsigned char publicKey[crypto_box_PUBLICKEYBYTES];
-		unsigned char secretKey[crypto_box_SECRETKEYBYTES];
+		unsigned char publicKey[crypto_kx_PUBLICKEYBYTES];
+		unsigned char secretKey[crypto_kx_SECRETKEYBYTES];
 	};
 
-	std::unique_ptr<char[]> _buffer;
-	std::vector<std::string> _messagesBuffer;
+	ReceiveBuffer _receiveBuffer;
 	KeyPair _keyPair;
-	unsigned char _remotePublicKey[crypto_box_PUBLICKEYBYTES];
-	unsigned long _bufferSize = 4*1024*1024;
+	unsigned char _remotePublicKey[crypto_kx_PUBLICKEYBYTES];
+	// kept only until the server's stream header arrives
+	unsigned char _receiveKey[crypto_kx_SESSIONKEYBYTES];
+	crypto_secretstream_xchacha20poly1305_state _sendStream;
+	crypto_secretstream_xchacha20poly1305_state _receiveStream;
 	std::mutex _sendMutex;
 
 #ifdef __linux__
@@ -95,20 +154,46 @@ private:
                 _hints;
 #endif
 
-	ssize_t _sizeOfPreviousMessage = 0;
 	bool _active = true;
 	bool _encrypted = false;
-	bool _moreInBuffer = false;
-
-	void clearBuffer () const;
+	bool _receiveStreamOpen = false;
+	// negotiated during the handshake, both sides have to advertise it
+	bool _rawTransport = false;
+	bool _compression = false;
+	bool _trustedTransport = false;
+	bool _peerResumes = false;
+	bool _peerPagesLists = false;
+	bool _peerReconciles = false;
+	Decompressor _decompressor;
 
 	[[nodiscard]] static std::vector<std::string> dnsLookup ( const std::string& domain, int ipv = 4 );
 
-	void _send ( const char* message, size_t length );
+	void _send ( Frame::Header header, const char* payload, size_t length );
+
+	Connection& _sendMessage ( std::string message, std::uint16_t flags );
+
+	/**
+	 * @brief Receives until at least `length` unconsumed bytes are buffered
+	 */
+	void _fill ( size_t length );
+
+	/**
+	 * @brief Reads the next message frame and returns a view of its decrypted payload
+	 */
+	std::string_view _receive ();
+
+	/**
+	 * @brief Derives the session keys from the exchanged public keys and starts the outgoing stream
+	 */
+	void _startSession ();
 
-	std::string _receive ();
+	void _openReceiveStream ( const Frame::Header& header );
 
-	void _secretOpen ( std::string& message ) const;
+	/**
+	 * @brief Decrypts the payload in place
+	 * @return view of the plaintext inside `payload`
+	 */
+	std::string_view _secretOpen ( std::span<char> payload, const unsigned char* frameHeader, bool raw );
 
-	void _secretSeal ( std::string& message ) const;
+	void _secretSeal ( std::string& message, const unsigned char* frameHeader );
 };
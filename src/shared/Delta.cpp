@@ -0,0 +1,209 @@
+#include "Delta.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <sodium.h>
+
+#include "utils.hpp"
+
+namespace {
+
+	constexpr std::size_t bufferSize = 4 * 1024 * 1024;
+	// literal data handed out at once, bounds what a run of changed bytes keeps in memory
+	constexpr std::size_t maxLiteral = 4 * 1024 * 1024;
+
+	// one bit per bucket of weak checksums, most positions of a changed region miss without a map lookup
+	constexpr unsigned filterBits = 20;
+
+	std::size_t filterIndex ( const std::uint32_t weak ) { return ( weak * 0x9e3779b1u ) >> ( 32 - filterBits ); }
+
+	/**
+	 * @brief Reads into the buffer after `filled`
+	 * @return whether the stream ended
+	 */
+	bool fill ( std::istream& stream, unsigned char* buffer, std::size_t& filled ) {
+		stream.read(reinterpret_cast<char*>(buffer + filled), static_cast<std::streamsize>(bufferSize - filled));
+		filled += stream.gcount();
+
+		if ( stream.bad() || ( !stream && !stream.eof() ) )
+			throw std::runtime_error("Delta: could not read the stream");
+
+		return stream.eof();
+	}
+
+}
+
+void Delta::Rolling::reset ( const unsigned char* data, const std::size_t size ) {
+	_a = 0;
+	_b = 0;
+	_size = size;
+
+	for ( std::size_t i = 0; i < size; ++i ) {
+		_a += data[i];
+		_b += static_cast<std::uint32_t>(size - i) * data[i];
+	}
+}
+
+std::size_t Delta::blockSize ( const std::uint64_t fileSize ) {
+	const auto root = static_cast<std::size_t>(std::sqrt(static_cast<double>(fileSize)));
+	return std::clamp<std::size_t>(root / 1024 * 1024, minBlockSize, maxBlockSize);
+}
+
+Delta::Strong Delta::strongHash ( const unsigned char* data, const std::size_t size ) {
+	Strong strong;
+	crypto_generichash(strong.data(), strong.size(), data, size, nullptr, 0);
+	return strong;
+}
+
+std::vector<Delta::Signature> Delta::signatures ( std::istream& stream, const std::size_t blockSize ) {
+	std::vector<Signature> signatures;
+
+	const auto buffer = std::make_unique_for_overwrite<unsigned char[]>(bufferSize);
+	std::size_t filled = 0;
+	Rolling rolling;
+
+	while ( true ) {
+		const bool end = fill(stream, buffer.get(), filled);
+		std::size_t start = 0;
+
+		for ( ; filled - start >= blockSize; start += blockSize ) {
+			rolling.reset(buffer.get() + start, blockSize);
+			signatures.push_back({rolling.value(), strongHash(buffer.get() + start, blockSize)});
+		}
+
+		if ( end )
+			return signatures;
+
+		std::memmove(buffer.get(), buffer.get() + start, filled - start);
+		filled -= start;
+	}
+}
+
+void Delta::diff ( std::istream& stream, const std::size_t blockSize, const std::vector<Signature>& signatures,
+                   const LiteralHandler& literal, const CopyHandler& copy ) {
+	std::unordered_map<std::uint32_t, std::vector<std::uint32_t>> blocks;
+	std::vector<bool> filter(std::size_t{1} << filterBits);
+
+	for ( std::uint32_t i = 0; i < signatures.size(); ++i ) {
+		blocks[signatures[i].weak].push_back(i);
+		filter[filterIndex(signatures[i].weak)] = true;
+	}
+
+	const auto buffer = std::make_unique_for_overwrite<unsigned char[]>(bufferSize);
+	const auto view = [&buffer] ( const std::size_t from, const std::size_t to ) {
+		return std::string_view(reinterpret_cast<const char*>(buffer.get() + from), to - from);
+	};
+
+	std::size_t filled = 0;
+
+	// nothing to find, every byte is literal
+	if ( blocks.empty() ) {
+		for ( bool end = false; !end; filled = 0 ) {
+			end = fill(stream, buffer.get(), filled);
+			if ( filled > 0 )
+				literal(view(0, filled));
+		}
+		return;
+	}
+
+	std::size_t position = 0;
+	std::size_t literalStart = 0;
+	bool end = false;
+
+	Rolling rolling;
+	bool rollingValid = false;
+	// a block that follows the previous match is the likeliest candidate among equal checksums
+	std::uint32_t expected = 0;
+
+	while ( true ) {
+		if ( filled - position < blockSize && !end ) {
+			if ( position > literalStart )
+				literal(view(literalStart, position));
+
+			std::memmove(buffer.get(), buffer.get() + position, filled - position);
+			filled -= position;
+			position = literalStart = 0;
+			end = fill(stream, buffer.get(), filled);
+			rollingValid = false;
+			continue;
+		}
+
+		if ( filled - position < blockSize )
+			break;
+
+		if ( !rollingValid ) {
+			rolling.reset(buffer.get() + position, blockSize);
+			rollingValid = true;
+		}
+
+		if ( const auto weak = rolling.value(); filter[filterIndex(weak)] ) {
+			if ( const auto candidates = blocks.find(weak); candidates != blocks.end() ) {
+				const auto strong = strongHash(buffer.get() + position, blockSize);
+				const auto matches = [&] ( const std::uint32_t block ) { return signatures[block].strong == strong; };
+
+				auto match = std::ranges::find(candidates->second, expected);
+				if ( match == candidates->second.end() || !matches(*match) )
+					match = std::ranges::find_if(candidates->second, matches);
+
+				if ( match != candidates->second.end() ) {
+					if ( position > literalStart )
+						literal(view(literalStart, position));
+
+					copy(*match);
+					expected = *match + 1;
+					position += blockSize;
+					literalStart = position;
+					rollingValid = false;
+					continue;
+				}
+			}
+		}
+
+		if ( position + blockSize < filled )
+			rolling.roll(buffer[position], buffer[position + blockSize]);
+		else
+			rollingValid = false;
+
+		++position;
+
+		if ( position - literalStart >= maxLiteral ) {
+			literal(view(literalStart, position));
+			literalStart = position;
+		}
+	}
+
+	// the tail shorter than a block
+	for ( ; literalStart < filled; literalStart += std::min(maxLiteral, filled - literalStart) )
+		literal(view(literalStart, literalStart + std::min(maxLiteral, filled - literalStart)));
+}
+
+std::string Delta::toHex ( const Signature& signature ) {
+	unsigned char bytes[4 + std::tuple_size_v<Strong>];
+
+	for ( int i = 0; i < 4; ++i )
+		bytes[i] = static_cast<unsigned char>(signature.weak >> ( 24 - 8 * i ));
+	std::memcpy(bytes + 4, signature.strong.data(), signature.strong.size());
+
+	return binToHex(bytes, sizeof bytes);
+}
+
+Delta::Signature Delta::fromHex ( const std::string_view hex ) {
+	unsigned char bytes[4 + std::tuple_size_v<Strong>];
+	std::size_t length = 0;
+
+	if ( hex.size() != sizeof bytes * 2 ||
+	     sodium_hex2bin(bytes, sizeof bytes, hex.data(), hex.size(), nullptr, &length, nullptr) != 0 ||
+	     length != sizeof bytes )
+		throw std::runtime_error("Delta: not a block signature: " + std::string(hex));
+
+	Signature signature{0, {}};
+	for ( int i = 0; i < 4; ++i )
+		signature.weak = signature.weak << 8 | bytes[i];
+	std::memcpy(signature.strong.data(), bytes + 4, signature.strong.size());
+
+	return signature;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief rsync-style delta encoding of a file against an older version of it
+ *
+ * The holder of the old version describes it as block signatures: a rolling checksum
+ * that is cheap to slide over the new file byte by byte, and a strong hash that confirms
+ * a candidate. The holder of the new version answers with the blocks it found at any
+ * offset and the literal bytes between them.
+ */
+namespace Delta {
+
+	constexpr std::size_t minBlockSize = 2 * 1024;
+	constexpr std::size_t maxBlockSize = 128 * 1024;
+
+	using Strong = std::array<unsigned char, 16>;
+
+	struct Signature {
+		std::uint32_t weak;
+		Strong strong;
+	};
+
+	/**
+	 * @brief Checksum of a window that moves one byte at a time in constant time, the one rsync uses
+	 */
+	class Rolling {
+	public:
+		void reset ( const unsigned char* data, std::size_t size );
+
+		void roll ( const unsigned char out, const unsigned char in ) {
+			_a += in - out;
+			_b += _a - static_cast<std::uint32_t>(_size) * out;
+		}
+
+		[[nodiscard]] std::uint32_t value () const { return ( _a & 0xffff ) | _b << 16; }
+
+	private:
+		std::uint32_t _a = 0;
+		std::uint32_t _b = 0;
+		std::size_t _size = 0;
+	};
+
+	using LiteralHandler = std::function<void ( std::string_view data )>;
+	using CopyHandler = std::function<void ( std::uint32_t block )>;
+
+	/**
+	 * @brief Block size for an old version of `fileSize` bytes, about its square root
+	 */
+	std::size_t blockSize ( std::uint64_t fileSize );
+
+	Strong strongHash ( const unsigned char* data, std::size_t size );
+
+	/**
+	 * @brief Signatures of the full blocks of the stream, a shorter tail is left out
+	 * @throws std::runtime_error if the stream fails before its end
+	 */
+	std::vector<Signature> signatures ( std::istream& stream, std::size_t blockSize );
+
+	/**
+	 * @brief Walks the stream and reports, in order, the literal data and the old blocks that make it up
+	 * @throws std::runtime_error if the stream fails before its end
+	 */
+	void diff ( std::istream& stream, std::size_t blockSize, const std::vector<Signature>& signatures,
+	            const LiteralHandler& literal, const CopyHandler& copy );
+
+	std::string toHex ( const Signature& signature );
+
+	/**
+	 * @throws std::runtime_error if `hex` is not a signature
+	 */
+	Signature fromHex ( std::string_view hex );
+
+}
@@ -1,6 +1,40 @@
 #include "FileInfo.hpp"
 
 #include <algorithm>
+#include <charconv>
+#include <cstdint>
+
+namespace {
+    // name length (2 bytes), hash length (1 byte), size (8 bytes), upload date in seconds (8 bytes), little endian
+    constexpr std::size_t binaryHeaderSize = 19;
+
+    template < typename T >
+    T parseNumber ( const std::string_view token, const char* what ) {
+        T value{};
+        const auto [end, error] = std::from_chars(token.data(), token.data() + token.size(), value);
+        if ( error != std::errc() || end != token.data() + token.size() )
+            throw std::runtime_error(std::string("Invalid ") + what + " in FileInfo representation: " + std::string(token));
+        return value;
+    }
+
+    template < typename T >
+    void appendNumber ( std::string& out, const T value ) {
+        char digits[24];
+        out.append(digits, std::to_chars(digits, digits + sizeof digits, value).ptr);
+    }
+
+    void writeLE ( char* out, const std::uint64_t value, const int bytes ) {
+        for ( int i = 0; i < bytes; ++i )
+            out[i] = static_cast<char>(value >> 8 * i);
+    }
+
+    std::uint64_t readLE ( const std::string_view in, const std::size_t offset, const int bytes ) {
+        std::uint64_t value = 0;
+        for ( int i = 0; i < bytes; ++i )
+            value |= static_cast<std::uint64_t>(static_cast<unsigned char>(in[offset + i])) << 8 * i;
+        return value;
+    }
+}
 
 FileInfo::FileInfo(
     std::string name,
@@ -32,51 +66,35 @@ FileInfo::FileInfo ( const std::filesystem::path& filePath, const bool convertFr
     _creationDate = std::chrono::clock_cast<std::chrono::utc_clock>(ftime);
 }
 
-FileInfo::FileInfo ( std::string encodedRepresentation ) {
+FileInfo::FileInfo ( const std::string& encodedRepresentation ) : FileInfo(parse(encodedRepresentation)) {}
+
+FileInfo::FileInfo ( const View& view )
+    : _name(view.name), _hash(view.hash), _size(view.size), _creationDate(view.creationDate) {}
+
+FileInfo::View FileInfo::parse ( std::string_view encodedRepresentation ) {
     if ( encodedRepresentation.empty() )
         throw std::runtime_error("Cannot decode empty FileInfo representation");
 
+    // formatted as name|hash|size|uploadDate|#
+    const auto whole = encodedRepresentation;
+    std::string_view tokens[4];
 
-    // formatted as name|hash|size|uploadDate
-
-    for ( size_t i = 0; i < 4; ++i ) {
+    for ( auto& token: tokens ) {
         const auto delimiterPos = encodedRepresentation.find('|');
-        if ( delimiterPos == std::string::npos )
-            throw std::runtime_error("Invalid FileInfo representation: " + encodedRepresentation);
-
-        const auto token = encodedRepresentation.substr(0, delimiterPos);
-
-        switch ( i ) {
-            case 0:
-                _name = token;
-                break;
-            case 1:
-                _hash = token;
-                break;
-            case 2:
-                try {
-                    _size = std::stoull(token);
-                } catch ( const std::exception& e ) {
-                    throw std::runtime_error("Invalid size in FileInfo representation: " + token + " | " + e.what());
-                }
-                break;
-            case 3:
-                try {
-                    const auto timeInSeconds = std::stol(token);
-                    _creationDate = std::chrono::time_point<std::chrono::utc_clock>(std::chrono::seconds(timeInSeconds));
-                } catch ( const std::exception& e) {
-                    throw std::runtime_error("Invalid upload date in FileInfo representation: " + token + " | " + e.what());
-                }
-            default:
-                break;
-        }
-
-        encodedRepresentation = encodedRepresentation.substr(delimiterPos + 1);
+        if ( delimiterPos == std::string_view::npos )
+            throw std::runtime_error("Invalid FileInfo representation: " + std::string(whole));
+
+        token = encodedRepresentation.substr(0, delimiterPos);
+        encodedRepresentation.remove_prefix(delimiterPos + 1);
     }
 
     if ( !encodedRepresentation.empty() && encodedRepresentation != "#" )
-        throw std::runtime_error("Invalid FileInfo representation, extra data found: " + encodedRepresentation);
+        throw std::runtime_error("Invalid FileInfo representation, extra data found: " + std::string(encodedRepresentation));
 
+    return {
+        tokens[0], tokens[1], parseNumber<std::size_t>(tokens[2], "size"),
+        std::chrono::time_point<std::chrono::utc_clock>(std::chrono::seconds(parseNumber<std::int64_t>(tokens[3], "upload date")))
+    };
 }
 
 std::string FileInfo::getName () const {
@@ -100,24 +118,70 @@ std::chrono::time_point<std::chrono::system_clock> FileInfo::getCreationDateInTZ
 }
 
 std::string FileInfo::getCreationDateString_c () {
-    if ( !_uploadDateString_A_cCache.empty() )
-        return _uploadDateString_A_cCache;
+    if ( _uploadDateString_A_cCache.empty() )
+        _uploadDateString_A_cCache = dateString_c(_creationDate);
 
-    const std::time_t t_c = std::chrono::system_clock::to_time_t(getCreationDateInTZ());
+    return _uploadDateString_A_cCache;
+}
+
+std::string FileInfo::dateString_c ( const std::chrono::time_point<std::chrono::utc_clock>& date ) {
+    const std::time_t t_c = std::chrono::system_clock::to_time_t(std::chrono::clock_cast<std::chrono::system_clock>(date));
     char mbstr[100];
     if ( !std::strftime(mbstr, sizeof(mbstr), "%c", std::localtime(&t_c)) ) {
         throw std::runtime_error("Could not format upload date");
     }
 
-    _uploadDateString_A_cCache = std::string(mbstr);
-
-    return _uploadDateString_A_cCache;
+    return mbstr;
 }
 
 std::string FileInfo::encode () const {
-    std::string ret = _name + '|' + _hash + '|' + std::to_string(_size) + '|';
+    std::string ret;
+    ret.reserve(_name.size() + _hash.size() + 48);
+    appendEncoded(ret);
+    return ret;
+}
+
+void FileInfo::appendEncoded ( std::string& out ) const {
+    out += _name;
+    out += '|';
+    out += _hash;
+    out += '|';
+    appendNumber(out, _size);
+    out += '|';
+    appendNumber(out, std::chrono::duration_cast<std::chrono::seconds>(_creationDate.time_since_epoch()).count());
+    out += "|#"; // '#' as end marker
+}
+
+void FileInfo::appendBinary ( std::string& out ) const {
+    if ( _name.size() > 0xffff || _hash.size() > 0xff )
+        throw std::runtime_error("FileInfo too large for the binary form: " + _name);
+
+    char header[binaryHeaderSize];
+    writeLE(header, _name.size(), 2);
+    writeLE(header + 2, _hash.size(), 1);
+    writeLE(header + 3, _size, 8);
+    writeLE(header + 11, std::chrono::duration_cast<std::chrono::seconds>(_creationDate.time_since_epoch()).count(), 8);
+
+    out.append(header, sizeof header);
+    out += _name;
+    out += _hash;
+}
+
+FileInfo::View FileInfo::decodeBinary ( std::string_view& in ) {
+    if ( in.size() < binaryHeaderSize )
+        throw std::runtime_error("Truncated binary FileInfo");
+
+    const auto nameSize = readLE(in, 0, 2);
+    const auto hashSize = readLE(in, 2, 1);
+
+    if ( in.size() < binaryHeaderSize + nameSize + hashSize )
+        throw std::runtime_error("Truncated binary FileInfo");
 
-    ret += std::to_string(std::chrono::duration_cast<std::chrono::seconds>(_creationDate.time_since_epoch()).count()) + '|';
+    const View view{
+        in.substr(binaryHeaderSize, nameSize), in.substr(binaryHeaderSize + nameSize, hashSize), readLE(in, 3, 8),
+        std::chrono::time_point<std::chrono::utc_clock>(std::chrono::seconds(static_cast<std::int64_t>(readLE(in, 11, 8))))
+    };
 
-    return ret + '#'; // '#' as end marker
+    in.remove_prefix(binaryHeaderSize + nameSize + hashSize);
+    return view;
 }
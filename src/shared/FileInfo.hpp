@@ -3,10 +3,21 @@
 #include <chrono>
 #include <filesystem>
 #include <string>
+#include <string_view>
 #include <utility>
 
 class FileInfo {
 public:
+    /**
+     * @brief A decoded record that still points into the buffer it was decoded from
+     */
+    struct View {
+        std::string_view name;
+        std::string_view hash;
+        std::size_t size = 0;
+        std::chrono::time_point<std::chrono::utc_clock> creationDate;
+    };
+
     FileInfo (
         std::string name,
         std::string hash,
@@ -16,7 +27,15 @@ public:
 
     FileInfo ( const std::filesystem::path &filePath, bool convertFromServerNameScheme = false );
 
-    explicit FileInfo ( std::string encodedRepresentation );
+    explicit FileInfo ( const std::string& encodedRepresentation );
+
+    explicit FileInfo ( const View& view );
+
+    /**
+     * @brief Parses `name|hash|size|date|#` in place
+     * @throws std::runtime_error on a malformed representation
+     */
+    static View parse ( std::string_view encodedRepresentation );
 
     [[nodiscard]] std::string getName () const;
 
@@ -30,8 +49,26 @@ public:
 
     [[nodiscard]] std::string getCreationDateString_c ();
 
+    static std::string dateString_c ( const std::chrono::time_point<std::chrono::utc_clock>& date );
+
     [[nodiscard]] std::string encode () const;
 
+    /**
+     * @brief Appends `name|hash|size|date|#` to `out`
+     */
+    void appendEncoded ( std::string& out ) const;
+
+    /**
+     * @brief Appends the compact binary form, meant for pages of many records
+     */
+    void appendBinary ( std::string& out ) const;
+
+    /**
+     * @brief Decodes one record of the binary form in place and moves `in` past it
+     * @throws std::runtime_error if `in` ends within the record
+     */
+    static View decodeBinary ( std::string_view& in );
+
 private:
     std::string _name;
     std::string _hash;
@@ -0,0 +1,196 @@
+#include "Frame.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+#include <string>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+namespace Frame {
+
+	void encodeHeader ( const Header& header, unsigned char* out ) {
+		out[0] = version;
+		out[1] = static_cast<unsigned char>(header.type);
+		out[2] = static_cast<unsigned char>(header.flags >> 8);
+		out[3] = static_cast<unsigned char>(header.flags);
+
+		for ( size_t i = 0; i < 8; ++i )
+			out[4 + i] = static_cast<unsigned char>(header.length >> ( 56 - 8 * i ));
+	}
+
+	Header decodeHeader ( const unsigned char* in ) {
+		if ( in[0] != version )
+			throw std::runtime_error("Frame: unsupported protocol version " + std::to_string(in[0]));
+
+		Header header;
+
+		switch ( static_cast<Type>(in[1]) ) {
+			case Type::Message:
+			case Type::StreamHeader:
+			case Type::Body:
+				header.type = static_cast<Type>(in[1]);
+				break;
+			default:
+				throw std::runtime_error("Frame: unknown frame type " + std::to_string(in[1]));
+		}
+
+		header.flags = static_cast<std::uint16_t>(in[2] << 8 | in[3]);
+
+		for ( size_t i = 0; i < 8; ++i )
+			header.length = header.length << 8 | in[4 + i];
+
+		// body frames are written to the file as they arrive, messages are held whole
+		if ( header.length > ( header.type == Type::Body ? maxBodySize : maxMessageSize ) )
+			throw std::runtime_error("Frame: payload too large: " + std::to_string(header.length));
+
+		return header;
+	}
+
+#ifdef __linux__
+	bool send ( const int socket, const Header& header, const char* payload ) {
+		unsigned char headerBytes[headerSize];
+		encodeHeader(header, headerBytes);
+
+		// header and payload go out in one syscall without copying them together
+		iovec parts[2] = {
+			{headerBytes, headerSize},
+			{const_cast<char*>(payload), header.length}
+		};
+		size_t part = 0;
+
+		while ( part < 2 ) {
+			msghdr message{};
+			message.msg_iov = parts + part;
+			message.msg_iovlen = 2 - part;
+
+			auto sent = sendmsg(socket, &message, 0);
+
+			if ( sent < 0 ) {
+				if ( errno == EINTR )
+					continue;
+				return false;
+			}
+
+			while ( part < 2 && static_cast<size_t>(sent) >= parts[part].iov_len ) {
+				sent -= static_cast<ssize_t>(parts[part].iov_len);
+				++part;
+			}
+
+			if ( part < 2 ) {
+				parts[part].iov_base = static_cast<char*>(parts[part].iov_base) + sent;
+				parts[part].iov_len -= sent;
+			}
+		}
+
+		return true;
+	}
+
+	namespace {
+		bool sendAll ( const int socket, const unsigned char* data, size_t length, const int flags ) {
+			while ( length > 0 ) {
+				const auto sent = ::send(socket, data, length, flags);
+
+				if ( sent < 0 ) {
+					if ( errno == EINTR )
+						continue;
+					return false;
+				}
+
+				data += sent;
+				length -= sent;
+			}
+
+			return true;
+		}
+	}
+
+	bool sendFile ( const int socket, const int file, const std::uint64_t offset, const std::uint64_t length ) {
+		auto position = static_cast<off_t>(offset);
+		auto remaining = length;
+
+		while ( remaining > 0 ) {
+			const auto frameLength = std::min(remaining, maxBodySize);
+
+			unsigned char headerBytes[headerSize];
+			encodeHeader({Type::Body, Flags::none, frameLength}, headerBytes);
+
+			if ( !sendAll(socket, headerBytes, headerSize, MSG_MORE) )
+				return false;
+
+			auto frameRemaining = frameLength;
+
+			while ( frameRemaining > 0 ) {
+				const auto sent = sendfile(socket, file, &position, frameRemaining);
+
+				if ( sent < 0 ) {
+					if ( errno == EINTR )
+						continue;
+					return false;
+				}
+
+				if ( sent == 0 )
+					return false;
+
+				frameRemaining -= sent;
+			}
+
+			remaining -= frameLength;
+		}
+
+		return true;
+	}
+
+	bool spliceToFile ( const int socket, const int file, const std::uint64_t offset, const std::uint64_t length ) {
+		int pipeEnds[2];
+		if ( pipe2(pipeEnds, O_CLOEXEC) < 0 )
+			return false;
+
+		auto position = static_cast<loff_t>(offset);
+		auto remaining = length;
+		bool ok = true;
+
+		while ( ok && remaining > 0 ) {
+			const auto moved = splice(socket, nullptr, pipeEnds[1], nullptr, remaining, SPLICE_F_MOVE | SPLICE_F_MORE);
+
+			if ( moved < 0 && errno == EINTR )
+				continue;
+
+			if ( moved <= 0 ) {
+				ok = false;
+				break;
+			}
+
+			auto inPipe = static_cast<size_t>(moved);
+
+			while ( inPipe > 0 ) {
+				const auto written = splice(pipeEnds[0], nullptr, file, &position, inPipe, SPLICE_F_MOVE);
+
+				if ( written < 0 && errno == EINTR )
+					continue;
+
+				if ( written <= 0 ) {
+					ok = false;
+					break;
+				}
+
+				inPipe -= written;
+			}
+
+			remaining -= moved;
+		}
+
+		close(pipeEnds[0]);
+		close(pipeEnds[1]);
+
+		return ok;
+	}
+#endif
+
+}
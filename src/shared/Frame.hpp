@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Binary framing shared by Connection and ConnectionServer
+ *
+ * Every message on the wire is prefixed by a fixed size header
+ * | version (1B) | type (1B) | flags (2B) | payload length (8B) |
+ * with all fields in network byte order, so the receiver always knows
+ * how many bytes to read before the payload arrives.
+ */
+namespace Frame {
+
+	constexpr std::uint8_t version = 1;
+	constexpr std::size_t headerSize = 12;
+
+	// message frames announcing more than this are rejected before anything is allocated,
+	// it leaves room for a hex encoded chunk and for the hash lists of a sync without reconciliation
+	constexpr std::uint64_t maxMessageSize = 256ULL * 1024 * 1024;
+	// largest part of a file a sender puts into one message
+	constexpr std::uint64_t maxChunkSize = 64ULL * 1024 * 1024;
+	// a file body is split into frames of at most this size
+	constexpr std::uint64_t maxBodySize = 1ULL * 1024 * 1024 * 1024;
+	// before the key exchange is done, only small handshake messages are expected
+	constexpr std::uint64_t maxHandshakePayloadSize = 64 * 1024;
+
+	enum class Type : std::uint8_t {
+		Message = 1,
+		// secretstream header opening the sender's encrypted stream, sent once after the key exchange
+		StreamHeader = 2,
+		// unencrypted file contents, only accepted once both sides agreed on the trusted transport
+		Body = 3
+	};
+
+	namespace Flags {
+		constexpr std::uint16_t none = 0;
+		// payload is a secretstream message, authenticated together with its frame header
+		constexpr std::uint16_t encrypted = 1 << 0;
+		// on handshake frames: the sender accepts raw ciphertext,
+		// on encrypted frames: the ciphertext is carried as raw bytes instead of hex
+		constexpr std::uint16_t rawCiphertext = 1 << 1;
+		// on handshake frames: the sender can decompress zstd,
+		// on encrypted frames: the plaintext is a zstd frame
+		constexpr std::uint16_t compressed = 1 << 2;
+		// on handshake frames: the sender keeps interrupted transfers, so they can be resumed
+		constexpr std::uint16_t resumable = 1 << 3;
+		// on handshake frames: the sender answers paged LIST queries
+		constexpr std::uint16_t pagedList = 1 << 4;
+		// on handshake frames: the sender syncs by reconciling hash sets instead of exchanging them
+		constexpr std::uint16_t reconciles = 1 << 5;
+	}
+
+	struct Header {
+		Type type = Type::Message;
+		std::uint16_t flags = Flags::none;
+		std::uint64_t length = 0;
+	};
+
+	void encodeHeader ( const Header& header, unsigned char* out );
+
+	/**
+	 * @throws std::runtime_error on unknown version, type or oversized payload
+	 */
+	Header decodeHeader ( const unsigned char* in );
+
+#ifdef __linux__
+	/**
+	 * @brief Writes header and payload to the socket, handling partial writes
+	 * @return false if the socket reported an error
+	 */
+	bool send ( int socket, const Header& header, const char* payload );
+
+	/**
+	 * @brief Sends `length` bytes of the file starting at `offset` as body frames, the contents never leave the kernel
+	 * @return false if the socket reported an error or the file ended early
+	 */
+	bool sendFile ( int socket, int file, std::uint64_t offset, std::uint64_t length );
+
+	/**
+	 * @brief Moves `length` bytes from the socket into the file at `offset` through a pipe, without copying them to user space
+	 * @return false if the socket or file reported an error or the peer disconnected
+	 */
+	bool spliceToFile ( int socket, int file, std::uint64_t offset, std::uint64_t length );
+#endif
+
+}
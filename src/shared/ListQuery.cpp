@@ -0,0 +1,80 @@
+#include "ListQuery.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <stdexcept>
+#include <string_view>
+
+namespace {
+
+	template < typename T >
+	T number ( const std::string_view key, const std::string_view value ) {
+		T result{};
+		const auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), result);
+		if ( error != std::errc() || end != value.data() + value.size() )
+			throw std::runtime_error("ListQuery: invalid " + std::string(key) + ": " + std::string(value));
+		return result;
+	}
+
+	constexpr const char* orderNames[] = {"name", "size", "date"};
+
+}
+
+std::string ListQuery::encode () const {
+	// the cursor goes last, a file name in it may contain anything but a '/'
+	return std::string("order=") + orderNames[static_cast<int>(order)] + ";desc=" + ( descending ? "1" : "0" ) +
+	       ";offset=" + std::to_string(offset) + ";limit=" + std::to_string(limit) +
+	       ";minSize=" + std::to_string(minSize) + ";maxSize=" + std::to_string(maxSize) +
+	       ";since=" + std::to_string(since) + ";until=" + std::to_string(until) + ";after=" + after;
+}
+
+ListQuery ListQuery::decode ( const std::string& encoded ) {
+	ListQuery query;
+	std::string_view rest = encoded;
+
+	while ( !rest.empty() ) {
+		const auto equals = rest.find('=');
+		if ( equals == std::string_view::npos )
+			throw std::runtime_error("ListQuery: malformed query: " + encoded);
+
+		const auto key = rest.substr(0, equals);
+		rest.remove_prefix(equals + 1);
+
+		if ( key == "after" ) {
+			query.after = rest;
+			break;
+		}
+
+		const auto end = std::min(rest.find(';'), rest.size());
+		const auto value = rest.substr(0, end);
+		rest.remove_prefix(std::min(end + 1, rest.size()));
+
+		if ( key == "order" )
+			query.order = orderFrom(std::string(value));
+		else if ( key == "desc" )
+			query.descending = value == "1";
+		else if ( key == "offset" )
+			query.offset = number<std::uint64_t>(key, value);
+		else if ( key == "limit" )
+			query.limit = number<std::uint64_t>(key, value);
+		else if ( key == "minSize" )
+			query.minSize = number<std::uint64_t>(key, value);
+		else if ( key == "maxSize" )
+			query.maxSize = number<std::uint64_t>(key, value);
+		else if ( key == "since" )
+			query.since = number<std::int64_t>(key, value);
+		else if ( key == "until" )
+			query.until = number<std::int64_t>(key, value);
+		// keys of newer clients are ignored
+	}
+
+	return query;
+}
+
+ListQuery::Order ListQuery::orderFrom ( const std::string& name ) {
+	for ( int i = 0; i < 3; ++i )
+		if ( name == orderNames[i] )
+			return static_cast<Order>(i);
+
+	throw std::runtime_error("ListQuery: unknown order: " + name);
+}
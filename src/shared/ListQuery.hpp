@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <string>
+
+/**
+ * @brief What a paged LIST asks the server for: order, window and filters
+ *
+ * Sent as one "query:" message after the authentication, the server answers with
+ * pages of binary FileInfo records and "DONE:<cursor>". Passing the cursor back as
+ * `after` continues the listing behind the last file received, unlike `offset` it
+ * stays correct while files are added or removed meanwhile.
+ */
+struct ListQuery {
+	enum class Order : std::uint8_t { name, size, date };
+
+	Order order = Order::name;
+	bool descending = false;
+	std::uint64_t offset = 0;
+	// 0 lists everything
+	std::uint64_t limit = 0;
+	std::uint64_t minSize = 0;
+	std::uint64_t maxSize = std::numeric_limits<std::uint64_t>::max();
+	// unix seconds
+	std::int64_t since = std::numeric_limits<std::int64_t>::min();
+	std::int64_t until = std::numeric_limits<std::int64_t>::max();
+	// cursor of the file to continue after, empty to start at the beginning
+	std::string after;
+
+	[[nodiscard]] std::string encode () const;
+
+	/**
+	 * @throws std::runtime_error on a malformed query
+	 */
+	static ListQuery decode ( const std::string& encoded );
+
+	/**
+	 * @throws std::runtime_error on an unknown order
+	 */
+	static Order orderFrom ( const std::string& name );
+};
@@ -0,0 +1,72 @@
+#include "ReceiveBuffer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+ReceiveBuffer::ReceiveBuffer ( const std::size_t capacity )
+	: _data(std::make_unique_for_overwrite<char[]>(capacity)), _capacity(capacity) {}
+
+std::span<char> ReceiveBuffer::writable () {
+	if ( _writePos == _capacity )
+		_compact();
+
+	return {_data.get() + _writePos, _capacity - _writePos};
+}
+
+void ReceiveBuffer::commit ( const std::size_t size ) {
+	if ( size > _capacity - _writePos )
+		throw std::out_of_range("ReceiveBuffer::commit: more bytes than free space");
+
+	_writePos += size;
+}
+
+std::span<char> ReceiveBuffer::readable () { return {_data.get() + _readPos, _writePos - _readPos}; }
+
+void ReceiveBuffer::consume ( const std::size_t size ) {
+	if ( size > _writePos - _readPos )
+		throw std::out_of_range("ReceiveBuffer::consume: more bytes than received");
+
+	_readPos += size;
+
+	if ( _readPos == _writePos )
+		_readPos = _writePos = 0;
+}
+
+void ReceiveBuffer::reserve ( const std::size_t size ) {
+	if ( _capacity - _readPos >= size )
+		return;
+
+	if ( _capacity >= size ) {
+		_compact();
+		return;
+	}
+
+	resize(size);
+}
+
+void ReceiveBuffer::resize ( const std::size_t capacity ) {
+	const auto pending = _writePos - _readPos;
+
+	if ( capacity < pending )
+		throw std::invalid_argument("ReceiveBuffer::resize: unconsumed data would not fit");
+
+	auto data = std::make_unique_for_overwrite<char[]>(capacity);
+	std::memcpy(data.get(), _data.get() + _readPos, pending);
+
+	_data = std::move(data);
+	_capacity = capacity;
+	_readPos = 0;
+	_writePos = pending;
+}
+
+std::size_t ReceiveBuffer::capacity () const { return _capacity; }
+
+void ReceiveBuffer::_compact () {
+	if ( _readPos == 0 )
+		return;
+
+	std::memmove(_data.get(), _data.get() + _readPos, _writePos - _readPos);
+	_writePos -= _readPos;
+	_readPos = 0;
+}
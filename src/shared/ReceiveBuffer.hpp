@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <span>
+
+/**
+ * @brief Reusable receive buffer handing out contiguous views of received frames
+ *
+ * Bytes are appended at the write position and consumed from the read position.
+ * When everything received has been consumed both positions return to the start,
+ * and a frame that would not fit behind the read position is moved to the front
+ * (or the buffer grows) instead of wrapping, so every frame stays contiguous.
+ * The storage is never zero-filled.
+ */
+class ReceiveBuffer {
+public:
+	explicit ReceiveBuffer ( std::size_t capacity );
+
+	/**
+	 * @brief Free space behind the received bytes, to be filled by recv
+	 */
+	[[nodiscard]] std::span<char> writable ();
+
+	void commit ( std::size_t size );
+
+	/**
+	 * @brief Received bytes that were not consumed yet
+	 */
+	[[nodiscard]] std::span<char> readable ();
+
+	void consume ( std::size_t size );
+
+	/**
+	 * @brief Makes sure `size` contiguous bytes starting at the read position fit into the buffer
+	 */
+	void reserve ( std::size_t size );
+
+	/**
+	 * @brief Changes the capacity, keeping unconsumed bytes
+	 */
+	void resize ( std::size_t capacity );
+
+	[[nodiscard]] std::size_t capacity () const;
+
+private:
+	std::unique_ptr<char[]> _data;
+	std::size_t _capacity;
+	std::size_t _readPos = 0;
+	std::size_t _writePos = 0;
+
+	void _compact ();
+};
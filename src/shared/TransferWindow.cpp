@@ -0,0 +1,60 @@
+#include "TransferWindow.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+TransferWindow::TransferWindow ( const unsigned initialChunks, const unsigned maxChunks )
+	: _minChunks(std::max(1u, initialChunks)), _maxChunks(std::max(_minChunks, maxChunks)), _size(_minChunks) {}
+
+void TransferWindow::sent ( const std::size_t bytes ) {
+	_inFlight.push_back({bytes, Clock::now()});
+
+	// chunk sizes change during the transfer, so keep a smoothed average
+	_averageChunk = _averageChunk == 0.0
+		                ? static_cast<double>(bytes)
+		                : _averageChunk * 0.875 + static_cast<double>(bytes) * 0.125;
+}
+
+void TransferWindow::acknowledged () {
+	if ( _inFlight.empty() )
+		throw std::runtime_error("TransferWindow: confirmation without a chunk in flight");
+
+	const auto now = Clock::now();
+	const auto chunk = _inFlight.front();
+	_inFlight.pop_front();
+
+	// queueing inside the pipeline inflates later samples, the minimum is the path delay
+	_minRtt = std::min(_minRtt, std::chrono::duration<double>(now - chunk.sentAt));
+
+	if ( _hadAck ) {
+		const auto interval = std::chrono::duration<double>(now - _lastAck).count();
+		if ( interval > 0.0 ) {
+			const auto rate = static_cast<double>(chunk.bytes) / interval;
+			_deliveryRate = _deliveryRate == 0.0 ? rate : _deliveryRate * 0.875 + rate * 0.125;
+		}
+	}
+
+	_lastAck = now;
+	_hadAck = true;
+
+	_adapt();
+}
+
+bool TransferWindow::full () const { return _inFlight.size() >= _size; }
+
+std::size_t TransferWindow::inFlight () const { return _inFlight.size(); }
+
+unsigned TransferWindow::size () const { return _size; }
+
+void TransferWindow::_adapt () {
+	if ( _deliveryRate == 0.0 || _averageChunk == 0.0 )
+		return;
+
+	const auto bdp = _deliveryRate * _minRtt.count();
+
+	// two chunks of headroom keep the pipe busy while a confirmation is on its way
+	const auto chunks = static_cast<unsigned>(std::ceil(bdp / _averageChunk)) + 2;
+
+	_size = std::clamp(chunks, _minChunks, _maxChunks);
+}
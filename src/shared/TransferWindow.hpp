@@ -0,0 +1,85 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <stdexcept>
+#include <string>
+
+/**
+ * @brief Sliding window over chunks that were sent but not confirmed yet
+ *
+ * The receiver confirms every chunk in order, so each confirmation acknowledges
+ * the oldest chunk in flight. The sender keeps sending until the window is full
+ * and only then waits for confirmations. The window follows the measured
+ * bandwidth-delay product: delivery rate times the lowest round trip seen,
+ * expressed in chunks of the average size, plus some headroom.
+ */
+class TransferWindow {
+public:
+	static constexpr unsigned defaultInitialChunks = 4;
+	static constexpr unsigned defaultMaxChunks = 64;
+
+	explicit TransferWindow ( unsigned initialChunks = defaultInitialChunks, unsigned maxChunks = defaultMaxChunks );
+
+	void sent ( std::size_t bytes );
+
+	/**
+	 * @brief Records the confirmation of the oldest chunk in flight
+	 */
+	void acknowledged ();
+
+	/**
+	 * @brief Reads the confirmations that already arrived, blocks only while the window is full
+	 */
+	template < typename Conn >
+	void collect ( Conn& connection ) {
+		while ( !_inFlight.empty() && ( full() || connection.hasPending() ) )
+			_confirm(connection.receiveInternal());
+	}
+
+	/**
+	 * @brief Waits for the confirmations of all chunks in flight
+	 */
+	template < typename Conn >
+	void drain ( Conn& connection ) {
+		while ( !_inFlight.empty() )
+			_confirm(connection.receiveInternal());
+	}
+
+	[[nodiscard]] bool full () const;
+
+	[[nodiscard]] std::size_t inFlight () const;
+
+	/**
+	 * @brief Current window size in chunks
+	 */
+	[[nodiscard]] unsigned size () const;
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	struct Chunk {
+		std::size_t bytes;
+		Clock::time_point sentAt;
+	};
+
+	std::deque<Chunk> _inFlight;
+	unsigned _minChunks;
+	unsigned _maxChunks;
+	unsigned _size;
+
+	std::chrono::duration<double> _minRtt = std::chrono::duration<double>::max();
+	double _deliveryRate = 0.0; // bytes per second, smoothed
+	double _averageChunk = 0.0;
+	Clock::time_point _lastAck;
+	bool _hadAck = false;
+
+	void _confirm ( const std::string& message ) {
+		if ( message != "confirm" )
+			throw std::runtime_error("TransferWindow: peer did not confirm the chunk, got: " + message);
+		acknowledged();
+	}
+
+	void _adapt ();
+};
@@ -0,0 +1,186 @@
+#include "TreeHash.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <unistd.h>
+
+#include "utils.hpp"
+
+namespace {
+
+	constexpr unsigned char leafPrefix = 0;
+	constexpr unsigned char nodePrefix = 1;
+
+	// leaves read at once by a worker, large reads keep the disk streaming
+	constexpr std::size_t leavesPerRead = 8;
+
+	TreeHash::Hash node ( const TreeHash::Hash& left, const TreeHash::Hash& right ) {
+		TreeHash::Hash hash;
+		crypto_generichash_state state;
+		crypto_generichash_init(&state, nullptr, 0, hash.size());
+		crypto_generichash_update(&state, &nodePrefix, 1);
+		crypto_generichash_update(&state, left.data(), left.size());
+		crypto_generichash_update(&state, right.data(), right.size());
+		crypto_generichash_final(&state, hash.data(), hash.size());
+		return hash;
+	}
+
+	/**
+	 * @brief Hashes leaves [first, last) of the file
+	 * @return false if the file could not be read
+	 */
+	bool hashLeaves ( const int file, const std::uint64_t size, const std::size_t first, const std::size_t last,
+	                  TreeHash::Hash* out ) {
+		const auto buffer = std::make_unique_for_overwrite<unsigned char[]>(leavesPerRead * TreeHash::leafSize);
+
+		for ( auto index = first; index < last; index += leavesPerRead ) {
+			const auto offset = static_cast<std::uint64_t>(index) * TreeHash::leafSize;
+			const auto length = std::min<std::uint64_t>(( std::min(last, index + leavesPerRead) - index ) * TreeHash::leafSize,
+			                                            size - offset);
+
+			for ( std::uint64_t done = 0; done < length; ) {
+				const auto result = pread(file, buffer.get() + done, length - done, static_cast<off_t>(offset + done));
+				if ( result < 0 && errno == EINTR )
+					continue;
+				if ( result <= 0 )
+					return false;
+				done += result;
+			}
+
+			for ( std::uint64_t start = 0; start < length; start += TreeHash::leafSize )
+				out[index + start / TreeHash::leafSize] =
+					TreeHash::leaf(buffer.get() + start, std::min<std::uint64_t>(TreeHash::leafSize, length - start));
+		}
+
+		return true;
+	}
+
+}
+
+bool TreeHash::isTreeId ( const std::string_view id ) { return id.starts_with(tag); }
+
+TreeHash::Hash TreeHash::leaf ( const unsigned char* data, const std::size_t size ) {
+	Hash hash;
+	crypto_generichash_state state;
+	crypto_generichash_init(&state, nullptr, 0, hash.size());
+	crypto_generichash_update(&state, &leafPrefix, 1);
+	crypto_generichash_update(&state, data, size);
+	crypto_generichash_final(&state, hash.data(), hash.size());
+	return hash;
+}
+
+TreeHash::Hash TreeHash::root ( std::vector<Hash> leaves ) {
+	if ( leaves.empty() )
+		return leaf(nullptr, 0);
+
+	while ( leaves.size() > 1 ) {
+		std::size_t parents = 0;
+
+		for ( std::size_t i = 0; i < leaves.size(); i += 2 )
+			leaves[parents++] = i + 1 < leaves.size() ? node(leaves[i], leaves[i + 1]) : leaves[i];
+
+		leaves.resize(parents);
+	}
+
+	return leaves.front();
+}
+
+std::string TreeHash::toId ( const Hash& root ) { return std::string(tag) + toHex(root); }
+
+std::vector<TreeHash::Hash> TreeHash::leaves ( const int file, const std::uint64_t size ) {
+	if ( size == 0 )
+		return {leaf(nullptr, 0)};
+
+	std::vector<Hash> leaves(( size + leafSize - 1 ) / leafSize);
+
+	// contiguous ranges per worker, each one reads sequentially
+	const auto workers = std::clamp<std::size_t>(std::thread::hardware_concurrency(), 1, leaves.size());
+	const auto perWorker = ( leaves.size() + workers - 1 ) / workers;
+
+	std::vector<char> succeeded(workers, false);
+
+	{
+		std::vector<std::jthread> threads;
+
+		for ( std::size_t worker = 0; worker < workers; ++worker ) {
+			const auto first = std::min(leaves.size(), worker * perWorker);
+			const auto last = std::min(leaves.size(), first + perWorker);
+
+			threads.emplace_back([&, worker, first, last] {
+				succeeded[worker] = hashLeaves(file, size, first, last, leaves.data());
+			});
+		}
+	}
+
+	if ( !std::ranges::all_of(succeeded, [] ( const char ok ) { return ok; }) )
+		throw std::runtime_error("TreeHash: could not read the file");
+
+	return leaves;
+}
+
+std::string TreeHash::toHex ( const Hash& hash ) { return binToHex(hash.data(), hash.size()); }
+
+TreeHash::Hash TreeHash::fromHex ( const std::string_view hex ) {
+	Hash hash;
+	std::size_t length = 0;
+
+	if ( hex.size() != hash.size() * 2 ||
+	     sodium_hex2bin(hash.data(), hash.size(), hex.data(), hex.size(), nullptr, &length, nullptr) != 0 ||
+	     length != hash.size() )
+		throw std::runtime_error("TreeHash: not a hash: " + std::string(hex));
+
+	return hash;
+}
+
+TreeHash::Hasher::Hasher ( const bool tree ) : _tree(tree) {
+	if ( _tree )
+		_startLeaf();
+	else
+		crypto_generichash_init(&_state, nullptr, 0, crypto_generichash_BYTES);
+}
+
+void TreeHash::Hasher::update ( const unsigned char* data, std::size_t size ) {
+	if ( !_tree ) {
+		crypto_generichash_update(&_state, data, size);
+		return;
+	}
+
+	while ( size > 0 ) {
+		const auto take = std::min(size, leafSize - _filled);
+		crypto_generichash_update(&_state, data, take);
+		_filled += take;
+		data += take;
+		size -= take;
+
+		if ( _filled == leafSize ) {
+			Hash hash;
+			crypto_generichash_final(&_state, hash.data(), hash.size());
+			_leaves.push_back(hash);
+			_startLeaf();
+		}
+	}
+}
+
+std::string TreeHash::Hasher::finalize () {
+	Hash hash;
+	crypto_generichash_final(&_state, hash.data(), hash.size());
+
+	if ( !_tree )
+		return toHex(hash);
+
+	// the last, shorter leaf; an empty file is a single empty leaf
+	if ( _filled > 0 || _leaves.empty() )
+		_leaves.push_back(hash);
+
+	return toId(root(_leaves));
+}
+
+void TreeHash::Hasher::_startLeaf () {
+	crypto_generichash_init(&_state, nullptr, 0, crypto_generichash_BYTES);
+	crypto_generichash_update(&_state, &leafPrefix, 1);
+	_filled = 0;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sodium.h>
+
+/**
+ * @brief Merkle tree hash of a file, hashed on all cores and checkable leaf by leaf
+ *
+ * Every 1 MiB leaf is hashed on its own with BLAKE2b, each parent hashes its two children
+ * and an odd node moves up unchanged. Leaves and parents get different prefixes, so one
+ * cannot pass for the other. Identifiers of tree hashes carry the tag "m1-" in front of
+ * the hex root, the untagged sequential BLAKE2b hashes of files stored earlier stay valid.
+ */
+namespace TreeHash {
+
+	constexpr std::size_t leafSize = 1024 * 1024;
+	constexpr std::string_view tag = "m1-";
+
+	using Hash = std::array<unsigned char, 32>;
+
+	[[nodiscard]] bool isTreeId ( std::string_view id );
+
+	Hash leaf ( const unsigned char* data, std::size_t size );
+
+	/**
+	 * @param leaves hashes of the leaves in file order, an empty file has the one leaf of no data
+	 */
+	Hash root ( std::vector<Hash> leaves );
+
+	std::string toId ( const Hash& root );
+
+	/**
+	 * @brief Hashes the leaves of the first `size` bytes of the file, spread over all cores; an empty file has one empty leaf
+	 * @throws std::runtime_error if the file could not be read
+	 */
+	std::vector<Hash> leaves ( int file, std::uint64_t size );
+
+	std::string toHex ( const Hash& hash );
+
+	/**
+	 * @throws std::runtime_error if `hex` is not a hash
+	 */
+	Hash fromHex ( std::string_view hex );
+
+	/**
+	 * @brief Incremental hash in either algorithm, the tree hash or the sequential BLAKE2b
+	 */
+	class Hasher {
+	public:
+		explicit Hasher ( bool tree );
+
+		/**
+		 * @brief Hasher of the algorithm the identifier was made with
+		 */
+		static Hasher like ( const std::string_view id ) { return Hasher(isTreeId(id)); }
+
+		void update ( const unsigned char* data, std::size_t size );
+
+		/**
+		 * @brief Leaves completed so far, only filled for the tree hash
+		 */
+		[[nodiscard]] const std::vector<Hash>& leaves () const { return _leaves; }
+
+		/**
+		 * @return identifier of everything passed to update
+		 */
+		std::string finalize ();
+
+	private:
+		bool _tree;
+		crypto_generichash_state _state;
+		// bytes in the current leaf
+		std::size_t _filled = 0;
+		std::vector<Hash> _leaves;
+
+		void _startLeaf ();
+	};
+
+}
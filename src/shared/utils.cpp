@@ -1,5 +1,9 @@
 #include "utils.hpp"
 
+#include <algorithm>
+#include <sodium.h>
+#include <stdexcept>
+
 std::string humanReadableSize ( const size_t size ) {
     const char* units[] = {"B", "KB", "MB", "GB", "TB"};
     auto sizeDouble = static_cast<double>(size);
@@ -49,6 +53,38 @@ std::string binToHex ( const unsigned char* bin, const size_t size ) {
     return {bin.get(), hex.size() / 2};
 }
 
+std::string fingerprint ( std::istream& stream, const uint64_t size ) {
+    constexpr uint64_t sampleSize = 1024 * 1024;
+
+    unsigned char hash[crypto_generichash_BYTES];
+    crypto_generichash_state state;
+    crypto_generichash_init(&state, nullptr, 0, sizeof hash);
+
+    const auto sizeString = std::to_string(size);
+    crypto_generichash_update(&state, reinterpret_cast<const unsigned char*>(sizeString.data()), sizeString.size());
+
+    const auto buffer = std::make_unique_for_overwrite<char[]>(sampleSize);
+    const auto length = std::min(size, sampleSize);
+
+    for ( const auto offset: {uint64_t{0}, ( size - length ) / 2, size - length} ) {
+        stream.clear();
+        stream.seekg(static_cast<std::streamoff>(offset));
+        stream.read(buffer.get(), static_cast<std::streamsize>(length));
+
+        if ( static_cast<uint64_t>(stream.gcount()) != length )
+            throw std::runtime_error("Could not read the file to fingerprint it");
+
+        crypto_generichash_update(&state, reinterpret_cast<const unsigned char*>(buffer.get()), length);
+    }
+
+    crypto_generichash_final(&state, hash, sizeof hash);
+
+    stream.clear();
+    stream.seekg(0);
+
+    return binToHex(hash, sizeof hash);
+}
+
 unsigned long getFreeMemory () {
     struct sysinfo memInfo{};
     sysinfo(&memInfo);
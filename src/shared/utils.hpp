@@ -1,7 +1,9 @@
 #pragma once
 
+#include <cstdint>
 #include <iomanip>
 #include <ios>
+#include <istream>
 #include <memory>
 #include <string>
 #include <sodium/utils.h>
@@ -15,6 +17,12 @@ std::string binToHex ( const unsigned char* bin, size_t size );
 
 std::pair<unsigned char*, size_t> hexToBin ( const std::string& hex );
 
+/**
+ * @brief Cheap stand-in for the hash of a file: BLAKE2b of its size and of its first, middle and last MiB
+ * @throws std::runtime_error if the stream ends early
+ */
+std::string fingerprint ( std::istream& stream, uint64_t size );
+
 unsigned long getFreeMemory ();
 
 std::string padStringToSize ( const std::string& str, const unsigned totalLength );
\ No newline at end of file
@@ -0,0 +1,206 @@
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+#include "FileTracker.hpp"
+#include "Reconciler.hpp"
+#include "SyncMarks.hpp"
+
+namespace {
+
+	int failures = 0;
+
+	void check ( const bool condition, const std::string& what ) {
+		if ( condition )
+			return;
+
+		std::cerr << "FAILED: " << what << std::endl;
+		++failures;
+	}
+
+	std::set<std::string> operator/ ( const std::set<std::string>& set, const std::set<std::string>& rhs ) {
+		std::set<std::string> result;
+
+		for ( const auto& item: set )
+			if ( !rhs.contains(item) )
+				result.insert(item);
+
+		return result;
+	}
+
+	/**
+	 * @brief The hash sets of one sync peer, in its own directory like settings/ of a server
+	 */
+	struct Peer {
+		explicit Peer ( const std::filesystem::path& directory )
+			: readyFiles(directory / "readyFiles.toml"), markedForRemoval(directory / "toRemove.toml") {}
+
+		FileTracker readyFiles;
+		FileTracker markedForRemoval;
+	};
+
+	struct Exchange {
+		std::set<std::string> masterGets;
+		std::set<std::string> slaveGets;
+		bool marksDiffered = false;
+	};
+
+	using Round = std::function<Exchange ( Peer& master, Peer& slave )>;
+
+	/**
+	 * @brief Bookkeeping of one SYNC round: both take over the other's removal marks, then compare ready files
+	 */
+	Exchange listedRound ( Peer& master, Peer& slave ) {
+		const auto masterMarks = master.markedForRemoval.list();
+		const auto slaveMarks = slave.markedForRemoval.list();
+
+		SyncMarks::adopt(slave.readyFiles, slave.markedForRemoval, masterMarks);
+		SyncMarks::adopt(master.readyFiles, master.markedForRemoval, slaveMarks);
+
+		const auto masterReady = master.readyFiles.list();
+		const auto slaveReady = slave.readyFiles.list();
+
+		return {slaveReady / masterReady, masterReady / slaveReady, masterMarks != slaveMarks};
+	}
+
+	/**
+	 * @brief One direction of an in-memory connection
+	 */
+	class Channel {
+	public:
+		void push ( std::string message ) {
+			std::lock_guard lock(_mutex);
+			_messages.push_back(std::move(message));
+			_ready.notify_one();
+		}
+
+		std::string pop () {
+			std::unique_lock lock(_mutex);
+			_ready.wait(lock, [this] { return !_messages.empty(); });
+
+			auto message = std::move(_messages.front());
+			_messages.pop_front();
+			return message;
+		}
+
+	private:
+		std::mutex _mutex;
+		std::condition_variable _ready;
+		std::deque<std::string> _messages;
+	};
+
+	struct End {
+		Channel& out;
+		Channel& in;
+
+		void sendData ( std::string message ) { out.push(std::move(message)); }
+
+		std::string receiveData () { return in.pop(); }
+	};
+
+	/**
+	 * @return the difference as the master and as the slave see it
+	 */
+	std::pair<Reconciler::Difference, Reconciler::Difference> reconcile ( const FileTracker& master,
+	                                                                     const FileTracker& slave ) {
+		Channel toSlave;
+		Channel toMaster;
+		End masterEnd{toSlave, toMaster};
+		End slaveEnd{toMaster, toSlave};
+
+		const Reconciler masterSide(master.list());
+		const Reconciler slaveSide(slave.list());
+
+		Reconciler::Difference slaveView;
+		std::thread slaveThread([&] { slaveView = slaveSide.reconcileAsSlave(slaveEnd); });
+		auto masterView = masterSide.reconcileAsMaster(masterEnd);
+		slaveThread.join();
+
+		return {std::move(masterView), std::move(slaveView)};
+	}
+
+	/**
+	 * @brief Bookkeeping of one RECONCILED_SYNC round, the sets only meet through a Reconciler
+	 */
+	Exchange reconciledRound ( Peer& master, Peer& slave ) {
+		const auto [masterMarks, slaveMarks] = reconcile(master.markedForRemoval, slave.markedForRemoval);
+
+		SyncMarks::adopt(master.readyFiles, master.markedForRemoval, masterMarks.remoteOnly);
+		SyncMarks::adopt(slave.readyFiles, slave.markedForRemoval, slaveMarks.remoteOnly);
+
+		const auto [masterFiles, slaveFiles] = reconcile(master.readyFiles, slave.readyFiles);
+
+		check(masterFiles.localOnly == slaveFiles.remoteOnly && masterFiles.remoteOnly == slaveFiles.localOnly,
+		      "both peers see the same difference");
+
+		return {masterFiles.remoteOnly, slaveFiles.remoteOnly,
+		        !masterMarks.localOnly.empty() || !masterMarks.remoteOnly.empty()};
+	}
+
+	void removalsConverge ( const std::filesystem::path& directory, const Round& round, const std::string& name ) {
+		std::filesystem::create_directories(directory / "a");
+		std::filesystem::create_directories(directory / "b");
+
+		const std::string kept(64, 'a');
+		const std::string removedOnMaster(64, 'b');
+		const std::string removedOnSlave(64, 'c');
+
+		{
+			Peer a(directory / "a");
+			Peer b(directory / "b");
+
+			a.readyFiles.add({kept, removedOnSlave});
+			b.readyFiles.add({kept, removedOnMaster, removedOnSlave});
+
+			// what _handleRemoveFile leaves behind on each side
+			a.markedForRemoval.add(removedOnMaster);
+			b.readyFiles.remove(removedOnSlave);
+			b.markedForRemoval.add(removedOnSlave);
+
+			const auto first = round(a, b);
+
+			check(!b.readyFiles.contains(removedOnMaster), name + ": the slave drops the file the master removed");
+			check(!a.readyFiles.contains(removedOnSlave), name + ": the master drops the file the slave removed");
+			check(first.masterGets.empty() && first.slaveGets.empty(),
+			      name + ": no removed file is offered back to its peer");
+
+			const auto second = round(a, b);
+
+			check(!second.marksDiffered && a.markedForRemoval.list() == b.markedForRemoval.list(),
+			      name + ": both peers hold the same marks");
+			check(second.masterGets.empty() && second.slaveGets.empty(),
+			      name + ": the next round finds nothing to exchange");
+			check(a.readyFiles.list() == std::set{kept} && b.readyFiles.list() == std::set{kept},
+			      name + ": only the kept file stays ready on both peers");
+		}
+
+		{
+			Peer b(directory / "b");
+
+			check(b.markedForRemoval.contains(removedOnMaster) && !b.readyFiles.contains(removedOnMaster),
+			      name + ": an adopted mark survives a restart");
+		}
+
+		std::filesystem::remove_all(directory);
+	}
+
+}
+
+int main () {
+	const auto directory = std::filesystem::temp_directory_path() / ( "hikup-sync-test-" + std::to_string(getpid()) );
+
+	removalsConverge(directory, listedRound, "SYNC");
+	removalsConverge(directory, reconciledRound, "RECONCILED_SYNC");
+
+	if ( failures == 0 )
+		std::cout << "sync: all checks passed" << std::endl;
+
+	return failures == 0 ? 0 : 1;
+}